@@ -0,0 +1,315 @@
+#include "load_gen.h"
+#include "core/event_loop.h"
+#include "http/http_chunked.h"
+#include "http/http_parser.h"
+#include "proxy/proxy_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOAD_BUFFER_SIZE 16384
+#define LOAD_MAX_CONNECTIONS 10000
+
+typedef enum {
+    LOAD_CONNECTING,
+    LOAD_SENDING,
+    LOAD_READ_HEAD,
+    LOAD_READ_BODY
+} load_state_t;
+
+typedef enum {
+    FRAME_LENGTH,
+    FRAME_CHUNKED,
+    FRAME_CLOSE
+} load_framing_t;
+
+typedef struct load_gen load_gen_t;
+
+typedef struct {
+    load_gen_t *gen;
+    io_watch_t watch;
+    load_state_t state;
+    int sent;
+    uint64_t start_us;
+
+    char buf[LOAD_BUFFER_SIZE];
+    int len;
+    http_message_t resp;
+    load_framing_t framing;
+    int64_t body_left;
+    http_chunked_t chunked;
+} load_conn_t;
+
+struct load_gen {
+    const load_config_t *config;
+    load_result_t *result;
+    event_loop_t *loop;
+    struct sockaddr_in addr;
+    char request[1024];
+    int request_len;
+    int measuring;
+    uint64_t measure_start_us;
+    int idle;               // Connections whose last connect() failed
+};
+
+static void load_drive(load_conn_t *c);
+
+static void load_disconnect(load_conn_t *c) {
+    if (c->watch.fd == SOCK_INVALID) return;
+    event_loop_remove(c->gen->loop, &c->watch);
+    sock_close(c->watch.fd);
+    c->watch.fd = SOCK_INVALID;
+}
+
+static void load_begin_request(load_conn_t *c) {
+    c->state = LOAD_SENDING;
+    c->sent = 0;
+    c->len = 0;
+    c->start_us = time_now_us();
+    http_message_init(&c->resp, HTTP_MESSAGE_RESPONSE);
+    event_loop_update(c->gen->loop, &c->watch, EV_READ | EV_WRITE);
+}
+
+// Leaves c idle (fd invalid) on failure; load_gen_run retries it later
+static void load_connect(load_conn_t *c) {
+    load_gen_t *gen = c->gen;
+    sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd != SOCK_INVALID) {
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+        if (sock_set_nonblocking(fd) != 0 ||
+            (connect(fd, (struct sockaddr*)&gen->addr, sizeof(gen->addr)) != 0 && !sock_would_block())) {
+            sock_close(fd);
+            fd = SOCK_INVALID;
+        }
+    }
+    if (fd != SOCK_INVALID) {
+        c->watch.fd = fd;
+        c->state = LOAD_CONNECTING;
+        if (event_loop_add(gen->loop, &c->watch, EV_READ | EV_WRITE) == 0) {
+            if (gen->measuring) gen->result->connects++;
+            return;
+        }
+        sock_close(fd);
+        c->watch.fd = SOCK_INVALID;
+    }
+    gen->result->errors++;
+    gen->idle++;
+}
+
+// One pass per loop turn over connections that could not connect
+static void load_retry_idle(load_gen_t *gen, load_conn_t *conns) {
+    if (gen->idle == 0) return;
+    sleep_ms(10); // Target down or out of sockets: don't spin
+    gen->idle = 0;
+    for (int i = 0; i < gen->config->connections; i++) {
+        if (conns[i].watch.fd == SOCK_INVALID) load_connect(&conns[i]);
+    }
+}
+
+static void load_fail(load_conn_t *c) {
+    c->gen->result->errors++;
+    load_disconnect(c);
+    load_connect(c);
+}
+
+static void load_complete(load_conn_t *c) {
+    load_gen_t *gen = c->gen;
+    load_result_t *result = gen->result;
+
+    if (gen->measuring && c->start_us >= gen->measure_start_us) {
+        uint64_t now = time_now_us();
+        histogram_record(&result->latency, now - c->start_us);
+        result->requests++;
+        if (c->resp.status < 200 || c->resp.status > 299) result->non_2xx++;
+    }
+
+    int keep = gen->config->keep_alive && !c->resp.conn_close && c->framing != FRAME_CLOSE &&
+               (c->resp.minor_version >= 1 || c->resp.conn_keep_alive);
+    if (!keep) {
+        load_disconnect(c);
+        load_connect(c);
+        return;
+    }
+    load_begin_request(c);
+}
+
+// Consume body bytes in buf[0..len). Returns 1 when the response ended,
+// 0 for more, -1 on bad framing.
+static int load_body(load_conn_t *c, const char *data, int len) {
+    switch (c->framing) {
+    case FRAME_LENGTH:
+        c->body_left -= len;
+        return c->body_left <= 0 ? 1 : 0;
+    case FRAME_CHUNKED: {
+        int n = http_chunked_scan(&c->chunked, data, len);
+        if (n < 0) return -1;
+        return http_chunked_done(&c->chunked) ? 1 : 0;
+    }
+    case FRAME_CLOSE:
+        return 0;
+    }
+    return -1;
+}
+
+static void load_head_done(load_conn_t *c) {
+    const http_message_t *resp = &c->resp;
+    int status = resp->status;
+
+    c->state = LOAD_READ_BODY;
+    if (status == 204 || status == 304 || (status >= 100 && status < 200)) {
+        c->framing = FRAME_LENGTH;
+        c->body_left = 0;
+    } else if (resp->chunked) {
+        c->framing = FRAME_CHUNKED;
+        http_chunked_init(&c->chunked);
+    } else if (resp->content_length >= 0) {
+        c->framing = FRAME_LENGTH;
+        c->body_left = resp->content_length;
+    } else {
+        c->framing = FRAME_CLOSE;
+    }
+}
+
+static void load_drive(load_conn_t *c) {
+    load_gen_t *gen = c->gen;
+
+    if (c->state == LOAD_CONNECTING) {
+        if (proxy_handler_connect_result(c->watch.fd) != 0) {
+            load_fail(c);
+            return;
+        }
+        load_begin_request(c);
+    }
+
+    while (c->watch.fd != SOCK_INVALID) {
+        if (c->state == LOAD_SENDING) {
+            int n = send(c->watch.fd, gen->request + c->sent, gen->request_len - c->sent, 0);
+            if (n < 0 && sock_would_block()) return;
+            if (n <= 0) {
+                load_fail(c);
+                return;
+            }
+            c->sent += n;
+            if (c->sent < gen->request_len) continue;
+            c->state = LOAD_READ_HEAD;
+            event_loop_update(gen->loop, &c->watch, EV_READ);
+        }
+
+        int n = recv(c->watch.fd, c->buf + c->len, LOAD_BUFFER_SIZE - c->len, 0);
+        if (n < 0 && sock_would_block()) return;
+        if (n == 0 && c->state == LOAD_READ_BODY && c->framing == FRAME_CLOSE) {
+            load_complete(c);
+            return;
+        }
+        if (n <= 0) {
+            load_fail(c);
+            return;
+        }
+        if (gen->measuring) gen->result->bytes += n;
+
+        int done;
+        if (c->state == LOAD_READ_HEAD) {
+            c->len += n;
+            int r = http_parse(&c->resp, c->buf, c->len);
+            if (r == HTTP_PARSE_ERROR || (r == HTTP_PARSE_AGAIN && c->len == LOAD_BUFFER_SIZE)) {
+                load_fail(c);
+                return;
+            }
+            if (r == HTTP_PARSE_AGAIN) continue;
+            load_head_done(c);
+            done = c->framing == FRAME_LENGTH && c->body_left == 0 ? 1 :
+                   load_body(c, c->buf + c->resp.header_len, c->len - (int)c->resp.header_len);
+            c->len = 0; // Body bytes are counted, never kept
+        } else {
+            done = load_body(c, c->buf, n);
+        }
+
+        if (done < 0) {
+            load_fail(c);
+            return;
+        }
+        if (done) {
+            load_complete(c);
+            if (c->state != LOAD_SENDING) return; // Reconnecting
+        }
+    }
+}
+
+static void on_load_event(io_watch_t *watch, uint32_t events) {
+    (void)events;
+    load_drive(watch->data);
+}
+
+int load_gen_run(const load_config_t *config, load_result_t *result) {
+    if (config->connections < 1 || config->connections > LOAD_MAX_CONNECTIONS) return -1;
+
+    load_gen_t gen;
+    memset(&gen, 0, sizeof(gen));
+    memset(result, 0, sizeof(*result));
+    gen.config = config;
+    gen.result = result;
+    gen.addr.sin_family = AF_INET;
+    gen.addr.sin_port = htons(config->port);
+    if (inet_pton(AF_INET, config->host, &gen.addr.sin_addr) != 1) return -1;
+    gen.request_len = snprintf(gen.request, sizeof(gen.request),
+                               "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: proxy-bench\r\n%s\r\n",
+                               config->path, config->host, config->port,
+                               config->keep_alive ? "" : "Connection: close\r\n");
+    if (gen.request_len <= 0 || gen.request_len >= (int)sizeof(gen.request)) return -1;
+
+    gen.loop = event_loop_create();
+    load_conn_t *conns = calloc(config->connections, sizeof(*conns));
+    if (!gen.loop || !conns) {
+        if (gen.loop) event_loop_destroy(gen.loop);
+        free(conns);
+        return -1;
+    }
+
+    for (int i = 0; i < config->connections; i++) {
+        load_conn_t *c = &conns[i];
+        c->gen = &gen;
+        c->watch.fd = SOCK_INVALID;
+        c->watch.handler = on_load_event;
+        c->watch.data = c;
+        load_connect(c);
+    }
+
+    uint64_t warmup_end = time_now_us() + (uint64_t)config->warmup_ms * 1000;
+    while (time_now_us() < warmup_end) {
+        event_loop_run_once(gen.loop, 10);
+        load_retry_idle(&gen, conns);
+    }
+
+    result->errors = 0;
+    gen.measuring = 1;
+    gen.measure_start_us = time_now_us();
+    uint64_t end = gen.measure_start_us + (uint64_t)config->duration_ms * 1000;
+    uint64_t now;
+    while ((now = time_now_us()) < end) {
+        event_loop_run_once(gen.loop, 10);
+        load_retry_idle(&gen, conns);
+    }
+    result->elapsed_sec = (now - gen.measure_start_us) / 1e6;
+
+    for (int i = 0; i < config->connections; i++) load_disconnect(&conns[i]);
+    free(conns);
+    event_loop_destroy(gen.loop);
+    return 0;
+}
+
+void load_result_print(const load_result_t *r) {
+    double secs = r->elapsed_sec > 0 ? r->elapsed_sec : 1;
+    printf("📊 %llu requests in %.2fs, %.1f MB read\n", (unsigned long long)r->requests, r->elapsed_sec,
+           r->bytes / 1e6);
+    printf("   Requests/sec: %.0f\n", r->requests / secs);
+    printf("   Transfer/sec: %.2f MB\n", r->bytes / 1e6 / secs);
+    printf("   Latency (us): p50 %llu  p99 %llu  p999 %llu  max %llu  mean %.0f\n",
+           (unsigned long long)histogram_quantile(&r->latency, 0.5),
+           (unsigned long long)histogram_quantile(&r->latency, 0.99),
+           (unsigned long long)histogram_quantile(&r->latency, 0.999),
+           (unsigned long long)histogram_quantile(&r->latency, 1.0),
+           r->latency.count ? (double)r->latency.sum / r->latency.count : 0.0);
+    printf("   Connects: %llu  Errors: %llu  Non-2xx: %llu\n", (unsigned long long)r->connects,
+           (unsigned long long)r->errors, (unsigned long long)r->non_2xx);
+}
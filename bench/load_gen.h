@@ -0,0 +1,35 @@
+#ifndef LOAD_GEN_H
+#define LOAD_GEN_H
+
+#include "core/histogram.h"
+
+// Closed-loop HTTP/1.1 load generator: each of `connections` sockets sends
+// one GET, waits for the complete response, records its latency and sends
+// the next, reconnecting whenever the server closes. Runs on the calling
+// thread with one event loop.
+
+typedef struct {
+    const char *host;       // IPv4 address
+    int port;
+    const char *path;
+    int connections;
+    int duration_ms;
+    int warmup_ms;          // Run this long first without recording
+    int keep_alive;         // 0 sends Connection: close on every request
+} load_config_t;
+
+typedef struct {
+    uint64_t requests;      // Completed during the measured window
+    uint64_t errors;        // Connect failures, resets, bad responses
+    uint64_t non_2xx;
+    uint64_t bytes;         // Response bytes, headers included
+    uint64_t connects;
+    double elapsed_sec;
+    histogram_t latency;    // Microseconds, request sent to response complete
+} load_result_t;
+
+int load_gen_run(const load_config_t *config, load_result_t *result);
+
+void load_result_print(const load_result_t *result);
+
+#endif
@@ -0,0 +1,179 @@
+// End-to-end benchmark: stub backend -> proxy -> load generator, all in
+// one process on loopback, so every change to the proxy's hot path can be
+// measured the same way.
+//
+// By default it starts the stub backend, starts the proxy via
+// start_http_server() pointing at it, and drives the proxy with N
+// keep-alive connections, reporting throughput and p50/p99/p999 latency.
+// --direct drives the stub without the proxy (the baseline), --target
+// drives an already running proxy instead, and --stub-only just serves the
+// stub so an external proxy and load tool can use it.
+//
+//   ./proxy_bench -c 64 -d 10 --path /fixed/4096
+//   ./proxy_bench --path '/chunked/65536?chunk=4096'
+//   ./proxy_bench -c 200 --path '/drip/1024?delay=5'
+
+#include "load_gen.h"
+#include "stub_backend.h"
+#include "http/http_scan.h"
+#include "http/http_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_STUB_PORT 18081
+#define BENCH_PROXY_PORT 18080
+#define BENCH_READY_TIMEOUT_MS 5000
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-c CONNECTIONS] [-d SECONDS] [-w WARMUP_SECONDS] [--path PATH] [--close]\n"
+           "          [--direct | --target HOST:PORT | --stub-only]\n"
+           "          [--stub-port N] [--stub-threads N] [--proxy-port N] [--cache-size MB] [--no-splice]\n"
+           "          [--io-engine epoll|io_uring|poll]\n"
+           "  PATH: /fixed/N, /chunked/N?chunk=M, /drip/N?delay=MS or /close/N\n"
+           "  (default /fixed/1024). --close sends Connection: close on every request.\n", prog);
+}
+
+static void run_proxy(void *arg) {
+    start_http_server(arg); // Never returns; exiting main stops it
+}
+
+// Wait until something accepts on host:port
+static int wait_ready(const char *host, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) return -1;
+
+    for (int waited = 0; waited < BENCH_READY_TIMEOUT_MS; waited += 50) {
+        sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == SOCK_INVALID) return -1;
+        int ok = connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        sock_close(fd);
+        if (ok) return 0;
+        sleep_ms(50);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    load_config_t load = { "127.0.0.1", BENCH_PROXY_PORT, "/fixed/1024", 64, 5000, 1000, 1 };
+    int direct = 0, stub_only = 0;
+    int stub_port = BENCH_STUB_PORT, stub_threads = 1;
+    const char *target = NULL;
+    char target_host[64];
+    size_t cache_mb = 0;
+    int splice = 1;
+    event_engine_t engine = EVENT_ENGINE_DEFAULT;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            load.connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            load.duration_ms = (int)(atof(argv[++i]) * 1000);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            load.warmup_ms = (int)(atof(argv[++i]) * 1000);
+        } else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc) {
+            load.path = argv[++i];
+        } else if (strcmp(argv[i], "--close") == 0) {
+            load.keep_alive = 0;
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            direct = 1;
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
+            target = argv[++i];
+        } else if (strcmp(argv[i], "--stub-only") == 0) {
+            stub_only = 1;
+        } else if (strcmp(argv[i], "--stub-port") == 0 && i + 1 < argc) {
+            stub_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stub-threads") == 0 && i + 1 < argc) {
+            stub_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--proxy-port") == 0 && i + 1 < argc) {
+            load.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_mb = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-splice") == 0) {
+            splice = 0;
+        } else if (strcmp(argv[i], "--io-engine") == 0 && i + 1 < argc) {
+            if (event_engine_parse(argv[++i], &engine) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (load.connections < 1 || load.duration_ms <= 0 || load.warmup_ms < 0 || direct + stub_only + !!target > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (platform_net_init() != 0) {
+        printf("❌ Network init failed: %d\n", sock_last_error());
+        return 1;
+    }
+    http_scan_select(HTTP_SCAN_AUTO);   // Stub, proxy and load threads all parse
+
+    if (target) {
+        const char *colon = strrchr(target, ':');
+        if (!colon || colon == target || (size_t)(colon - target) >= sizeof(target_host)) {
+            usage(argv[0]);
+            return 1;
+        }
+        memcpy(target_host, target, colon - target);
+        target_host[colon - target] = '\0';
+        load.host = target_host;
+        load.port = atoi(colon + 1);
+    } else {
+        stub_backend_t *stub = stub_backend_start(stub_port, stub_threads);
+        if (!stub) return 1;
+        printf("🧪 Stub backend on 127.0.0.1:%d (%d threads)\n", stub_port, stub_threads);
+        if (stub_only) {
+            while (1) sleep_ms(1000);
+        }
+
+        if (direct) {
+            load.port = stub_port;
+        } else {
+            char spec[32];
+            snprintf(spec, sizeof(spec), "127.0.0.1:%d", stub_port);
+            upstream_group_t *upstream = upstream_group_create("bench", LB_ROUND_ROBIN);
+            if (!upstream || upstream_group_add(upstream, spec) != 0 || upstream_group_finalize(upstream) != 0) {
+                printf("❌ Failed to build upstream group\n");
+                return 1;
+            }
+
+            static http_server_config_t config;
+            http_server_config_defaults(&config);
+            config.listen_port = load.port;
+            config.upstream = upstream;
+            config.cache_size = cache_mb << 20;
+            config.splice = splice;
+            config.io_engine = engine;
+            config.access_log = NULL; // Would measure the log writer, not the proxy
+
+            thread_t proxy;
+            if (thread_start(&proxy, run_proxy, &config) != 0) return 1;
+        }
+    }
+
+    if (wait_ready(load.host, load.port) != 0) {
+        printf("❌ Nothing listening on %s:%d\n", load.host, load.port);
+        return 1;
+    }
+
+    printf("🏁 %d connections for %.1fs (warmup %.1fs): GET http://%s:%d%s%s\n", load.connections,
+           load.duration_ms / 1000.0, load.warmup_ms / 1000.0, load.host, load.port, load.path,
+           direct ? " (direct, no proxy)" : "");
+    static load_result_t result;
+    if (load_gen_run(&load, &result) != 0) {
+        printf("❌ Invalid load configuration\n");
+        return 1;
+    }
+    load_result_print(&result);
+
+    // The proxy runs until the process exits
+    fflush(stdout);
+    exit(0);
+}
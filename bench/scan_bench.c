@@ -0,0 +1,246 @@
+// Micro-benchmark: end-of-headers detection and head parsing.
+//
+// Compares the old approach (strstr over the whole accumulated buffer after
+// every read) with the resumable http_scan kernels, for a typical browser
+// request and for a large cookie-heavy head arriving in TCP-sized segments.
+//
+//   gcc -O2 -Isrc bench/scan_bench.c src/http/http_scan.c src/http/http_parser.c -o scan_bench
+
+#include "http/http_scan.h"
+#include "http/http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+static double now_sec(void) {
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart / (double)f.QuadPart;
+}
+#else
+#include <time.h>
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+#define SEGMENT 1460
+
+typedef struct {
+    const char *name;
+    char *data;
+    size_t len;
+    size_t segment; // Bytes delivered per simulated read
+} workload_t;
+
+static volatile size_t sink;
+
+static char *build_head(size_t target_len, size_t *out_len) {
+    char *buf = malloc(target_len + 4096);
+    size_t pos = 0;
+    pos += sprintf(buf + pos,
+                   "GET /static/app/main.3f9c2a.js?v=1720000000 HTTP/1.1\r\n"
+                   "Host: www.example.com\r\n"
+                   "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+                   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                   "Accept-Language: en-US,en;q=0.9\r\n"
+                   "Accept-Encoding: gzip, deflate, br\r\n"
+                   "Referer: https://www.example.com/products/category/widgets?page=2\r\n"
+                   "Sec-Fetch-Dest: script\r\n"
+                   "Sec-Fetch-Mode: no-cors\r\n"
+                   "Sec-Fetch-Site: same-origin\r\n"
+                   "Cache-Control: no-cache\r\n"
+                   "Connection: keep-alive\r\n");
+    int n = 0;
+    while (pos < target_len) {
+        pos += sprintf(buf + pos, "Cookie: session_%d=%08x%08x%08x%08x; theme=dark; consent=yes\r\n",
+                       n++, rand(), rand(), rand(), rand());
+    }
+    pos += sprintf(buf + pos, "\r\n");
+    *out_len = pos;
+    return buf;
+}
+
+// Old loop: NUL-terminate and strstr from the start after every read
+static double run_strstr(const workload_t *w, int iters) {
+    char *buf = malloc(w->len + 1);
+    double t0 = now_sec();
+    for (int it = 0; it < iters; it++) {
+        size_t have = 0;
+        char *end = NULL;
+        while (!end) {
+            size_t n = w->len - have < w->segment ? w->len - have : w->segment;
+            memcpy(buf + have, w->data + have, n);
+            have += n;
+            buf[have] = '\0';
+            end = strstr(buf, "\r\n\r\n");
+        }
+        sink += (size_t)(end - buf);
+    }
+    double t = now_sec() - t0;
+    free(buf);
+    return t;
+}
+
+// Resumable kernel: only the new bytes (plus 3 of overlap) are scanned
+static double run_scan(const workload_t *w, int iters) {
+    char *buf = malloc(w->len);
+    double t0 = now_sec();
+    for (int it = 0; it < iters; it++) {
+        size_t have = 0;
+        size_t end = HTTP_SCAN_NOT_FOUND;
+        while (end == HTTP_SCAN_NOT_FOUND) {
+            size_t n = w->len - have < w->segment ? w->len - have : w->segment;
+            memcpy(buf + have, w->data + have, n);
+            size_t from = have > 3 ? have - 3 : 0;
+            have += n;
+            end = http_scan_header_end(buf, from, have);
+        }
+        sink += end;
+    }
+    double t = now_sec() - t0;
+    free(buf);
+    return t;
+}
+
+// Full resumable parse (spans + header index) fed segment by segment
+static double run_parse(const workload_t *w, int iters) {
+    char *buf = malloc(w->len);
+    http_message_t *msg = malloc(sizeof(*msg));
+    double t0 = now_sec();
+    for (int it = 0; it < iters; it++) {
+        size_t have = 0;
+        int r = HTTP_PARSE_AGAIN;
+        http_message_init(msg, HTTP_MESSAGE_REQUEST);
+        while (r == HTTP_PARSE_AGAIN && have < w->len) {
+            size_t n = w->len - have < w->segment ? w->len - have : w->segment;
+            memcpy(buf + have, w->data + have, n);
+            have += n;
+            r = http_parse(msg, buf, have);
+        }
+        sink += msg->header_count;
+    }
+    double t = now_sec() - t0;
+    free(msg);
+    free(buf);
+    return t;
+}
+
+// All kernels must agree with the scalar reference
+static int self_check(void) {
+    char buf[512];
+    for (int round = 0; round < 20000; round++) {
+        size_t len = (size_t)(rand() % (int)sizeof(buf));
+        for (size_t i = 0; i < len; i++) {
+            int r = rand() % 8;
+            buf[i] = r == 0 ? '\n' : r == 1 ? ':' : r == 2 ? '\r' : (char)('a' + rand() % 26);
+        }
+        size_t from = len ? (size_t)rand() % len : 0;
+
+        size_t ref_colon, ref_end, ref_lf;
+        http_scan_select(HTTP_SCAN_SCALAR);
+        ref_lf = http_scan_line(buf, from, len, &ref_colon);
+        ref_end = http_scan_header_end(buf, from, len);
+
+        for (int impl = HTTP_SCAN_SSE2; impl <= HTTP_SCAN_AVX2; impl++) {
+            if (http_scan_select((http_scan_impl_t)impl) != 0) continue;
+            size_t colon;
+            if (http_scan_line(buf, from, len, &colon) != ref_lf || colon != ref_colon ||
+                http_scan_header_end(buf, from, len) != ref_end) {
+                printf("MISMATCH in %s (len %zu, from %zu)\n", http_scan_impl_name(), len, from);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Heads the parser must accept or reject, whatever the kernel
+typedef struct {
+    const char *head;
+    size_t len;
+    int expect;
+} parse_case_t;
+
+#define PARSE_CASE(lit, expect) { lit, sizeof(lit) - 1, expect }
+
+static const parse_case_t parse_cases[] = {
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\r\nX-Tab: a\tb\r\n\r\n", HTTP_PARSE_DONE),
+    PARSE_CASE("\r\nGET / HTTP/1.1\r\nHost: a\r\n\r\n", HTTP_PARSE_DONE),
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\r\nX-Evil: a\rb\r\n\r\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\r\nX-Evil: a\0b\r\n\r\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\r\nX-Evil: a\x7f\r\n\r\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("GET / HTTP/1.1\nHost: a\r\n\r\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\n\r\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("GET / HTTP/1.1\r\nHost: a\r\n\n", HTTP_PARSE_ERROR),
+    PARSE_CASE("\nGET / HTTP/1.1\r\nHost: a\r\n\r\n", HTTP_PARSE_ERROR),
+};
+
+static int parser_check(void) {
+    http_message_t *msg = malloc(sizeof(*msg));
+    for (int impl = HTTP_SCAN_SCALAR; impl <= HTTP_SCAN_AVX2; impl++) {
+        if (http_scan_select((http_scan_impl_t)impl) != 0) continue;
+        for (size_t i = 0; i < sizeof(parse_cases) / sizeof(parse_cases[0]); i++) {
+            const parse_case_t *c = &parse_cases[i];
+            http_message_init(msg, HTTP_MESSAGE_REQUEST);
+            int r = http_parse(msg, c->head, c->len);
+            if (r != c->expect) {
+                printf("PARSE MISMATCH in %s, case %zu: got %d, want %d\n",
+                       http_scan_impl_name(), i, r, c->expect);
+                free(msg);
+                return -1;
+            }
+        }
+    }
+    free(msg);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : 200000;
+    srand(42);
+
+    if (self_check() != 0) return 1;
+    if (parser_check() != 0) return 1;
+
+    workload_t workloads[2];
+    workloads[0].name = "browser request (single read)";
+    workloads[0].data = build_head(700, &workloads[0].len);
+    workloads[0].segment = workloads[0].len;
+    workloads[1].name = "32 KB cookie head (1460 B reads)";
+    workloads[1].data = build_head(32 * 1024, &workloads[1].len);
+    workloads[1].segment = SEGMENT;
+
+    const http_scan_impl_t impls[] = { HTTP_SCAN_SCALAR, HTTP_SCAN_SSE2, HTTP_SCAN_AVX2 };
+
+    for (int i = 0; i < 2; i++) {
+        const workload_t *w = &workloads[i];
+        int n = w->len > 4096 ? iters / 50 : iters;
+        double mb = (double)w->len * n / (1024.0 * 1024.0);
+
+        printf("\n%s: %zu bytes x %d\n", w->name, w->len, n);
+        double t = run_strstr(w, n);
+        printf("  %-22s %8.1f ns/head %9.1f MB/s\n", "strstr rescan", t * 1e9 / n, mb / t);
+
+        for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+            if (http_scan_select(impls[k]) != 0) continue;
+            char label[64];
+            t = run_scan(w, n);
+            snprintf(label, sizeof(label), "scan_header_end %s", http_scan_impl_name());
+            printf("  %-22s %8.1f ns/head %9.1f MB/s\n", label, t * 1e9 / n, mb / t);
+            t = run_parse(w, n);
+            snprintf(label, sizeof(label), "http_parse %s", http_scan_impl_name());
+            printf("  %-22s %8.1f ns/head %9.1f MB/s\n", label, t * 1e9 / n, mb / t);
+        }
+    }
+
+    free(workloads[0].data);
+    free(workloads[1].data);
+    return 0;
+}
@@ -0,0 +1,335 @@
+#include "stub_backend.h"
+#include "core/event_loop.h"
+#include "core/timer_wheel.h"
+#include "http/http_output.h"
+#include "http/http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STUB_BUFFER_SIZE 8192
+#define STUB_BODY_BLOCK (64 * 1024)    // Largest piece queued per send
+#define STUB_DRIP_STEP 64
+#define STUB_CHUNKS_PER_FILL 16
+#define STUB_MAX_THREADS 64
+
+typedef enum {
+    STUB_FIXED,
+    STUB_CHUNKED,
+    STUB_DRIP,
+    STUB_CLOSE
+} stub_kind_t;
+
+typedef struct stub_worker stub_worker_t;
+
+typedef struct {
+    stub_worker_t *worker;
+    io_watch_t watch;
+    char in[STUB_BUFFER_SIZE];
+    int in_len;
+    http_message_t req;
+
+    // Response being produced
+    int responding;
+    int keep_alive;
+    stub_kind_t kind;
+    uint64_t left;          // Body bytes not yet queued
+    int chunk;
+    int delay_ms;
+    int final_chunk_sent;
+    http_out_t out;
+    timer_entry_t drip;
+} stub_conn_t;
+
+struct stub_worker {
+    stub_backend_t *stub;
+    event_loop_t *loop;
+    io_watch_t listener;
+    timer_wheel_t timers;
+    thread_t thread;
+};
+
+struct stub_backend {
+    stub_worker_t workers[STUB_MAX_THREADS];
+    int count;
+    int stop;
+};
+
+// Shared body bytes; every response references slices of it
+static char g_body[STUB_BODY_BLOCK];
+
+static void stub_close(stub_conn_t *c) {
+    if (timer_armed(&c->drip)) timer_wheel_remove(&c->worker->timers, &c->drip);
+    event_loop_remove(c->worker->loop, &c->watch);
+    sock_close(c->watch.fd);
+    free(c);
+}
+
+static uint64_t query_int(const char *q, size_t len, const char *name, uint64_t fallback) {
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i + name_len < len; i++) {
+        if ((i == 0 || q[i - 1] == '?' || q[i - 1] == '&') && memcmp(q + i, name, name_len) == 0 &&
+            q[i + name_len] == '=') {
+            return strtoull(q + i + name_len + 1, NULL, 10);
+        }
+    }
+    return fallback;
+}
+
+// Queue the next slice of the body once the previous one has been sent
+static void stub_fill(stub_conn_t *c) {
+    switch (c->kind) {
+    case STUB_FIXED:
+    case STUB_CLOSE: {
+        size_t n = c->left < STUB_BODY_BLOCK ? (size_t)c->left : STUB_BODY_BLOCK;
+        http_out_add(&c->out, g_body, n);
+        c->left -= n;
+        break;
+    }
+    case STUB_CHUNKED:
+        for (int i = 0; i < STUB_CHUNKS_PER_FILL && c->left > 0; i++) {
+            size_t n = c->left < (uint64_t)c->chunk ? (size_t)c->left : (size_t)c->chunk;
+            http_out_printf(&c->out, "%zx\r\n", n);
+            http_out_add(&c->out, g_body, n);
+            http_out_literal(&c->out, "\r\n");
+            c->left -= n;
+        }
+        if (c->left == 0 && !c->final_chunk_sent) {
+            http_out_literal(&c->out, "0\r\n\r\n");
+            c->final_chunk_sent = 1;
+        }
+        break;
+    case STUB_DRIP: {
+        size_t n = c->left < STUB_DRIP_STEP ? (size_t)c->left : STUB_DRIP_STEP;
+        http_out_add(&c->out, g_body, n);
+        c->left -= n;
+        break;
+    }
+    }
+}
+
+static void stub_start_response(stub_conn_t *c) {
+    const http_message_t *req = &c->req;
+    const char *target = c->in + req->target.off;
+    size_t target_len = req->target.len;
+
+    c->keep_alive = !req->conn_close && (req->minor_version >= 1 || req->conn_keep_alive);
+    c->chunk = (int)query_int(target, target_len, "chunk", 1024);
+    c->delay_ms = (int)query_int(target, target_len, "delay", 10);
+    if (c->chunk < 1) c->chunk = 1;
+    if (c->chunk > STUB_BODY_BLOCK) c->chunk = STUB_BODY_BLOCK;
+    c->final_chunk_sent = 0;
+    c->responding = 1;
+    http_out_reset(&c->out);
+
+    static const struct { const char *prefix; stub_kind_t kind; } routes[] = {
+        { "/fixed/", STUB_FIXED }, { "/chunked/", STUB_CHUNKED }, { "/drip/", STUB_DRIP }, { "/close/", STUB_CLOSE }
+    };
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
+        size_t len = strlen(routes[i].prefix);
+        if (target_len <= len || memcmp(target, routes[i].prefix, len) != 0) continue;
+
+        c->kind = routes[i].kind;
+        c->left = strtoull(target + len, NULL, 10);
+        if (c->kind == STUB_CLOSE) c->keep_alive = 0;
+
+        http_out_literal(&c->out, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n");
+        if (c->kind == STUB_CHUNKED) http_out_literal(&c->out, "Transfer-Encoding: chunked\r\n");
+        else if (c->kind != STUB_CLOSE) http_out_printf(&c->out, "Content-Length: %llu\r\n", (unsigned long long)c->left);
+        if (c->keep_alive) http_out_literal(&c->out, "Connection: keep-alive\r\n\r\n");
+        else http_out_literal(&c->out, "Connection: close\r\n\r\n");
+        if (c->kind != STUB_DRIP) stub_fill(c);
+        return;
+    }
+
+    c->kind = STUB_FIXED;
+    c->left = 0;
+    http_out_literal(&c->out, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n");
+    if (c->keep_alive) http_out_literal(&c->out, "Connection: keep-alive\r\n\r\n");
+    else http_out_literal(&c->out, "Connection: close\r\n\r\n");
+}
+
+static int stub_response_done(const stub_conn_t *c) {
+    return c->left == 0 && (c->kind != STUB_CHUNKED || c->final_chunk_sent);
+}
+
+static void stub_drive(stub_conn_t *c);
+
+static void on_drip(timer_entry_t *timer) {
+    stub_conn_t *c = timer->data;
+    stub_fill(c);
+    stub_drive(c);
+}
+
+// Send what is queued, produce more, and read the next request. Frees c
+// when the connection ends.
+static void stub_drive(stub_conn_t *c) {
+    while (1) {
+        if (c->responding) {
+            int r = http_out_send(&c->out, c->watch.fd);
+            if (r < 0) {
+                stub_close(c);
+                return;
+            }
+            if (r == 0) return;
+
+            if (!stub_response_done(c)) {
+                if (c->kind == STUB_DRIP) {
+                    timer_wheel_add(&c->worker->timers, &c->drip, time_now_ms() + c->delay_ms);
+                    return;
+                }
+                stub_fill(c);
+                continue;
+            }
+
+            c->responding = 0;
+            if (!c->keep_alive) {
+                stub_close(c);
+                return;
+            }
+            int consumed = (int)c->req.header_len;
+            memmove(c->in, c->in + consumed, c->in_len - consumed);
+            c->in_len -= consumed;
+            http_message_init(&c->req, HTTP_MESSAGE_REQUEST);
+        }
+
+        // Pipelined requests may already be buffered
+        if (c->in_len > 0) {
+            int r = http_parse(&c->req, c->in, c->in_len);
+            if (r == HTTP_PARSE_ERROR) {
+                stub_close(c);
+                return;
+            }
+            if (r == HTTP_PARSE_DONE) {
+                stub_start_response(c);
+                continue;
+            }
+        }
+
+        if (c->in_len == STUB_BUFFER_SIZE) {
+            stub_close(c);
+            return;
+        }
+        int n = recv(c->watch.fd, c->in + c->in_len, STUB_BUFFER_SIZE - c->in_len, 0);
+        if (n < 0 && sock_would_block()) return;
+        if (n <= 0) {
+            stub_close(c);
+            return;
+        }
+        c->in_len += n;
+    }
+}
+
+static void on_stub_event(io_watch_t *watch, uint32_t events) {
+    (void)events;
+    stub_drive(watch->data);
+}
+
+static void on_stub_accept(io_watch_t *watch, uint32_t events) {
+    stub_worker_t *worker = watch->data;
+    (void)events;
+
+    while (1) {
+        sock_t fd = accept(watch->fd, NULL, NULL);
+        if (fd == SOCK_INVALID) return;
+
+        stub_conn_t *c = calloc(1, sizeof(*c));
+        if (!c || sock_set_nonblocking(fd) != 0) {
+            free(c);
+            sock_close(fd);
+            continue;
+        }
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+
+        c->worker = worker;
+        c->watch.fd = fd;
+        c->watch.handler = on_stub_event;
+        c->watch.data = c;
+        c->drip.fn = on_drip;
+        c->drip.data = c;
+        http_message_init(&c->req, HTTP_MESSAGE_REQUEST);
+        if (event_loop_add(worker->loop, &c->watch, EV_READ | EV_WRITE) != 0) {
+            sock_close(fd);
+            free(c);
+            continue;
+        }
+        stub_drive(c);
+    }
+}
+
+static void stub_worker_run(void *arg) {
+    stub_worker_t *worker = arg;
+    while (!atomic_get(&worker->stub->stop)) {
+        int timeout = worker->timers.count > 0 ? 1 : 100;
+        if (event_loop_run_once(worker->loop, timeout) < 0) return;
+        timer_wheel_advance(&worker->timers, time_now_ms());
+    }
+}
+
+static sock_t stub_listen(int port) {
+    sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == SOCK_INVALID) return SOCK_INVALID;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt));
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 511) != 0 ||
+        sock_set_nonblocking(fd) != 0) {
+        sock_close(fd);
+        return SOCK_INVALID;
+    }
+    return fd;
+}
+
+stub_backend_t *stub_backend_start(int port, int threads) {
+#ifndef SO_REUSEPORT
+    threads = 1;
+#endif
+    if (threads < 1) threads = 1;
+    if (threads > STUB_MAX_THREADS) threads = STUB_MAX_THREADS;
+
+    stub_backend_t *stub = calloc(1, sizeof(*stub));
+    if (!stub) return NULL;
+    memset(g_body, 'x', sizeof(g_body));
+
+    for (int i = 0; i < threads; i++) {
+        stub_worker_t *worker = &stub->workers[i];
+        worker->stub = stub;
+        worker->loop = event_loop_create();
+        worker->listener.fd = stub_listen(port);
+        worker->listener.handler = on_stub_accept;
+        worker->listener.data = worker;
+        timer_wheel_init(&worker->timers, 1, time_now_ms());
+        if (!worker->loop || worker->listener.fd == SOCK_INVALID ||
+            event_loop_add(worker->loop, &worker->listener, EV_READ) != 0 ||
+            thread_start(&worker->thread, stub_worker_run, worker) != 0) {
+            printf("❌ Stub backend failed to listen on port %d\n", port);
+            if (worker->listener.fd != SOCK_INVALID) sock_close(worker->listener.fd);
+            stub->count = i;
+            stub_backend_stop(stub);
+            return NULL;
+        }
+        stub->count = i + 1;
+    }
+    return stub;
+}
+
+void stub_backend_stop(stub_backend_t *stub) {
+    if (!stub) return;
+    atomic_set(&stub->stop, 1);
+    for (int i = 0; i < stub->count; i++) {
+        thread_join(stub->workers[i].thread);
+        sock_close(stub->workers[i].listener.fd);
+        event_loop_destroy(stub->workers[i].loop);
+    }
+    free(stub);
+}
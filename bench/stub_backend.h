@@ -0,0 +1,22 @@
+#ifndef STUB_BACKEND_H
+#define STUB_BACKEND_H
+
+// Minimal HTTP/1.1 origin for benchmarks, built on the proxy's own event
+// loop so it costs far less per request than the proxy under test. Every
+// route is keep-alive unless the client asks to close:
+//
+//   /fixed/N               N body bytes with Content-Length
+//   /chunked/N?chunk=M     N bytes in M-byte chunks (default 1024)
+//   /drip/N?delay=MS       N bytes with Content-Length, 64 bytes every MS
+//                          ms (default 10): a slow backend
+//   /close/N               N bytes delimited by closing the connection
+//
+// Anything else answers 404. Request bodies are not supported.
+
+typedef struct stub_backend stub_backend_t;
+
+// Listen on 127.0.0.1:port with threads event loops (SO_REUSEPORT)
+stub_backend_t *stub_backend_start(int port, int threads);
+void stub_backend_stop(stub_backend_t *stub);
+
+#endif
@@ -0,0 +1,485 @@
+#include "response_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_BUCKETS 4096      // Per shard, power of two
+
+typedef struct {
+    mutex_t lock;
+    cache_entry_t *buckets[CACHE_BUCKETS];
+    cache_entry_t lru;          // Sentinel: lru.lru_next is the most recent
+    size_t used;
+    size_t budget;
+} cache_shard_t;
+
+struct response_cache {
+    cache_shard_t shards[CACHE_SHARDS];
+    size_t max_entry;
+};
+
+static uint64_t fnv1a(const char *data, size_t len) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static inline char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? (char)(ch + 32) : ch;
+}
+
+response_cache_t *cache_create(size_t budget_bytes, size_t max_entry_bytes) {
+    response_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) return NULL;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        mutex_init(&shard->lock);
+        shard->lru.lru_next = shard->lru.lru_prev = &shard->lru;
+        shard->budget = budget_bytes / CACHE_SHARDS;
+    }
+    cache->max_entry = max_entry_bytes;
+    if (cache->max_entry > budget_bytes / CACHE_SHARDS) cache->max_entry = budget_bytes / CACHE_SHARDS;
+    return cache;
+}
+
+static void entry_free(cache_entry_t *e) {
+    for (int i = 0; i < CACHE_VARIANT_SLOTS; i++) free(e->variants[i]);
+    free(e->key);
+    free(e->data);
+    free(e);
+}
+
+void cache_release(cache_entry_t *entry) {
+    if (entry && atomic_add(&entry->refs, -1) == 0) entry_free(entry);
+}
+
+void cache_destroy(response_cache_t *cache) {
+    if (!cache) return;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        cache_entry_t *e = shard->lru.lru_next;
+        while (e != &shard->lru) {
+            cache_entry_t *next = e->lru_next;
+            cache_release(e);
+            e = next;
+        }
+        mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+size_t cache_max_entry(const response_cache_t *cache) {
+    return cache->max_entry;
+}
+
+static cache_shard_t *shard_for(response_cache_t *cache, uint64_t hash) {
+    return &cache->shards[hash >> 60];
+}
+
+static cache_entry_t **bucket_for(cache_shard_t *shard, uint64_t hash) {
+    return &shard->buckets[hash & (CACHE_BUCKETS - 1)];
+}
+
+static void lru_unlink(cache_entry_t *e) {
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void lru_push_front(cache_shard_t *shard, cache_entry_t *e) {
+    e->lru_prev = &shard->lru;
+    e->lru_next = shard->lru.lru_next;
+    shard->lru.lru_next->lru_prev = e;
+    shard->lru.lru_next = e;
+}
+
+static void lru_touch(cache_shard_t *shard, cache_entry_t *e) {
+    lru_unlink(e);
+    lru_push_front(shard, e);
+}
+
+static int entry_linked(const cache_entry_t *e) {
+    return e->lru_prev != NULL;
+}
+
+// Drop e from the table; its bytes live on until the last holder releases it
+static void shard_unlink(cache_shard_t *shard, cache_entry_t *e) {
+    cache_entry_t **pp = bucket_for(shard, e->hash);
+    while (*pp != e) pp = &(*pp)->hash_next;
+    *pp = e->hash_next;
+    lru_unlink(e);
+    e->lru_prev = e->lru_next = NULL;
+    shard->used -= e->cost;
+    cache_release(e);
+}
+
+static void shard_link(cache_shard_t *shard, cache_entry_t *e) {
+    cache_entry_t **bucket = bucket_for(shard, e->hash);
+    e->hash_next = *bucket;
+    *bucket = e;
+    lru_push_front(shard, e);
+    shard->used += e->cost;
+}
+
+// Evict least recently used entries until the shard fits its budget.
+// Entries being filled stay, since requests are queued behind them.
+static void shard_evict(cache_shard_t *shard) {
+    cache_entry_t *e = shard->lru.lru_prev;
+    while (shard->used > shard->budget && e != &shard->lru) {
+        cache_entry_t *prev = e->lru_prev;
+        if (!e->filling) shard_unlink(shard, e);
+        e = prev;
+    }
+}
+
+static cache_entry_t *shard_find(cache_shard_t *shard, uint64_t hash, const char *key, size_t key_len) {
+    for (cache_entry_t *e = *bucket_for(shard, hash); e; e = e->hash_next) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) return e;
+    }
+    return NULL;
+}
+
+static cache_entry_t *entry_new(uint64_t hash, const char *key, size_t key_len) {
+    cache_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    e->key = malloc(key_len);
+    if (!e->key) {
+        free(e);
+        return NULL;
+    }
+    memcpy(e->key, key, key_len);
+    e->key_len = (uint32_t)key_len;
+    e->hash = hash;
+    e->refs = 1;    // The table's
+    e->cost = sizeof(*e) + key_len;
+    return e;
+}
+
+// Call f(name, name_len, value, value_len) for each Cache-Control directive
+// in msg until it returns non-zero
+typedef int (*directive_fn)(const char *name, size_t name_len, const char *value, size_t value_len, void *arg);
+
+static int for_each_directive(const http_message_t *msg, const char *buf, http_header_id_t id,
+                              directive_fn f, void *arg) {
+    for (int i = 0; i < msg->header_count; i++) {
+        const http_header_t *h = &msg->headers[i];
+        if (h->id != id) continue;
+
+        const char *p = buf + h->value.off;
+        const char *end = p + h->value.len;
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+            const char *name = p;
+            while (p < end && *p != ',' && *p != '=') p++;
+            const char *name_end = p;
+            while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t')) name_end--;
+
+            const char *value = p, *value_end = p;
+            if (p < end && *p == '=') {
+                value = ++p;
+                while (p < end && *p != ',') p++;
+                value_end = p;
+                while (value < value_end && (*value == ' ' || *value == '"')) value++;
+                while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '"')) value_end--;
+            }
+            if (name_end > name && f(name, name_end - name, value, value_end - value, arg)) return 1;
+        }
+    }
+    return 0;
+}
+
+static int name_is(const char *name, size_t len, const char *lit) {
+    if (strlen(lit) != len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (lower(name[i]) != lit[i]) return 0;
+    }
+    return 1;
+}
+
+static int64_t parse_seconds(const char *p, size_t len) {
+    if (len == 0 || len > 10) return -1;
+    int64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9') return -1;
+        v = v * 10 + (p[i] - '0');
+    }
+    return v;
+}
+
+typedef struct {
+    int64_t max_age;
+    int64_t s_maxage;
+    int no_store;
+} response_directives_t;
+
+static int response_directive(const char *name, size_t len, const char *value, size_t value_len, void *arg) {
+    response_directives_t *d = arg;
+    if (name_is(name, len, "no-store") || name_is(name, len, "private") || name_is(name, len, "no-cache")) {
+        // no-cache would allow storing with revalidation on every use,
+        // which saves nothing over forwarding
+        d->no_store = 1;
+        return 1;
+    }
+    if (name_is(name, len, "max-age")) d->max_age = parse_seconds(value, value_len);
+    else if (name_is(name, len, "s-maxage")) d->s_maxage = parse_seconds(value, value_len);
+    return 0;
+}
+
+uint64_t cache_response_ttl(const http_message_t *resp, const char *buf) {
+    switch (resp->status) {
+    case 200: case 203: case 301: case 404: case 410:
+        break;
+    default:
+        return 0;
+    }
+    if (http_message_header(resp, HTTP_HDR_SET_COOKIE)) return 0;
+
+    const http_header_t *vary = http_message_header(resp, HTTP_HDR_VARY);
+    if (vary && http_value_has_token(buf, vary->value, "*")) return 0;
+
+    response_directives_t d = { -1, -1, 0 };
+    for_each_directive(resp, buf, HTTP_HDR_CACHE_CONTROL, response_directive, &d);
+    if (d.no_store) return 0;
+
+    // Shared caches prefer s-maxage; without either there is no lifetime
+    // we can use (Expires would need date parsing)
+    int64_t ttl = d.s_maxage >= 0 ? d.s_maxage : d.max_age;
+    if (ttl <= 0) return 0;
+
+    // Time already spent in caches further up
+    const http_header_t *age = http_message_header(resp, HTTP_HDR_AGE);
+    if (age) {
+        int64_t a = parse_seconds(buf + age->value.off, age->value.len);
+        if (a > 0) ttl -= a;
+        if (ttl <= 0) return 0;
+    }
+    return (uint64_t)ttl * 1000;
+}
+
+// Fold in every value of request header name
+static uint64_t hash_request_header(uint64_t h, const http_message_t *req, const char *req_buf,
+                                    const char *name, size_t name_len) {
+    for (int i = 0; i < req->header_count; i++) {
+        const http_header_t *rh = &req->headers[i];
+        if (rh->name.len != name_len) continue;
+        size_t k = 0;
+        while (k < name_len && lower(req_buf[rh->name.off + k]) == lower(name[k])) k++;
+        if (k != name_len) continue;
+        for (uint32_t j = 0; j < rh->value.len; j++) {
+            h = (h ^ (unsigned char)req_buf[rh->value.off + j]) * 1099511628211ull;
+        }
+        h = (h ^ ',') * 1099511628211ull;
+    }
+    return h;
+}
+
+typedef struct {
+    const http_message_t *req;
+    const char *req_buf;
+    uint64_t hash;
+} vary_state_t;
+
+static int vary_field(const char *name, size_t len, const char *value, size_t value_len, void *arg) {
+    vary_state_t *v = arg;
+    (void)value;
+    (void)value_len;
+    v->hash = (v->hash ^ len) * 1099511628211ull;
+    v->hash = hash_request_header(v->hash, v->req, v->req_buf, name, len);
+    return 0;
+}
+
+uint64_t cache_vary_hash(const http_message_t *resp, const char *resp_buf,
+                         const http_message_t *req, const char *req_buf) {
+    if (!http_message_header(resp, HTTP_HDR_VARY)) return 0;
+    vary_state_t v = { req, req_buf, 1469598103934665603ull };
+    for_each_directive(resp, resp_buf, HTTP_HDR_VARY, vary_field, &v);
+    return v.hash;
+}
+
+typedef struct {
+    int bypass;
+} request_directives_t;
+
+static int request_directive(const char *name, size_t len, const char *value, size_t value_len, void *arg) {
+    (void)value;
+    (void)value_len;
+    if (name_is(name, len, "no-store") || name_is(name, len, "no-cache")) {
+        ((request_directives_t *)arg)->bypass = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Requests the cache must not answer or fill
+static int request_bypasses(const http_message_t *req, const char *req_buf) {
+    if (http_message_header(req, HTTP_HDR_AUTHORIZATION)) return 1;
+    if (req->content_length > 0 || req->chunked) return 1;
+
+    const http_header_t *pragma = http_message_header(req, HTTP_HDR_PRAGMA);
+    if (pragma && http_value_has_token(req_buf, pragma->value, "no-cache")) return 1;
+
+    request_directives_t d = { 0 };
+    for_each_directive(req, req_buf, HTTP_HDR_CACHE_CONTROL, request_directive, &d);
+    return d.bypass;
+}
+
+cache_status_t cache_lookup(response_cache_t *cache, const char *key, size_t key_len,
+                            const http_message_t *req, const char *req_buf,
+                            int may_fill, int waiter_bit, uint64_t now, cache_entry_t **entry) {
+    *entry = NULL;
+    if (request_bypasses(req, req_buf)) return CACHE_BYPASS;
+
+    uint64_t hash = fnv1a(key, key_len);
+    cache_shard_t *shard = shard_for(cache, hash);
+    cache_status_t status = CACHE_BYPASS;
+
+    mutex_lock(&shard->lock);
+    cache_entry_t *e = shard_find(shard, hash, key, key_len);
+
+    if (e && e->state == CACHE_ENTRY_PASS && !e->filling && now >= e->expires_at) {
+        // Hit-for-pass marker ran out: let one request try again
+        shard_unlink(shard, e);
+        e = NULL;
+    }
+
+    if (!e) {
+        if (may_fill && (e = entry_new(hash, key, key_len)) != NULL) {
+            e->state = CACHE_ENTRY_PENDING;
+            e->filling = 1;
+            e->refs++;  // The filler's
+            shard_link(shard, e);
+            shard_evict(shard);
+            *entry = e;
+            status = CACHE_FILL;
+        }
+    } else if (e->state == CACHE_ENTRY_PASS) {
+        status = CACHE_PASS;
+    } else if (e->state == CACHE_ENTRY_PENDING ||
+               (e->filling && now >= e->expires_at)) {
+        // Someone is already fetching or revalidating this key
+        e->waiters |= 1ull << (waiter_bit & 63);
+        status = CACHE_WAIT;
+    } else if (e->vary_hash != cache_vary_hash(&e->msg, e->data, req, req_buf)) {
+        // Only one variant is kept per key; other variants go to the backend
+        status = CACHE_BYPASS;
+    } else if (now < e->expires_at) {
+        atomic_add(&e->refs, 1);
+        lru_touch(shard, e);
+        *entry = e;
+        status = CACHE_HIT;
+    } else if (may_fill) {
+        // Stale: this request refreshes it, later ones wait
+        e->filling = 1;
+        atomic_add(&e->refs, 1);
+        *entry = e;
+        status = http_message_header(&e->msg, HTTP_HDR_ETAG) ? CACHE_REVALIDATE : CACHE_FILL;
+    }
+    mutex_unlock(&shard->lock);
+    return status;
+}
+
+// Hand the fill's waiters over and stop it being a fill
+static uint64_t fill_finish(cache_entry_t *fill) {
+    uint64_t waiters = fill->waiters;
+    fill->waiters = 0;
+    fill->filling = 0;
+    return waiters;
+}
+
+uint64_t cache_commit(response_cache_t *cache, cache_entry_t *fill, char *data, size_t data_len,
+                      const char *backend_host, int backend_port, uint64_t ttl_ms, uint64_t vary_hash,
+                      uint64_t now) {
+    cache_entry_t *e = entry_new(fill->hash, fill->key, fill->key_len);
+    if (e) {
+        http_message_init(&e->msg, HTTP_MESSAGE_RESPONSE);
+        if (http_parse(&e->msg, data, data_len) != HTTP_PARSE_DONE) {
+            entry_free(e);
+            e = NULL;
+        }
+    }
+    if (!e) {
+        free(data);
+        return cache_abort(cache, fill, 0, now);
+    }
+
+    e->data = data;
+    e->data_len = data_len;
+    snprintf(e->backend_host, sizeof(e->backend_host), "%s", backend_host);
+    e->backend_port = backend_port;
+    e->vary_hash = vary_hash;
+    e->stored_at = now;
+    e->expires_at = now + ttl_ms;
+    e->state = CACHE_ENTRY_READY;
+    e->cost += data_len;
+
+    cache_shard_t *shard = shard_for(cache, fill->hash);
+    mutex_lock(&shard->lock);
+    uint64_t waiters = fill_finish(fill);
+    if (entry_linked(fill)) shard_unlink(shard, fill);
+    if (e->cost <= shard->budget) {
+        shard_link(shard, e);
+        shard_evict(shard);
+    } else {
+        cache_release(e);
+    }
+    mutex_unlock(&shard->lock);
+
+    cache_release(fill);
+    return waiters;
+}
+
+uint64_t cache_abort(response_cache_t *cache, cache_entry_t *fill, uint64_t pass_ttl_ms, uint64_t now) {
+    cache_shard_t *shard = shard_for(cache, fill->hash);
+    mutex_lock(&shard->lock);
+    uint64_t waiters = fill_finish(fill);
+
+    if (entry_linked(fill) && (fill->state == CACHE_ENTRY_PENDING || pass_ttl_ms > 0)) {
+        // A failed first fetch leaves nothing behind; an uncacheable answer
+        // replaces the key with a hit-for-pass marker. A stale entry whose
+        // refresh merely failed is kept for the next request to retry.
+        shard_unlink(shard, fill);
+        cache_entry_t *pass = pass_ttl_ms > 0 ? entry_new(fill->hash, fill->key, fill->key_len) : NULL;
+        if (pass) {
+            pass->state = CACHE_ENTRY_PASS;
+            pass->expires_at = now + pass_ttl_ms;
+            shard_link(shard, pass);
+            shard_evict(shard);
+        }
+    }
+    mutex_unlock(&shard->lock);
+
+    cache_release(fill);
+    return waiters;
+}
+
+const cache_variant_t *cache_add_variant(response_cache_t *cache, cache_entry_t *entry, int slot,
+                                         cache_variant_t *variant) {
+    cache_shard_t *shard = shard_for(cache, entry->hash);
+    mutex_lock(&shard->lock);
+    if (entry->variants[slot]) {
+        free(variant);
+        variant = entry->variants[slot];
+    } else {
+        atomic_set(&entry->variants[slot], variant);
+        size_t cost = sizeof(*variant) + variant->len;
+        entry->cost += cost;
+        if (entry_linked(entry)) {
+            shard->used += cost;
+            shard_evict(shard);
+        }
+    }
+    mutex_unlock(&shard->lock);
+    return variant;
+}
+
+uint64_t cache_refresh(response_cache_t *cache, cache_entry_t *entry, uint64_t ttl_ms, uint64_t now) {
+    cache_shard_t *shard = shard_for(cache, entry->hash);
+    mutex_lock(&shard->lock);
+    uint64_t waiters = fill_finish(entry);
+    atomic_set(&entry->stored_at, now);
+    atomic_set(&entry->expires_at, now + ttl_ms);
+    if (entry_linked(entry)) lru_touch(shard, entry);
+    mutex_unlock(&shard->lock);
+    return waiters;
+}
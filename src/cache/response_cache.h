@@ -0,0 +1,121 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "../core/platform.h"
+#include "../http/http_parser.h"
+
+// Shared in-memory response cache. Keys are Host + request target; entries
+// hold the backend's header block and body exactly as received. The key
+// space is split over shards, each with its own lock, hash table, LRU list
+// and slice of the memory budget, so workers rarely contend.
+//
+// Only one request per key talks to the backend at a time: the first miss
+// becomes the filler and later requests for the same key wait until it
+// commits or aborts (request coalescing). Waiting workers are named in a
+// bitmask that commit/abort return, so the caller can wake them.
+//
+// Entries are reference counted; a hit keeps its bytes alive while they are
+// being sent even if the entry is evicted or replaced meanwhile.
+//
+// A ready entry can also carry re-encoded copies of its body (compressed
+// variants), one per slot, made by whichever request first needs one and
+// shared by every later hit. They count against the entry's shard budget
+// and go with the entry.
+
+#define CACHE_SHARDS 16
+#define CACHE_DEFAULT_MAX_ENTRY (1024 * 1024)
+#define CACHE_VARIANT_SLOTS 4
+
+typedef enum {
+    CACHE_BYPASS,       // Not cacheable, forward as usual
+    CACHE_HIT,          // Fresh entry returned
+    CACHE_FILL,         // Caller fetches and must commit or abort *entry
+    CACHE_REVALIDATE,   // Stale entry with a validator; caller revalidates
+    CACHE_WAIT,         // Another request is filling this key
+    CACHE_PASS          // Recently found uncacheable; forward without waiting
+} cache_status_t;
+
+typedef enum {
+    CACHE_ENTRY_PENDING,    // Placeholder for the first fill
+    CACHE_ENTRY_READY,
+    CACHE_ENTRY_PASS        // Hit-for-pass marker
+} cache_entry_state_t;
+
+typedef struct {
+    size_t len;
+    char data[];
+} cache_variant_t;
+
+typedef struct cache_entry {
+    // Immutable once ready
+    uint64_t hash;
+    char *key;
+    uint32_t key_len;
+    char *data;             // Header block followed by the body
+    size_t data_len;
+    http_message_t msg;     // Parsed header block, spans into data
+    uint64_t vary_hash;
+    // Backend that produced it, for redirect rewrites. By address, since
+    // backend indexes change with a reload.
+    char backend_host[256];
+    int backend_port;
+    cache_variant_t *variants[CACHE_VARIANT_SLOTS]; // Set once, read atomically
+
+    // Guarded by the shard lock (refs and the times are also read atomically)
+    uint64_t stored_at;     // Fetched or last revalidated
+    uint64_t expires_at;
+    int refs;
+    int state;
+    int filling;
+    uint64_t waiters;       // Bit (worker id % 64) per waiting worker
+    size_t cost;
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+} cache_entry_t;
+
+typedef struct response_cache response_cache_t;
+
+response_cache_t *cache_create(size_t budget_bytes, size_t max_entry_bytes);
+void cache_destroy(response_cache_t *cache);
+size_t cache_max_entry(const response_cache_t *cache);
+
+// Look key up for req. Only GET requests may fill (may_fill); HEAD can be
+// answered from an entry but never populates one. waiter_bit identifies
+// the calling worker if it has to wait.
+cache_status_t cache_lookup(response_cache_t *cache, const char *key, size_t key_len,
+                            const http_message_t *req, const char *req_buf,
+                            int may_fill, int waiter_bit, uint64_t now, cache_entry_t **entry);
+
+// Store a fetched response in place of the fill token. data (header block
+// then body) is taken over by the cache. Commit and abort consume the
+// caller's reference to fill. Both return the workers to wake.
+uint64_t cache_commit(response_cache_t *cache, cache_entry_t *fill, char *data, size_t data_len,
+                      const char *backend_host, int backend_port, uint64_t ttl_ms, uint64_t vary_hash,
+                      uint64_t now);
+
+// Give up a fill. With pass_ttl_ms > 0 the key is remembered as
+// uncacheable for that long so later requests don't queue behind it.
+uint64_t cache_abort(response_cache_t *cache, cache_entry_t *fill, uint64_t pass_ttl_ms, uint64_t now);
+
+// The backend confirmed a stale entry (304): extend it by ttl_ms. The
+// caller keeps its reference to serve the entry.
+uint64_t cache_refresh(response_cache_t *cache, cache_entry_t *entry, uint64_t ttl_ms, uint64_t now);
+
+void cache_release(cache_entry_t *entry);
+
+// Attach a variant (malloc'd, taken over) to a ready entry the caller
+// holds. If another request got there first, the variant is freed and
+// the existing one returned.
+const cache_variant_t *cache_add_variant(response_cache_t *cache, cache_entry_t *entry, int slot,
+                                         cache_variant_t *variant);
+
+// Freshness lifetime of a backend response in ms, or 0 if it must not be
+// stored (status, no-store, private, no-cache, Set-Cookie, Vary: *, ...)
+uint64_t cache_response_ttl(const http_message_t *resp, const char *buf);
+
+// Hash of the request header values the response varies on
+uint64_t cache_vary_hash(const http_message_t *resp, const char *resp_buf,
+                         const http_message_t *req, const char *req_buf);
+
+#endif
@@ -0,0 +1,18 @@
+#include "event_loop.h"
+#include <string.h>
+
+static const char *engine_names[] = { "default", "epoll", "io_uring", "poll" };
+
+int event_engine_parse(const char *name, event_engine_t *engine) {
+    for (int i = 0; i < (int)(sizeof(engine_names) / sizeof(engine_names[0])); i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = (event_engine_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *event_engine_name(event_engine_t engine) {
+    return engine_names[engine];
+}
@@ -0,0 +1,62 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "platform.h"
+
+#define EV_READ  0x01
+#define EV_WRITE 0x02
+#define EV_ERROR 0x04 // hangup or pending socket error
+
+typedef struct event_loop event_loop_t;
+typedef struct io_watch io_watch_t;
+
+// Kernel interface behind a loop. All engines present the same readiness
+// interface; they differ in how interest changes and waits reach the
+// kernel. io_uring (Linux 5.13+) arms multishot poll requests and batches
+// every arm, re-arm and removal into the one io_uring_enter that waits.
+typedef enum {
+    EVENT_ENGINE_DEFAULT,   // epoll on Linux, poll elsewhere
+    EVENT_ENGINE_EPOLL,
+    EVENT_ENGINE_IO_URING,
+    EVENT_ENGINE_POLL
+} event_engine_t;
+
+// Names used on the command line: default, epoll, io_uring, poll
+int event_engine_parse(const char *name, event_engine_t *engine);
+const char *event_engine_name(event_engine_t engine);
+
+typedef void (*io_handler_fn)(io_watch_t *watch, uint32_t events);
+
+// One registered socket. Embedded in the owner (listener, client or upstream
+// connection); `data` points back at it. Handlers must drain the socket until
+// it would block, since the epoll backend is edge-triggered.
+struct io_watch {
+    sock_t fd;
+    uint32_t interest;
+    io_handler_fn handler;
+    void *data;
+    int slot; // backend private, -1 when not registered
+};
+
+event_loop_t *event_loop_create(void);
+
+// NULL if the engine is not built for this platform or the kernel refuses it
+event_loop_t *event_loop_create_engine(event_engine_t engine);
+void event_loop_destroy(event_loop_t *loop);
+
+int event_loop_add(event_loop_t *loop, io_watch_t *watch, uint32_t interest);
+
+// Interest hint. Edge-triggered backends only re-arm when new bits are
+// requested; level-triggered ones must honour it to avoid spinning.
+int event_loop_update(event_loop_t *loop, io_watch_t *watch, uint32_t interest);
+
+void event_loop_remove(event_loop_t *loop, io_watch_t *watch);
+
+// Wait up to timeout_ms and dispatch ready watches. Returns the number of
+// dispatched events or -1 on error.
+int event_loop_run_once(event_loop_t *loop, int timeout_ms);
+
+// Engine name of a loop, e.g. for the startup banner
+const char *event_loop_backend(const event_loop_t *loop);
+
+#endif
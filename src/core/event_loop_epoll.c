@@ -0,0 +1,125 @@
+#include "event_loop.h"
+
+#ifdef __linux__
+
+#include "event_loop_uring.h"
+#include <stdlib.h>
+#include <sys/epoll.h>
+
+#define MAX_EPOLL_EVENTS 256
+
+// Linux loops are epoll unless created for io_uring, in which case every
+// call is handed to the io_uring engine
+struct event_loop {
+    int epfd;
+    uring_loop_t *uring;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+};
+
+static uint32_t to_epoll(uint32_t interest) {
+    uint32_t ev = EPOLLET | EPOLLRDHUP;
+    if (interest & EV_READ) ev |= EPOLLIN;
+    if (interest & EV_WRITE) ev |= EPOLLOUT;
+    return ev;
+}
+
+event_loop_t *event_loop_create(void) {
+    return event_loop_create_engine(EVENT_ENGINE_DEFAULT);
+}
+
+event_loop_t *event_loop_create_engine(event_engine_t engine) {
+    if (engine == EVENT_ENGINE_POLL) return NULL;
+    event_loop_t *loop = calloc(1, sizeof(*loop));
+    if (!loop) return NULL;
+
+    if (engine == EVENT_ENGINE_IO_URING) {
+        loop->epfd = -1;
+        loop->uring = uring_loop_create();
+        if (!loop->uring) {
+            free(loop);
+            return NULL;
+        }
+        return loop;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+void event_loop_destroy(event_loop_t *loop) {
+    if (!loop) return;
+    if (loop->uring) uring_loop_destroy(loop->uring);
+    else close(loop->epfd);
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, io_watch_t *watch, uint32_t interest) {
+    if (loop->uring) return uring_loop_add(loop->uring, watch, interest);
+
+    struct epoll_event ev;
+    ev.events = to_epoll(interest);
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, watch->fd, &ev) < 0) return -1;
+    watch->interest = interest;
+    watch->slot = 0;
+    return 0;
+}
+
+int event_loop_update(event_loop_t *loop, io_watch_t *watch, uint32_t interest) {
+    if (loop->uring) return uring_loop_update(loop->uring, watch, interest);
+
+    // Edge-triggered: extra readiness bits are harmless, so only re-arm when
+    // the caller needs a bit we are not yet subscribed to
+    if ((watch->interest & interest) == interest) return 0;
+
+    struct epoll_event ev;
+    ev.events = to_epoll(watch->interest | interest);
+    ev.data.ptr = watch;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) return -1;
+    watch->interest |= interest;
+    return 0;
+}
+
+void event_loop_remove(event_loop_t *loop, io_watch_t *watch) {
+    if (loop->uring) {
+        uring_loop_remove(loop->uring, watch);
+        return;
+    }
+    if (watch->slot < 0) return;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+    watch->slot = -1;
+}
+
+int event_loop_run_once(event_loop_t *loop, int timeout_ms) {
+    if (loop->uring) return uring_loop_run_once(loop->uring, timeout_ms);
+
+    int n = epoll_wait(loop->epfd, loop->events, MAX_EPOLL_EVENTS, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; i++) {
+        io_watch_t *watch = loop->events[i].data.ptr;
+        uint32_t ev = loop->events[i].events;
+        uint32_t mask = 0;
+
+        // Removed earlier in this batch
+        if (watch->slot < 0) continue;
+
+        if (ev & (EPOLLIN | EPOLLRDHUP)) mask |= EV_READ;
+        if (ev & EPOLLOUT) mask |= EV_WRITE;
+        if (ev & (EPOLLERR | EPOLLHUP)) mask |= EV_ERROR | EV_READ | EV_WRITE;
+
+        watch->handler(watch, mask);
+    }
+    return n;
+}
+
+const char *event_loop_backend(const event_loop_t *loop) {
+    return loop->uring ? "io_uring" : "epoll";
+}
+
+#endif
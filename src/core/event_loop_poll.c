@@ -0,0 +1,140 @@
+#include "event_loop.h"
+
+// Portable level-triggered fallback for platforms without epoll
+// (WSAPoll on Windows, poll(2) elsewhere).
+#ifndef __linux__
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+typedef WSAPOLLFD pollfd_t;
+#define sys_poll(fds, n, timeout) WSAPoll((fds), (ULONG)(n), (timeout))
+#else
+#include <poll.h>
+typedef struct pollfd pollfd_t;
+#define sys_poll(fds, n, timeout) poll((fds), (nfds_t)(n), (timeout))
+#endif
+
+typedef struct {
+    io_watch_t *watch;
+    uint32_t events;
+} ready_t;
+
+struct event_loop {
+    pollfd_t *fds;
+    io_watch_t **watches;
+    ready_t *ready;
+    int count;
+    int capacity;
+    int ready_capacity;
+};
+
+static short to_poll(uint32_t interest) {
+    short ev = 0;
+    if (interest & EV_READ) ev |= POLLIN;
+    if (interest & EV_WRITE) ev |= POLLOUT;
+    return ev;
+}
+
+event_loop_t *event_loop_create(void) {
+    return event_loop_create_engine(EVENT_ENGINE_DEFAULT);
+}
+
+event_loop_t *event_loop_create_engine(event_engine_t engine) {
+    if (engine != EVENT_ENGINE_DEFAULT && engine != EVENT_ENGINE_POLL) return NULL;
+    return calloc(1, sizeof(event_loop_t));
+}
+
+void event_loop_destroy(event_loop_t *loop) {
+    if (!loop) return;
+    free(loop->fds);
+    free(loop->watches);
+    free(loop->ready);
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, io_watch_t *watch, uint32_t interest) {
+    if (loop->count == loop->capacity) {
+        int cap = loop->capacity ? loop->capacity * 2 : 64;
+        pollfd_t *fds = realloc(loop->fds, cap * sizeof(*fds));
+        if (!fds) return -1;
+        loop->fds = fds;
+        io_watch_t **watches = realloc(loop->watches, cap * sizeof(*watches));
+        if (!watches) return -1;
+        loop->watches = watches;
+        loop->capacity = cap;
+    }
+
+    int slot = loop->count++;
+    loop->fds[slot].fd = watch->fd;
+    loop->fds[slot].events = to_poll(interest);
+    loop->fds[slot].revents = 0;
+    loop->watches[slot] = watch;
+    watch->interest = interest;
+    watch->slot = slot;
+    return 0;
+}
+
+int event_loop_update(event_loop_t *loop, io_watch_t *watch, uint32_t interest) {
+    if (watch->slot < 0) return -1;
+    loop->fds[watch->slot].events = to_poll(interest);
+    watch->interest = interest;
+    return 0;
+}
+
+void event_loop_remove(event_loop_t *loop, io_watch_t *watch) {
+    int slot = watch->slot;
+    if (slot < 0) return;
+
+    int last = --loop->count;
+    if (slot != last) {
+        loop->fds[slot] = loop->fds[last];
+        loop->watches[slot] = loop->watches[last];
+        loop->watches[slot]->slot = slot;
+    }
+    watch->slot = -1;
+}
+
+int event_loop_run_once(event_loop_t *loop, int timeout_ms) {
+    int n = sys_poll(loop->fds, loop->count, timeout_ms);
+    if (n <= 0) return n < 0 ? -1 : 0;
+
+    // Snapshot first: handlers add and remove watches while we dispatch,
+    // so the ready list is only ever resized here
+    if (loop->ready_capacity < loop->count) {
+        ready_t *r = realloc(loop->ready, loop->capacity * sizeof(*r));
+        if (!r) return -1;
+        loop->ready = r;
+        loop->ready_capacity = loop->capacity;
+    }
+
+    int ready = 0;
+    for (int i = 0; i < loop->count && ready < n; i++) {
+        short rev = loop->fds[i].revents;
+        if (!rev) continue;
+
+        uint32_t mask = 0;
+        if (rev & POLLIN) mask |= EV_READ;
+        if (rev & POLLOUT) mask |= EV_WRITE;
+        if (rev & (POLLERR | POLLHUP | POLLNVAL)) mask |= EV_ERROR | EV_READ | EV_WRITE;
+
+        loop->ready[ready].watch = loop->watches[i];
+        loop->ready[ready].events = mask;
+        ready++;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        io_watch_t *watch = loop->ready[i].watch;
+        if (watch->slot < 0) continue;
+        watch->handler(watch, loop->ready[i].events);
+    }
+    return ready;
+}
+
+const char *event_loop_backend(const event_loop_t *loop) {
+    (void)loop;
+    return "poll";
+}
+
+#endif
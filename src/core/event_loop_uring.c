@@ -0,0 +1,323 @@
+#ifdef __linux__
+#define _GNU_SOURCE // POLLRDHUP
+#endif
+
+#include "event_loop_uring.h"
+
+// Readiness through io_uring: every watch is one multishot POLL_ADD that
+// keeps posting completions as the socket becomes ready, so, as with
+// edge-triggered epoll, handlers drain until EAGAIN. Arming, re-arming and
+// removal are submission entries rather than syscalls; they go to the
+// kernel together with the wait in a single io_uring_enter per loop turn.
+//
+// Completions carry a slot index and a generation. Removing or re-arming a
+// watch bumps its slot's generation, so completions still in flight for
+// the old request are recognised and dropped even after the watch itself
+// is freed.
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define URING_ENTRIES 1024
+#define URING_REMOVE_TAG UINT64_MAX // Completions of poll removals, ignored
+
+// Kernel features this engine relies on. RSRC_TAGS has no use here but
+// arrived in the same release (5.13) as multishot poll, which has no flag.
+#define URING_REQUIRED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+                                 IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)
+
+typedef struct {
+    io_watch_t *watch;  // NULL while free
+    uint32_t gen;
+    int next_free;
+} uring_slot_t;
+
+struct uring_loop {
+    int fd;
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    // Submission queue; sq_tail runs ahead of the kernel's copy until the
+    // next io_uring_enter
+    unsigned *sq_head;
+    unsigned *sq_ktail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_tail;
+    unsigned sq_submitted;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uring_slot_t *slots;
+    int slot_count;
+    int slot_capacity;
+    int free_slot;      // Head of the free slot list, -1 if empty
+};
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                           void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static void uring_unmap(uring_loop_t *u) {
+    if (u->ring && u->ring != MAP_FAILED) munmap(u->ring, u->ring_size);
+    if (u->sqes && (void*)u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+}
+
+uring_loop_t *uring_loop_create(void) {
+    uring_loop_t *u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->free_slot = -1;
+
+    // Cooperative task running (5.19) saves an interrupt per completion;
+    // older kernels reject the flag, so retry without it
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    u->fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        u->fd = sys_uring_setup(URING_ENTRIES, &p);
+    }
+    if (u->fd < 0) {
+        free(u);
+        return NULL;
+    }
+    if ((p.features & URING_REQUIRED_FEATURES) != URING_REQUIRED_FEATURES) goto fail;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                   IORING_OFF_SQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                   IORING_OFF_SQES);
+    if (u->ring == MAP_FAILED || (void*)u->sqes == MAP_FAILED) goto fail;
+
+    char *ring = u->ring;
+    u->sq_head = (unsigned*)(ring + p.sq_off.head);
+    u->sq_ktail = (unsigned*)(ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_tail = u->sq_submitted = *u->sq_ktail;
+    u->cq_head = (unsigned*)(ring + p.cq_off.head);
+    u->cq_tail = (unsigned*)(ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+    // Submission entries are always used in ring order
+    unsigned *array = (unsigned*)(ring + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) array[i] = i;
+    return u;
+
+fail:
+    uring_unmap(u);
+    close(u->fd);
+    free(u);
+    return NULL;
+}
+
+void uring_loop_destroy(uring_loop_t *u) {
+    if (!u) return;
+    uring_unmap(u);
+    close(u->fd); // Cancels every outstanding poll
+    free(u->slots);
+    free(u);
+}
+
+// Hand queued entries to the kernel, optionally waiting for completions.
+// Returns what io_uring_enter returns.
+static int uring_enter(uring_loop_t *u, unsigned wait_nr, int timeout_ms) {
+    unsigned to_submit = u->sq_tail - u->sq_submitted;
+    __atomic_store_n(u->sq_ktail, u->sq_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t arg_size = 0;
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            arg_size = sizeof(arg);
+        }
+    }
+    if (to_submit == 0 && wait_nr == 0) return 0;
+
+    int r = sys_uring_enter(u->fd, to_submit, wait_nr, flags, argp, arg_size);
+    if (r > 0) u->sq_submitted += (unsigned)r > to_submit ? to_submit : (unsigned)r;
+    return r;
+}
+
+// Next free submission entry, zeroed. Flushes the queue when it is full.
+static struct io_uring_sqe *uring_sqe(uring_loop_t *u) {
+    if (u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        uring_enter(u, 0, 0);
+        if (u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_tail++;
+    return sqe;
+}
+
+static uint64_t slot_tag(const uring_loop_t *u, int slot) {
+    return ((uint64_t)u->slots[slot].gen << 32) | (uint32_t)slot;
+}
+
+static int slot_alloc(uring_loop_t *u) {
+    if (u->free_slot >= 0) {
+        int slot = u->free_slot;
+        u->free_slot = u->slots[slot].next_free;
+        return slot;
+    }
+    if (u->slot_count == u->slot_capacity) {
+        int cap = u->slot_capacity ? u->slot_capacity * 2 : 64;
+        uring_slot_t *slots = realloc(u->slots, cap * sizeof(*slots));
+        if (!slots) return -1;
+        u->slots = slots;
+        u->slot_capacity = cap;
+    }
+    int slot = u->slot_count++;
+    u->slots[slot].watch = NULL;
+    u->slots[slot].gen = 0;
+    return slot;
+}
+
+static void slot_free(uring_loop_t *u, int slot) {
+    u->slots[slot].watch = NULL;
+    u->slots[slot].gen++;
+    u->slots[slot].next_free = u->free_slot;
+    u->free_slot = slot;
+}
+
+static unsigned to_poll(uint32_t interest) {
+    unsigned ev = POLLRDHUP;
+    if (interest & EV_READ) ev |= POLLIN;
+    if (interest & EV_WRITE) ev |= POLLOUT;
+    return ev;
+}
+
+static int uring_arm(uring_loop_t *u, int slot, uint32_t interest) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = u->slots[slot].watch->fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = to_poll(interest);
+    sqe->user_data = slot_tag(u, slot);
+    return 0;
+}
+
+// Cancel the poll posted under tag. If the queue can't take the removal
+// the poll stays armed, but its completions no longer match any slot.
+static void uring_disarm(uring_loop_t *u, uint64_t tag) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    sqe->user_data = URING_REMOVE_TAG;
+}
+
+int uring_loop_add(uring_loop_t *u, io_watch_t *watch, uint32_t interest) {
+    int slot = slot_alloc(u);
+    if (slot < 0) return -1;
+    u->slots[slot].watch = watch;
+    if (uring_arm(u, slot, interest) != 0) {
+        slot_free(u, slot);
+        return -1;
+    }
+    watch->interest = interest;
+    watch->slot = slot;
+    return 0;
+}
+
+int uring_loop_update(uring_loop_t *u, io_watch_t *watch, uint32_t interest) {
+    // Same policy as epoll: only re-arm for bits not yet subscribed to
+    if ((watch->interest & interest) == interest) return 0;
+    if (watch->slot < 0) return -1;
+
+    int slot = watch->slot;
+    uring_disarm(u, slot_tag(u, slot));
+    u->slots[slot].gen++;
+    if (uring_arm(u, slot, watch->interest | interest) != 0) return -1;
+    watch->interest |= interest;
+    return 0;
+}
+
+void uring_loop_remove(uring_loop_t *u, io_watch_t *watch) {
+    if (watch->slot < 0) return;
+    uring_disarm(u, slot_tag(u, watch->slot));
+    slot_free(u, watch->slot);
+    watch->slot = -1;
+}
+
+int uring_loop_run_once(uring_loop_t *u, int timeout_ms) {
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    // Submit pending changes; only block when nothing has completed yet
+    if (head == tail || u->sq_tail != u->sq_submitted) {
+        int r = uring_enter(u, head == tail ? 1 : 0, timeout_ms);
+        if (r < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    int n = 0;
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+
+        // Removals, and polls whose watch was removed or re-armed since
+        if (tag == URING_REMOVE_TAG) continue;
+        int slot = (int)(uint32_t)tag;
+        if (slot >= u->slot_count || !u->slots[slot].watch || u->slots[slot].gen != (uint32_t)(tag >> 32)) {
+            continue;
+        }
+        io_watch_t *watch = u->slots[slot].watch;
+
+        uint32_t mask = 0;
+        if (res < 0) {
+            mask = EV_ERROR | EV_READ | EV_WRITE;
+        } else {
+            if (res & (POLLIN | POLLRDHUP)) mask |= EV_READ;
+            if (res & POLLOUT) mask |= EV_WRITE;
+            if (res & (POLLERR | POLLHUP)) mask |= EV_ERROR | EV_READ | EV_WRITE;
+            // The kernel ends a multishot poll when it can't post more
+            // (e.g. completion overflow); keep the watch armed
+            if (!(flags & IORING_CQE_F_MORE)) uring_arm(u, slot, watch->interest);
+        }
+
+        watch->handler(watch, mask);
+        n++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+#endif
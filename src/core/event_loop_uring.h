@@ -0,0 +1,25 @@
+#ifndef EVENT_LOOP_URING_H
+#define EVENT_LOOP_URING_H
+
+#include "event_loop.h"
+
+// io_uring engine behind the Linux event loop: event_loop_epoll.c hands
+// loops created for EVENT_ENGINE_IO_URING to these. Same contract as the
+// public event_loop_* calls.
+
+#ifdef __linux__
+
+typedef struct uring_loop uring_loop_t;
+
+// NULL if the kernel lacks io_uring or the features this engine needs
+uring_loop_t *uring_loop_create(void);
+void uring_loop_destroy(uring_loop_t *loop);
+
+int uring_loop_add(uring_loop_t *loop, io_watch_t *watch, uint32_t interest);
+int uring_loop_update(uring_loop_t *loop, io_watch_t *watch, uint32_t interest);
+void uring_loop_remove(uring_loop_t *loop, io_watch_t *watch);
+int uring_loop_run_once(uring_loop_t *loop, int timeout_ms);
+
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#include "histogram.h"
+
+static int bucket_index(uint64_t v) {
+    if (v < 2 * HIST_SUB_COUNT) return (int)v;
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    int i = (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) & (HIST_SUB_COUNT - 1));
+    return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+uint64_t histogram_bucket_upper(int i) {
+    if (i < 2 * HIST_SUB_COUNT) return (uint64_t)i;
+    int shift = i / HIST_SUB_COUNT - 1;
+    uint64_t base = (uint64_t)(HIST_SUB_COUNT + i % HIST_SUB_COUNT) << shift;
+    return base + ((uint64_t)1 << shift) - 1;
+}
+
+void histogram_record(histogram_t *h, uint64_t value) {
+    counter_add(&h->counts[bucket_index(value)], 1);
+    counter_add(&h->count, 1);
+    counter_add(&h->sum, value);
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += counter_get(&src->counts[i]);
+    }
+    dst->count += counter_get(&src->count);
+    dst->sum += counter_get(&src->sum);
+}
+
+uint64_t histogram_quantile(const histogram_t *h, double q) {
+    // Count from the buckets: the total may be a moment ahead of them
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) total += h->counts[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) return histogram_bucket_upper(i);
+    }
+    return histogram_bucket_upper(HIST_BUCKETS - 1);
+}
+
+uint64_t histogram_count_le(const histogram_t *h, uint64_t limit) {
+    uint64_t n = 0;
+    for (int i = 0; i < HIST_BUCKETS && histogram_bucket_upper(i) <= limit; i++) {
+        n += h->counts[i];
+    }
+    return n;
+}
@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "platform.h"
+
+// HDR-style log-linear latency histogram: exact below 32, then 16 buckets
+// per power of two, so any recorded value is within ~6% of its bucket
+// bound from 1 us up to days. Recording is a couple of shifts and one
+// counter add with no locks: a histogram has a single writer and any
+// number of readers that merge snapshots (see counter_add).
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (40 * HIST_SUB_COUNT)     // Up to 2^40 (~12 days in us)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} histogram_t;
+
+void histogram_record(histogram_t *h, uint64_t value);
+
+// Add a snapshot of src (which may be written concurrently) into dst
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+// Largest value that falls into bucket i
+uint64_t histogram_bucket_upper(int i);
+
+// Value at quantile q (0..1), as the upper bound of its bucket
+uint64_t histogram_quantile(const histogram_t *h, double q);
+
+// Recorded values <= limit
+uint64_t histogram_count_le(const histogram_t *h, uint64_t limit);
+
+#endif
@@ -0,0 +1,299 @@
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH 64
+#define JSON_MAX_FILE_SIZE (1024 * 1024)
+
+typedef struct {
+    const char *p;
+    const char *end;
+    const char *start;
+    char *err;
+    size_t err_len;
+    int failed;
+} json_parser_t;
+
+static int fail(json_parser_t *ps, const char *what) {
+    if (!ps->failed) {
+        int line = 1;
+        for (const char *c = ps->start; c < ps->p && c < ps->end; c++) {
+            if (*c == '\n') line++;
+        }
+        snprintf(ps->err, ps->err_len, "line %d: %s", line, what);
+        ps->failed = 1;
+    }
+    return -1;
+}
+
+static void skip_space(json_parser_t *ps) {
+    while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')) ps->p++;
+}
+
+static int literal(json_parser_t *ps, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(ps->end - ps->p) < n || memcmp(ps->p, word, n) != 0) return fail(ps, "unexpected token");
+    ps->p += n;
+    return 0;
+}
+
+static int hex4(const char *p, unsigned *out) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static size_t put_utf8(char *out, unsigned cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// ps->p is on the opening quote. Unescaped output is never longer than
+// the escaped input, so one allocation of the raw length is enough.
+static int parse_string(json_parser_t *ps, char **out) {
+    const char *s = ++ps->p;
+    while (ps->p < ps->end && *ps->p != '"') {
+        if (*ps->p == '\\') ps->p++;
+        ps->p++;
+    }
+    if (ps->p >= ps->end) return fail(ps, "unterminated string");
+
+    char *str = malloc(ps->p - s + 1);
+    if (!str) return fail(ps, "out of memory");
+    size_t n = 0;
+    for (const char *c = s; c < ps->p; c++) {
+        if ((unsigned char)*c < 0x20) {
+            free(str);
+            return fail(ps, "control character in string");
+        }
+        if (*c != '\\') {
+            str[n++] = *c;
+            continue;
+        }
+        c++;
+        switch (*c) {
+        case '"': str[n++] = '"'; break;
+        case '\\': str[n++] = '\\'; break;
+        case '/': str[n++] = '/'; break;
+        case 'b': str[n++] = '\b'; break;
+        case 'f': str[n++] = '\f'; break;
+        case 'n': str[n++] = '\n'; break;
+        case 'r': str[n++] = '\r'; break;
+        case 't': str[n++] = '\t'; break;
+        case 'u': {
+            unsigned cp, lo;
+            if (ps->p - c < 5 || hex4(c + 1, &cp) != 0) {
+                free(str);
+                return fail(ps, "bad \\u escape");
+            }
+            c += 4;
+            // UTF-16 surrogate pair
+            if (cp >= 0xD800 && cp < 0xDC00 && ps->p - c >= 7 && c[1] == '\\' && c[2] == 'u' &&
+                hex4(c + 3, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                c += 6;
+            }
+            n += put_utf8(str + n, cp);
+            break;
+        }
+        default:
+            free(str);
+            return fail(ps, "bad escape");
+        }
+    }
+    str[n] = '\0';
+    ps->p++;
+    *out = str;
+    return 0;
+}
+
+static int parse_number(json_parser_t *ps, double *out) {
+    char buf[64];
+    size_t n = 0;
+    while (ps->p < ps->end && n < sizeof(buf) - 1 && strchr("+-0123456789.eE", *ps->p)) buf[n++] = *ps->p++;
+    buf[n] = '\0';
+    char *end;
+    *out = strtod(buf, &end);
+    if (n == 0 || *end != '\0') return fail(ps, "bad number");
+    return 0;
+}
+
+static int parse_value(json_parser_t *ps, json_value_t *v, int depth);
+static void free_children(json_value_t *v);
+
+static int append(json_parser_t *ps, json_value_t *parent, int *cap, const json_value_t *item) {
+    if (parent->count == *cap) {
+        int n = *cap ? *cap * 2 : 4;
+        json_value_t *items = realloc(parent->items, n * sizeof(*items));
+        if (!items) return fail(ps, "out of memory");
+        parent->items = items;
+        *cap = n;
+    }
+    parent->items[parent->count++] = *item;
+    return 0;
+}
+
+// Array or object; ps->p is on the opening bracket
+static int parse_container(json_parser_t *ps, json_value_t *v, int depth) {
+    int object = *ps->p == '{';
+    char close = object ? '}' : ']';
+    int cap = 0;
+    v->type = object ? JSON_OBJECT : JSON_ARRAY;
+    ps->p++;
+
+    skip_space(ps);
+    if (ps->p < ps->end && *ps->p == close) {
+        ps->p++;
+        return 0;
+    }
+    while (1) {
+        json_value_t item;
+        memset(&item, 0, sizeof(item));
+        skip_space(ps);
+        if (object) {
+            if (ps->p >= ps->end || *ps->p != '"') return fail(ps, "expected member name");
+            if (parse_string(ps, &item.key) != 0) return -1;
+            skip_space(ps);
+            if (ps->p >= ps->end || *ps->p != ':') {
+                free(item.key);
+                return fail(ps, "expected ':'");
+            }
+            ps->p++;
+        }
+        if (parse_value(ps, &item, depth + 1) != 0 || append(ps, v, &cap, &item) != 0) {
+            free_children(&item);
+            return -1;
+        }
+
+        skip_space(ps);
+        if (ps->p < ps->end && *ps->p == ',') {
+            ps->p++;
+            continue;
+        }
+        if (ps->p < ps->end && *ps->p == close) {
+            ps->p++;
+            return 0;
+        }
+        return fail(ps, object ? "expected ',' or '}'" : "expected ',' or ']'");
+    }
+}
+
+static int parse_value(json_parser_t *ps, json_value_t *v, int depth) {
+    if (depth > JSON_MAX_DEPTH) return fail(ps, "nested too deeply");
+    skip_space(ps);
+    if (ps->p >= ps->end) return fail(ps, "unexpected end of input");
+
+    switch (*ps->p) {
+    case '{':
+    case '[':
+        return parse_container(ps, v, depth);
+    case '"':
+        v->type = JSON_STRING;
+        return parse_string(ps, &v->string);
+    case 't':
+        v->type = JSON_BOOL;
+        v->boolean = 1;
+        return literal(ps, "true");
+    case 'f':
+        v->type = JSON_BOOL;
+        return literal(ps, "false");
+    case 'n':
+        v->type = JSON_NULL;
+        return literal(ps, "null");
+    default:
+        v->type = JSON_NUMBER;
+        return parse_number(ps, &v->number);
+    }
+}
+
+static void free_children(json_value_t *v) {
+    for (int i = 0; i < v->count; i++) free_children(&v->items[i]);
+    free(v->items);
+    free(v->key);
+    free(v->string);
+}
+
+void json_free(json_value_t *value) {
+    if (!value) return;
+    free_children(value);
+    free(value);
+}
+
+json_value_t *json_parse(const char *text, size_t len, char *err, size_t err_len) {
+    json_parser_t ps = { text, text + len, text, err, err_len, 0 };
+    json_value_t *root = calloc(1, sizeof(*root));
+    if (!root) {
+        snprintf(err, err_len, "out of memory");
+        return NULL;
+    }
+    if (parse_value(&ps, root, 0) == 0) {
+        skip_space(&ps);
+        if (ps.p == ps.end) return root;
+        fail(&ps, "trailing characters after the document");
+    }
+    json_free(root);
+    return NULL;
+}
+
+json_value_t *json_parse_file(const char *path, char *err, size_t err_len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        snprintf(err, err_len, "cannot open %s", path);
+        return NULL;
+    }
+    char *text = malloc(JSON_MAX_FILE_SIZE);
+    size_t len = text ? fread(text, 1, JSON_MAX_FILE_SIZE, f) : 0;
+    int too_big = text && len == JSON_MAX_FILE_SIZE;
+    int read_error = ferror(f);
+    fclose(f);
+    if (!text || too_big || read_error) {
+        if (!text) snprintf(err, err_len, "out of memory");
+        else if (too_big) snprintf(err, err_len, "%s is too large", path);
+        else snprintf(err, err_len, "cannot read %s", path);
+        free(text);
+        return NULL;
+    }
+    json_value_t *root = json_parse(text, len, err, err_len);
+    free(text);
+    return root;
+}
+
+const json_value_t *json_get(const json_value_t *object, const char *key) {
+    if (!object || object->type != JSON_OBJECT) return NULL;
+    for (int i = 0; i < object->count; i++) {
+        if (strcmp(object->items[i].key, key) == 0) return &object->items[i];
+    }
+    return NULL;
+}
+
+const char *json_type_name(json_type_t type) {
+    static const char *names[] = { "null", "boolean", "number", "string", "array", "object" };
+    return names[type];
+}
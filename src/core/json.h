@@ -0,0 +1,42 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+
+// Small JSON reader for configuration files: parses a whole document into
+// a tree that is read once and freed. Strings are unescaped and
+// NUL-terminated (\u escapes become UTF-8); numbers are doubles. Not meant
+// for anything on the request path.
+
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} json_type_t;
+
+typedef struct json_value json_value_t;
+
+struct json_value {
+    json_type_t type;
+    char *key;              // Member name inside an object, else NULL
+    int boolean;
+    double number;
+    char *string;
+    json_value_t *items;    // Array elements or object members
+    int count;
+};
+
+// NULL on error, with a message naming the line in err
+json_value_t *json_parse(const char *text, size_t len, char *err, size_t err_len);
+json_value_t *json_parse_file(const char *path, char *err, size_t err_len);
+void json_free(json_value_t *value);
+
+// Member of an object, NULL if absent or value is not an object
+const json_value_t *json_get(const json_value_t *object, const char *key);
+
+const char *json_type_name(json_type_t type);
+
+#endif
@@ -0,0 +1,17 @@
+#include "log.h"
+
+int log_allow(log_limit_t *limit, int *suppressed) {
+    uint64_t second = time_now_ms() / 1000;
+    uint64_t seen = atomic_get(&limit->second);
+
+    *suppressed = 0;
+    if (seen != second && atomic_cas(&limit->second, &seen, second)) {
+        // First message of a new window
+        atomic_set(&limit->count, 0);
+        *suppressed = atomic_swap(&limit->suppressed, 0);
+    }
+
+    if (atomic_add(&limit->count, 1) <= LOG_WARN_PER_SEC) return 1;
+    atomic_add(&limit->suppressed, 1);
+    return 0;
+}
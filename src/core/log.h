@@ -0,0 +1,54 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "platform.h"
+#include <stdio.h>
+
+// Diagnostics on stdout. Startup and state-change messages use printf
+// directly; anything that can happen once per request goes through these
+// macros so it never serialises workers on the stdout lock in production:
+//
+//   LOG_DEBUG  per-request chatter, only built in when PROXY_LOG_LEVEL >= 2
+//              (e.g. -DPROXY_LOG_LEVEL=2); otherwise dead code the compiler
+//              drops, though its arguments are still type-checked
+//   LOG_WARN   per-request failures, at most LOG_WARN_PER_SEC per call site
+//              and second, with a count of what was suppressed
+//
+// Per-request results belong in the access log (http/access_log.h).
+
+#ifndef PROXY_LOG_LEVEL
+#define PROXY_LOG_LEVEL 1
+#endif
+
+#define LOG_WARN_PER_SEC 10
+
+#if PROXY_LOG_LEVEL >= 2
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
+typedef struct {
+    uint64_t second;
+    int count;
+    int suppressed;
+} log_limit_t;
+
+// True if the call site may log now; *suppressed is the number of messages
+// dropped in the previous window, reported once
+int log_allow(log_limit_t *limit, int *suppressed);
+
+#if PROXY_LOG_LEVEL >= 1
+#define LOG_WARN(...) do { \
+        static log_limit_t log_limit_; \
+        int log_suppressed_; \
+        if (log_allow(&log_limit_, &log_suppressed_)) { \
+            if (log_suppressed_) printf("⚠️ %d similar messages suppressed\n", log_suppressed_); \
+            printf(__VA_ARGS__); \
+        } \
+    } while (0)
+#else
+#define LOG_WARN(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
+#endif
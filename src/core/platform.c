@@ -0,0 +1,358 @@
+#ifdef __linux__
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ
+#endif
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/un.h>
+#include <time.h>
+#endif
+
+typedef struct {
+    thread_fn fn;
+    void *arg;
+} thread_trampoline_t;
+
+#ifdef _WIN32
+
+#pragma comment(lib, "ws2_32.lib")
+
+int platform_net_init(void) {
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0 ? 0 : -1;
+}
+
+void platform_net_cleanup(void) {
+    WSACleanup();
+}
+
+int platform_on_hangup(void (*fn)(int sig)) {
+    (void)fn;
+    return -1;
+}
+
+int platform_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+uint64_t time_now_ms(void) {
+    return (uint64_t)GetTickCount64();
+}
+
+uint64_t time_now_us(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+static unsigned __stdcall thread_trampoline(void *arg) {
+    thread_trampoline_t t = *(thread_trampoline_t *)arg;
+    free(arg);
+    t.fn(t.arg);
+    return 0;
+}
+
+int thread_start(thread_t *thread, thread_fn fn, void *arg) {
+    thread_trampoline_t *t = malloc(sizeof(*t));
+    if (!t) return -1;
+    t->fn = fn;
+    t->arg = arg;
+
+    uintptr_t handle = _beginthreadex(NULL, 0, thread_trampoline, t, 0, NULL);
+    if (!handle) {
+        free(t);
+        return -1;
+    }
+    *thread = (HANDLE)handle;
+    return 0;
+}
+
+void thread_join(thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void sleep_ms(int ms) {
+    Sleep((DWORD)ms);
+}
+
+int sock_set_nonblocking(sock_t sock) {
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0 ? 0 : -1;
+}
+
+int sock_sendv(sock_t sock, sock_iov_t *iov, int count) {
+    DWORD sent = 0;
+    if (WSASend(sock, iov, (DWORD)count, &sent, 0, NULL, NULL) != 0) return -1;
+    return (int)sent;
+}
+
+// No socketpair on Winsock: connect two loopback TCP sockets instead
+int sock_pair(sock_t pair[2]) {
+    struct sockaddr_in addr;
+    int addrlen = sizeof(addr);
+    sock_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == SOCK_INVALID) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pair[0] = pair[1] = SOCK_INVALID;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addrlen) != 0 ||
+        listen(listener, 1) != 0) {
+        goto fail;
+    }
+    pair[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (pair[0] == SOCK_INVALID || connect(pair[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) goto fail;
+    pair[1] = accept(listener, NULL, NULL);
+    if (pair[1] == SOCK_INVALID) goto fail;
+    closesocket(listener);
+    return 0;
+
+fail:
+    if (pair[0] != SOCK_INVALID) closesocket(pair[0]);
+    closesocket(listener);
+    return -1;
+}
+
+int sock_last_error(void) {
+    return WSAGetLastError();
+}
+
+int sock_would_block(void) {
+    int err = WSAGetLastError();
+    return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+void sock_set_would_block(int would_block) {
+    WSASetLastError(would_block ? WSAEWOULDBLOCK : WSAECONNRESET);
+}
+
+int sock_wait(sock_t sock, int for_write, int timeout_ms) {
+    WSAPOLLFD p = { sock, for_write ? POLLOUT : POLLIN, 0 };
+    return WSAPoll(&p, 1, timeout_ms) > 0;
+}
+
+#else
+
+int platform_net_init(void) {
+    // A client vanishing mid-send must surface as EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+void platform_net_cleanup(void) {
+}
+
+int platform_on_hangup(void (*fn)(int sig)) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fn;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGHUP, &sa, NULL);
+}
+
+int platform_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+uint64_t time_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t time_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void *thread_trampoline(void *arg) {
+    thread_trampoline_t t = *(thread_trampoline_t *)arg;
+    free(arg);
+    t.fn(t.arg);
+    return NULL;
+}
+
+int thread_start(thread_t *thread, thread_fn fn, void *arg) {
+    thread_trampoline_t *t = malloc(sizeof(*t));
+    if (!t) return -1;
+    t->fn = fn;
+    t->arg = arg;
+
+    if (pthread_create(thread, NULL, thread_trampoline, t) != 0) {
+        free(t);
+        return -1;
+    }
+    return 0;
+}
+
+void thread_join(thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+int sock_set_nonblocking(sock_t sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+int sock_sendv(sock_t sock, sock_iov_t *iov, int count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    return (int)sendmsg(sock, &msg, MSG_NOSIGNAL);
+#else
+    return (int)sendmsg(sock, &msg, 0);
+#endif
+}
+
+int sock_pair(sock_t pair[2]) {
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+}
+
+int sock_last_error(void) {
+    return errno;
+}
+
+int sock_would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+void sock_set_would_block(int would_block) {
+    errno = would_block ? EAGAIN : ECONNRESET;
+}
+
+int sock_wait(sock_t sock, int for_write, int timeout_ms) {
+    struct pollfd p = { sock, for_write ? POLLOUT : POLLIN, 0 };
+    return poll(&p, 1, timeout_ms) > 0;
+}
+
+#ifdef PLATFORM_HAS_SPLICE
+int splice_pipe_open(splice_pipe_t *p) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) return -1;
+    fcntl(fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE); // Keeps the default 64 KB if refused
+    p->rd = fds[0];
+    p->wr = fds[1];
+    return 0;
+}
+
+void splice_pipe_close(splice_pipe_t *p) {
+    close(p->rd);
+    close(p->wr);
+    p->rd = p->wr = -1;
+}
+
+int sock_splice(int from, int to, size_t len) {
+    return (int)splice(from, NULL, to, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+#endif
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+sock_t unix_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) != 0) return SOCK_INVALID;
+    sock_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == SOCK_INVALID) return SOCK_INVALID;
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 4) != 0) {
+        close(sock);
+        return SOCK_INVALID;
+    }
+    return sock;
+}
+
+sock_t unix_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) != 0) return SOCK_INVALID;
+    sock_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == SOCK_INVALID) return SOCK_INVALID;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return SOCK_INVALID;
+    }
+    return sock;
+}
+
+int sock_send_fds(sock_t sock, const void *data, size_t len, const sock_t *fds, int count) {
+    char control[CMSG_SPACE(SOCK_MAX_PASSED_FDS * sizeof(int))];
+    struct iovec iov = { (void *)data, len };
+    struct msghdr msg;
+    if (count < 0 || count > SOCK_MAX_PASSED_FDS) return -1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (count > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    }
+    return sendmsg(sock, &msg, 0) == (ssize_t)len ? 0 : -1;
+}
+
+int sock_recv_fds(sock_t sock, void *data, size_t len, sock_t *fds, int max, int *count) {
+    char control[CMSG_SPACE(SOCK_MAX_PASSED_FDS * sizeof(int))];
+    struct iovec iov = { data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    *count = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+#else
+    ssize_t n = recvmsg(sock, &msg, 0);
+#endif
+    if (n < 0) return -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < received; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*count < max) fds[(*count)++] = fd;
+            else close(fd);
+        }
+    }
+    return (int)n;
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Thin portability layer so the proxy core builds with MinGW (Winsock)
+// and on Linux/POSIX (BSD sockets + pthreads).
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <process.h>
+
+typedef SOCKET sock_t;
+#define SOCK_INVALID INVALID_SOCKET
+#define sock_close closesocket
+
+typedef CRITICAL_SECTION mutex_t;
+#define mutex_init(m) InitializeCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+
+typedef HANDLE thread_t;
+
+// Scatter-gather buffer for sock_sendv
+typedef WSABUF sock_iov_t;
+#define SOCK_IOV_BASE(v) ((v).buf)
+#define SOCK_IOV_LEN(v) ((v).len)
+
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <pthread.h>
+
+typedef int sock_t;
+#define SOCK_INVALID (-1)
+#define sock_close close
+
+typedef pthread_mutex_t mutex_t;
+#define mutex_init(m) pthread_mutex_init((m), NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+
+typedef pthread_t thread_t;
+
+typedef struct iovec sock_iov_t;
+#define SOCK_IOV_BASE(v) ((v).iov_base)
+#define SOCK_IOV_LEN(v) ((v).iov_len)
+
+#endif
+
+// Atomics for the little state workers share (GCC/Clang builtins, which
+// MinGW provides as well)
+#define atomic_get(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_set(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_swap(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_cas(p, expected, desired) \
+    __atomic_compare_exchange_n((p), (expected), (desired), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+// Counters with a single writing thread that others may read at any time:
+// a relaxed load and store, so no locked instruction on the hot path
+#define counter_add(p, v) __atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (v), __ATOMIC_RELAXED)
+#define counter_get(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+typedef void (*thread_fn)(void *arg);
+
+// WSAStartup on Windows, SIGPIPE suppression on POSIX
+int platform_net_init(void);
+void platform_net_cleanup(void);
+
+int platform_cpu_count(void);
+
+// Run fn from a signal handler on SIGHUP, so only async-signal-safe work
+// is allowed (typically setting a flag). -1 where there is no SIGHUP.
+int platform_on_hangup(void (*fn)(int sig));
+
+// Monotonic milliseconds / microseconds
+uint64_t time_now_ms(void);
+uint64_t time_now_us(void);
+
+int thread_start(thread_t *thread, thread_fn fn, void *arg);
+void thread_join(thread_t thread);
+void sleep_ms(int ms);
+
+int sock_set_nonblocking(sock_t sock);
+
+// Gather-write count buffers in one call (sendmsg / WSASend). Returns the
+// number of bytes sent, or -1 with the error left for sock_would_block().
+int sock_sendv(sock_t sock, sock_iov_t *iov, int count);
+// Connected pair of stream sockets, used to wake an event loop from
+// another thread
+int sock_pair(sock_t pair[2]);
+int sock_last_error(void);
+
+// True when the last socket call failed only because it would block
+// (EAGAIN/EWOULDBLOCK, or EINPROGRESS for a non-blocking connect)
+int sock_would_block(void);
+
+// Report the outcome of a socket-like call that is not a plain socket call
+// (a TLS record layer) the way sock_would_block() expects to find it
+void sock_set_would_block(int would_block);
+
+// Wait up to timeout_ms for one socket to become readable (or writable).
+// Returns 1 when it is ready, including for an error to collect, else 0.
+// Unlike select this works for any descriptor number, however many the
+// workers hold open.
+int sock_wait(sock_t sock, int for_write, int timeout_ms);
+
+// Socket-to-socket relay through a pipe (Linux splice): bytes move between
+// kernel buffers and never enter user space. Only defined where the
+// kernel has it; elsewhere callers keep to recv/send.
+#ifdef __linux__
+#define PLATFORM_HAS_SPLICE 1
+
+typedef struct {
+    int rd;
+    int wr;
+} splice_pipe_t;
+
+// Non-blocking pipe, enlarged to SPLICE_PIPE_SIZE when the system allows
+#define SPLICE_PIPE_SIZE (256 * 1024)
+int splice_pipe_open(splice_pipe_t *pipe);
+void splice_pipe_close(splice_pipe_t *pipe);
+
+// Move up to len bytes from `from` to `to`, one of which is a pipe end.
+// Returns bytes moved, 0 at end of stream, or -1 with the error left for
+// sock_would_block().
+int sock_splice(int from, int to, size_t len);
+#endif
+
+// Unix-domain stream sockets that carry open descriptors (SCM_RIGHTS), so
+// a process can hand its listening sockets to another. POSIX only.
+#ifndef _WIN32
+#define PLATFORM_HAS_FD_PASSING 1
+#define SOCK_MAX_PASSED_FDS 253     // Per message (SCM_MAX_FD)
+
+// Listening socket at path, replacing any socket file already there
+sock_t unix_listen(const char *path);
+sock_t unix_connect(const char *path);
+
+// One message of len > 0 bytes carrying count descriptors. Returns 0 or -1.
+int sock_send_fds(sock_t sock, const void *data, size_t len, const sock_t *fds, int count);
+// Returns bytes received (0 at end of stream, -1 on error); descriptors
+// beyond max are closed. *count is how many landed in fds.
+int sock_recv_fds(sock_t sock, void *data, size_t len, sock_t *fds, int max, int *count);
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#include "rate_limit.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_LIMIT_WAYS 4
+#define MILLI 1000
+
+typedef struct {
+    uint64_t key;       // Hash of the client address, 0 while unused
+    rate_bucket_t bucket;
+} rate_slot_t;
+
+typedef struct {
+    rate_slot_t ways[RATE_LIMIT_WAYS];
+} __attribute__((aligned(64))) rate_set_t;
+
+struct rate_limiter {
+    void *mem;
+    rate_set_t *sets;   // mem aligned to a cache line
+    uint64_t mask;
+    uint64_t seed;      // Per process, so clients can't aim at one set
+};
+
+static uint64_t fnv1a(const char *data, size_t len, uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+int rate_bucket_take(rate_bucket_t *bucket, int rate, int burst, uint64_t now_ms) {
+    uint32_t now = (uint32_t)now_ms;
+    if (burst > RATE_LIMIT_MAX_BURST) burst = RATE_LIMIT_MAX_BURST;
+    uint64_t full = (uint64_t)burst * MILLI;
+    uint64_t old = atomic_get(&bucket->state);
+    while (1) {
+        // rate tokens per second is rate milli-tokens per ms
+        uint64_t tokens = full;
+        if (old != 0) tokens = (uint32_t)old + (uint64_t)(uint32_t)(now - (uint32_t)(old >> 32)) * rate;
+        if (tokens > full) tokens = full;
+        if (tokens < MILLI) return 0;
+        uint64_t state = (uint64_t)now << 32 | (tokens - MILLI);
+        if (atomic_cas(&bucket->state, &old, state)) return 1;
+    }
+}
+
+rate_limiter_t *rate_limiter_create(int slots) {
+    rate_limiter_t *limiter = calloc(1, sizeof(*limiter));
+    if (!limiter) return NULL;
+    uint64_t sets = 1;
+    while (sets * RATE_LIMIT_WAYS < (uint64_t)slots) sets <<= 1;
+    limiter->mem = calloc(sets + 1, sizeof(rate_set_t));
+    if (!limiter->mem) {
+        free(limiter);
+        return NULL;
+    }
+    uintptr_t p = ((uintptr_t)limiter->mem + sizeof(rate_set_t) - 1) & ~(uintptr_t)(sizeof(rate_set_t) - 1);
+    limiter->sets = (rate_set_t *)p;
+    limiter->mask = sets - 1;
+    limiter->seed = 1469598103934665603ull ^ time_now_us();
+    return limiter;
+}
+
+void rate_limiter_destroy(rate_limiter_t *limiter) {
+    if (!limiter) return;
+    free(limiter->mem);
+    free(limiter);
+}
+
+// The way holding key, claiming a free or the least recently drawn one
+static rate_slot_t *set_slot(rate_set_t *set, uint64_t key, uint32_t now) {
+    while (1) {
+        rate_slot_t *victim = NULL;
+        uint32_t victim_age = 0;
+        for (int i = 0; i < RATE_LIMIT_WAYS; i++) {
+            rate_slot_t *slot = &set->ways[i];
+            uint64_t k = atomic_get(&slot->key);
+            if (k == key) return slot;
+            uint32_t age = k ? now - (uint32_t)(atomic_get(&slot->bucket.state) >> 32) : UINT32_MAX;
+            if (!victim || age > victim_age) {
+                victim = slot;
+                victim_age = age;
+            }
+        }
+
+        uint64_t k = atomic_get(&victim->key);
+        if (k == key) return victim;
+        if (atomic_cas(&victim->key, &k, key)) {
+            atomic_set(&victim->bucket.state, 0);
+            return victim;
+        }
+        // Another worker claimed it first; it may have been for this key
+    }
+}
+
+int rate_limiter_take(rate_limiter_t *limiter, const char *key, size_t key_len, int rate, int burst, uint64_t now_ms) {
+    uint64_t h = fnv1a(key, key_len, limiter->seed) | 1;
+    rate_set_t *set = &limiter->sets[(h >> 32) & limiter->mask];
+    rate_slot_t *slot = set_slot(set, h, (uint32_t)now_ms);
+    return rate_bucket_take(&slot->bucket, rate, burst, now_ms);
+}
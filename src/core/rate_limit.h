@@ -0,0 +1,37 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include "platform.h"
+
+// Token buckets that any number of workers draw from without locks. A
+// bucket is one 64-bit word, the time it was last drawn from and the
+// tokens it held then, updated with a compare-and-swap; refills are
+// computed from the elapsed time, so idle buckets cost nothing.
+//
+// rate_limiter_t keys buckets by client address in a fixed table of
+// 4-way sets, each a cache line. A key that finds its set full takes over
+// the way drawn from longest ago (approximate LRU), so the table never
+// grows and a forgotten client simply starts again with a full bucket.
+// Two workers racing for a way may share one bucket for a moment; the
+// limits are approximate to that extent.
+
+#define RATE_LIMIT_DEFAULT_SLOTS 65536  // 1 MB of buckets
+#define RATE_LIMIT_MAX_BURST 1000000    // Its milli-tokens fit the 32 bits a bucket keeps
+
+typedef struct {
+    uint64_t state;     // Last draw in ms (high half), milli-tokens left then; 0 when fresh
+} rate_bucket_t;
+
+// Take a token from a bucket refilled at rate per second up to burst
+// (at most RATE_LIMIT_MAX_BURST). Returns 1, or 0 if it is empty.
+int rate_bucket_take(rate_bucket_t *bucket, int rate, int burst, uint64_t now_ms);
+
+typedef struct rate_limiter rate_limiter_t;
+
+rate_limiter_t *rate_limiter_create(int slots);
+void rate_limiter_destroy(rate_limiter_t *limiter);
+
+// rate_bucket_take() on key's bucket
+int rate_limiter_take(rate_limiter_t *limiter, const char *key, size_t key_len, int rate, int burst, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,49 @@
+#include "slab.h"
+#include <stdlib.h>
+
+// Free blocks store the list link in their first bytes
+typedef struct slab_block {
+    struct slab_block *next;
+} slab_block_t;
+
+void slab_init(slab_t *slab, size_t block_size, int max_free, uint64_t *heap_allocs) {
+    slab->block_size = block_size < sizeof(slab_block_t) ? sizeof(slab_block_t) : block_size;
+    slab->max_free = max_free;
+    slab->free_count = 0;
+    slab->free_list = NULL;
+    slab->heap_allocs = heap_allocs;
+}
+
+void slab_destroy(slab_t *slab) {
+    slab_block_t *b = slab->free_list;
+    while (b) {
+        slab_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    slab->free_list = NULL;
+    slab->free_count = 0;
+}
+
+void *slab_alloc(slab_t *slab) {
+    slab_block_t *b = slab->free_list;
+    if (b) {
+        slab->free_list = b->next;
+        slab->free_count--;
+        return b;
+    }
+    if (slab->heap_allocs) counter_add(slab->heap_allocs, 1);
+    return malloc(slab->block_size);
+}
+
+void slab_free(slab_t *slab, void *block) {
+    if (!block) return;
+    if (slab->free_count >= slab->max_free) {
+        free(block);
+        return;
+    }
+    slab_block_t *b = block;
+    b->next = slab->free_list;
+    slab->free_list = b;
+    slab->free_count++;
+}
@@ -0,0 +1,27 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "platform.h"
+
+// Free list of fixed-size blocks owned by one thread. Released blocks are
+// kept for the next slab_alloc() instead of going back to malloc, so a
+// worker in steady state stops touching the heap. The list is capped so a
+// burst of connections doesn't pin its peak memory forever. Not
+// thread-safe; each worker owns its own slabs.
+
+typedef struct {
+    size_t block_size;
+    int max_free;           // Blocks kept on the list, the rest are freed
+    int free_count;
+    void *free_list;
+    uint64_t *heap_allocs;  // Bumped (counter_add) on every malloc, may be NULL
+} slab_t;
+
+void slab_init(slab_t *slab, size_t block_size, int max_free, uint64_t *heap_allocs);
+void slab_destroy(slab_t *slab);
+
+// Contents are undefined, as with malloc
+void *slab_alloc(slab_t *slab);
+void slab_free(slab_t *slab, void *block);
+
+#endif
@@ -0,0 +1,126 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t tick_ms, uint64_t now) {
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->tick_ms = tick_ms ? tick_ms : 1;
+    wheel->current = now / wheel->tick_ms;
+    wheel->count = 0;
+}
+
+static void timer_push(timer_entry_t **head, timer_entry_t *timer) {
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+// The level is picked by distance from the current tick: a timer on level
+// L is at least TIMER_WHEEL_SLOTS^L ticks out, so its slot is only reached
+// once the levels below have gone round.
+static void timer_link(timer_wheel_t *wheel, timer_entry_t *timer) {
+    // Already overdue timers go in the tick being processed
+    uint64_t tick = timer->expires / wheel->tick_ms;
+    if (tick < wheel->current) tick = wheel->current;
+    if (tick - wheel->current >= WHEEL_SPAN) tick = wheel->current + WHEEL_SPAN - 1;
+
+    uint64_t delta = tick - wheel->current;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << ((level + 1) * TIMER_WHEEL_BITS)) level++;
+
+    timer_push(&wheel->slots[level][(tick >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK], timer);
+    wheel->count++;
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expires) {
+    if (timer_armed(timer)) timer_wheel_remove(wheel, timer);
+    timer->expires = expires;
+    timer_link(wheel, timer);
+}
+
+void timer_wheel_remove(timer_wheel_t *wheel, timer_entry_t *timer) {
+    if (!timer_armed(timer)) return;
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->count--;
+}
+
+// Spread one upper-level slot over the levels below
+static void timer_cascade(timer_wheel_t *wheel, int level) {
+    timer_entry_t **head = &wheel->slots[level][(wheel->current >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK];
+    timer_entry_t *timer = *head;
+    *head = NULL;
+    while (timer) {
+        timer_entry_t *next = timer->next;
+        wheel->count--;
+        timer_link(wheel, timer);
+        timer = next;
+    }
+}
+
+static void timer_run_tick(timer_wheel_t *wheel, uint64_t now) {
+    // Entering a new block of a level pulls its slot down, highest first
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((wheel->current & (((uint64_t)1 << (level * TIMER_WHEEL_BITS)) - 1)) == 0) {
+            timer_cascade(wheel, level);
+        }
+    }
+
+    // Due entries move to a list of their own before any of them fires: a
+    // callback may disarm others (closing a session closes its streams),
+    // which then simply drop off that list, and one it re-arms lands back
+    // on the wheel rather than being fired again this round
+    timer_entry_t *due = NULL;
+    timer_entry_t *timer = wheel->slots[0][wheel->current & SLOT_MASK];
+    while (timer) {
+        timer_entry_t *next = timer->next;
+        if (timer->expires <= now) {
+            timer_wheel_remove(wheel, timer);
+            timer_push(&due, timer);
+            wheel->count++;
+        }
+        timer = next;
+    }
+    while (due) {
+        timer = due;
+        timer_wheel_remove(wheel, timer);
+        timer->fn(timer);
+    }
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now) {
+    uint64_t target = now / wheel->tick_ms;
+
+    // The tick now falls in is revisited on the next call, for timers due
+    // later within it
+    while (wheel->count > 0) {
+        timer_run_tick(wheel, now);
+        if (wheel->current >= target) return;
+        wheel->current++;
+    }
+    if (wheel->current < target) wheel->current = target;
+}
+
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now, int max_ms) {
+    if (wheel->count == 0) return max_ms;
+    uint64_t current = wheel->current;
+    if (now / wheel->tick_ms > current) return 0;
+
+    // First occupied tick before the next cascade, which needs a wakeup of
+    // its own. Timers in the current tick are at most one tick away.
+    uint64_t wake = (current | SLOT_MASK) + 1;
+    for (uint64_t t = current; t < wake; t++) {
+        if (wheel->slots[0][t & SLOT_MASK]) {
+            wake = t > current ? t : t + 1;
+            break;
+        }
+    }
+    uint64_t at = wake * wheel->tick_ms;
+    if (at <= now) return 0;
+    return at - now < (uint64_t)max_ms ? (int)(at - now) : max_ms;
+}
@@ -0,0 +1,55 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timing wheel: O(1) add/remove, and advancing only touches
+// the slots that elapsed. Level 0 has one slot per tick; each level above
+// covers TIMER_WHEEL_SLOTS times the span of the one below, and its slots
+// are cascaded into the lower levels as time reaches them, so a timer is
+// moved at most once per level. Entries are intrusive, so arming a timer
+// never allocates. Deadlines past the top level's span park in its last
+// slot and are placed again when it comes up. Not thread-safe; each event
+// loop owns its own wheel.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)  // Per level
+#define TIMER_WHEEL_LEVELS 4                        // 2^24 ticks in all
+
+typedef struct timer_entry timer_entry_t;
+typedef void (*timer_fn)(timer_entry_t *timer);
+
+struct timer_entry {
+    uint64_t expires;       // Absolute ms
+    timer_fn fn;
+    void *data;
+    timer_entry_t *next;
+    timer_entry_t **pprev;  // NULL while not armed
+};
+
+typedef struct {
+    timer_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t tick_ms;
+    uint64_t current;       // Tick being processed; earlier ones are done
+    int count;
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t tick_ms, uint64_t now);
+
+// (Re)arm timer to fire at expires
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expires);
+void timer_wheel_remove(timer_wheel_t *wheel, timer_entry_t *timer);
+
+static inline int timer_armed(const timer_entry_t *timer) {
+    return timer->pprev != 0;
+}
+
+// Fire everything due at or before now. Callbacks may re-arm or free their
+// own entry, and disarm others.
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now);
+
+// How long an event loop may block before the wheel needs advancing:
+// until the next occupied tick, or the next cascade, capped at max_ms
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now, int max_ms);
+
+#endif
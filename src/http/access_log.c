@@ -0,0 +1,180 @@
+#include "access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH_SIZE (64 * 1024)
+#define RECORD_MAX 2048         // Worst case formatted record, escapes included
+
+typedef struct {
+    access_log_entry_t slots[ACCESS_LOG_RING_SIZE];
+    uint32_t head;              // Next slot the worker fills
+    char pad[64];               // Keep the two indexes on separate cache lines
+    uint32_t tail;              // Next slot the writer drains
+    uint64_t dropped;
+} access_log_ring_t;
+
+struct access_log {
+    FILE *out;
+    access_log_format_t format;
+    access_log_ring_t *rings;
+    int ring_count;
+    int stop;
+    thread_t thread;
+    uint64_t dropped_reported;
+    char batch[BATCH_SIZE];
+    size_t batch_len;
+};
+
+access_log_entry_t *access_log_reserve(access_log_t *log, int ring) {
+    access_log_ring_t *r = &log->rings[ring];
+    uint32_t head = r->head;
+    if (head - atomic_get(&r->tail) == ACCESS_LOG_RING_SIZE) {
+        atomic_add(&r->dropped, 1);
+        return NULL;
+    }
+    return &r->slots[head & (ACCESS_LOG_RING_SIZE - 1)];
+}
+
+void access_log_commit(access_log_t *log, int ring) {
+    access_log_ring_t *r = &log->rings[ring];
+    atomic_set(&r->head, r->head + 1);
+}
+
+int access_log_parse_format(const char *name, access_log_format_t *format) {
+    if (strcmp(name, "text") == 0) *format = ACCESS_LOG_TEXT;
+    else if (strcmp(name, "json") == 0) *format = ACCESS_LOG_JSON;
+    else return -1;
+    return 0;
+}
+
+static void batch_flush(access_log_t *log) {
+    if (log->batch_len == 0) return;
+    fwrite(log->batch, 1, log->batch_len, log->out);
+    log->batch_len = 0;
+}
+
+// JSON string body; the method and path come straight from clients
+static int json_escape(char *dst, size_t cap, const char *src) {
+    size_t n = 0;
+    for (; *src && n + 7 < cap; src++) {
+        unsigned char ch = (unsigned char)*src;
+        if (ch == '"' || ch == '\\') {
+            dst[n++] = '\\';
+            dst[n++] = (char)ch;
+        } else if (ch < 0x20 || ch == 0x7f) {
+            n += snprintf(dst + n, cap - n, "\\u%04x", ch);
+        } else {
+            dst[n++] = (char)ch;
+        }
+    }
+    dst[n] = '\0';
+    return (int)n;
+}
+
+static int format_record(const access_log_t *log, const access_log_entry_t *e, char *out) {
+    time_t t = (time_t)e->time;
+    struct tm tm;
+#ifdef _WIN32
+    tm = *gmtime(&t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+
+    char upstream[300] = "-";
+    if (e->upstream_host) snprintf(upstream, sizeof(upstream), "%s:%d", e->upstream_host, e->upstream_port);
+    double upstream_ms = e->upstream_us >= 0 ? e->upstream_us / 1000.0 : -1;
+    double total_ms = e->total_us / 1000.0;
+
+    if (log->format == ACCESS_LOG_JSON) {
+        char when[32], method[100], path[sizeof(e->path) * 6];
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        json_escape(method, sizeof(method), e->method);
+        json_escape(path, sizeof(path), e->path);
+        return snprintf(out, RECORD_MAX,
+                        "{\"time\":\"%s\",\"client\":\"%s\",\"method\":\"%s\",\"path\":\"%s\","
+                        "\"status\":%d,\"bytes\":%lld,\"upstream\":\"%s\",\"upstream_ms\":%.3f,"
+                        "\"total_ms\":%.3f,\"cache\":\"%s\"}\n",
+                        when, e->client_ip, method, path, e->status, (long long)e->bytes,
+                        upstream, upstream_ms, total_ms, e->cache ? e->cache : "-");
+    }
+
+    // Common log format first, then the proxy's own fields
+    char when[40];
+    strftime(when, sizeof(when), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+    return snprintf(out, RECORD_MAX, "%s - - [%s] \"%s %s\" %d %lld upstream=%s upstream_ms=%.3f total_ms=%.3f cache=%s\n",
+                    e->client_ip, when, e->method[0] ? e->method : "-", e->path[0] ? e->path : "-",
+                    e->status, (long long)e->bytes, upstream, upstream_ms, total_ms, e->cache ? e->cache : "-");
+}
+
+// Format everything published so far. Returns the number of records.
+static int drain(access_log_t *log) {
+    int drained = 0;
+    uint64_t dropped = 0;
+
+    for (int i = 0; i < log->ring_count; i++) {
+        access_log_ring_t *r = &log->rings[i];
+        uint32_t tail = r->tail;
+        uint32_t head = atomic_get(&r->head);
+
+        for (; tail != head; tail++) {
+            if (log->batch_len + RECORD_MAX > BATCH_SIZE) batch_flush(log);
+            int n = format_record(log, &r->slots[tail & (ACCESS_LOG_RING_SIZE - 1)], log->batch + log->batch_len);
+            if (n > 0) log->batch_len += n < RECORD_MAX ? (size_t)n : RECORD_MAX - 1;
+            drained++;
+        }
+        atomic_set(&r->tail, tail);
+        dropped += atomic_get(&r->dropped);
+    }
+
+    if (dropped != log->dropped_reported) {
+        printf("⚠️ Access log fell behind: %llu records dropped\n",
+               (unsigned long long)(dropped - log->dropped_reported));
+        log->dropped_reported = dropped;
+    }
+    if (drained) {
+        batch_flush(log);
+        fflush(log->out);
+    }
+    return drained;
+}
+
+static void writer_run(void *arg) {
+    access_log_t *log = arg;
+    while (!atomic_get(&log->stop)) {
+        if (drain(log) == 0) sleep_ms(ACCESS_LOG_FLUSH_MS);
+    }
+    drain(log);
+}
+
+access_log_t *access_log_open(const char *path, access_log_format_t format, int rings) {
+    access_log_t *log = calloc(1, sizeof(*log));
+    if (!log) return NULL;
+    log->rings = calloc(rings, sizeof(*log->rings));
+    log->out = strcmp(path, "-") == 0 ? stdout : fopen(path, "a");
+    if (!log->rings || !log->out) {
+        free(log->rings);
+        free(log);
+        return NULL;
+    }
+    log->format = format;
+    log->ring_count = rings;
+
+    if (thread_start(&log->thread, writer_run, log) != 0) {
+        if (log->out != stdout) fclose(log->out);
+        free(log->rings);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+void access_log_close(access_log_t *log) {
+    if (!log) return;
+    atomic_set(&log->stop, 1);
+    thread_join(log->thread);
+    if (log->out != stdout) fclose(log->out);
+    free(log->rings);
+    free(log);
+}
@@ -0,0 +1,48 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "../core/platform.h"
+
+// Structured access log kept off the request path. Each worker owns a
+// single-producer ring of fixed-size records; filling one is a few copies
+// and a release store. A writer thread drains every ring in batches,
+// formats the records and writes them with one fwrite per batch. When a
+// ring is full the record is dropped and counted rather than stalling the
+// worker.
+
+#define ACCESS_LOG_RING_SIZE 1024   // Records per worker, power of two
+#define ACCESS_LOG_FLUSH_MS 50      // Writer poll interval when idle
+
+typedef enum {
+    ACCESS_LOG_TEXT,
+    ACCESS_LOG_JSON
+} access_log_format_t;
+
+typedef struct {
+    int64_t time;               // Wall clock seconds at completion
+    char client_ip[46];
+    char method[16];
+    char path[256];             // Truncated request target
+    int status;
+    int64_t bytes;              // Body bytes sent to the client
+    int64_t upstream_us;        // Until backend headers arrived, -1 if not forwarded
+    int64_t total_us;           // From the parsed request head to the last byte
+    const char *upstream_host;  // Outlives the record by the reload grace period, or NULL
+    int upstream_port;
+    const char *cache;          // X-Cache status or NULL
+} access_log_entry_t;
+
+typedef struct access_log access_log_t;
+
+// path "-" writes to stdout. One ring per producer thread.
+access_log_t *access_log_open(const char *path, access_log_format_t format, int rings);
+void access_log_close(access_log_t *log);
+
+// Slot for the next record on ring, or NULL if the writer is behind.
+// Fill it in and publish it with access_log_commit.
+access_log_entry_t *access_log_reserve(access_log_t *log, int ring);
+void access_log_commit(access_log_t *log, int ring);
+
+int access_log_parse_format(const char *name, access_log_format_t *format);
+
+#endif
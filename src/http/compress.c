@@ -0,0 +1,322 @@
+#include "compress.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#define BROTLI_WINDOW_BITS 19   // 512 KB window: the per-stream memory is what scales with connections
+#endif
+
+struct compress_stream {
+    compress_coding_t coding;
+    int level;
+    int pending;
+    compress_stream_t *next;    // While idle in a pool
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_BROTLI
+    BrotliEncoderState *br;
+#endif
+};
+
+static const char *coding_names[COMPRESS_CODING_COUNT] = { "identity", "gzip", "deflate", "br" };
+
+static inline char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? (char)(ch + 32) : ch;
+}
+
+static int equals_nocase(const char *a, size_t len, const char *lit) {
+    size_t i = 0;
+    while (i < len && lit[i] && lower(a[i]) == lower(lit[i])) i++;
+    return i == len && lit[i] == '\0';
+}
+
+unsigned compress_available(void) {
+    unsigned bits = 0;
+#ifdef HAVE_ZLIB
+    bits |= COMPRESS_BIT(COMPRESS_GZIP) | COMPRESS_BIT(COMPRESS_DEFLATE);
+#endif
+#ifdef HAVE_BROTLI
+    bits |= COMPRESS_BIT(COMPRESS_BROTLI);
+#endif
+    return bits;
+}
+
+const char *compress_coding_name(compress_coding_t coding) {
+    return coding < COMPRESS_CODING_COUNT ? coding_names[coding] : "identity";
+}
+
+static int coding_from(const char *name, size_t len, compress_coding_t *out) {
+    for (int c = COMPRESS_GZIP; c < COMPRESS_CODING_COUNT; c++) {
+        if (equals_nocase(name, len, coding_names[c])) {
+            *out = (compress_coding_t)c;
+            return 0;
+        }
+    }
+    if (equals_nocase(name, len, "x-gzip")) {
+        *out = COMPRESS_GZIP;
+        return 0;
+    }
+    return -1;
+}
+
+int compress_parse_coding(const char *name, compress_coding_t *out) {
+    return coding_from(name, strlen(name), out);
+}
+
+int compress_parse_codings(const char *list, unsigned *out) {
+    unsigned bits = 0;
+    if (strcmp(list, "off") == 0) {
+        *out = 0;
+        return 0;
+    }
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *start = p;
+        while (*p && *p != ',' && *p != ' ') p++;
+        if (p == start) break;
+
+        compress_coding_t coding;
+        if (coding_from(start, p - start, &coding) != 0) return -1;
+        bits |= COMPRESS_BIT(coding);
+    }
+    *out = bits;
+    return 0;
+}
+
+// "q=0.5" as thousandths; anything unparsable counts as 1
+static int parse_qvalue(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (end - p < 2 || lower(p[0]) != 'q' || p[1] != '=') return 1000;
+    p += 2;
+    if (p >= end || (*p != '0' && *p != '1')) return 1000;
+    int q = (*p++ - '0') * 1000;
+    if (p < end && *p == '.') {
+        p++;
+        for (int scale = 100; scale > 0 && p < end && *p >= '0' && *p <= '9'; scale /= 10) q += (*p++ - '0') * scale;
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+compress_coding_t compress_negotiate(const char *buf, http_span_t accept, unsigned allowed) {
+    int q[COMPRESS_CODING_COUNT];
+    int any = -1;
+    for (int c = 0; c < COMPRESS_CODING_COUNT; c++) q[c] = -1;
+
+    const char *p = buf + accept.off;
+    const char *end = p + accept.len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *name = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t name_len = p - name;
+        const char *params = p;
+        while (p < end && *p != ',') p++;
+
+        int value = 1000;
+        for (const char *s = params; s < p; s++) {
+            if (*s == ';') value = parse_qvalue(s + 1, p);
+        }
+        compress_coding_t coding;
+        if (name_len == 1 && name[0] == '*') any = value;
+        else if (name_len > 0 && coding_from(name, name_len, &coding) == 0) q[coding] = value;
+    }
+
+    static const compress_coding_t preference[] = { COMPRESS_BROTLI, COMPRESS_GZIP, COMPRESS_DEFLATE };
+    compress_coding_t best = COMPRESS_NONE;
+    int best_q = 0;
+    allowed &= compress_available();
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        compress_coding_t c = preference[i];
+        int value = q[c] >= 0 ? q[c] : any;
+        if ((allowed & COMPRESS_BIT(c)) && value > best_q) {
+            best = c;
+            best_q = value;
+        }
+    }
+    return best;
+}
+
+static int type_listed(const char *type, size_t type_len, const char *types) {
+    const char *p = types;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *start = p;
+        while (*p && *p != ',') p++;
+        size_t len = p - start;
+        while (len > 0 && start[len - 1] == ' ') len--;
+
+        // "type/*" compares through the slash
+        int wildcard = len >= 2 && start[len - 2] == '/' && start[len - 1] == '*';
+        size_t cmp = wildcard ? len - 1 : len;
+        if (len > 0 && (wildcard ? type_len > cmp : type_len == cmp)) {
+            size_t i = 0;
+            while (i < cmp && lower(type[i]) == lower(start[i])) i++;
+            if (i == cmp) return 1;
+        }
+    }
+    return 0;
+}
+
+int compress_response_eligible(const http_message_t *resp, const char *buf, const char *types) {
+    if (resp->status == 206) return 0;
+
+    const http_header_t *h = http_message_header(resp, HTTP_HDR_CONTENT_ENCODING);
+    if (h && !http_span_equals(buf, h->value, "identity")) return 0;
+    h = http_message_header(resp, HTTP_HDR_CACHE_CONTROL);
+    if (h && http_value_has_token(buf, h->value, "no-transform")) return 0;
+
+    h = http_message_header(resp, HTTP_HDR_CONTENT_TYPE);
+    if (!h) return 0;
+    const char *type = buf + h->value.off;
+    size_t len = 0;
+    while (len < h->value.len && type[len] != ';' && type[len] != ' ' && type[len] != '\t') len++;
+    return type_listed(type, len, types);
+}
+
+static compress_stream_t *stream_create(compress_coding_t coding, int level) {
+    if (!(compress_available() & COMPRESS_BIT(coding))) return NULL;
+    compress_stream_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->coding = coding;
+    s->level = level;
+
+#ifdef HAVE_ZLIB
+    if (coding == COMPRESS_GZIP || coding == COMPRESS_DEFLATE) {
+        // +16 writes the gzip wrapper; plain 15 the zlib one HTTP calls deflate
+        int bits = coding == COMPRESS_GZIP ? 15 + 16 : 15;
+        if (deflateInit2(&s->z, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(s);
+            return NULL;
+        }
+    }
+#endif
+#ifdef HAVE_BROTLI
+    if (coding == COMPRESS_BROTLI) {
+        s->br = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (!s->br) {
+            free(s);
+            return NULL;
+        }
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_QUALITY, (uint32_t)level);
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_LGWIN, BROTLI_WINDOW_BITS);
+    }
+#endif
+    return s;
+}
+
+static void stream_free(compress_stream_t *s) {
+#ifdef HAVE_ZLIB
+    if (s->coding == COMPRESS_GZIP || s->coding == COMPRESS_DEFLATE) deflateEnd(&s->z);
+#endif
+#ifdef HAVE_BROTLI
+    if (s->coding == COMPRESS_BROTLI) BrotliEncoderDestroyInstance(s->br);
+#endif
+    free(s);
+}
+
+compress_stream_t *compress_stream_get(compress_pool_t *pool, compress_coding_t coding, int level) {
+    compress_stream_t **pp = &pool->idle;
+    while (*pp) {
+        compress_stream_t *s = *pp;
+        if (s->coding == coding && s->level == level) {
+            *pp = s->next;
+            s->next = NULL;
+            pool->count--;
+            return s;
+        }
+        pp = &s->next;
+    }
+    return stream_create(coding, level);
+}
+
+// zlib streams are reset and kept; brotli has no reset, so its state goes
+void compress_stream_put(compress_pool_t *pool, compress_stream_t *s) {
+    if (!s) return;
+#ifdef HAVE_ZLIB
+    if ((s->coding == COMPRESS_GZIP || s->coding == COMPRESS_DEFLATE) && pool->count < COMPRESS_POOL_SIZE &&
+        deflateReset(&s->z) == Z_OK) {
+        s->pending = 0;
+        s->next = pool->idle;
+        pool->idle = s;
+        pool->count++;
+        return;
+    }
+#else
+    (void)pool;
+#endif
+    stream_free(s);
+}
+
+void compress_pool_clear(compress_pool_t *pool) {
+    while (pool->idle) {
+        compress_stream_t *s = pool->idle;
+        pool->idle = s->next;
+        stream_free(s);
+    }
+    pool->count = 0;
+}
+
+int compress_stream_run(compress_stream_t *s, compress_op_t op, const char *in, size_t *in_len,
+                        char *out, size_t out_cap) {
+#ifdef HAVE_ZLIB
+    if (s->coding == COMPRESS_GZIP || s->coding == COMPRESS_DEFLATE) {
+        static const int flush[] = { Z_NO_FLUSH, Z_SYNC_FLUSH, Z_FINISH };
+        s->z.next_in = (Bytef *)in;
+        s->z.avail_in = (uInt)*in_len;
+        s->z.next_out = (Bytef *)out;
+        s->z.avail_out = (uInt)out_cap;
+        int r = deflate(&s->z, flush[op]);
+        if (r == Z_STREAM_ERROR) return -1;
+        *in_len -= s->z.avail_in;
+        // A flush is only done once it leaves output space unused
+        s->pending = s->z.avail_in > 0 || (op == COMPRESS_FLUSH && s->z.avail_out == 0) ||
+                     (op == COMPRESS_FINISH && r != Z_STREAM_END);
+        return (int)(out_cap - s->z.avail_out);
+    }
+#endif
+#ifdef HAVE_BROTLI
+    if (s->coding == COMPRESS_BROTLI) {
+        static const BrotliEncoderOperation ops[] = {
+            BROTLI_OPERATION_PROCESS, BROTLI_OPERATION_FLUSH, BROTLI_OPERATION_FINISH
+        };
+        size_t avail_in = *in_len, avail_out = out_cap;
+        const uint8_t *next_in = (const uint8_t *)in;
+        uint8_t *next_out = (uint8_t *)out;
+        if (!BrotliEncoderCompressStream(s->br, ops[op], &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+            return -1;
+        }
+        *in_len -= avail_in;
+        s->pending = avail_in > 0 || BrotliEncoderHasMoreOutput(s->br) ||
+                     (op == COMPRESS_FINISH && !BrotliEncoderIsFinished(s->br));
+        return (int)(out_cap - avail_out);
+    }
+#endif
+    (void)s;
+    (void)op;
+    (void)in;
+    (void)in_len;
+    (void)out;
+    (void)out_cap;
+    return -1;
+}
+
+int compress_stream_pending(const compress_stream_t *s) {
+    return s->pending;
+}
+
+long compress_buffer(compress_coding_t coding, int level, const char *in, size_t len, char *out, size_t out_cap) {
+    compress_stream_t *s = stream_create(coding, level);
+    if (!s) return -1;
+    size_t in_len = len;
+    int n = compress_stream_run(s, COMPRESS_FINISH, in, &in_len, out, out_cap);
+    if (s->pending) n = -1;
+    stream_free(s);
+    return n;
+}
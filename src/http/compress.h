@@ -0,0 +1,83 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "http_parser.h"
+#include <stddef.h>
+
+// Response content codings. gzip and deflate come from zlib (built with
+// HAVE_ZLIB), br from the brotli encoder (HAVE_BROTLI); a coding that was
+// not built in is never negotiated, so without either library responses
+// simply pass through as the backend sent them.
+//
+// Encoders are incremental: body bytes are compressed as they are relayed,
+// into a bounded output buffer, and the stream can be flushed whenever the
+// backend goes quiet so a slow response still reaches the client promptly.
+
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_DEFLATE,
+    COMPRESS_BROTLI,
+    COMPRESS_CODING_COUNT
+} compress_coding_t;
+
+#define COMPRESS_BIT(coding) (1u << (coding))
+#define COMPRESS_MIN_LEVEL 1
+#define COMPRESS_MAX_LEVEL 9
+#define COMPRESS_POOL_SIZE 16   // Idle encoders kept per pool
+
+typedef enum {
+    COMPRESS_PROCESS,   // Consume input, emit whatever output is ready
+    COMPRESS_FLUSH,     // Also emit everything consumed so far
+    COMPRESS_FINISH     // End the stream after the input
+} compress_op_t;
+
+typedef struct compress_stream compress_stream_t;
+
+// Idle encoders for reuse: setting up a zlib stream allocates a few
+// hundred KB. Not thread-safe; each worker keeps its own.
+typedef struct {
+    compress_stream_t *idle;
+    int count;
+} compress_pool_t;
+
+// COMPRESS_BIT per coding this build can produce
+unsigned compress_available(void);
+
+const char *compress_coding_name(compress_coding_t coding);
+
+// "br", "gzip" or "deflate"; -1 if unknown. Codings that are not built in
+// parse, so one configuration serves every build, and are never offered.
+int compress_parse_coding(const char *name, compress_coding_t *out);
+
+// Comma separated codings as COMPRESS_BIT flags, or "off"
+int compress_parse_codings(const char *list, unsigned *out);
+
+// Best of the allowed codings the client's Accept-Encoding value takes,
+// preferring br, then gzip, then deflate. q=0 refuses a coding, and "*"
+// stands for any not listed.
+compress_coding_t compress_negotiate(const char *buf, http_span_t accept, unsigned allowed);
+
+// True if a response may be re-encoded: it has no Content-Encoding, isn't
+// a 206 part, doesn't forbid transformation, and its Content-Type is in
+// types (comma separated; "text/*" matches a whole type).
+int compress_response_eligible(const http_message_t *resp, const char *buf, const char *types);
+
+compress_stream_t *compress_stream_get(compress_pool_t *pool, compress_coding_t coding, int level);
+void compress_stream_put(compress_pool_t *pool, compress_stream_t *stream);
+void compress_pool_clear(compress_pool_t *pool);
+
+// Run op over *in_len bytes of in, writing at most out_cap bytes to out.
+// Sets *in_len to the input consumed and returns the bytes written, or -1
+// on error. Until compress_stream_pending() is false, the op (FLUSH and
+// FINISH included) isn't complete: call again with a drained out and the
+// unconsumed input.
+int compress_stream_run(compress_stream_t *stream, compress_op_t op, const char *in, size_t *in_len,
+                        char *out, size_t out_cap);
+int compress_stream_pending(const compress_stream_t *stream);
+
+// Compress len bytes of in in one go. Returns the output length, or -1
+// if it doesn't fit in out_cap.
+long compress_buffer(compress_coding_t coding, int level, const char *in, size_t len, char *out, size_t out_cap);
+
+#endif
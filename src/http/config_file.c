@@ -0,0 +1,340 @@
+#include "config_file.h"
+#include "compress.h"
+#include "../core/json.h"
+#include "../core/rate_limit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char *err;
+    size_t err_len;
+    const char *section;    // Object being read, for messages
+} loader_t;
+
+static int invalid(loader_t *l, const char *key, const char *what) {
+    snprintf(l->err, l->err_len, "%s%s%s: %s", l->section, l->section[0] ? "." : "", key, what);
+    return -1;
+}
+
+// Each getter leaves *out alone when the key is absent
+static int get_number(loader_t *l, const json_value_t *obj, const char *key, double min, double max, double *out) {
+    const json_value_t *v = json_get(obj, key);
+    if (!v) return 0;
+    if (v->type != JSON_NUMBER) return invalid(l, key, "expected a number");
+    if (v->number < min || v->number > max || v->number != (double)(long long)v->number) {
+        return invalid(l, key, "out of range");
+    }
+    *out = v->number;
+    return 0;
+}
+
+static int get_int(loader_t *l, const json_value_t *obj, const char *key, int min, int max, int *out) {
+    double d = *out;
+    if (get_number(l, obj, key, min, max, &d) != 0) return -1;
+    *out = (int)d;
+    return 0;
+}
+
+static int get_size(loader_t *l, const json_value_t *obj, const char *key, double max, uint64_t *out) {
+    double d = (double)*out;
+    if (get_number(l, obj, key, 0, max, &d) != 0) return -1;
+    *out = (uint64_t)d;
+    return 0;
+}
+
+static int get_bool(loader_t *l, const json_value_t *obj, const char *key, int *out) {
+    const json_value_t *v = json_get(obj, key);
+    if (!v) return 0;
+    if (v->type != JSON_BOOL) return invalid(l, key, "expected true or false");
+    *out = v->boolean;
+    return 0;
+}
+
+static int get_string(loader_t *l, const json_value_t *obj, const char *key, const char **out) {
+    const json_value_t *v = json_get(obj, key);
+    if (!v) return 0;
+    if (v->type != JSON_STRING) return invalid(l, key, "expected a string");
+    *out = v->string;
+    return 0;
+}
+
+static int get_object(loader_t *l, const json_value_t *obj, const char *key, const json_value_t **out) {
+    const json_value_t *v = json_get(obj, key);
+    *out = NULL;
+    if (!v) return 0;
+    if (v->type != JSON_OBJECT) return invalid(l, key, "expected an object");
+    *out = v;
+    return 0;
+}
+
+static int load_upstream(loader_t *l, const json_value_t *obj, upstream_group_t *upstream) {
+    const char *s = NULL;
+    const json_value_t *health;
+    l->section = "upstream";
+
+    if (get_string(l, obj, "name", &s) != 0) return -1;
+    if (s) snprintf(upstream->name, sizeof(upstream->name), "%s", s);
+    s = NULL;
+    if (get_string(l, obj, "algorithm", &s) != 0) return -1;
+    if (s && upstream_parse_algorithm(s, &upstream->algorithm) != 0) return invalid(l, "algorithm", "unknown");
+    s = NULL;
+    if (get_string(l, obj, "hash_key", &s) != 0) return -1;
+    if (s && upstream_parse_hash_key(s, &upstream->hash_key) != 0) return invalid(l, "hash_key", "expected ip or uri");
+
+    const json_value_t *backends = json_get(obj, "backends");
+    if (backends) {
+        if (backends->type != JSON_ARRAY) return invalid(l, "backends", "expected an array");
+        for (int i = 0; i < backends->count; i++) {
+            const json_value_t *b = &backends->items[i];
+            if (b->type != JSON_STRING || upstream_group_add(upstream, b->string) != 0) {
+                return invalid(l, "backends", "expected \"host:port[,weight=N]\" entries");
+            }
+        }
+    }
+
+    if (get_object(l, obj, "health", &health) != 0) return -1;
+    if (health) {
+        health_config_t *hc = &upstream->health_config;
+        l->section = "upstream.health";
+        s = NULL;
+        if (get_int(l, health, "interval_ms", 0, 3600000, &hc->interval_ms) != 0 ||
+            get_int(l, health, "timeout_ms", 1, 600000, &hc->timeout_ms) != 0 ||
+            get_int(l, health, "fails", 1, 1000, &hc->fall) != 0 ||
+            get_int(l, health, "rises", 1, 1000, &hc->rise) != 0 ||
+            get_int(l, health, "cooldown_ms", 0, 3600000, &hc->cooldown_ms) != 0 ||
+            get_string(l, health, "path", &s) != 0) return -1;
+        if (s) {
+            if (strlen(s) >= sizeof(hc->path)) return invalid(l, "path", "too long");
+            snprintf(hc->path, sizeof(hc->path), "%s", s);
+        }
+    }
+    return 0;
+}
+
+// A list of strings such as ["br", "gzip"], or null for none; each item
+// goes to add, which rejects it by returning non-zero
+static int get_list(loader_t *l, const json_value_t *obj, const char *key,
+                    int (*add)(const char *item, void *arg), void *arg, int *present) {
+    const json_value_t *v = json_get(obj, key);
+    *present = v != NULL;
+    if (!v || v->type == JSON_NULL) return 0;
+    if (v->type != JSON_ARRAY) return invalid(l, key, "expected an array of strings");
+    for (int i = 0; i < v->count; i++) {
+        const json_value_t *item = &v->items[i];
+        if (item->type != JSON_STRING) return invalid(l, key, "expected an array of strings");
+        if (add(item->string, arg) != 0) {
+            char what[96];
+            snprintf(what, sizeof(what), "\"%.64s\" not supported here", item->string);
+            return invalid(l, key, what);
+        }
+    }
+    return 0;
+}
+
+static int add_coding(const char *name, void *arg) {
+    compress_coding_t coding;
+    if (compress_parse_coding(name, &coding) != 0) return -1;
+    *(unsigned *)arg |= COMPRESS_BIT(coding);
+    return 0;
+}
+
+// Appends to a comma separated list in a fixed buffer
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+} joined_t;
+
+static int add_joined(const char *item, void *arg) {
+    joined_t *j = arg;
+    int n = snprintf(j->buf + j->len, j->cap - j->len, "%s%s", j->len ? "," : "", item);
+    if (n < 0 || (size_t)n >= j->cap - j->len) return -1;
+    j->len += n;
+    return 0;
+}
+
+static int load_compression(loader_t *l, const json_value_t *obj, http_server_config_t *config) {
+    unsigned codings = 0;
+    char types[sizeof(config->compress_types)] = "";
+    joined_t joined = { types, sizeof(types), 0 };
+    int present;
+    l->section = "compression";
+
+    if (get_list(l, obj, "codings", add_coding, &codings, &present) != 0) return -1;
+    if (present) config->compress_codings = codings;
+    if (get_list(l, obj, "types", add_joined, &joined, &present) != 0) return -1;
+    if (present) memcpy(config->compress_types, types, sizeof(types));
+    if (get_int(l, obj, "level", COMPRESS_MIN_LEVEL, COMPRESS_MAX_LEVEL, &config->compress_level) != 0 ||
+        get_int(l, obj, "cache_level", COMPRESS_MIN_LEVEL, COMPRESS_MAX_LEVEL, &config->compress_cache_level) != 0 ||
+        get_int(l, obj, "min_size", 0, 1 << 30, &config->compress_min_size) != 0) return -1;
+    return 0;
+}
+
+
+static int load_tls(loader_t *l, const json_value_t *obj, http_server_config_t *config) {
+    l->section = "tls";
+    const json_value_t *certs = json_get(obj, "certificates");
+    if (certs) {
+        if (certs->type != JSON_ARRAY) return invalid(l, "certificates", "expected an array");
+        if (certs->count > TLS_MAX_CERTS) return invalid(l, "certificates", "too many");
+        for (int i = 0; i < certs->count; i++) {
+            const json_value_t *cert = json_get(&certs->items[i], "cert");
+            const json_value_t *key = json_get(&certs->items[i], "key");
+            if (!cert || cert->type != JSON_STRING || !key || key->type != JSON_STRING) {
+                return invalid(l, "certificates", "expected {\"cert\": PATH, \"key\": PATH} entries");
+            }
+            // Strings handed out in config outlive the parsed document
+            config->tls_certs[i].cert_file = http_server_config_keep(config, cert->string);
+            config->tls_certs[i].key_file = http_server_config_keep(config, key->string);
+        }
+        config->tls_cert_count = certs->count;
+    }
+    if (get_int(l, obj, "session_timeout", 0, 7 * 86400, &config->tls_session_timeout) != 0 ||
+        get_bool(l, obj, "ktls", &config->tls_ktls) != 0) return -1;
+    return 0;
+}
+
+static int load(loader_t *l, const json_value_t *root, http_server_config_t *config, upstream_group_t *upstream) {
+    const json_value_t *section;
+    const char *s = NULL;
+
+    l->section = "";
+    if (root->type != JSON_OBJECT) return invalid(l, "(top level)", "expected an object");
+    if (get_int(l, root, "listen_port", 1, 65535, &config->listen_port) != 0 ||
+        get_int(l, root, "admin_port", 0, 65535, &config->admin_port) != 0 ||
+        get_int(l, root, "max_keep_alive_requests", 1, 1000000000, &config->max_keep_alive_requests) != 0 ||
+        get_bool(l, root, "splice", &config->splice) != 0 ||
+        get_int(l, root, "drain_timeout_ms", 0, 86400000, &config->drain_timeout_ms) != 0 ||
+        get_string(l, root, "io_engine", &s) != 0) return -1;
+    if (s && event_engine_parse(s, &config->io_engine) != 0) return invalid(l, "io_engine", "unknown engine");
+    s = NULL;
+    if (get_string(l, root, "upgrade_socket", &s) != 0) return -1;
+    if (s) config->upgrade_socket = http_server_config_keep(config, s);
+
+    if (get_object(l, root, "upstream", &section) != 0) return -1;
+    if (section && load_upstream(l, section, upstream) != 0) return -1;
+    l->section = "";
+    if (!json_get(section, "backends") && json_get(root, "target_host")) {
+        // Original format: one backend
+        const char *host = NULL;
+        int port = 80;
+        if (get_string(l, root, "target_host", &host) != 0 ||
+            get_int(l, root, "target_port", 1, 65535, &port) != 0) return -1;
+        char spec[300];
+        snprintf(spec, sizeof(spec), "%s:%d", host, port);
+        if (upstream_group_add(upstream, spec) != 0) return invalid(l, "target_host", "invalid backend");
+    }
+
+    if (get_object(l, root, "pool", &section) != 0) return -1;
+    l->section = "pool";
+    if (section && (get_int(l, section, "max_idle", 0, 100000, &config->pool_max_idle) != 0 ||
+                    get_int(l, section, "idle_timeout_ms", 1, 86400000, &config->pool_idle_timeout_ms) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "timeouts", &section) != 0) return -1;
+    l->section = "timeouts";
+    if (section && (get_int(l, section, "request_ms", 1, 86400000, &config->request_timeout_ms) != 0 ||
+                    get_int(l, section, "body_ms", 1, 86400000, &config->body_timeout_ms) != 0 ||
+                    get_int(l, section, "keep_alive_ms", 1, 86400000, &config->keep_alive_timeout_ms) != 0 ||
+                    get_int(l, section, "connect_ms", 1, 86400000, &config->connect_timeout_ms) != 0 ||
+                    get_int(l, section, "response_ms", 1, 86400000, &config->response_timeout_ms) != 0 ||
+                    get_int(l, section, "send_ms", 1, 86400000, &config->send_timeout_ms) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "buffers", &section) != 0) return -1;
+    l->section = "buffers";
+    if (section && (get_int(l, section, "io_buffer_size", HTTP_MIN_IO_BUFFER_SIZE, HTTP_MAX_IO_BUFFER_SIZE,
+                            &config->io_buffer_size) != 0 ||
+                    get_int(l, section, "max_request_header_size", 1024, 16 << 20,
+                            &config->max_request_header_size) != 0 ||
+                    get_int(l, section, "max_response_header_size", 1024, 16 << 20,
+                            &config->max_response_header_size) != 0 ||
+                    get_size(l, section, "max_body_size", 1e15, &config->max_body_size) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "cache", &section) != 0) return -1;
+    l->section = "cache";
+    if (section) {
+        uint64_t size_mb = config->cache_size >> 20, max_entry_kb = config->cache_max_entry >> 10;
+        if (get_size(l, section, "size_mb", 1 << 20, &size_mb) != 0 ||
+            get_size(l, section, "max_entry_kb", 1 << 20, &max_entry_kb) != 0) return -1;
+        if (max_entry_kb == 0) return invalid(l, "max_entry_kb", "must be positive");
+        config->cache_size = (size_t)size_mb << 20;
+        config->cache_max_entry = (size_t)max_entry_kb << 10;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "tls", &section) != 0) return -1;
+    if (section && load_tls(l, section, config) != 0) return -1;
+
+    l->section = "";
+    if (get_object(l, root, "http2", &section) != 0) return -1;
+    l->section = "http2";
+    if (section && (get_bool(l, section, "enabled", &config->http2) != 0 ||
+                    get_int(l, section, "max_concurrent_streams", 1, 65536, &config->http2_max_streams) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "rate_limit", &section) != 0) return -1;
+    l->section = "rate_limit";
+    if (section && (get_int(l, section, "client_rps", 0, 1000000, &config->rate_limit_client_rps) != 0 ||
+                    get_int(l, section, "client_burst", 1, RATE_LIMIT_MAX_BURST, &config->rate_limit_client_burst) != 0 ||
+                    get_int(l, section, "global_rps", 0, 1000000, &config->rate_limit_global_rps) != 0 ||
+                    get_int(l, section, "global_burst", 1, RATE_LIMIT_MAX_BURST, &config->rate_limit_global_burst) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "admission", &section) != 0) return -1;
+    l->section = "admission";
+    if (section && (get_int(l, section, "max_connections", 0, 10000000, &config->max_connections) != 0 ||
+                    get_int(l, section, "shed_lag_ms", 0, 60000, &config->shed_lag_ms) != 0)) {
+        return -1;
+    }
+
+    l->section = "";
+    if (get_object(l, root, "compression", &section) != 0) return -1;
+    if (section && load_compression(l, section, config) != 0) return -1;
+
+    l->section = "";
+    section = json_get(root, "access_log");
+    if (section && section->type != JSON_OBJECT) return invalid(l, "access_log", "expected an object");
+    l->section = "access_log";
+    if (section) {
+        const json_value_t *path = json_get(section, "path");
+        if (path && path->type == JSON_NULL) config->access_log = NULL;
+        else if (path && path->type == JSON_STRING) config->access_log = http_server_config_keep(config, path->string);
+        else if (path) return invalid(l, "path", "expected a string or null");
+        s = NULL;
+        if (get_string(l, section, "format", &s) != 0) return -1;
+        if (s && access_log_parse_format(s, &config->access_log_format) != 0) {
+            return invalid(l, "format", "expected text or json");
+        }
+    }
+    return 0;
+}
+
+int config_file_load(const char *path, http_server_config_t *config, upstream_group_t *upstream,
+                     char *err, size_t err_len) {
+    char parse_err[128];
+    json_value_t *root = json_parse_file(path, parse_err, sizeof(parse_err));
+    if (!root) {
+        snprintf(err, err_len, "%s: %s", path, parse_err);
+        return -1;
+    }
+
+    char why[256];
+    loader_t l = { why, sizeof(why), "" };
+    int r = load(&l, root, config, upstream);
+    if (r != 0) snprintf(err, err_len, "%s: %s", path, why);
+    json_free(root);
+    return r;
+}
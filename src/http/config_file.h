@@ -0,0 +1,38 @@
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+#include "http_server.h"
+
+// JSON configuration file (config/config.json). Every key is optional and
+// absent ones keep whatever config and upstream already hold, so callers
+// start from http_server_config_defaults(), load the file and then apply
+// command-line overrides. Sizes are in bytes unless the key says otherwise.
+//
+//   listen_port, admin_port, io_engine ("epoll", "io_uring", ...)
+//   upstream: { name, algorithm, hash_key, backends: ["host:port[,weight=N]"],
+//               health: { interval_ms, path, timeout_ms, fails, rises, cooldown_ms } }
+//   pool: { max_idle, idle_timeout_ms }
+//   timeouts: { request_ms, body_ms, keep_alive_ms, connect_ms, response_ms, send_ms }
+//   max_keep_alive_requests
+//   buffers: { io_buffer_size, max_request_header_size, max_response_header_size, max_body_size }
+//   splice (boolean)
+//   upgrade_socket (path), drain_timeout_ms
+//   tls: { certificates: [{ cert, key }] (first is the default), session_timeout (seconds),
+//          ktls (boolean) }
+//   http2: { enabled, max_concurrent_streams }
+//   rate_limit: { client_rps, client_burst, global_rps, global_burst } (rps 0 disables)
+//   admission: { max_connections, shed_lag_ms } (0 disables)
+//   cache: { size_mb, max_entry_kb }
+//   compression: { codings: ["br", "gzip", "deflate"] ([] disables), level, cache_level,
+//                  min_size, types: ["text/*", "application/json", ...] }
+//   access_log: { path (null disables), format ("text" or "json") }
+//
+// target_host and target_port, from the original single-backend format,
+// still add one backend when there is no upstream.backends list.
+
+// Returns 0, or -1 with the reason in err. Strings in config point into
+// storage owned by this module that stays valid for the process lifetime.
+int config_file_load(const char *path, http_server_config_t *config, upstream_group_t *upstream,
+                     char *err, size_t err_len);
+
+#endif
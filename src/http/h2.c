@@ -0,0 +1,305 @@
+#include "h2.h"
+#include "../core/platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define H2_NAME_MAX 256     // Longer response field names are dropped
+
+enum {
+    PSEUDO_METHOD = 1,
+    PSEUDO_SCHEME = 2,
+    PSEUDO_AUTHORITY = 4,
+    PSEUDO_PATH = 8
+};
+
+void h2_frame_read(h2_frame_t *frame, const uint8_t *p) {
+    frame->length = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    frame->type = p[3];
+    frame->flags = p[4];
+    frame->stream_id = h2_get32(p + 5) & 0x7fffffff;
+}
+
+void h2_frame_write(uint8_t *p, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id) {
+    p[0] = (uint8_t)(length >> 16);
+    p[1] = (uint8_t)(length >> 8);
+    p[2] = (uint8_t)length;
+    p[3] = type;
+    p[4] = flags;
+    h2_put32(p + 5, stream_id);
+}
+
+int h2_preface_match(const char *buf, size_t len) {
+    size_t n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+    if (memcmp(buf, H2_PREFACE, n) != 0) return -1;
+    return n == H2_PREFACE_LEN ? 1 : 0;
+}
+
+int h2_parse_urgency(const char *value, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        if (len - i >= 3 && value[i] == 'u' && value[i + 1] == '=' && value[i + 2] >= '0' && value[i + 2] <= '7' &&
+            (len - i == 3 || value[i + 3] == ',' || value[i + 3] == ' ' || value[i + 3] == ';')) {
+            return value[i + 2] - '0';
+        }
+        while (i < len && value[i] != ',') i++;
+    }
+    return H2_DEFAULT_URGENCY;
+}
+
+static int equals(const char *s, size_t len, const char *lit) {
+    return strlen(lit) == len && memcmp(s, lit, len) == 0;
+}
+
+static int iequals(const char *s, size_t len, const char *lit) {
+    if (strlen(lit) != len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char ch = (s[i] >= 'A' && s[i] <= 'Z') ? (char)(s[i] + 32) : s[i];
+        if (ch != lit[i]) return 0;
+    }
+    return 1;
+}
+
+// Field names are lowercase tokens in HTTP/2
+static int valid_name(const char *name, size_t len) {
+    if (len == 0) return 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)name[i];
+        if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')) continue;
+        if (!strchr("!#$%&'*+-.^_`|~", ch) || ch == '\0') return 0;
+    }
+    return 1;
+}
+
+// No NUL, CR or LF, which would split the HTTP/1.1 line, and no
+// surrounding whitespace
+static int valid_value(const char *value, size_t len) {
+    if (len > 0 && (value[0] == ' ' || value[0] == '\t' || value[len - 1] == ' ' || value[len - 1] == '\t')) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] == '\0' || value[i] == '\r' || value[i] == '\n') return 0;
+    }
+    return 1;
+}
+
+// Request line parts can't hold spaces or controls
+static int valid_token(const char *s, size_t len) {
+    if (len == 0) return 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch <= ' ' || ch == 0x7f) return 0;
+    }
+    return 1;
+}
+
+static void fail(h2_request_t *r, h2_request_status_t status) {
+    if (r->status == H2_REQUEST_OK) r->status = status;
+}
+
+static int reserve(h2_request_t *r, size_t len) {
+    if (r->status != H2_REQUEST_OK) return -1;
+    if (r->len + len <= r->cap) return 0;
+    if (r->len + len > r->max) {
+        fail(r, H2_REQUEST_TOO_LARGE);
+        return -1;
+    }
+    size_t cap = r->cap * 2;
+    if (cap < r->len + len) cap = r->len + len;
+    if (cap > r->max) cap = r->max;
+    if (r->heap_allocs) counter_add(r->heap_allocs, 1);
+    char *buf = realloc(r->buf, cap);
+    if (!buf) {
+        fail(r, H2_REQUEST_TOO_LARGE);
+        return -1;
+    }
+    r->buf = buf;
+    r->cap = cap;
+    return 0;
+}
+
+static void append(h2_request_t *r, const char *data, size_t len) {
+    if (reserve(r, len) != 0) return;
+    memcpy(r->buf + r->len, data, len);
+    r->len += len;
+}
+
+static void append_line(h2_request_t *r, const char *name, size_t name_len, const char *value, size_t value_len) {
+    append(r, name, name_len);
+    append(r, ": ", 2);
+    append(r, value, value_len);
+    append(r, "\r\n", 2);
+}
+
+static const char *pseudo(const h2_request_t *r, http_span_t span) {
+    return r->pseudo + span.off;
+}
+
+// Once the first regular field arrives, or at the end of the block
+static void write_request_line(h2_request_t *r, unsigned seen) {
+    r->line_done = 1;
+    if ((seen & (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH)) != (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH) ||
+        !valid_token(pseudo(r, r->method), r->method.len) || !valid_token(pseudo(r, r->path), r->path.len) ||
+        equals(pseudo(r, r->method), r->method.len, "CONNECT")) {
+        fail(r, H2_REQUEST_MALFORMED);
+        return;
+    }
+    append(r, pseudo(r, r->method), r->method.len);
+    append(r, " ", 1);
+    append(r, pseudo(r, r->path), r->path.len);
+    append(r, " HTTP/1.1\r\n", 11);
+    if (r->authority.len > 0) {
+        append_line(r, "host", 4, pseudo(r, r->authority), r->authority.len);
+        r->has_host = 1;
+    }
+}
+
+// Crumbs after the first are appended to its line with "; "
+static void append_cookie(h2_request_t *r, const char *value, size_t len) {
+    if (r->cookie_end == 0) {
+        append(r, "cookie: ", 8);
+        append(r, value, len);
+        r->cookie_end = r->len;
+        append(r, "\r\n", 2);
+        return;
+    }
+    if (reserve(r, len + 2) != 0) return;
+    char *at = r->buf + r->cookie_end;
+    memmove(at + len + 2, at, r->len - r->cookie_end);
+    memcpy(at, "; ", 2);
+    memcpy(at + 2, value, len);
+    r->len += len + 2;
+    r->cookie_end += len + 2;
+}
+
+void h2_request_begin(h2_request_t *r, char *buf, size_t cap, size_t max, uint64_t *heap_allocs) {
+    r->buf = buf;
+    r->len = 0;
+    r->cap = cap;
+    r->max = max;
+    r->heap_allocs = heap_allocs;
+    r->pseudo_len = 0;
+    memset(&r->method, 0, sizeof(r->method));
+    memset(&r->scheme, 0, sizeof(r->scheme));
+    memset(&r->authority, 0, sizeof(r->authority));
+    memset(&r->path, 0, sizeof(r->path));
+    r->line_done = 0;
+    r->has_host = 0;
+    r->has_length = 0;
+    r->expect_continue = 0;
+    r->urgency = H2_DEFAULT_URGENCY;
+    r->cookie_end = 0;
+    r->status = H2_REQUEST_OK;
+}
+
+static unsigned pseudo_seen(const h2_request_t *r) {
+    return (r->method.len ? PSEUDO_METHOD : 0) | (r->scheme.len ? PSEUDO_SCHEME : 0) |
+           (r->authority.len ? PSEUDO_AUTHORITY : 0) | (r->path.len ? PSEUDO_PATH : 0);
+}
+
+void h2_request_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    h2_request_t *r = arg;
+    if (r->status != H2_REQUEST_OK) return;
+    if (!valid_value(value, value_len)) {
+        fail(r, H2_REQUEST_MALFORMED);
+        return;
+    }
+
+    if (name_len > 0 && name[0] == ':') {
+        http_span_t *span = NULL;
+        if (equals(name, name_len, ":method")) span = &r->method;
+        else if (equals(name, name_len, ":scheme")) span = &r->scheme;
+        else if (equals(name, name_len, ":authority")) span = &r->authority;
+        else if (equals(name, name_len, ":path")) span = &r->path;
+        // Only ahead of regular fields, once each, and not empty
+        if (!span || r->line_done || span->len > 0 || value_len == 0) {
+            fail(r, H2_REQUEST_MALFORMED);
+            return;
+        }
+        if (value_len > H2_PSEUDO_MAX - r->pseudo_len) {
+            fail(r, H2_REQUEST_TOO_LARGE);
+            return;
+        }
+        memcpy(r->pseudo + r->pseudo_len, value, value_len);
+        span->off = (uint32_t)r->pseudo_len;
+        span->len = (uint32_t)value_len;
+        r->pseudo_len += value_len;
+        return;
+    }
+
+    if (!valid_name(name, name_len)) {
+        fail(r, H2_REQUEST_MALFORMED);
+        return;
+    }
+    if (!r->line_done) write_request_line(r, pseudo_seen(r));
+
+    // Connection-specific fields make the request malformed; TE may only
+    // say trailers, which means nothing to the backend connection
+    if (equals(name, name_len, "connection") || equals(name, name_len, "keep-alive") ||
+        equals(name, name_len, "proxy-connection") || equals(name, name_len, "transfer-encoding") ||
+        equals(name, name_len, "upgrade")) {
+        fail(r, H2_REQUEST_MALFORMED);
+    } else if (equals(name, name_len, "te")) {
+        if (!equals(value, value_len, "trailers")) fail(r, H2_REQUEST_MALFORMED);
+    } else if (equals(name, name_len, "host")) {
+        if (r->has_host) return;    // :authority wins
+        r->has_host = 1;
+        append_line(r, name, name_len, value, value_len);
+    } else if (equals(name, name_len, "cookie")) {
+        append_cookie(r, value, value_len);
+    } else if (equals(name, name_len, "expect") && iequals(value, value_len, "100-continue")) {
+        r->expect_continue = 1;
+    } else {
+        if (equals(name, name_len, "content-length")) r->has_length = 1;
+        else if (equals(name, name_len, "priority")) r->urgency = h2_parse_urgency(value, value_len);
+        append_line(r, name, name_len, value, value_len);
+    }
+}
+
+h2_request_status_t h2_request_finish(h2_request_t *r, int body) {
+    if (!r->line_done) write_request_line(r, pseudo_seen(r));
+    if (body && !r->has_length) append(r, "transfer-encoding: chunked\r\n", 28);
+    append(r, "\r\n", 2);
+    return r->status;
+}
+
+// Values that rarely repeat would only push useful ones out of the table
+static hpack_indexing_t response_indexing(const char *name, size_t len) {
+    static const char *const unique[] = {
+        "content-length", "etag", "last-modified", "age", "location", "content-range", "set-cookie", "expires"
+    };
+    for (size_t i = 0; i < sizeof(unique) / sizeof(unique[0]); i++) {
+        if (equals(name, len, unique[i])) return HPACK_NO_INDEX;
+    }
+    return HPACK_INDEX;
+}
+
+long h2_response_block(hpack_encoder_t *e, const http_message_t *msg, const char *buf, uint8_t *out, size_t cap) {
+    size_t len = 0;
+    char status[8];
+    snprintf(status, sizeof(status), "%03d", msg->status % 1000);
+    if (hpack_encode(e, ":status", 7, status, 3, HPACK_INDEX, out, cap, &len) != 0) return -1;
+
+    for (int i = 0; i < msg->header_count; i++) {
+        const http_header_t *h = &msg->headers[i];
+        switch (h->id) {
+        case HTTP_HDR_CONNECTION:
+        case HTTP_HDR_KEEP_ALIVE:
+        case HTTP_HDR_PROXY_CONNECTION:
+        case HTTP_HDR_TRANSFER_ENCODING:
+        case HTTP_HDR_UPGRADE:
+            continue;
+        }
+        if (h->name.len > H2_NAME_MAX) continue;
+
+        char name[H2_NAME_MAX];
+        const char *src = buf + h->name.off;
+        for (uint32_t j = 0; j < h->name.len; j++) {
+            name[j] = (src[j] >= 'A' && src[j] <= 'Z') ? (char)(src[j] + 32) : src[j];
+        }
+        if (hpack_encode(e, name, h->name.len, buf + h->value.off, h->value.len, response_indexing(name, h->name.len),
+                         out, cap, &len) != 0) return -1;
+    }
+    return (long)len;
+}
@@ -0,0 +1,158 @@
+#ifndef H2_H
+#define H2_H
+
+#include "hpack.h"
+#include "http_parser.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// HTTP/2 (RFC 9113) pieces of the frontend that don't depend on the
+// connection machinery: frame headers, the connection preface, and the
+// translation between a stream's header blocks and the HTTP/1.1 heads the
+// proxy path works on. Each stream becomes a request of its own: its head
+// is rebuilt as HTTP/1.1 text, and the response the proxy produces for it
+// is parsed back and sent as HEADERS and DATA frames. Sessions, flow
+// control and stream scheduling live with the connections in
+// http_server.c.
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN (sizeof(H2_PREFACE) - 1)
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_DEFAULT_FRAME_SIZE 16384     // Largest frame payload until a peer allows more
+#define H2_MAX_FRAME_SIZE 16777215
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+
+typedef enum {
+    H2_DATA,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION
+} h2_frame_type_t;
+
+#define H2_FLAG_END_STREAM 0x01
+#define H2_FLAG_ACK 0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED 0x08
+#define H2_FLAG_PRIORITY 0x20
+
+typedef enum {
+    H2_NO_ERROR,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM,
+    H2_INADEQUATE_SECURITY,
+    H2_HTTP_1_1_REQUIRED
+} h2_error_t;
+
+typedef enum {
+    H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+    H2_SETTINGS_ENABLE_PUSH,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    H2_SETTINGS_MAX_FRAME_SIZE,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE
+} h2_setting_t;
+
+typedef struct {
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+} h2_frame_t;
+
+void h2_frame_read(h2_frame_t *frame, const uint8_t *p);
+
+// Writes H2_FRAME_HEADER_SIZE bytes
+void h2_frame_write(uint8_t *p, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id);
+
+static inline uint32_t h2_get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void h2_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// 1 if buf starts with the client connection preface, 0 if it still
+// might once more bytes arrive, -1 if it doesn't
+int h2_preface_match(const char *buf, size_t len);
+
+// Stream scheduling by the RFC 9218 urgency a request asks for in its
+// Priority header ("u=0" most urgent .. "u=7"); PRIORITY frames are obsolete
+// and ignored
+#define H2_URGENCY_LEVELS 8
+#define H2_DEFAULT_URGENCY 3
+int h2_parse_urgency(const char *value, size_t len);
+
+// Room for :method, :scheme, :authority and :path together
+#define H2_PSEUDO_MAX 8192
+
+typedef enum {
+    H2_REQUEST_OK,
+    H2_REQUEST_MALFORMED,   // Stream error PROTOCOL_ERROR
+    H2_REQUEST_TOO_LARGE
+} h2_request_status_t;
+
+// A stream's request head rebuilt as HTTP/1.1 from its header fields, in
+// a buffer grown with realloc up to max bytes, each growth counted in
+// *heap_allocs (may be NULL). Pseudo-header fields are
+// kept aside until the request line can be written; cookie crumbs are
+// joined into one Cookie line. A request that sends a body without a
+// content-length gets Transfer-Encoding: chunked, its DATA to be framed
+// that way. Expect: 100-continue is taken out: HTTP/2 answers it at once.
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t max;
+    uint64_t *heap_allocs;
+    char pseudo[H2_PSEUDO_MAX];
+    size_t pseudo_len;
+    http_span_t method;     // Into pseudo
+    http_span_t scheme;
+    http_span_t authority;
+    http_span_t path;
+    int line_done;          // Request line written: no more pseudo-header fields
+    int has_host;
+    int has_length;
+    int expect_continue;
+    int urgency;
+    size_t cookie_end;      // End of the Cookie line's value, 0 while there is none
+    h2_request_status_t status;
+} h2_request_t;
+
+void h2_request_begin(h2_request_t *r, char *buf, size_t cap, size_t max, uint64_t *heap_allocs);
+
+// An hpack_field_fn taking the h2_request_t
+void h2_request_field(void *r, const char *name, size_t name_len, const char *value, size_t value_len);
+
+// End the head; body is set when DATA frames follow. r->buf may have
+// moved.
+h2_request_status_t h2_request_finish(h2_request_t *r, int body);
+
+// Encode a parsed HTTP/1.1 response head as a HEADERS block: :status, then
+// the fields with lowercase names and without the connection-specific
+// ones. Returns the block length, or -1 if it doesn't fit in cap, which
+// H2_RESPONSE_BLOCK_BOUND always does.
+#define H2_RESPONSE_BLOCK_BOUND(msg) ((size_t)(msg)->header_len + 16 * ((size_t)(msg)->header_count + 1))
+long h2_response_block(hpack_encoder_t *e, const http_message_t *msg, const char *buf, uint8_t *out, size_t cap);
+
+#endif
@@ -0,0 +1,522 @@
+#include "hpack.h"
+#include <string.h>
+
+#define STATIC_COUNT 61
+#define MAX_INT_SHIFT 21    // Continuation bytes of an integer, 7 bits each, past its prefix
+
+typedef struct {
+    const char *name;
+    uint32_t name_len;
+    const char *value;
+    uint32_t value_len;
+} static_field_t;
+
+#define FIELD(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+
+// RFC 7541 Appendix A, index 1 first
+static const static_field_t static_table[STATIC_COUNT] = {
+    FIELD(":authority", ""),
+    FIELD(":method", "GET"),
+    FIELD(":method", "POST"),
+    FIELD(":path", "/"),
+    FIELD(":path", "/index.html"),
+    FIELD(":scheme", "http"),
+    FIELD(":scheme", "https"),
+    FIELD(":status", "200"),
+    FIELD(":status", "204"),
+    FIELD(":status", "206"),
+    FIELD(":status", "304"),
+    FIELD(":status", "400"),
+    FIELD(":status", "404"),
+    FIELD(":status", "500"),
+    FIELD("accept-charset", ""),
+    FIELD("accept-encoding", "gzip, deflate"),
+    FIELD("accept-language", ""),
+    FIELD("accept-ranges", ""),
+    FIELD("accept", ""),
+    FIELD("access-control-allow-origin", ""),
+    FIELD("age", ""),
+    FIELD("allow", ""),
+    FIELD("authorization", ""),
+    FIELD("cache-control", ""),
+    FIELD("content-disposition", ""),
+    FIELD("content-encoding", ""),
+    FIELD("content-language", ""),
+    FIELD("content-length", ""),
+    FIELD("content-location", ""),
+    FIELD("content-range", ""),
+    FIELD("content-type", ""),
+    FIELD("cookie", ""),
+    FIELD("date", ""),
+    FIELD("etag", ""),
+    FIELD("expect", ""),
+    FIELD("expires", ""),
+    FIELD("from", ""),
+    FIELD("host", ""),
+    FIELD("if-match", ""),
+    FIELD("if-modified-since", ""),
+    FIELD("if-none-match", ""),
+    FIELD("if-range", ""),
+    FIELD("if-unmodified-since", ""),
+    FIELD("last-modified", ""),
+    FIELD("link", ""),
+    FIELD("location", ""),
+    FIELD("max-forwards", ""),
+    FIELD("proxy-authenticate", ""),
+    FIELD("proxy-authorization", ""),
+    FIELD("range", ""),
+    FIELD("referer", ""),
+    FIELD("refresh", ""),
+    FIELD("retry-after", ""),
+    FIELD("server", ""),
+    FIELD("set-cookie", ""),
+    FIELD("strict-transport-security", ""),
+    FIELD("transfer-encoding", ""),
+    FIELD("user-agent", ""),
+    FIELD("vary", ""),
+    FIELD("via", ""),
+    FIELD("www-authenticate", ""),
+};
+
+// RFC 7541 Appendix B. The code is canonical, so decoding only needs the
+// first code of each length and the symbols in code order.
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// Symbols by (code length, symbol): canonical order
+static const uint16_t huffman_symbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256,
+};
+
+// Per code length: first code, number of codes, index of the first in huffman_symbols
+static const uint32_t huffman_first[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+    0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+    0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+static const uint16_t huffman_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+static const uint16_t huffman_offset[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+    0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+
+static void table_init(hpack_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->max_size = HPACK_DEFAULT_TABLE_SIZE;
+}
+
+// i = 0 is the newest entry
+static const hpack_entry_t *table_get(const hpack_table_t *t, int i) {
+    return &t->entries[(t->head - i + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES];
+}
+
+static const char *entry_name(const hpack_table_t *t, const hpack_entry_t *e) {
+    return t->arena + e->off;
+}
+
+static const char *entry_value(const hpack_table_t *t, const hpack_entry_t *e) {
+    return t->arena + e->off + e->name_len;
+}
+
+static size_t entry_size(const hpack_entry_t *e) {
+    return e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+}
+
+static void table_evict(hpack_table_t *t, size_t max) {
+    while (t->count > 0 && t->size > max) {
+        int oldest = (t->head - t->count + 1 + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES;
+        t->size -= entry_size(&t->entries[oldest]);
+        t->count--;
+    }
+    if (t->count == 0) t->used = 0;
+}
+
+static void table_free(hpack_table_t *t) {
+    table_evict(t, 0);
+}
+
+// Slide the live entries' bytes to the start of the arena. *name follows
+// if it points into them.
+static void table_compact(hpack_table_t *t, const char **name) {
+    if (t->count == 0) return;
+    int oldest = (t->head - t->count + 1 + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES;
+    uint32_t base = t->entries[oldest].off;
+    if (base == 0) return;
+    if (*name >= t->arena + base && *name < t->arena + t->used) *name -= base;
+    memmove(t->arena, t->arena + base, t->used - base);
+    for (int i = 0; i < t->count; i++) {
+        t->entries[(oldest + i) % HPACK_MAX_ENTRIES].off -= base;
+    }
+    t->used -= base;
+}
+
+// Copy the field in before evicting for it: the name may be that of an
+// entry about to go. Live bytes stay under max_size and a field under
+// max_size too, so after compaction it always fits in the arena. Returns
+// the new entry, or NULL when the field is larger than the table, which
+// then ends up empty.
+static const hpack_entry_t *table_add(hpack_table_t *t, const char *name, size_t name_len,
+                                      const char *value, size_t value_len) {
+    size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+    if (size > t->max_size) {
+        table_evict(t, 0);
+        return NULL;
+    }
+    if (t->used + name_len + value_len > HPACK_ARENA_SIZE) table_compact(t, &name);
+    uint32_t off = t->used;
+    memmove(t->arena + off, name, name_len);
+    memcpy(t->arena + off + name_len, value, value_len);
+
+    table_evict(t, t->max_size - size);
+    t->head = (t->head + 1) % HPACK_MAX_ENTRIES;
+    hpack_entry_t *e = &t->entries[t->head];
+    e->off = off;
+    e->name_len = (uint32_t)name_len;
+    e->value_len = (uint32_t)value_len;
+    t->used = off + (uint32_t)(name_len + value_len);
+    t->count++;
+    t->size += size;
+    return e;
+}
+
+static int decode_int(const uint8_t **p, const uint8_t *end, int prefix_bits, uint32_t *out) {
+    uint32_t mask = (1u << prefix_bits) - 1;
+    uint32_t v = *(*p)++ & mask;
+    if (v < mask) {
+        *out = v;
+        return 0;
+    }
+    for (int shift = 0; *p < end && shift <= MAX_INT_SHIFT; shift += 7) {
+        uint8_t b = *(*p)++;
+        v += (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Bit by bit against the per-length code ranges. Padding must be under a
+// byte of ones (a prefix of EOS); EOS itself is an error.
+static long huffman_decode(const uint8_t *in, size_t len, char *out, size_t cap) {
+    uint32_t code = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            code = (code << 1) | ((in[i] >> b) & 1);
+            bits++;
+            if (code - huffman_first[bits] < huffman_count[bits]) {
+                uint16_t sym = huffman_symbols[huffman_offset[bits] + code - huffman_first[bits]];
+                if (sym == 256 || n == cap) return -1;
+                out[n++] = (char)sym;
+                code = 0;
+                bits = 0;
+            } else if (bits == 30) {
+                return -1;
+            }
+        }
+    }
+    if (bits > 7 || code != (1u << bits) - 1) return -1;
+    return (long)n;
+}
+
+// String literal at *p: raw ones are returned in place, Huffman-coded ones
+// decoded into scratch
+static int decode_string(const uint8_t **p, const uint8_t *end, char **scratch, const char *scratch_end,
+                         const char **str, size_t *len) {
+    if (*p >= end) return -1;
+    int huffman = **p & 0x80;
+    uint32_t n;
+    if (decode_int(p, end, 7, &n) != 0 || n > (size_t)(end - *p)) return -1;
+    if (!huffman) {
+        *str = (const char *)*p;
+        *len = n;
+    } else {
+        long decoded = huffman_decode(*p, n, *scratch, scratch_end - *scratch);
+        if (decoded < 0) return -1;
+        *str = *scratch;
+        *len = (size_t)decoded;
+        *scratch += decoded;
+    }
+    *p += n;
+    return 0;
+}
+
+// Index 1..61 is the static table, the dynamic table follows
+static int lookup(const hpack_table_t *t, uint32_t index, const char **name, size_t *name_len,
+                  const char **value, size_t *value_len) {
+    if (index == 0) return -1;
+    if (index <= STATIC_COUNT) {
+        const static_field_t *f = &static_table[index - 1];
+        *name = f->name;
+        *name_len = f->name_len;
+        *value = f->value;
+        *value_len = f->value_len;
+        return 0;
+    }
+    index -= STATIC_COUNT + 1;
+    if (index >= (uint32_t)t->count) return -1;
+    const hpack_entry_t *e = table_get(t, (int)index);
+    *name = entry_name(t, e);
+    *name_len = e->name_len;
+    *value = entry_value(t, e);
+    *value_len = e->value_len;
+    return 0;
+}
+
+void hpack_decoder_init(hpack_decoder_t *d) {
+    table_init(&d->table);
+}
+
+void hpack_decoder_free(hpack_decoder_t *d) {
+    table_free(&d->table);
+}
+
+int hpack_decode(hpack_decoder_t *d, const uint8_t *block, size_t len, char *scratch, size_t scratch_cap,
+                 hpack_field_fn field, void *arg) {
+    const uint8_t *p = block;
+    const uint8_t *end = block + len;
+    const char *scratch_end = scratch + scratch_cap;
+    int fields = 0;
+
+    while (p < end) {
+        const char *name, *value;
+        size_t name_len, value_len;
+        uint32_t index;
+        uint8_t b = *p;
+
+        if (b & 0x80) {
+            // Indexed field
+            if (decode_int(&p, end, 7, &index) != 0 ||
+                lookup(&d->table, index, &name, &name_len, &value, &value_len) != 0) return -1;
+            field(arg, name, name_len, value, value_len);
+            fields++;
+            continue;
+        }
+        if ((b & 0xe0) == 0x20) {
+            // Table size update, only ahead of the first field and within
+            // what the proxy advertised
+            if (fields > 0 || decode_int(&p, end, 5, &index) != 0 || index > HPACK_DEFAULT_TABLE_SIZE) return -1;
+            d->table.max_size = index;
+            table_evict(&d->table, index);
+            continue;
+        }
+
+        // Literal, with incremental indexing (01), without (0000) or never
+        // indexed (0001); the name is indexed or follows as a string
+        int indexing = (b & 0xc0) == 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) != 0) return -1;
+        if (index > 0) {
+            const char *unused;
+            size_t unused_len;
+            if (lookup(&d->table, index, &name, &name_len, &unused, &unused_len) != 0) return -1;
+        } else if (decode_string(&p, end, &scratch, scratch_end, &name, &name_len) != 0) {
+            return -1;
+        }
+        if (decode_string(&p, end, &scratch, scratch_end, &value, &value_len) != 0) return -1;
+
+        if (indexing) {
+            const hpack_entry_t *e = table_add(&d->table, name, name_len, value, value_len);
+            if (e) {
+                name = entry_name(&d->table, e);
+                value = entry_value(&d->table, e);
+            }
+        }
+        field(arg, name, name_len, value, value_len);
+        fields++;
+    }
+    return 0;
+}
+
+void hpack_encoder_init(hpack_encoder_t *e) {
+    table_init(&e->table);
+    e->update = SIZE_MAX;
+}
+
+void hpack_encoder_free(hpack_encoder_t *e) {
+    table_free(&e->table);
+}
+
+void hpack_encoder_set_max(hpack_encoder_t *e, size_t max) {
+    if (max > HPACK_DEFAULT_TABLE_SIZE) max = HPACK_DEFAULT_TABLE_SIZE;
+    if (max == e->table.max_size) return;
+    e->table.max_size = max;
+    table_evict(&e->table, max);
+    e->update = max;
+}
+
+static size_t encode_int(uint8_t *p, uint8_t first, int prefix_bits, size_t v) {
+    size_t mask = ((size_t)1 << prefix_bits) - 1;
+    if (v < mask) {
+        p[0] = (uint8_t)(first | v);
+        return 1;
+    }
+    size_t n = 0;
+    p[n++] = (uint8_t)(first | mask);
+    v -= mask;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t huffman_length(const char *s, size_t len) {
+    size_t bits = 0;
+    for (size_t i = 0; i < len; i++) bits += huffman_lengths[(uint8_t)s[i]];
+    return (bits + 7) / 8;
+}
+
+static size_t huffman_encode(const char *s, size_t len, uint8_t *out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)s[i];
+        acc = (acc << huffman_lengths[c]) | huffman_codes[c];
+        bits += huffman_lengths[c];
+        while (bits >= 8) {
+            bits -= 8;
+            out[n++] = (uint8_t)(acc >> bits);
+        }
+        acc &= ((uint64_t)1 << bits) - 1;
+    }
+    if (bits > 0) out[n++] = (uint8_t)((acc << (8 - bits)) | (0xff >> bits));
+    return n;
+}
+
+// Huffman-coded when that is shorter
+static size_t encode_string(uint8_t *p, const char *s, size_t len) {
+    size_t coded = huffman_length(s, len);
+    if (coded < len) {
+        size_t n = encode_int(p, 0x80, 7, coded);
+        return n + huffman_encode(s, len, p + n);
+    }
+    size_t n = encode_int(p, 0x00, 7, len);
+    memcpy(p + n, s, len);
+    return n + len;
+}
+
+static int equals(const char *a, size_t a_len, const char *b, size_t b_len) {
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+int hpack_encode(hpack_encoder_t *e, const char *name, size_t name_len, const char *value, size_t value_len,
+                 hpack_indexing_t indexing, uint8_t *out, size_t cap, size_t *len) {
+    if (cap < *len || cap - *len < HPACK_FIELD_BOUND(name_len, value_len)) return -1;
+    uint8_t *p = out + *len;
+    if (*len == 0 && e->update != SIZE_MAX) {
+        p += encode_int(p, 0x20, 5, e->update);
+        e->update = SIZE_MAX;
+    }
+
+    // Whole field from either table, else the first index with the name
+    size_t name_index = 0;
+    for (int i = 0; i < STATIC_COUNT; i++) {
+        const static_field_t *f = &static_table[i];
+        if (!equals(f->name, f->name_len, name, name_len)) continue;
+        if (indexing != HPACK_NEVER_INDEX && equals(f->value, f->value_len, value, value_len)) {
+            *len = p - out + encode_int(p, 0x80, 7, i + 1);
+            return 0;
+        }
+        if (!name_index) name_index = i + 1;
+    }
+    for (int i = 0; i < e->table.count; i++) {
+        const hpack_entry_t *entry = table_get(&e->table, i);
+        if (!equals(entry_name(&e->table, entry), entry->name_len, name, name_len)) continue;
+        if (indexing != HPACK_NEVER_INDEX &&
+            equals(entry_value(&e->table, entry), entry->value_len, value, value_len)) {
+            *len = p - out + encode_int(p, 0x80, 7, STATIC_COUNT + 1 + i);
+            return 0;
+        }
+        if (!name_index) name_index = STATIC_COUNT + 1 + i;
+    }
+
+    // Only fields that leave room for others are worth a table slot
+    if (indexing == HPACK_INDEX && name_len + value_len + HPACK_ENTRY_OVERHEAD <= e->table.max_size / 2 &&
+        table_add(&e->table, name, name_len, value, value_len)) {
+        p += encode_int(p, 0x40, 6, name_index);
+    } else {
+        p += encode_int(p, indexing == HPACK_NEVER_INDEX ? 0x10 : 0x00, 4, name_index);
+    }
+    if (!name_index) p += encode_string(p, name, name_len);
+    p += encode_string(p, value, value_len);
+    *len = p - out;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// HPACK header compression (RFC 7541) for the HTTP/2 frontend. Each
+// direction of a connection has its own dynamic table: the decoder's
+// follows the client's header blocks, the encoder's the proxy's responses.
+// Both stay within HPACK_DEFAULT_TABLE_SIZE, which is what the proxy
+// advertises and what it assumes the peer allows unless told otherwise.
+//
+// Header blocks must be decoded completely and in the order they arrive,
+// even for streams that are refused, or the tables drift apart.
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_ENTRY_OVERHEAD 32     // Counted per entry on top of name and value
+#define HPACK_MAX_ENTRIES (HPACK_DEFAULT_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+#define HPACK_ARENA_SIZE (2 * HPACK_DEFAULT_TABLE_SIZE)
+
+typedef struct {
+    uint32_t off;           // Name, then value, at arena[off]
+    uint32_t name_len;
+    uint32_t value_len;
+} hpack_entry_t;
+
+// Newest entry first; the oldest are evicted once the entries' sizes pass
+// max_size. Entry bytes are appended to the arena in insertion order and
+// slid back to its start when the end is reached, so the tables live inside
+// the connection and inserts never touch the heap.
+typedef struct {
+    hpack_entry_t entries[HPACK_MAX_ENTRIES];   // Ring, entries[head] newest
+    int head;
+    int count;
+    size_t size;
+    size_t max_size;
+    uint32_t used;          // End of the newest entry's bytes in arena
+    char arena[HPACK_ARENA_SIZE];
+} hpack_table_t;
+
+typedef struct {
+    hpack_table_t table;
+} hpack_decoder_t;
+
+// How an encoded field may be kept in compression tables
+typedef enum {
+    HPACK_INDEX,        // Added to the dynamic table for later blocks
+    HPACK_NO_INDEX,     // Values that rarely repeat
+    HPACK_NEVER_INDEX   // Sensitive: not stored here or by any intermediary
+} hpack_indexing_t;
+
+typedef struct {
+    hpack_table_t table;
+    size_t update;      // Size change to announce at the start of the next block, SIZE_MAX if none
+} hpack_encoder_t;
+
+// Called for every field of a block, in order. The strings are only valid
+// during the call.
+typedef void (*hpack_field_fn)(void *arg, const char *name, size_t name_len, const char *value, size_t value_len);
+
+void hpack_decoder_init(hpack_decoder_t *d);
+void hpack_decoder_free(hpack_decoder_t *d);
+
+// Decode a complete header block. Huffman-coded strings are decoded into
+// scratch, which should be at least twice the block size. Returns 0, or -1
+// if the block is malformed or decodes past scratch_cap: the connection's
+// compression state is then lost.
+int hpack_decode(hpack_decoder_t *d, const uint8_t *block, size_t len, char *scratch, size_t scratch_cap,
+                 hpack_field_fn field, void *arg);
+
+void hpack_encoder_init(hpack_encoder_t *e);
+void hpack_encoder_free(hpack_encoder_t *e);
+
+// The peer's SETTINGS_HEADER_TABLE_SIZE. The table never grows past the
+// default, only shrinks to fit a smaller limit.
+void hpack_encoder_set_max(hpack_encoder_t *e, size_t max);
+
+// Largest encoding of a field: what hpack_encode() needs free in out
+#define HPACK_FIELD_BOUND(name_len, value_len) ((name_len) + (value_len) + 16)
+
+// Append a field to the block being built in out[*len..cap), after any
+// pending table size update when *len is 0. Returns -1 if less than
+// HPACK_FIELD_BOUND() is free; nothing is written or changed then.
+int hpack_encode(hpack_encoder_t *e, const char *name, size_t name_len, const char *value, size_t value_len,
+                 hpack_indexing_t indexing, uint8_t *out, size_t cap, size_t *len);
+
+#endif
@@ -0,0 +1,159 @@
+#include "http_chunked.h"
+#include <string.h>
+
+#define MAX_CHUNK_SIZE_DIGITS 15
+#define MAX_TRAILER_SIZE 8192
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+void http_chunked_init(http_chunked_t *c) {
+    c->state = CHUNK_SIZE;
+    c->remaining = 0;
+    c->size_digits = 0;
+    c->trailer_bytes = 0;
+    c->strict = 0;
+}
+
+void http_chunked_init_strict(http_chunked_t *c) {
+    http_chunked_init(c);
+    c->strict = 1;
+}
+
+// Control characters other than HTAB
+static inline int is_ctl(char ch) {
+    return ((unsigned char)ch < 0x20 && ch != '\t') || ch == 0x7f;
+}
+
+// Shared state machine. With payload set, chunk data is also moved to
+// payload + *payload_len (in place when payload == data, since the output
+// never overtakes the input).
+static int chunked_run(http_chunked_t *c, const char *data, int len, char *payload, int *payload_len) {
+    int i = 0;
+
+    while (i < len && c->state != CHUNK_DONE) {
+        char ch = data[i];
+
+        switch (c->state) {
+        case CHUNK_SIZE: {
+            int v = hex_value(ch);
+            if (v >= 0) {
+                if (++c->size_digits > MAX_CHUNK_SIZE_DIGITS) goto malformed;
+                c->remaining = (c->remaining << 4) | (uint64_t)v;
+            } else if (c->size_digits == 0) {
+                goto malformed;
+            } else if (ch == ';' || ch == ' ' || ch == '\t') {
+                c->state = CHUNK_EXT;
+            } else if (ch == '\r') {
+                c->state = CHUNK_SIZE_LF;
+            } else {
+                goto malformed;
+            }
+            i++;
+            break;
+        }
+
+        case CHUNK_EXT:
+            // Chunk extensions are passed through untouched
+            if (ch == '\r') c->state = CHUNK_SIZE_LF;
+            else if (c->strict && is_ctl(ch)) goto malformed;
+            i++;
+            break;
+
+        case CHUNK_SIZE_LF:
+            if (ch != '\n') goto malformed;
+            c->state = c->remaining ? CHUNK_DATA : CHUNK_TRAILER_START;
+            c->size_digits = 0;
+            i++;
+            break;
+
+        case CHUNK_DATA: {
+            // Skip chunk payload in bulk
+            uint64_t avail = (uint64_t)(len - i);
+            uint64_t take = c->remaining < avail ? c->remaining : avail;
+            if (payload) {
+                memmove(payload + *payload_len, data + i, (size_t)take);
+                *payload_len += (int)take;
+            }
+            i += (int)take;
+            c->remaining -= take;
+            if (c->remaining == 0) c->state = CHUNK_DATA_CR;
+            break;
+        }
+
+        case CHUNK_DATA_CR:
+            if (ch != '\r') goto malformed;
+            c->state = CHUNK_DATA_LF;
+            i++;
+            break;
+
+        case CHUNK_DATA_LF:
+            if (ch != '\n') goto malformed;
+            c->state = CHUNK_SIZE;
+            i++;
+            break;
+
+        case CHUNK_TRAILER_START:
+            if (c->strict && ch == '\n') goto malformed;
+            c->state = ch == '\r' ? CHUNK_FINAL_LF : CHUNK_TRAILER_LINE;
+            if (c->state == CHUNK_TRAILER_LINE) c->trailer_bytes++;
+            i++;
+            break;
+
+        case CHUNK_TRAILER_LINE:
+            // Trailer fields are relayed as they are, within a bound
+            if (++c->trailer_bytes > MAX_TRAILER_SIZE) goto malformed;
+            if (c->strict) {
+                if (ch == '\r') c->state = CHUNK_TRAILER_LF;
+                else if (is_ctl(ch)) goto malformed;
+            } else if (ch == '\n') {
+                c->state = CHUNK_TRAILER_START;
+            }
+            i++;
+            break;
+
+        case CHUNK_TRAILER_LF:
+            if (ch != '\n') goto malformed;
+            c->trailer_bytes++;
+            c->state = CHUNK_TRAILER_START;
+            i++;
+            break;
+
+        case CHUNK_FINAL_LF:
+            if (ch != '\n') goto malformed;
+            c->state = CHUNK_DONE;
+            i++;
+            break;
+
+        case CHUNK_DONE:
+        case CHUNK_ERROR:
+            return c->state == CHUNK_ERROR ? -1 : i;
+        }
+    }
+    return c->state == CHUNK_ERROR ? -1 : i;
+
+malformed:
+    c->state = CHUNK_ERROR;
+    return -1;
+}
+
+int http_chunked_scan(http_chunked_t *c, const char *data, int len) {
+    return chunked_run(c, data, len, NULL, NULL);
+}
+
+int http_chunked_decode(http_chunked_t *c, char *data, int len, int *payload_len) {
+    *payload_len = 0;
+    return chunked_run(c, data, len, data, payload_len);
+}
+
+int http_chunked_encode(http_out_t *out, const char *data, size_t len) {
+    if (len == 0) return 0; // A zero-size chunk would end the body
+    int r = http_out_printf(out, "%zx\r\n", len);
+    r |= http_out_add(out, data, len);
+    r |= http_out_literal(out, "\r\n");
+    return r;
+}
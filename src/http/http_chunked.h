@@ -0,0 +1,59 @@
+#ifndef HTTP_CHUNKED_H
+#define HTTP_CHUNKED_H
+
+#include "http_output.h"
+#include <stdint.h>
+
+// Incremental chunked transfer coding. The scanner tracks chunk boundaries
+// as bytes stream through so the relay knows exactly where a message ends,
+// without buffering or rewriting the body; the decoder additionally strips
+// the framing in place, and the encoder frames a body of unknown length.
+typedef enum {
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER_START,
+    CHUNK_TRAILER_LINE,
+    CHUNK_TRAILER_LF,
+    CHUNK_FINAL_LF,
+    CHUNK_DONE,
+    CHUNK_ERROR
+} http_chunked_state_t;
+
+typedef struct {
+    http_chunked_state_t state;
+    uint64_t remaining; // Data bytes left in the current chunk
+    int size_digits;
+    int trailer_bytes;  // Trailer section seen so far, bounded
+    int strict;         // Lines must end in CRLF; no control characters in extensions or trailers
+} http_chunked_t;
+
+void http_chunked_init(http_chunked_t *c);
+
+// For request bodies, whose framing is relayed as it is to pooled backend
+// connections: anything a lenient backend could read differently, like a
+// bare LF ending the trailers early, is malformed
+void http_chunked_init_strict(http_chunked_t *c);
+
+// Consume up to len bytes, stopping right after the final CRLF.
+// Returns bytes consumed, or -1 on malformed framing.
+int http_chunked_scan(http_chunked_t *c, const char *data, int len);
+
+// Scan like http_chunked_scan, moving the chunk payload to the front of
+// data and setting *payload_len. Extensions and trailers are dropped.
+int http_chunked_decode(http_chunked_t *c, char *data, int len, int *payload_len);
+
+// Queue len bytes (referenced in place) as one chunk
+int http_chunked_encode(http_out_t *out, const char *data, size_t len);
+
+// Queue the last chunk, with no trailers
+#define http_chunked_finish(out) http_out_literal((out), "0\r\n\r\n")
+
+static inline int http_chunked_done(const http_chunked_t *c) {
+    return c->state == CHUNK_DONE;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include "http_output.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+void http_out_reset(http_out_t *out) {
+    out->count = 0;
+    out->cur = 0;
+    out->remaining = 0;
+    out->arena_used = 0;
+}
+
+int http_out_add(http_out_t *out, const char *data, size_t len) {
+    if (len == 0) return 0;
+
+    if (out->count > out->cur) {
+        sock_iov_t *last = &out->iov[out->count - 1];
+        if ((const char *)SOCK_IOV_BASE(*last) + SOCK_IOV_LEN(*last) == data) {
+            SOCK_IOV_LEN(*last) += len;
+            out->remaining += len;
+            return 0;
+        }
+    }
+
+    if (out->count == HTTP_OUT_MAX_IOV) return -1;
+    sock_iov_t *v = &out->iov[out->count++];
+    SOCK_IOV_BASE(*v) = (char *)data;
+    SOCK_IOV_LEN(*v) = len;
+    out->remaining += len;
+    return 0;
+}
+
+int http_out_printf(http_out_t *out, const char *fmt, ...) {
+    size_t avail = sizeof(out->arena) - out->arena_used;
+    char *dst = out->arena + out->arena_used;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(dst, avail, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= avail) return -1;
+
+    out->arena_used += n;
+    return http_out_add(out, dst, n);
+}
+
+static int sendv_socket(void *arg, sock_iov_t *iov, int count) {
+    return sock_sendv(*(sock_t *)arg, iov, count);
+}
+
+int http_out_send(http_out_t *out, sock_t sock) {
+    return http_out_write(out, sendv_socket, &sock);
+}
+
+int http_out_write(http_out_t *out, http_sendv_fn sendv, void *arg) {
+    while (out->remaining > 0) {
+        int n = sendv(arg, out->iov + out->cur, out->count - out->cur);
+        if (n < 0) return sock_would_block() ? 0 : -1;
+        out->remaining -= n;
+
+        // Drop fully sent entries and trim the one sent part-way
+        size_t left = (size_t)n;
+        while (left > 0) {
+            sock_iov_t *v = &out->iov[out->cur];
+            if (left < SOCK_IOV_LEN(*v)) {
+                SOCK_IOV_BASE(*v) = (char *)SOCK_IOV_BASE(*v) + left;
+                SOCK_IOV_LEN(*v) -= left;
+                break;
+            }
+            left -= SOCK_IOV_LEN(*v);
+            out->cur++;
+        }
+    }
+
+    // Drained: nothing references the arena any more
+    http_out_reset(out);
+    return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef HTTP_OUTPUT_H
+#define HTTP_OUTPUT_H
+
+#include "../core/platform.h"
+#include "http_parser.h"
+
+// Outgoing bytes as a scatter-gather list. Unchanged header lines and
+// bodies are referenced where they already sit (receive buffers, static
+// pages); only injected lines are formatted, into a small per-queue arena.
+// Everything queued is sent with one gather-write per readiness event, so
+// nothing is copied into a staging buffer.
+//
+// Referenced memory must stay untouched until http_out_send() reports the
+// queue drained.
+
+#define HTTP_OUT_MAX_IOV (2 * HTTP_MAX_HEADERS + 16)
+#define HTTP_OUT_ARENA_SIZE 1024
+
+typedef struct {
+    sock_iov_t iov[HTTP_OUT_MAX_IOV];
+    int count;
+    int cur;            // First iov with unsent bytes
+    size_t remaining;   // Unsent bytes across all iovs
+    size_t arena_used;
+    char arena[HTTP_OUT_ARENA_SIZE];
+} http_out_t;
+
+void http_out_reset(http_out_t *out);
+
+// Reference len bytes in place; merged with the previous entry when the
+// two are adjacent in memory. Returns -1 if the list is full.
+int http_out_add(http_out_t *out, const char *data, size_t len);
+
+// Queue a string literal
+#define http_out_literal(out, lit) http_out_add((out), (lit), sizeof(lit) - 1)
+
+// Format into the arena and queue the result. Returns -1 if it doesn't fit.
+int http_out_printf(http_out_t *out, const char *fmt, ...);
+
+// Returns 1 once everything queued was sent, 0 to wait, -1 on error
+int http_out_send(http_out_t *out, sock_t sock);
+
+// As http_out_send(), through a gather-write with sock_sendv()'s contract
+// (a TLS connection, say)
+typedef int (*http_sendv_fn)(void *arg, sock_iov_t *iov, int count);
+int http_out_write(http_out_t *out, http_sendv_fn sendv, void *arg);
+
+static inline int http_out_pending(const http_out_t *out) {
+    return out->remaining > 0;
+}
+
+#endif
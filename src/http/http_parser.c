@@ -0,0 +1,324 @@
+#include "http_parser.h"
+#include "http_scan.h"
+#include <string.h>
+
+enum {
+    PARSE_START_LINE,
+    PARSE_HEADERS,
+    PARSE_DONE,
+    PARSE_ERROR
+};
+
+typedef struct {
+    const char *name;
+    uint8_t len;
+    uint8_t id;
+} known_header_t;
+
+#define KNOWN(name, id) { name, sizeof(name) - 1, id }
+
+static const known_header_t known_headers[] = {
+    KNOWN("host", HTTP_HDR_HOST),
+    KNOWN("connection", HTTP_HDR_CONNECTION),
+    KNOWN("proxy-connection", HTTP_HDR_PROXY_CONNECTION),
+    KNOWN("keep-alive", HTTP_HDR_KEEP_ALIVE),
+    KNOWN("content-length", HTTP_HDR_CONTENT_LENGTH),
+    KNOWN("transfer-encoding", HTTP_HDR_TRANSFER_ENCODING),
+    KNOWN("te", HTTP_HDR_TE),
+    KNOWN("trailers", HTTP_HDR_TRAILERS),
+    KNOWN("upgrade", HTTP_HDR_UPGRADE),
+    KNOWN("expect", HTTP_HDR_EXPECT),
+    KNOWN("x-forwarded-for", HTTP_HDR_X_FORWARDED_FOR),
+    KNOWN("x-forwarded-proto", HTTP_HDR_X_FORWARDED_PROTO),
+    KNOWN("x-real-ip", HTTP_HDR_X_REAL_IP),
+    KNOWN("via", HTTP_HDR_VIA),
+    KNOWN("location", HTTP_HDR_LOCATION),
+    KNOWN("proxy-authenticate", HTTP_HDR_PROXY_AUTHENTICATE),
+    KNOWN("proxy-authorization", HTTP_HDR_PROXY_AUTHORIZATION),
+    KNOWN("content-type", HTTP_HDR_CONTENT_TYPE),
+    KNOWN("content-encoding", HTTP_HDR_CONTENT_ENCODING),
+    KNOWN("accept-encoding", HTTP_HDR_ACCEPT_ENCODING),
+    KNOWN("cache-control", HTTP_HDR_CACHE_CONTROL),
+    KNOWN("pragma", HTTP_HDR_PRAGMA),
+    KNOWN("etag", HTTP_HDR_ETAG),
+    KNOWN("if-none-match", HTTP_HDR_IF_NONE_MATCH),
+    KNOWN("vary", HTTP_HDR_VARY),
+    KNOWN("authorization", HTTP_HDR_AUTHORIZATION),
+    KNOWN("age", HTTP_HDR_AGE),
+    KNOWN("set-cookie", HTTP_HDR_SET_COOKIE),
+    KNOWN("if-modified-since", HTTP_HDR_IF_MODIFIED_SINCE),
+    KNOWN("trailer", HTTP_HDR_TRAILER),
+};
+
+static inline char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? (char)(ch + 32) : ch;
+}
+
+static int iequals(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (lower(a[i]) != b[i]) return 0;
+    }
+    return 1;
+}
+
+static uint8_t lookup_header(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); i++) {
+        const known_header_t *k = &known_headers[i];
+        if (k->len == len && lower(name[0]) == k->name[0] && iequals(name, k->name, len)) {
+            return k->id;
+        }
+    }
+    return HTTP_HDR_OTHER;
+}
+
+// RFC 9110 tchar as a 256-bit set: ALPHA / DIGIT / "!#$%&'*+-.^_`|~"
+static const uint64_t tchar_bits[4] = {
+    0x03ff6cfa00000000ull, 0x57ffffffc7fffffeull, 0, 0
+};
+
+static inline int is_token_char(unsigned char ch) {
+    return (int)((tchar_bits[ch >> 6] >> (ch & 63)) & 1);
+}
+
+// Control bytes other than HTAB never appear in a field value (RFC 9110 5.5)
+static inline int is_ctl(unsigned char ch) {
+    return (ch < 0x20 && ch != '\t') || ch == 0x7f;
+}
+
+static http_span_t span(uint32_t start, uint32_t end) {
+    http_span_t s = { start, end - start };
+    return s;
+}
+
+void http_message_init(http_message_t *msg, http_message_kind_t kind) {
+    msg->kind = kind;
+    msg->start_line = span(0, 0);
+    msg->method = span(0, 0);
+    msg->target = span(0, 0);
+    msg->status = 0;
+    msg->minor_version = 1;
+    msg->header_count = 0;
+    memset(msg->known, 0xff, sizeof(msg->known));
+    msg->header_len = 0;
+    msg->content_length = -1;
+    msg->chunked = 0;
+    msg->has_transfer_encoding = 0;
+    msg->conn_close = 0;
+    msg->conn_keep_alive = 0;
+    msg->conn_upgrade = 0;
+    msg->state = PARSE_START_LINE;
+    msg->pos = 0;
+    msg->line_start = 0;
+    msg->colon = UINT32_MAX;
+}
+
+static int parse_version(const char *p, uint32_t len, int *minor) {
+    if (len != 8 || memcmp(p, "HTTP/1.", 7) != 0) return -1;
+    if (p[7] != '0' && p[7] != '1') return -1;
+    *minor = p[7] - '0';
+    return 0;
+}
+
+// method SP request-target SP HTTP-version
+static int parse_request_line(http_message_t *msg, const char *buf, uint32_t start, uint32_t end) {
+    uint32_t i = start;
+    while (i < end && is_token_char((unsigned char)buf[i])) i++;
+    if (i == start || i >= end || buf[i] != ' ') return -1;
+    msg->method = span(start, i);
+
+    uint32_t target_start = ++i;
+    while (i < end && buf[i] != ' ') {
+        if ((unsigned char)buf[i] <= 0x20 || buf[i] == 0x7f) return -1;
+        i++;
+    }
+    if (i == target_start || i >= end) return -1;
+    msg->target = span(target_start, i);
+
+    i++;
+    return parse_version(buf + i, end - i, &msg->minor_version);
+}
+
+// HTTP-version SP status-code SP [ reason-phrase ]
+static int parse_status_line(http_message_t *msg, const char *buf, uint32_t start, uint32_t end) {
+    if (end - start < 12 || parse_version(buf + start, 8, &msg->minor_version) != 0) return -1;
+
+    const char *p = buf + start + 8;
+    if (p[0] != ' ') return -1;
+    int status = 0;
+    for (int i = 1; i <= 3; i++) {
+        if (p[i] < '0' || p[i] > '9') return -1;
+        status = status * 10 + (p[i] - '0');
+    }
+    if (end - start > 12 && p[4] != ' ') return -1;
+    msg->status = status;
+    return 0;
+}
+
+static int parse_content_length(const char *p, uint32_t len, int64_t *out) {
+    if (len == 0 || len > 18) return -1;
+    int64_t v = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9') return -1;
+        v = v * 10 + (p[i] - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+// Last transfer-coding in a Transfer-Encoding value
+static int last_coding_is_chunked(const char *buf, http_span_t value) {
+    const char *p = buf + value.off;
+    uint32_t end = value.len;
+    while (end > 0 && (p[end - 1] == ' ' || p[end - 1] == '\t' || p[end - 1] == ',')) end--;
+    uint32_t start = end;
+    while (start > 0 && p[start - 1] != ',' && p[start - 1] != ' ' && p[start - 1] != '\t') start--;
+    return end - start == 7 && iequals(p + start, "chunked", 7);
+}
+
+static int parse_header_line(http_message_t *msg, const char *buf, uint32_t start, uint32_t end, uint32_t colon) {
+    // Obsolete line folding is rejected rather than guessed at
+    if (buf[start] == ' ' || buf[start] == '\t') return -1;
+    if (msg->header_count == HTTP_MAX_HEADERS) return -1;
+    if (colon == UINT32_MAX || colon == start || colon >= end) return -1;
+
+    // No whitespace between name and colon (request smuggling vector)
+    for (uint32_t i = start; i < colon; i++) {
+        if (!is_token_char((unsigned char)buf[i])) return -1;
+    }
+
+    uint32_t vstart = colon + 1;
+    uint32_t vend = end;
+    while (vstart < vend && (buf[vstart] == ' ' || buf[vstart] == '\t')) vstart++;
+    while (vend > vstart && (buf[vend - 1] == ' ' || buf[vend - 1] == '\t')) vend--;
+    for (uint32_t i = vstart; i < vend; i++) {
+        if (is_ctl((unsigned char)buf[i])) return -1;
+    }
+
+    http_header_t *h = &msg->headers[msg->header_count];
+    h->name = span(start, colon);
+    h->value = span(vstart, vend);
+    h->id = lookup_header(buf + start, colon - start);
+
+    if (h->id != HTTP_HDR_OTHER) {
+        switch (h->id) {
+        case HTTP_HDR_CONTENT_LENGTH: {
+            int64_t v;
+            if (parse_content_length(buf + vstart, vend - vstart, &v) != 0) return -1;
+            // Conflicting duplicates make the framing ambiguous
+            if (msg->content_length >= 0 && msg->content_length != v) return -1;
+            msg->content_length = v;
+            break;
+        }
+        case HTTP_HDR_TRANSFER_ENCODING:
+            msg->has_transfer_encoding = 1;
+            msg->chunked = last_coding_is_chunked(buf, h->value);
+            break;
+        case HTTP_HDR_CONNECTION:
+            if (http_value_has_token(buf, h->value, "close")) msg->conn_close = 1;
+            if (http_value_has_token(buf, h->value, "keep-alive")) msg->conn_keep_alive = 1;
+            if (http_value_has_token(buf, h->value, "upgrade")) msg->conn_upgrade = 1;
+            break;
+        }
+        if (msg->known[h->id] == 0xff) msg->known[h->id] = (uint8_t)msg->header_count;
+    }
+
+    msg->header_count++;
+    return 0;
+}
+
+static void finish_message(http_message_t *msg) {
+    // Transfer-Encoding overrides Content-Length (RFC 9112 6.3)
+    if (msg->has_transfer_encoding) msg->content_length = -1;
+}
+
+int http_parse(http_message_t *msg, const char *buf, size_t len) {
+    if (msg->state == PARSE_DONE) return HTTP_PARSE_DONE;
+    if (msg->state == PARSE_ERROR) return HTTP_PARSE_ERROR;
+
+    while (msg->pos < len) {
+        // One pass finds both the line end and the name/value separator
+        size_t colon;
+        size_t lf_pos = http_scan_line(buf, msg->pos, len, &colon);
+        if (colon != HTTP_SCAN_NOT_FOUND && msg->colon == UINT32_MAX) {
+            msg->colon = (uint32_t)colon;
+        }
+        if (lf_pos >= len) {
+            msg->pos = (uint32_t)len;
+            return HTTP_PARSE_AGAIN;
+        }
+
+        uint32_t start = msg->line_start;
+        uint32_t lf = (uint32_t)lf_pos;
+        uint32_t end = lf;
+        uint32_t line_colon = msg->colon;
+        if (end > start && buf[end - 1] == '\r') {
+            end--;
+        } else if (msg->kind == HTTP_MESSAGE_REQUEST) {
+            // Requests must end lines with CRLF; a bare LF is a smuggling vector
+            goto malformed;
+        }
+        msg->pos = msg->line_start = lf + 1;
+        msg->colon = UINT32_MAX;
+
+        if (msg->state == PARSE_START_LINE) {
+            // Tolerate stray CRLFs between pipelined requests (RFC 9112 2.2)
+            if (end == start) continue;
+
+            int r = msg->kind == HTTP_MESSAGE_REQUEST
+                ? parse_request_line(msg, buf, start, end)
+                : parse_status_line(msg, buf, start, end);
+            if (r != 0) goto malformed;
+            msg->start_line = span(start, end);
+            msg->state = PARSE_HEADERS;
+            continue;
+        }
+
+        if (end == start) {
+            msg->header_len = msg->pos;
+            finish_message(msg);
+            msg->state = PARSE_DONE;
+            return HTTP_PARSE_DONE;
+        }
+        if (parse_header_line(msg, buf, start, end, line_colon) != 0) goto malformed;
+    }
+    return HTTP_PARSE_AGAIN;
+
+malformed:
+    msg->state = PARSE_ERROR;
+    return HTTP_PARSE_ERROR;
+}
+
+int http_span_equals(const char *buf, http_span_t s, const char *lit) {
+    size_t len = strlen(lit);
+    return s.len == len && memcmp(buf + s.off, lit, len) == 0;
+}
+
+int http_span_iequals(const char *buf, http_span_t s, const char *lit) {
+    size_t len = strlen(lit);
+    if (s.len != len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (lower(buf[s.off + i]) != lower(lit[i])) return 0;
+    }
+    return 1;
+}
+
+int http_value_has_token(const char *buf, http_span_t value, const char *token) {
+    const char *p = buf + value.off;
+    const char *end = p + value.len;
+    size_t token_len = strlen(token);
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *start = p;
+        while (p < end && *p != ',') p++;
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+
+        if ((size_t)(stop - start) == token_len) {
+            size_t i = 0;
+            while (i < token_len && lower(start[i]) == lower(token[i])) i++;
+            if (i == token_len) return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Resumable HTTP/1.x head parser. It never copies: every field is a span
+// (offset + length) into the caller's receive buffer, so the buffer may be
+// grown with realloc between calls. Call http_parse() again with the same
+// buffer and its new length whenever more bytes arrive; scanning resumes
+// where the previous call stopped.
+
+#define HTTP_MAX_HEADERS 100
+
+#define HTTP_PARSE_ERROR (-1)
+#define HTTP_PARSE_AGAIN 0
+#define HTTP_PARSE_DONE  1
+
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} http_span_t;
+
+// Headers the proxy looks at, resolved once at parse time so lookups are a
+// single array index
+typedef enum {
+    HTTP_HDR_HOST,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_PROXY_CONNECTION,
+    HTTP_HDR_KEEP_ALIVE,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_TE,
+    HTTP_HDR_TRAILERS,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_EXPECT,
+    HTTP_HDR_X_FORWARDED_FOR,
+    HTTP_HDR_X_FORWARDED_PROTO,
+    HTTP_HDR_X_REAL_IP,
+    HTTP_HDR_VIA,
+    HTTP_HDR_LOCATION,
+    HTTP_HDR_PROXY_AUTHENTICATE,
+    HTTP_HDR_PROXY_AUTHORIZATION,
+    HTTP_HDR_CONTENT_TYPE,
+    HTTP_HDR_CONTENT_ENCODING,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_CACHE_CONTROL,
+    HTTP_HDR_PRAGMA,
+    HTTP_HDR_ETAG,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_VARY,
+    HTTP_HDR_AUTHORIZATION,
+    HTTP_HDR_AGE,
+    HTTP_HDR_SET_COOKIE,
+    HTTP_HDR_IF_MODIFIED_SINCE,
+    HTTP_HDR_TRAILER,
+    HTTP_HDR_COUNT,
+    HTTP_HDR_OTHER = 0xff
+} http_header_id_t;
+
+typedef struct {
+    http_span_t name;
+    http_span_t value;
+    uint8_t id;
+} http_header_t;
+
+typedef enum {
+    HTTP_MESSAGE_REQUEST,
+    HTTP_MESSAGE_RESPONSE
+} http_message_kind_t;
+
+typedef struct {
+    http_message_kind_t kind;
+
+    // Start line
+    http_span_t start_line;
+    http_span_t method;     // Requests
+    http_span_t target;     // Requests
+    int status;             // Responses
+    int minor_version;      // HTTP/1.x
+
+    http_header_t headers[HTTP_MAX_HEADERS];
+    int header_count;
+    uint8_t known[HTTP_HDR_COUNT]; // First index into headers, 0xff if absent
+
+    // Framing and connection semantics, valid once parsing is done
+    uint32_t header_len;    // Through the blank line
+    int64_t content_length; // -1 when absent or overridden by chunked
+    unsigned chunked : 1;
+    unsigned has_transfer_encoding : 1;
+    unsigned conn_close : 1;
+    unsigned conn_keep_alive : 1;
+    unsigned conn_upgrade : 1;
+
+    // Resume state
+    int state;
+    uint32_t pos;
+    uint32_t line_start;
+    uint32_t colon;         // First ':' on the current line, UINT32_MAX if unseen
+} http_message_t;
+
+void http_message_init(http_message_t *msg, http_message_kind_t kind);
+
+// Returns HTTP_PARSE_DONE once the blank line is seen, HTTP_PARSE_AGAIN if
+// more bytes are needed, HTTP_PARSE_ERROR on malformed or ambiguous input.
+int http_parse(http_message_t *msg, const char *buf, size_t len);
+
+static inline const http_header_t *http_message_header(const http_message_t *msg, http_header_id_t id) {
+    return msg->known[id] == 0xff ? NULL : &msg->headers[msg->known[id]];
+}
+
+// Case-sensitive / case-insensitive comparison of a span with a literal
+int http_span_equals(const char *buf, http_span_t span, const char *lit);
+int http_span_iequals(const char *buf, http_span_t span, const char *lit);
+
+// True if a comma-separated header value lists token (case-insensitive)
+int http_value_has_token(const char *buf, http_span_t value, const char *token);
+
+#endif
@@ -1,9 +1,8 @@
 #include "http_request.h"
-#include <stdio.h>
-#include <string.h>
 
-int http_request_parse(const char *raw, http_request_t *req) {
-    if (sscanf(raw, "%7s %1023s %15s", req->method, req->path, req->version) != 3) {
+int http_request_parse(const char *raw, size_t len, http_request_t *req) {
+    http_message_init(req, HTTP_MESSAGE_REQUEST);
+    if (http_parse(req, raw, len) != HTTP_PARSE_DONE) {
         return -1;
     }
     return 0;
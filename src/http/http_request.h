@@ -1,12 +1,13 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
-typedef struct {
-    char method[8];
-    char path[1024];
-    char version[16];
-} http_request_t;
+#include "http_parser.h"
 
-int http_request_parse(const char *raw, http_request_t *req);
+// Parsed request head. Method, target and headers are spans into the
+// buffer that was parsed, so it must outlive the request.
+typedef http_message_t http_request_t;
+
+// One-shot parse of a complete request head held in raw[0..len)
+int http_request_parse(const char *raw, size_t len, http_request_t *req);
 
 #endif
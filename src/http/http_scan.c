@@ -0,0 +1,195 @@
+#include "http_scan.h"
+#include <string.h>
+
+// SSE2 is part of the x86-64 baseline; AVX2 is checked at runtime
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_line_fn)(const char *buf, size_t from, size_t len, size_t *colon);
+typedef size_t (*scan_end_fn)(const char *buf, size_t from, size_t len);
+
+static size_t scan_line_scalar(const char *buf, size_t from, size_t len, size_t *colon);
+static size_t scan_end_scalar(const char *buf, size_t from, size_t len);
+
+// Scalar until http_scan_select() runs; written only before threads start
+static scan_line_fn scan_line_impl = scan_line_scalar;
+static scan_end_fn scan_end_impl = scan_end_scalar;
+static http_scan_impl_t active_impl = HTTP_SCAN_SCALAR;
+
+static size_t scan_line_scalar(const char *buf, size_t from, size_t len, size_t *colon) {
+    const char *lf = memchr(buf + from, '\n', len - from);
+    size_t end = lf ? (size_t)(lf - buf) : len;
+    const char *c = memchr(buf + from, ':', end - from);
+    *colon = c ? (size_t)(c - buf) : HTTP_SCAN_NOT_FOUND;
+    return end;
+}
+
+static size_t scan_end_scalar(const char *buf, size_t from, size_t len) {
+    size_t i = from;
+    while (i + 4 <= len) {
+        const char *cr = memchr(buf + i, '\r', len - 3 - i);
+        if (!cr) break;
+        i = (size_t)(cr - buf);
+        if (cr[1] == '\n' && cr[2] == '\r' && cr[3] == '\n') return i + 4;
+        i++;
+    }
+    return HTTP_SCAN_NOT_FOUND;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// Colons that come before the first LF in this block
+static inline unsigned colons_before_lf(unsigned colon_mask, unsigned lf_mask) {
+    return lf_mask ? colon_mask & ((lf_mask & (0u - lf_mask)) - 1) : colon_mask;
+}
+
+static size_t scan_line_tail(const char *buf, size_t i, size_t len, size_t c, size_t *colon) {
+    for (; i < len; i++) {
+        if (buf[i] == '\n') break;
+        if (buf[i] == ':' && c == HTTP_SCAN_NOT_FOUND) c = i;
+    }
+    *colon = c;
+    return i;
+}
+
+static inline __attribute__((always_inline))
+size_t sse2_loop(const char *buf, size_t i, size_t len, size_t c, size_t *colon) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned lm = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if (c == HTTP_SCAN_NOT_FOUND) {
+            unsigned cm = colons_before_lf((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, co)), lm);
+            if (cm) c = i + __builtin_ctz(cm);
+        }
+        if (lm) {
+            *colon = c;
+            return i + __builtin_ctz(lm);
+        }
+    }
+    return scan_line_tail(buf, i, len, c, colon);
+}
+
+static size_t scan_line_sse2(const char *buf, size_t from, size_t len, size_t *colon) {
+    return sse2_loop(buf, from, len, HTTP_SCAN_NOT_FOUND, colon);
+}
+
+// "\r\n\r\n" starts at every bit set in the AND of four shifted compares
+static inline __attribute__((always_inline))
+size_t sse2_end_loop(const char *buf, size_t i, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for (; i + 19 <= len; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), cr);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 1)), lf);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 2)), cr);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 3)), lf);
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d)));
+        if (m) return i + __builtin_ctz(m) + 4;
+    }
+    return scan_end_scalar(buf, i, len);
+}
+
+static size_t scan_end_sse2(const char *buf, size_t from, size_t len) {
+    return sse2_end_loop(buf, from, len);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_line_avx2(const char *buf, size_t from, size_t len, size_t *colon) {
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+    size_t c = HTTP_SCAN_NOT_FOUND;
+    size_t i = from;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned lm = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        if (c == HTTP_SCAN_NOT_FOUND) {
+            unsigned cm = colons_before_lf((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co)), lm);
+            if (cm) c = i + __builtin_ctz(cm);
+        }
+        if (lm) {
+            *colon = c;
+            return i + __builtin_ctz(lm);
+        }
+    }
+    // Finish the last < 32 bytes 16 at a time (inlined, so VEX-encoded)
+    return sse2_loop(buf, i, len, c, colon);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_end_avx2(const char *buf, size_t from, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = from;
+
+    for (; i + 35 <= len; i += 32) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), cr);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 1)), lf);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 2)), cr);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 3)), lf);
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d)));
+        if (m) return i + __builtin_ctz(m) + 4;
+    }
+    return sse2_end_loop(buf, i, len);
+}
+
+#endif
+
+int http_scan_select(http_scan_impl_t impl) {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (impl == HTTP_SCAN_AUTO) {
+        impl = __builtin_cpu_supports("avx2") ? HTTP_SCAN_AVX2 : HTTP_SCAN_SSE2;
+    }
+    switch (impl) {
+    case HTTP_SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        scan_line_impl = scan_line_avx2;
+        scan_end_impl = scan_end_avx2;
+        break;
+    case HTTP_SCAN_SSE2:
+        scan_line_impl = scan_line_sse2;
+        scan_end_impl = scan_end_sse2;
+        break;
+    default:
+        impl = HTTP_SCAN_SCALAR;
+        scan_line_impl = scan_line_scalar;
+        scan_end_impl = scan_end_scalar;
+        break;
+    }
+#else
+    if (impl == HTTP_SCAN_SSE2 || impl == HTTP_SCAN_AVX2) return -1;
+    impl = HTTP_SCAN_SCALAR;
+    scan_line_impl = scan_line_scalar;
+    scan_end_impl = scan_end_scalar;
+#endif
+    active_impl = impl;
+    return 0;
+}
+
+const char *http_scan_impl_name(void) {
+    switch (active_impl) {
+    case HTTP_SCAN_AVX2: return "avx2";
+    case HTTP_SCAN_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+size_t http_scan_line(const char *buf, size_t from, size_t len, size_t *colon) {
+    if (from >= len) {
+        *colon = HTTP_SCAN_NOT_FOUND;
+        return len;
+    }
+    return scan_line_impl(buf, from, len, colon);
+}
+
+size_t http_scan_header_end(const char *buf, size_t from, size_t len) {
+    if (from >= len) return HTTP_SCAN_NOT_FOUND;
+    return scan_end_impl(buf, from, len);
+}
@@ -0,0 +1,35 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+// Vectorised search for the structural bytes of an HTTP head (LF, ':' and
+// the blank line). AVX2 or SSE2 kernels are picked at runtime from what the
+// CPU supports; other targets use the scalar fallback. Every function takes
+// a start offset so callers resume where the previous read stopped instead
+// of rescanning the whole buffer.
+
+#define HTTP_SCAN_NOT_FOUND ((size_t)-1)
+
+typedef enum {
+    HTTP_SCAN_AUTO,
+    HTTP_SCAN_SCALAR,
+    HTTP_SCAN_SSE2,
+    HTTP_SCAN_AVX2
+} http_scan_impl_t;
+
+// Offset of the first '\n' in buf[from..len), or len if there is none.
+// *colon receives the first ':' before it, or HTTP_SCAN_NOT_FOUND.
+size_t http_scan_line(const char *buf, size_t from, size_t len, size_t *colon);
+
+// Offset just past the first "\r\n\r\n" whose final LF is at or after
+// from, or HTTP_SCAN_NOT_FOUND. Resume with from = previous length - 3.
+size_t http_scan_header_end(const char *buf, size_t from, size_t len);
+
+// Pick a kernel, HTTP_SCAN_AUTO for the best the CPU has; the scalar one
+// is used until then. Not thread-safe: call before any thread scans.
+// Returns -1 if the CPU lacks the kernel asked for.
+int http_scan_select(http_scan_impl_t impl);
+const char *http_scan_impl_name(void);
+
+#endif
@@ -1,426 +1,4009 @@
 #include "http_server.h"
+#include "../proxy/health.h"
 #include "../proxy/proxy_handler.h"
+#include "../proxy/upstream.h"
+#include "../cache/response_cache.h"
+#include "../core/platform.h"
+#include "../core/event_loop.h"
+#include "../core/log.h"
+#include "../core/rate_limit.h"
+#include "../core/slab.h"
+#include "../core/timer_wheel.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "compress.h"
+#include "h2.h"
+#include "http_chunked.h"
+#include "http_output.h"
+#include "http_request.h"
+#include "tls.h"
+#include "upgrade.h"
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <process.h>
+#include <time.h>
 
-#pragma comment(lib, "ws2_32.lib")
+#define LISTEN_BACKLOG 511
+#define MIN_UPLOAD_WINDOW 4096              // Smallest body window behind a request head
+#define SLAB_MAX_FREE 1024                  // Recycled blocks kept per worker and size
+#define SPLICE_MIN_BODY (64 * 1024)         // Smaller bodies are copied through resp
+#define SPLICE_POOL_SIZE 64                 // Idle pipes kept per worker
+#define LOOP_TICK_MS 1000               // Longest the loop blocks; pool reaping runs at this rate
+#define LAG_PROBE_MS 50                 // Load shedding samples how late the loop wakes this often
+#define TIMER_TICK_MS 100               // Resolution of connection deadlines
+#define MAX_UPSTREAM_TRIES 2            // Backends tried per request when connects fail
+#define CACHE_KEY_MAX 4096              // Host + target; longer requests skip the cache
+#define CACHE_WAIT_TIMEOUT_MS 5000      // Then go to the backend without the cache
+#define CACHE_PASS_TTL_MS 10000         // Uncacheable keys skip coalescing this long
+#define RELOAD_POLL_MS 200              // Reload thread checks for SIGHUP this often
+#define ADMIN_BIND_TRIES 30               // 100 ms apart, while an upgraded-from process frees the port
+#define SNAPSHOT_GRACE_MS 5000          // Unused snapshots outlive access log records naming their backends
+#define H2_WRITE_BUFFER_SIZE (64 * 1024)    // Frames on their way to the socket, per HTTP/2 connection
+#define H2_CONTROL_RESERVE 1024             // Part of it DATA never takes: acks, resets, window updates
+#define H2_CONN_WINDOW (1024 * 1024)        // Upload bytes a client may have in flight per connection
+#define H2_STREAM_WINDOW H2_DEFAULT_WINDOW  // ... and per stream, buffered until its backend takes them
+#define H2_BODY_BUFFER_MIN 4096
+#define H2_QUANTUM 16384                    // Sent by a stream before the next of its urgency gets a turn
+#define H2_CHUNK_OVERHEAD 12                // Size line and CRLF around a chunk of an int's length
 
-// Global backend info
-static char g_backend_host[256];
-static int g_backend_port;
+// Reloadable settings. Each reload publishes a new immutable snapshot and
+// workers switch to it between events; a request keeps the worker view it
+// started on until it completes, so in-flight requests finish on the old
+// settings. The only shared access on the request path is one load of
+// g_snapshot_gen per loop turn. A retired snapshot is freed by the reload
+// thread once no worker view holds it.
+typedef struct server_snapshot {
+    http_server_config_t config;
+    const upstream_group_t *upstream;
+    int owns_config;            // Upstream group and strings came with a reload, freed with the snapshot
+    health_checker_t *checker;  // Stopped when the snapshot is retired
+    tls_context_t *tls;         // Certificates new connections handshake with, NULL for plain HTTP
+    uint64_t gen;
+    int refs;                   // Worker views holding it, plus one while current
+    uint64_t retired_at;        // ms
+    struct server_snapshot *next_retired;
+} server_snapshot_t;
 
-// Extract client IP from socket
-void get_client_ip(SOCKET client_fd, char* ip_buffer, int buffer_size) {
-    struct sockaddr_in client_addr;
-    int addr_len = sizeof(client_addr);
-    
-    if (getpeername(client_fd, (struct sockaddr*)&client_addr, &addr_len) == 0) {
-        inet_ntop(AF_INET, &client_addr.sin_addr, ip_buffer, buffer_size);
-    } else {
+// A worker's state for one snapshot: the balancer built over its group
+typedef struct worker_view {
+    server_snapshot_t *snap;
+    upstream_lb_t *lb;
+    int users;                  // Requests pinned to it
+} worker_view_t;
+
+static server_snapshot_t *g_snapshot;   // Current, under g_snapshot_lock
+static uint64_t g_snapshot_gen;
+static mutex_t g_snapshot_lock;
+static server_snapshot_t *g_retired;    // Reload thread only
+static http_config_reload_fn g_reload;
+static void *g_reload_arg;
+static volatile sig_atomic_t g_reload_requested;
+
+// Set once listeners have been handed to a new process: workers stop
+// accepting, finish what they have and exit by g_drain_deadline
+static int g_draining;
+static uint64_t g_drain_deadline;
+static upgrade_server_t *g_upgrade;
+static metrics_server_t *g_admin;
+
+// Slab block size for request buffers and relay windows, fixed at startup
+static int g_io_buffer_size;
+
+// Shared response cache, NULL when disabled
+static response_cache_t *g_cache;
+
+// One ring per worker, NULL when access logging is off
+static access_log_t *g_access_log;
+
+// Admission control, shared by every worker. The client table exists even
+// while client limits are off, so a reload can turn them on.
+static rate_limiter_t *g_client_limits;
+static rate_bucket_t g_global_bucket;
+static int g_open_conns;                // Client connections, all workers
+
+static const char BAD_GATEWAY_RESPONSE[] =
+    "HTTP/1.1 502 Bad Gateway\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 136\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n"
+    "<html><body><h1>502 Bad Gateway</h1><p>The backend server is not available.</p><p>Proxy: Custom-Reverse-Proxy</p></body></html>";
+
+static const char GATEWAY_TIMEOUT_RESPONSE[] =
+    "HTTP/1.1 504 Gateway Timeout\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+static const char BAD_REQUEST_RESPONSE[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+static const char EXPECTATION_FAILED_RESPONSE[] =
+    "HTTP/1.1 417 Expectation Failed\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+static const char CONTINUE_RESPONSE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static const char TOO_LARGE_RESPONSE[] =
+    "HTTP/1.1 413 Payload Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+static const char TOO_MANY_REQUESTS_RESPONSE[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+static const char SERVICE_UNAVAILABLE_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Via: 1.1 reverse-proxy\r\n"
+    "\r\n";
+
+// Client connection lifecycle: each accepted socket walks these states on
+// its worker's event loop instead of blocking a thread.
+typedef enum {
+    CONN_READ_HEADERS,
+    CONN_CACHE_WAIT,    // Another request is fetching the same key
+    CONN_FORWARD,
+    CONN_WRITE_RESPONSE,
+    CONN_H2,            // HTTP/2 connection: its streams are connections of their own
+    CONN_CLOSED
+} conn_state_t;
+
+// Sub-states of CONN_FORWARD
+typedef enum {
+    UPSTREAM_CONNECTING,
+    UPSTREAM_SENDING,
+    UPSTREAM_READ_HEADERS
+} upstream_state_t;
+
+// What a connection's deadline guards. Each is armed where the wait
+// begins, so the timer is touched once per wait and not per byte.
+typedef enum {
+    TIMEOUT_HEADER,     // Whole request head, from its first byte
+    TIMEOUT_BODY,       // Gap in a request body upload
+    TIMEOUT_KEEP_ALIVE, // Idle between requests
+    TIMEOUT_CACHE_WAIT, // Queued behind another request's cache fill
+    TIMEOUT_CONNECT,    // Backend connect
+    TIMEOUT_RESPONSE,   // Backend silent, or not taking the request
+    TIMEOUT_SEND        // Client not reading the response
+} conn_timeout_t;
+
+// How the backend delimits the response body
+typedef enum {
+    BODY_NONE,
+    BODY_LENGTH,
+    BODY_CHUNKED,
+    BODY_UNTIL_CLOSE
+} body_framing_t;
+
+// How the response body is re-framed for the client. A compressed body is
+// always re-framed: its payload is taken out of the backend's framing and
+// the encoder output sent chunked, or close-delimited to HTTP/1.0.
+typedef enum {
+    RECODE_NONE,
+    RECODE_CHUNK,       // Close-delimited body sent chunked to an HTTP/1.1 client
+    RECODE_UNCHUNK      // Chunked body sent close-delimited to an HTTP/1.0 client
+} body_recode_t;
+
+typedef struct http_worker http_worker_t;
+
+typedef struct http_conn {
+    http_worker_t *worker;
+    conn_state_t state;
+    io_watch_t client;
+    char client_ip[INET_ADDRSTRLEN];
+    tls_conn_t *tls;    // NULL for plain HTTP
+    int tls_ready;      // Handshake completed
+
+    // Raw request as received; req holds spans into it. Taken from the
+    // worker's buffer slab when a request starts arriving and returned
+    // while the connection sits idle.
+    char *in;
+    int in_len;
+    int in_cap;
+    http_request_t req;
+    int header_len;     // Through the blank line, 0 until parsed
+    int content_length; // Body bytes of this request held in `in`
+
+    // Request bodies stream through in[header_len..in_cap) as a window
+    // that is refilled from the client once sent to the backend
+    body_framing_t req_framing;
+    int64_t req_body_left;  // BODY_LENGTH
+    http_chunked_t req_chunks;
+    uint64_t req_body_bytes;
+    int req_body_done;
+    int req_body_streamed;  // Window reused: the body can't be replayed
+    int continue_left;      // Bytes of a 100 Continue still owed to the client
+
+    // Per-request accounting for the access log and stage metrics
+    uint64_t read_start_us;     // First byte of the request, 0 until seen
+    uint64_t request_start_us;  // Request head parsed
+    uint64_t upstream_start_us;
+    uint64_t connect_start_us;
+    uint64_t ttfb_start_us;     // Request fully sent to the backend
+    uint64_t upstream_headers_us;
+    uint64_t write_start_us;    // Response headers queued for the client
+    int64_t upstream_us;        // Time to backend headers, -1 if not forwarded
+    int status;
+
+    // Persistent connection bookkeeping
+    int keep_alive;     // Decided per request
+    int requests_served;
+    timer_entry_t timer;    // The one deadline armed at a time, on the worker's wheel
+    conn_timeout_t timeout; // What it guards
+
+    // Bytes queued for the current peer (upstream request, then client
+    // response), referenced in place from in/resp or static pages
+    http_out_t out;
+
+    int head_request;
+
+    // Settings the current request runs on, pinned once its head is
+    // parsed; NULL between requests
+    worker_view_t *view;
+
+    // Upstream exchange
+    int backend;        // Index into the view's upstream group, chosen per request
+    io_watch_t upstream;
+    upstream_state_t upstream_state;
+    int upstream_reused;
+    int upstream_retried;   // Stale pooled socket replaced
+    int upstream_tries;     // Backends whose connect failed for this request
+    int upstream_keep_alive;
+
+    // Bounded response window: holds the backend header block first, then
+    // body bytes in flight. Only refilled once drained to the client, so a
+    // slow client throttles the backend instead of growing memory. Slab
+    // backed, held only while a request is forwarded.
+    char *resp;
+    int resp_cap;
+    int resp_start;
+    int resp_end;
+    http_message_t resp_msg;
+    body_framing_t body_framing;
+    int64_t body_remaining;
+    http_chunked_t chunked;
+    body_recode_t recode;
+    int body_done;
+    int64_t bytes_sent;
+
+    // Response compression: window payload runs through encoder into zbuf
+    // (slab backed), which is queued and drained before the encoder runs
+    // again
+    compress_coding_t coding;
+    compress_stream_t *encoder;
+    char *zbuf;
+    int compress_unflushed;     // Input taken since the last flush
+    int compress_flush;         // Flushing before waiting on the backend
+#ifdef PLATFORM_HAS_SPLICE
+    // Body bytes moved backend -> pipe -> client inside the kernel instead
+    // of through resp; pipe_bytes are in the pipe, not yet sent
+    int splicing;
+    int pipe_open;
+    splice_pipe_t pipe;
+    int pipe_bytes;
+#endif
+
+    // Response cache
+    const char *cache_status;   // X-Cache value, NULL when not looked up
+    cache_entry_t *cache_entry; // Entry being served
+    cache_entry_t *cache_fill;  // Fill or revalidation this request owns
+    int cache_revalidate;       // cache_fill is a stale entry sent with If-None-Match
+    char *capture;              // Header block and body being stored
+    size_t capture_len;
+    size_t capture_cap;
+    uint64_t capture_ttl;
+    uint64_t capture_vary;
+    struct http_conn *wait_prev;
+    struct http_conn *wait_next;
+
+    // HTTP/2: the connection's session, or for a stream (which has no
+    // socket; its client I/O goes through the session) the stream state.
+    // A session's streams are linked through prev/next instead of the
+    // worker's list.
+    struct h2_session *h2;
+    struct h2_stream *stream;
+
+    struct http_conn *prev;
+    struct http_conn *next;
+    struct http_conn *next_closed;
+} http_conn_t;
+
+// An HTTP/2 client connection. Frames are read into the connection's `in`;
+// whatever is sent is framed into wbuf and drains through its `out`.
+// Streams that can't send (flow control, wbuf full, their turn used up)
+// wait in ready[] by urgency until the session wakes them.
+typedef struct h2_session {
+    hpack_decoder_t decoder;
+    hpack_encoder_t encoder;
+    h2_request_t request;       // Head of the stream being opened
+
+    // HEADERS plus CONTINUATION block, and the scratch its Huffman
+    // strings decode into
+    uint8_t *block;
+    int block_len;
+    int block_cap;
+    uint32_t block_stream;      // Stream whose block awaits CONTINUATION, 0 if none
+    int block_end_stream;
+    char *scratch;
+    int scratch_cap;
+
+    uint8_t *wbuf;
+    int wbuf_cap;
+    int wbuf_len;
+    int wbuf_queued;            // Handed to `out` up to here
+    uint8_t *hbuf;              // A response's header block before framing
+    int hbuf_cap;
+    uint64_t framed;            // Bytes framed for streams, to tell when a wake achieved anything
+
+    int preface_done;
+    int settings_seen;          // The client's first frame must be SETTINGS
+    int64_t peer_initial_window;
+    int64_t send_window;        // Connection-level, granted by the client
+    int32_t recv_window;        // What the client may still send
+    int32_t recv_consumed;      // Taken by backends since the last WINDOW_UPDATE
+    uint32_t last_stream;
+    int goaway_sent;
+    int goaway_received;
+    h2_error_t error;           // Sent with the final GOAWAY
+    int driving;                // Frames are flushed once the session's turn ends
+    int failed;                 // Socket error: streams stop, the session closes on the next tick
+    int closing;
+
+    struct http_conn *streams;
+    int stream_count;
+    struct http_conn *ready[H2_URGENCY_LEVELS];
+    struct http_conn *ready_tail[H2_URGENCY_LEVELS];
+} h2_session_t;
+
+// Where a stream is in turning its HTTP/1.1 response into frames
+typedef enum {
+    H2_OUT_HEAD,
+    H2_OUT_LENGTH,
+    H2_OUT_CHUNKED,     // Chunk framing stripped into DATA
+    H2_OUT_UNTIL_CLOSE,
+    H2_OUT_DONE         // END_STREAM queued
+} h2_out_state_t;
+
+typedef struct h2_stream {
+    struct http_conn *session;
+    uint32_t id;
+    int urgency;
+    int64_t send_window;
+    int32_t recv_window;
+    int32_t recv_consumed;
+    int quantum;                // Left of its turn while woken, INT_MAX otherwise
+
+    // DATA the exchange hasn't taken yet. A request without content-length
+    // was given chunked framing, which is added as the exchange reads.
+    char *body;
+    int body_start;
+    int body_len;
+    int body_cap;
+    int body_chunked;
+    int body_final;             // Last chunk handed out
+    int remote_closed;          // END_STREAM received
+
+    // The response head as the exchange writes it, parsed again for HEADERS
+    h2_out_state_t out_state;
+    char *head;
+    int head_len;
+    int head_cap;
+    int head_parsed;            // Its last byte stays unconsumed until HEADERS is queued
+    http_message_t msg;
+    int64_t out_remaining;      // H2_OUT_LENGTH
+    http_chunked_t out_chunks;
+    int reset;                  // RST_STREAM sent or received
+
+    struct http_conn *ready_next;
+    int queued;
+} h2_stream_t;
+
+// One reactor per core: its own event loop and (with SO_REUSEPORT) its own
+// listening socket, so workers never share connection state.
+struct http_worker {
+    int id;
+    event_loop_t *loop;
+    io_watch_t listener;
+    thread_t thread;
+    int started;            // Has its own thread (worker 0 runs on the caller's)
+    int draining;
+    http_conn_t *conns;  // Open connections
+    http_conn_t *closed; // Freed after each dispatch round
+    int active_conns;
+    uint64_t lag_us;        // How late the loop wakes, smoothed; kept while shedding is on
+    worker_metrics_t *metrics;
+    upstream_pool_t *pool;
+    worker_view_t *view;    // Newest snapshot this worker has adopted
+    timer_wheel_t timers;   // Connection deadlines
+
+    // Recycled connection and HTTP/2 stream structs, and g_io_buffer_size
+    // buffers
+    slab_t conn_slab;
+    slab_t stream_slab;
+    slab_t buffer_slab;
+#ifdef PLATFORM_HAS_SPLICE
+    splice_pipe_t pipes[SPLICE_POOL_SIZE]; // Empty pipes kept for reuse
+    int pipe_count;
+#endif
+    compress_pool_t encoders;
+
+    // Cache fills completed on other workers wake waiting requests here
+    io_watch_t notify;
+    sock_t notify_tx;
+    int notify_pending;
+    http_conn_t *cache_waiters;
+};
+
+static http_worker_t *g_workers;
+static int g_worker_count;
+
+// Extract client IP from accepted address
+void get_client_ip(const struct sockaddr_in *client_addr, char* ip_buffer, int buffer_size) {
+    if (!inet_ntop(AF_INET, &client_addr->sin_addr, ip_buffer, buffer_size)) {
         strcpy(ip_buffer, "127.0.0.1");
     }
 }
 
-// Fix request headers for backend
-char* fix_request_headers(const char* original_request, int request_len, const char* client_ip, int* new_len) {
-    // Find header end
-    char* header_end = strstr(original_request, "\r\n\r\n");
-    if (!header_end) return NULL;
-    
-    int headers_len = header_end - original_request;
-    int body_len = request_len - headers_len - 4;
-    
-    // Parse request line
-    char method[16], path[2048], version[16];
-    if (sscanf(original_request, "%15s %2047s %15s", method, path, version) != 3) {
-        return NULL;
+// Queue one line of raw in place, reusing its own CRLF when it has one
+static int out_add_line(http_out_t *out, const char *raw, uint32_t off, uint32_t len) {
+    if (raw[off + len] == '\r' && raw[off + len + 1] == '\n') {
+        return http_out_add(out, raw + off, len + 2);
     }
-    
-    // Build new headers
-    char new_headers[8192];
-    int pos = 0;
-    
-    // Add request line
-    pos += sprintf(new_headers + pos, "%s %s %s\r\n", method, path, version);
+    if (http_out_add(out, raw + off, len) != 0) return -1;
+    return http_out_literal(out, "\r\n");
+}
+
+// Queue one parsed header line ("Name: value\r\n")
+static int out_add_header(http_out_t *out, const char *raw, const http_header_t *h) {
+    return out_add_line(out, raw, h->name.off, h->value.off + h->value.len - h->name.off);
+}
+
+// Fix request headers for backend. Kept lines and the body are queued
+// straight from the receive buffer; only the proxy's own headers are new.
+// A cached entry being revalidated passes its ETag as etag (else NULL).
+int fix_request_headers(const http_request_t *req, const char* original_request, int body_len, const char* client_ip,
+                        int tls, const upstream_backend_t *backend, const char *etag, int etag_len, http_out_t *out) {
+    int r = 0;
+
+    // Request line as received
+    r |= out_add_line(out, original_request, req->start_line.off, req->start_line.len);
     
     // Add essential proxy headers first
-    pos += sprintf(new_headers + pos, "Host: %s:%d\r\n", g_backend_host, g_backend_port);
-    pos += sprintf(new_headers + pos, "X-Forwarded-For: %s\r\n", client_ip);
-    pos += sprintf(new_headers + pos, "X-Real-IP: %s\r\n", client_ip);
-    pos += sprintf(new_headers + pos, "X-Forwarded-Proto: http\r\n");
-    pos += sprintf(new_headers + pos, "Via: 1.1 reverse-proxy\r\n");
-    
-    // Parse and copy other headers (skip problematic ones)
-    const char* line = original_request;
-    line = strstr(line, "\r\n") + 2; // Skip request line
+    r |= http_out_printf(out, "Host: %s:%d\r\n", backend->host, backend->port);
+    r |= http_out_printf(out, "X-Forwarded-For: %s\r\n", client_ip);
+    r |= http_out_printf(out, "X-Real-IP: %s\r\n", client_ip);
+    if (tls) r |= http_out_literal(out, "X-Forwarded-Proto: https\r\n");
+    else r |= http_out_literal(out, "X-Forwarded-Proto: http\r\n");
+    r |= http_out_literal(out, "Via: 1.1 reverse-proxy\r\n");
     
-    while (line < header_end) {
-        const char* line_end = strstr(line, "\r\n");
-        if (!line_end) break;
+    // Copy other headers (skip problematic ones)
+    for (int i = 0; i < req->header_count; i++) {
+        const http_header_t *h = &req->headers[i];
         
         // Skip headers that proxy should handle
-        if (_strnicmp(line, "Host:", 5) == 0 ||
-            _strnicmp(line, "Connection:", 11) == 0 ||
-            _strnicmp(line, "Proxy-Connection:", 17) == 0 ||
-            _strnicmp(line, "Keep-Alive:", 11) == 0 ||
-            _strnicmp(line, "Upgrade:", 8) == 0 ||
-            _strnicmp(line, "X-Forwarded-For:", 16) == 0 ||
-            _strnicmp(line, "X-Real-IP:", 10) == 0 ||
-            _strnicmp(line, "Via:", 4) == 0) {
-            // Skip these headers
-            line = line_end + 2;
+        switch (h->id) {
+        case HTTP_HDR_HOST:
+        case HTTP_HDR_CONNECTION:
+        case HTTP_HDR_PROXY_CONNECTION:
+        case HTTP_HDR_KEEP_ALIVE:
+        case HTTP_HDR_UPGRADE:
+        case HTTP_HDR_X_FORWARDED_FOR:
+        case HTTP_HDR_X_REAL_IP:
+        case HTTP_HDR_X_FORWARDED_PROTO:
+        case HTTP_HDR_VIA:
+        case HTTP_HDR_EXPECT:   // Answered by the proxy
             continue;
         }
         
-        // Copy other headers
-        int header_len = line_end - line;
-        if (pos + header_len + 2 < sizeof(new_headers)) {
-            memcpy(new_headers + pos, line, header_len);
-            pos += header_len;
-            memcpy(new_headers + pos, "\r\n", 2);
-            pos += 2;
-        }
-        
-        line = line_end + 2;
-    }
-    
-    // Add connection management
-    pos += sprintf(new_headers + pos, "Connection: keep-alive\r\n");
-    
-    // End headers
-    pos += sprintf(new_headers + pos, "\r\n");
-    
-    // Allocate new request
-    *new_len = pos + body_len;
-    char* new_request = malloc(*new_len + 1);
-    if (!new_request) return NULL;
-    
-    // Copy headers and body
-    memcpy(new_request, new_headers, pos);
-    if (body_len > 0) {
-        memcpy(new_request + pos, header_end + 4, body_len);
+        r |= out_add_header(out, original_request, h);
     }
-    new_request[*new_len] = '\0';
-    
-    printf("   Fixed headers:\n");
-    printf("   Original Host header → Host: %s:%d\n", g_backend_host, g_backend_port);
-    printf("   Added X-Forwarded-For: %s\n", client_ip);
-    printf("   Request size: %d → %d bytes\n", request_len, *new_len);
-    
-    return new_request;
-}
 
-// Fix response headers for client
-char* fix_response_headers(const char* original_response, int response_len, int* new_len) {
-    // Find header end
-    char* header_end = strstr(original_response, "\r\n\r\n");
-    if (!header_end) {
-        // No headers found, return as-is
-        *new_len = response_len;
-        char* copy = malloc(response_len);
-        if (copy) memcpy(copy, original_response, response_len);
-        return copy;
+    if (etag) {
+        r |= http_out_literal(out, "If-None-Match: ");
+        r |= http_out_add(out, etag, etag_len);
+        r |= http_out_literal(out, "\r\n");
     }
     
-    int headers_len = header_end - original_response;
-    int body_len = response_len - headers_len - 4;
+    // Add connection management and end headers
+    r |= http_out_literal(out, "Connection: keep-alive\r\n\r\n");
     
-    // Parse status line
-    char status_line[256];
-    const char* first_line_end = strstr(original_response, "\r\n");
-    if (!first_line_end || first_line_end > header_end) return NULL;
+    // Body follows untouched
+    r |= http_out_add(out, original_request + req->header_len, body_len);
+    if (r != 0) return -1;
     
-    int status_len = first_line_end - original_response;
-    if (status_len >= sizeof(status_line)) status_len = sizeof(status_line) - 1;
-    memcpy(status_line, original_response, status_len);
-    status_line[status_len] = '\0';
+    LOG_DEBUG("   Fixed headers:\n");
+    LOG_DEBUG("   Original Host header → Host: %s:%d\n", backend->host, backend->port);
+    LOG_DEBUG("   Added X-Forwarded-For: %s\n", client_ip);
+    LOG_DEBUG("   Request size: %d → %d bytes\n", (int)req->header_len + body_len, (int)out->remaining);
     
-    // Build new headers
-    char new_headers[8192];
-    int pos = 0;
+    return 0;
+}
+
+// Fix response headers for client. Only the header block is queued here;
+// body bytes are relayed separately as they arrive. cache_status adds an
+// X-Cache header; age >= 0 marks a response served from the cache; recode
+// says how the body framing changes on the way out. A body sent with a
+// content coding gets Content-Encoding and a weakened ETag, and length >= 0
+// replaces its framing with that Content-Length. Redirects to the backend
+// are pointed at host (the client's Host header) in the client's scheme
+// (https when tls), or made relative when there is none.
+int fix_response_headers(const http_message_t *resp, const char* original_response, int keep_alive,
+                         const char *backend_host, int backend_port, const char *host, int host_len, int tls,
+                         const char *cache_status, int age, body_recode_t recode,
+                         compress_coding_t coding, int64_t length, http_out_t *out) {
+    int r = 0;
+    size_t start = out->remaining;
+    int reframed = recode != RECODE_NONE || length >= 0;
     
-    // Add status line
-    pos += sprintf(new_headers + pos, "%s\r\n", status_line);
+    // Status line as received
+    r |= out_add_line(out, original_response, resp->start_line.off, resp->start_line.len);
     
-    // Parse and filter response headers
-    const char* line = first_line_end + 2;
-    while (line < header_end) {
-        const char* line_end = strstr(line, "\r\n");
-        if (!line_end) break;
+    // Filter response headers
+    for (int i = 0; i < resp->header_count; i++) {
+        const http_header_t *h = &resp->headers[i];
         
         // Skip hop-by-hop headers that proxy should not forward
-        if (_strnicmp(line, "Connection:", 11) == 0 ||
-            _strnicmp(line, "Keep-Alive:", 11) == 0 ||
-            _strnicmp(line, "Proxy-Authenticate:", 19) == 0 ||
-            _strnicmp(line, "Proxy-Authorization:", 20) == 0 ||
-            _strnicmp(line, "TE:", 3) == 0 ||
-            _strnicmp(line, "Trailers:", 9) == 0 ||
-            _strnicmp(line, "Upgrade:", 8) == 0) {
-            // Skip these headers
-            line = line_end + 2;
+        switch (h->id) {
+        case HTTP_HDR_CONNECTION:
+        case HTTP_HDR_KEEP_ALIVE:
+        case HTTP_HDR_PROXY_AUTHENTICATE:
+        case HTTP_HDR_PROXY_AUTHORIZATION:
+        case HTTP_HDR_TE:
+        case HTTP_HDR_TRAILERS:
+        case HTTP_HDR_UPGRADE:
             continue;
+        case HTTP_HDR_AGE:
+            if (age >= 0) continue; // Replaced below
+            break;
+        case HTTP_HDR_CONTENT_LENGTH:
+        case HTTP_HDR_TRANSFER_ENCODING:
+        case HTTP_HDR_TRAILER:
+            if (reframed) continue;
+            break;
+        case HTTP_HDR_ETAG:
+            // The compressed body is not byte-for-byte the tagged one
+            if (coding != COMPRESS_NONE && h->value.len > 0 && original_response[h->value.off] == '"') {
+                r |= http_out_literal(out, "ETag: W/");
+                r |= out_add_line(out, original_response, h->value.off, h->value.len);
+                continue;
+            }
+            break;
         }
         
         // Fix problematic headers
-        if (_strnicmp(line, "Location:", 9) == 0) {
+        if (h->id == HTTP_HDR_LOCATION) {
             // Fix redirect URLs that point to backend
-            char location[1024];
-            const char* value_start = line + 9;
-            while (*value_start == ' ') value_start++;
+            const char* location = original_response + h->value.off;
             
-            int value_len = line_end - value_start;
-            if (value_len < sizeof(location)) {
-                memcpy(location, value_start, value_len);
-                location[value_len] = '\0';
-                
-                // Replace backend host with proxy host
-                char backend_url[256];
-                sprintf(backend_url, "http://%s:%d", g_backend_host, g_backend_port);
-                
-                if (strstr(location, backend_url)) {
-                    pos += sprintf(new_headers + pos, "Location: http://localhost:8080%s\r\n", 
-                                 location + strlen(backend_url));
-                    line = line_end + 2;
-                    continue;
-                }
+            // Replace backend host with proxy host
+            char backend_url[300];
+            int url_len = snprintf(backend_url, sizeof(backend_url), "http://%s:%d", backend_host, backend_port);
+            
+            // Only the whole authority: :5001 must not match :50012
+            if ((int)h->value.len >= url_len && memcmp(location, backend_url, url_len) == 0 &&
+                ((int)h->value.len == url_len || location[url_len] == '/' || location[url_len] == '?' ||
+                 location[url_len] == '#')) {
+                if (!host) r |= http_out_literal(out, "Location: ");
+                else if (tls) r |= http_out_literal(out, "Location: https://");
+                else r |= http_out_literal(out, "Location: http://");
+                if (host) r |= http_out_add(out, host, host_len);
+                else if ((int)h->value.len == url_len || location[url_len] != '/') r |= http_out_literal(out, "/");
+                r |= out_add_line(out, original_response, h->value.off + url_len, h->value.len - url_len);
+                continue;
             }
         }
         
         // Copy other headers as-is
-        int header_len = line_end - line;
-        if (pos + header_len + 2 < sizeof(new_headers)) {
-            memcpy(new_headers + pos, line, header_len);
-            pos += header_len;
-            memcpy(new_headers + pos, "\r\n", 2);
-            pos += 2;
-        }
-        
-        line = line_end + 2;
+        r |= out_add_header(out, original_response, h);
     }
     
     // Add proxy identification
-    pos += sprintf(new_headers + pos, "Via: 1.1 reverse-proxy\r\n");
-    pos += sprintf(new_headers + pos, "X-Proxy: Custom-Reverse-Proxy/1.0\r\n");
-    
-    // Manage connection based on client request
-    pos += sprintf(new_headers + pos, "Connection: close\r\n");
+    r |= http_out_literal(out, "Via: 1.1 reverse-proxy\r\n"
+                              "X-Proxy: Custom-Reverse-Proxy/1.0\r\n");
+    if (cache_status) r |= http_out_printf(out, "X-Cache: %s\r\n", cache_status);
+    if (age >= 0) r |= http_out_printf(out, "Age: %d\r\n", age);
+    if (coding != COMPRESS_NONE) {
+        const http_header_t *vary = http_message_header(resp, HTTP_HDR_VARY);
+        r |= http_out_printf(out, "Content-Encoding: %s\r\n", compress_coding_name(coding));
+        if (!vary || !http_value_has_token(original_response, vary->value, "Accept-Encoding")) {
+            r |= http_out_literal(out, "Vary: Accept-Encoding\r\n");
+        }
+    }
+    if (length >= 0) r |= http_out_printf(out, "Content-Length: %lld\r\n", (long long)length);
+    if (recode == RECODE_CHUNK) r |= http_out_literal(out, "Transfer-Encoding: chunked\r\n");
     
-    // End headers
-    pos += sprintf(new_headers + pos, "\r\n");
+    // Manage connection based on client request, then end headers
+    if (keep_alive) r |= http_out_literal(out, "Connection: keep-alive\r\n\r\n");
+    else r |= http_out_literal(out, "Connection: close\r\n\r\n");
+    if (r != 0) return -1;
     
-    // Allocate new response
-    *new_len = pos + body_len;
-    char* new_response = malloc(*new_len + 1);
-    if (!new_response) return NULL;
+    LOG_DEBUG("📝 Fixed response headers:\n");
+    LOG_DEBUG("   Removed hop-by-hop headers\n");
+    LOG_DEBUG("   Added Via header\n");
+    LOG_DEBUG("   Header size: %d → %d bytes\n", (int)resp->header_len, (int)(out->remaining - start));
     
-    // Copy headers and body
-    memcpy(new_response, new_headers, pos);
-    if (body_len > 0) {
-        memcpy(new_response + pos, header_end + 4, body_len);
+    return 0;
+}
+
+static void conn_drive(http_conn_t *conn);
+static void h2_session_close(http_conn_t *session);
+static void h2_session_free(h2_session_t *s);
+static void h2_stream_close(http_conn_t *conn);
+static void h2_stream_free(http_worker_t *worker, h2_stream_t *st);
+static int h2_stream_recv(http_conn_t *conn, char *buf, int len);
+static int sendv_h2_stream(void *arg, sock_iov_t *iov, int count);
+
+static const http_server_config_t *worker_config(const http_worker_t *worker) {
+    return &worker->view->snap->config;
+}
+
+// Only valid while a request is pinned to a view
+static const http_server_config_t *conn_config(const http_conn_t *conn) {
+    return &conn->view->snap->config;
+}
+
+static const upstream_group_t *conn_upstream(const http_conn_t *conn) {
+    return conn->view->snap->upstream;
+}
+
+static const upstream_backend_t *conn_backend(const http_conn_t *conn) {
+    return &conn_upstream(conn)->backends[conn->backend];
+}
+
+// Arm the connection's deadline, replacing whatever it guarded before
+static void conn_set_timeout(http_conn_t *conn, conn_timeout_t kind, int ms) {
+    conn->timeout = kind;
+    timer_wheel_add(&conn->worker->timers, &conn->timer, time_now_ms() + ms);
+}
+
+static void conn_clear_timeout(http_conn_t *conn) {
+    timer_wheel_remove(&conn->worker->timers, &conn->timer);
+}
+
+// The client stopped taking the response: it gets send_timeout_ms to make
+// room again, so one that never reads can't hold the connection and its
+// backend socket. Only progress extends the deadline; other wakeups (the
+// backend filling the window) don't. A stream is only held to it while a
+// flow-control window is shut: waiting its turn or on the session's socket
+// is not its client stalling, and the session has a deadline of its own.
+// Static responses may have no view pinned.
+static void conn_wait_client(http_conn_t *conn, int progressed) {
+    h2_stream_t *st = conn->stream;
+    if (st && st->send_window > 0 && st->session->h2->send_window > 0) {
+        conn_clear_timeout(conn);
+        return;
     }
-    
-    printf("📝 Fixed response headers:\n");
-    printf("   Removed hop-by-hop headers\n");
-    printf("   Added Via header\n");
-    printf("   Response size: %d → %d bytes\n", response_len, *new_len);
-    
-    return new_response;
+    if (!progressed && conn->timeout == TIMEOUT_SEND && timer_armed(&conn->timer)) return;
+    conn_set_timeout(conn, TIMEOUT_SEND, worker_config(conn->worker)->send_timeout_ms);
 }
 
-// Thread function to handle each client
-unsigned __stdcall handle_client_thread(void* arg) {
-    SOCKET client_fd = (SOCKET)(uintptr_t)arg;
-    char client_ip[INET_ADDRSTRLEN];
-    
-    get_client_ip(client_fd, client_ip, sizeof(client_ip));
-    printf("🔗 New client from %s\n", client_ip);
-    
-    // Read request with timeout
-    char buffer[16384];
-    int total_received = 0;
-    
-    // Set timeout for reading
-    int timeout = 10000; // 10 seconds
-    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
-    
-    // Read initial chunk
-    int n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (n <= 0) {
-        printf("❌ Failed to read from client %s\n", client_ip);
-        closesocket(client_fd);
-        return 0;
+static void snapshot_release(server_snapshot_t *snap) {
+    atomic_add(&snap->refs, -1);
+}
+
+static worker_view_t *worker_view_create(http_worker_t *worker, server_snapshot_t *snap) {
+    worker_view_t *view = calloc(1, sizeof(*view));
+    if (!view) return NULL;
+    view->snap = snap;
+    view->lb = upstream_lb_create(snap->upstream, (uint32_t)(worker->id + 1) * 2654435761u);
+    if (!view->lb) {
+        free(view);
+        return NULL;
     }
-    
-    total_received = n;
-    buffer[total_received] = '\0';
-    
-    // Check if we have complete headers
-    char* header_end = strstr(buffer, "\r\n\r\n");
-    if (!header_end) {
-        // Try to read more for headers
-        n = recv(client_fd, buffer + total_received, sizeof(buffer) - total_received - 1, 0);
-        if (n > 0) {
-            total_received += n;
-            buffer[total_received] = '\0';
-            header_end = strstr(buffer, "\r\n\r\n");
-        }
+    return view;
+}
+
+static void worker_view_free(worker_view_t *view) {
+    upstream_lb_destroy(view->lb);
+    snapshot_release(view->snap);
+    free(view);
+}
+
+// Switch to the current snapshot. Requests pinned to the old view finish
+// on it; it goes away with the last of them.
+static void worker_adopt_snapshot(http_worker_t *worker) {
+    mutex_lock(&g_snapshot_lock);
+    server_snapshot_t *snap = g_snapshot;
+    atomic_add(&snap->refs, 1);
+    mutex_unlock(&g_snapshot_lock);
+
+    worker_view_t *view = worker_view_create(worker, snap);
+    if (!view) {
+        snapshot_release(snap); // Retried on the next loop turn
+        return;
     }
-    
-    if (!header_end) {
-        printf("❌ Incomplete HTTP request from %s\n", client_ip);
-        closesocket(client_fd);
-        return 0;
+    worker_view_t *old = worker->view;
+    worker->view = view;
+    proxy_pool_configure(worker->pool, snap->config.pool_max_idle, snap->config.pool_idle_timeout_ms);
+    if (old->users == 0) worker_view_free(old);
+}
+
+static void conn_pin_view(http_conn_t *conn) {
+    if (conn->view) return;
+    conn->view = conn->worker->view;
+    conn->view->users++;
+}
+
+static void conn_unpin_view(http_conn_t *conn) {
+    worker_view_t *view = conn->view;
+    if (!view) return;
+    conn->view = NULL;
+    if (--view->users == 0 && view != conn->worker->view) worker_view_free(view);
+}
+
+static void worker_notify(http_worker_t *worker) {
+    int expected = 0;
+    if (atomic_cas(&worker->notify_pending, &expected, 1)) {
+        send(worker->notify_tx, "!", 1, 0);
     }
-    
-    // Check for POST/PUT body
-    char* content_length_str = strstr(buffer, "Content-Length:");
-    if (content_length_str && content_length_str < header_end) {
-        int content_length = 0;
-        sscanf(content_length_str, "Content-Length: %d", &content_length);
-        
-        if (content_length > 0) {
-            int headers_len = header_end - buffer + 4;
-            int body_received = total_received - headers_len;
-            
-            // Read remaining body if needed
-            while (body_received < content_length && total_received < sizeof(buffer) - 1) {
-                n = recv(client_fd, buffer + total_received, 
-                        min(content_length - body_received, sizeof(buffer) - total_received - 1), 0);
-                if (n <= 0) break;
-                total_received += n;
-                body_received += n;
-                buffer[total_received] = '\0';
-            }
-        }
+}
+
+// Wake the workers named in a cache waiter mask (bit = worker id % 64)
+static void cache_wake(uint64_t waiters) {
+    if (!waiters) return;
+    for (int i = 0; i < g_worker_count; i++) {
+        if (waiters & (1ull << (i & 63))) worker_notify(&g_workers[i]);
     }
-    
-    printf("📥 Received %d bytes from %s\n", total_received, client_ip);
-    
-    // Fix request headers
-    int fixed_request_len;
-    char* fixed_request = fix_request_headers(buffer, total_received, client_ip, &fixed_request_len);
-    
-    if (!fixed_request) {
-        printf("❌ Failed to fix request headers from %s\n", client_ip);
-        closesocket(client_fd);
-        return 0;
+}
+
+static void conn_wait_remove(http_conn_t *conn) {
+    if (conn->wait_prev) conn->wait_prev->wait_next = conn->wait_next;
+    else conn->worker->cache_waiters = conn->wait_next;
+    if (conn->wait_next) conn->wait_next->wait_prev = conn->wait_prev;
+    conn->wait_prev = conn->wait_next = NULL;
+}
+
+// Give up this request's cache fill, if any, and let its waiters retry
+static void conn_cache_abort(http_conn_t *conn, uint64_t pass_ttl_ms) {
+    free(conn->capture);
+    conn->capture = NULL;
+    if (!conn->cache_fill) return;
+    cache_wake(cache_abort(g_cache, conn->cache_fill, pass_ttl_ms, time_now_ms()));
+    conn->cache_fill = NULL;
+}
+
+// Request finished or abandoned: drop everything it held in the cache
+static void conn_cache_done(http_conn_t *conn) {
+    conn_cache_abort(conn, 0);
+    cache_release(conn->cache_entry);
+    conn->cache_entry = NULL;
+    conn->cache_revalidate = 0;
+    conn->cache_status = NULL;
+}
+
+static void conn_close(http_conn_t *conn) {
+    if (conn->state == CONN_CLOSED) return;
+    http_worker_t *worker = conn->worker;
+
+    if (conn->h2) h2_session_close(conn);
+    if (conn->state == CONN_CACHE_WAIT) conn_wait_remove(conn);
+    conn_cache_done(conn);
+    conn_clear_timeout(conn);
+
+    if (conn->upstream.fd != SOCK_INVALID) {
+        const upstream_backend_t *backend = conn_backend(conn);
+        event_loop_remove(worker->loop, &conn->upstream);
+        proxy_handler_release(worker->pool, conn->upstream.fd, backend->host, backend->port, 0);
+        upstream_lb_release(conn->view->lb, conn->backend);
+        conn->upstream.fd = SOCK_INVALID;
     }
-    
-    // Forward to backend
-    int resp_len;
-    unsigned char* backend_response = proxy_handler_forward(g_backend_host, g_backend_port, 
-                                                          fixed_request, fixed_request_len, &resp_len);
-    
-    free(fixed_request);
-    
-    if (backend_response && resp_len > 0) {
-        // Fix response headers
-        int fixed_response_len;
-        char* fixed_response = fix_response_headers((char*)backend_response, resp_len, &fixed_response_len);
-        
-        if (fixed_response) {
-            // Send fixed response to client
-            int sent = 0;
-            while (sent < fixed_response_len) {
-                int bytes_sent = send(client_fd, fixed_response + sent, fixed_response_len - sent, 0);
-                if (bytes_sent == SOCKET_ERROR) break;
-                sent += bytes_sent;
-            }
-            printf("📤 Sent %d bytes to %s\n", sent, client_ip);
-            free(fixed_response);
-        } else {
-            // Fallback: send original response
-            send(client_fd, (char*)backend_response, resp_len, 0);
-        }
-        
-        free(backend_response);
+
+    if (conn->stream) {
+        // No socket of its own: the stream ends through its session
+        h2_stream_close(conn);
+        conn->state = CONN_CLOSED;
+        conn->next_closed = worker->closed;
+        worker->closed = conn;
+        return;
+    }
+
+    event_loop_remove(worker->loop, &conn->client);
+    tls_conn_free(conn->tls);
+    conn->tls = NULL;
+    sock_close(conn->client.fd);
+    conn->client.fd = SOCK_INVALID;
+
+    conn->state = CONN_CLOSED;
+    if (conn->prev) conn->prev->next = conn->next;
+    else worker->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    conn->next_closed = worker->closed;
+    worker->closed = conn;
+    worker->active_conns--;
+    atomic_add(&g_open_conns, -1);
+    counter_add(&worker->metrics->connections_active, -1);
+    LOG_DEBUG("🔌 Closed connection to %s\n", conn->client_ip);
+}
+
+// Return a request buffer or response window; grown ones go back to malloc
+static void worker_buffer_put(http_worker_t *worker, char *buf, int cap) {
+    if (cap == g_io_buffer_size) slab_free(&worker->buffer_slab, buf);
+    else free(buf);
+}
+
+// Heap growth past the slab size, counted with the slab misses
+static void *worker_realloc(http_worker_t *worker, void *p, size_t size) {
+    counter_add(&worker->metrics->heap_allocs, 1);
+    return realloc(p, size);
+}
+
+static void conn_release_resp(http_conn_t *conn) {
+    worker_buffer_put(conn->worker, conn->resp, conn->resp_cap);
+    conn->resp = NULL;
+    conn->resp_cap = 0;
+}
+
+static void conn_release_encoder(http_conn_t *conn) {
+    compress_stream_put(&conn->worker->encoders, conn->encoder);
+    conn->encoder = NULL;
+    if (conn->zbuf) worker_buffer_put(conn->worker, conn->zbuf, g_io_buffer_size);
+    conn->zbuf = NULL;
+    conn->coding = COMPRESS_NONE;
+    conn->compress_unflushed = 0;
+    conn->compress_flush = 0;
+}
+
+#ifdef PLATFORM_HAS_SPLICE
+// An empty pipe goes back to the worker; one still holding bytes of an
+// abandoned response can't be reused and is closed
+static void conn_release_pipe(http_conn_t *conn) {
+    http_worker_t *worker = conn->worker;
+    conn->splicing = 0;
+    if (!conn->pipe_open) return;
+    if (conn->pipe_bytes == 0 && worker->pipe_count < SPLICE_POOL_SIZE) {
+        worker->pipes[worker->pipe_count++] = conn->pipe;
     } else {
-        // Send proper error response
-        const char* error_response = 
-            "HTTP/1.1 502 Bad Gateway\r\n"
-            "Content-Type: text/html\r\n"
-            "Content-Length: 136\r\n"
-            "Connection: close\r\n"
-            "Via: 1.1 reverse-proxy\r\n"
-            "\r\n"
-            "<html><body><h1>502 Bad Gateway</h1><p>The backend server is not available.</p><p>Proxy: Custom-Reverse-Proxy</p></body></html>";
-        
-        send(client_fd, error_response, strlen(error_response), 0);
-        printf("❌ Sent 502 error to %s\n", client_ip);
+        splice_pipe_close(&conn->pipe);
     }
-    
-    closesocket(client_fd);
-    printf("🔌 Closed connection to %s\n", client_ip);
+    conn->pipe_open = 0;
+    conn->pipe_bytes = 0;
+}
+#endif
+
+static void conn_free(http_conn_t *conn) {
+    http_worker_t *worker = conn->worker;
+    conn_clear_timeout(conn);   // The wheel must never hold a freed block
+    worker_buffer_put(worker, conn->in, conn->in_cap);
+    conn_release_resp(conn);
+    conn_release_encoder(conn);
+#ifdef PLATFORM_HAS_SPLICE
+    conn_release_pipe(conn);
+#endif
+    conn_unpin_view(conn);
+    if (conn->h2) h2_session_free(conn->h2);
+    if (conn->stream) h2_stream_free(worker, conn->stream);
+    slab_free(&worker->conn_slab, conn);
+}
+
+// Client I/O goes through the TLS layer when the listener terminates TLS,
+// and through the session for an HTTP/2 stream
+static int conn_client_recv(http_conn_t *conn, char *buf, int len) {
+    if (conn->stream) return h2_stream_recv(conn, buf, len);
+    if (conn->tls) return tls_recv(conn->tls, buf, len);
+    return recv(conn->client.fd, buf, len, 0);
+}
+
+static int sendv_tls(void *arg, sock_iov_t *iov, int count) {
+    return tls_sendv(arg, iov, count);
+}
+
+// Write what is left of the 100 Continue. Same contract as
+// http_out_send(): 1 once sent, 0 to wait, -1 on error.
+static int conn_send_continue(http_conn_t *conn) {
+    while (conn->continue_left > 0) {
+        sock_iov_t iov;
+        SOCK_IOV_BASE(iov) = (char *)CONTINUE_RESPONSE + sizeof(CONTINUE_RESPONSE) - 1 - conn->continue_left;
+        SOCK_IOV_LEN(iov) = conn->continue_left;
+        int n = conn->tls ? tls_sendv(conn->tls, &iov, 1) : sock_sendv(conn->client.fd, &iov, 1);
+        if (n < 0) return sock_would_block() ? 0 : -1;
+        conn->continue_left -= n;
+        counter_add(&conn->worker->metrics->client_bytes_out, n);
+    }
+    return 1;
+}
+
+// http_out_send() of the client's queue
+static int conn_client_send(http_conn_t *conn) {
+    // A 100 Continue cut short is finished ahead of the response; one not
+    // started yet is no longer owed
+    if (conn->continue_left == (int)sizeof(CONTINUE_RESPONSE) - 1) conn->continue_left = 0;
+    if (conn->continue_left > 0) {
+        int r = conn_send_continue(conn);
+        if (r <= 0) return r;
+    }
+    if (conn->stream) return http_out_write(&conn->out, sendv_h2_stream, conn);
+    if (conn->tls) return http_out_write(&conn->out, sendv_tls, conn->tls);
+    return http_out_send(&conn->out, conn->client.fd);
+}
+
+static int conn_client_tls(const http_conn_t *conn) {
+    return conn->tls || (conn->stream && conn->stream->session->tls);
+}
+
+// Reply with a canned response that has no relayed body
+static void conn_respond_static(http_conn_t *conn, const char *response, int len) {
+    http_out_reset(&conn->out);
+    http_out_add(&conn->out, response, len);
+    conn->status = atoi(response + 9);  // "HTTP/1.1 NNN"
+    conn->bytes_sent = 0;
+    conn->write_start_us = time_now_us();
+    conn->keep_alive = 0;
+    conn->resp_start = conn->resp_end = 0;
+    conn->body_done = 1;
+    conn->state = CONN_WRITE_RESPONSE;
+}
+
+static void upstream_detach(http_conn_t *conn, int keep_alive) {
+    if (conn->upstream.fd == SOCK_INVALID) return;
+    const upstream_backend_t *backend = conn_backend(conn);
+    event_loop_remove(conn->worker->loop, &conn->upstream);
+    proxy_handler_release(conn->worker->pool, conn->upstream.fd, backend->host, backend->port, keep_alive);
+    upstream_lb_release(conn->view->lb, conn->backend);
+    conn->upstream.fd = SOCK_INVALID;
+}
+
+static void upstream_fail(http_conn_t *conn) {
+    upstream_detach(conn, 0);
+    conn_cache_abort(conn, 0);
+    conn_clear_timeout(conn);
+    LOG_WARN("❌ Sent 502 error to %s\n", conn->client_ip);
+    conn_respond_static(conn, BAD_GATEWAY_RESPONSE, sizeof(BAD_GATEWAY_RESPONSE) - 1);
+}
+
+// The backend failed the exchange: count it against its circuit breaker
+static void upstream_fail_backend(http_conn_t *conn) {
+    counter_add(&conn->worker->metrics->upstream_failures, 1);
+    upstream_report(conn_upstream(conn), conn->backend, 0);
+    upstream_fail(conn);
+}
+
+static void on_upstream_event(io_watch_t *watch, uint32_t events);
+static int conn_pick_backend(http_conn_t *conn);
+static int conn_queue_request(http_conn_t *conn);
+
+// Acquire a backend socket and register it with this worker's loop
+static int upstream_attach(http_conn_t *conn) {
+    if (!conn->resp) {
+        conn->resp = slab_alloc(&conn->worker->buffer_slab);
+        if (!conn->resp) return -1;
+        conn->resp_cap = g_io_buffer_size;
+    }
+
+    const upstream_backend_t *backend = conn_backend(conn);
+    worker_metrics_t *metrics = conn->worker->metrics;
+    int connected, reused;
+    conn->connect_start_us = time_now_us();
+    sock_t sock = proxy_handler_connect(conn->worker->pool, backend->host, backend->port, &backend->addr,
+                                        &connected, &reused);
+    if (sock == SOCK_INVALID) return -1;
+
+    conn->upstream.fd = sock;
+    conn->upstream.handler = on_upstream_event;
+    conn->upstream.data = conn;
+    if (event_loop_add(conn->worker->loop, &conn->upstream, EV_READ | EV_WRITE) != 0) {
+        proxy_handler_release(conn->worker->pool, sock, backend->host, backend->port, 0);
+        conn->upstream.fd = SOCK_INVALID;
+        return -1;
+    }
+    upstream_lb_acquire(conn->view->lb, conn->backend);
+    counter_add(reused ? &metrics->pool_hits : &metrics->pool_misses, 1);
+    if (connected && !reused) metrics_stage(metrics, STAGE_UPSTREAM_CONNECT, conn->connect_start_us, time_now_us());
+
+    conn->upstream_reused = reused;
+    conn->upstream_state = connected ? UPSTREAM_SENDING : UPSTREAM_CONNECTING;
+    if (connected) conn_clear_timeout(conn);
+    else conn_set_timeout(conn, TIMEOUT_CONNECT, conn_config(conn)->connect_timeout_ms);
+    conn->resp_start = conn->resp_end = 0;
+    http_message_init(&conn->resp_msg, HTTP_MESSAGE_RESPONSE);
     return 0;
 }
 
-void start_http_server(int listen_port, const char *backend_host, int backend_port) {
-    WSADATA wsa;
-    SOCKET server_fd;
-    struct sockaddr_in server_addr, client_addr;
-    int addrlen = sizeof(client_addr);
-    
-    // Store backend info globally
-    strcpy(g_backend_host, backend_host);
-    g_backend_port = backend_port;
-    
-    if (WSAStartup(MAKEWORD(2,2), &wsa) != 0) {
-        printf("❌ WSAStartup failed: %d\n", WSAGetLastError());
-        return;
+// Connecting to the chosen backend failed (refused, timed out): count it
+// against the backend and move the request to another one before giving up.
+// Nothing has been sent, so the retry is safe for any method.
+static void upstream_connect_failed(http_conn_t *conn) {
+    counter_add(&conn->worker->metrics->upstream_failures, 1);
+    upstream_report(conn_upstream(conn), conn->backend, 0);
+    upstream_detach(conn, 0);
+
+    while (++conn->upstream_tries < MAX_UPSTREAM_TRIES && conn_pick_backend(conn) == 0) {
+        if (conn_queue_request(conn) == 0 && upstream_attach(conn) == 0) return;
+        upstream_report(conn_upstream(conn), conn->backend, 0);
     }
-    
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
-        printf("❌ Socket failed: %d\n", WSAGetLastError());
-        WSACleanup();
-        return;
+    upstream_fail(conn);
+}
+
+// Queue the rewritten request for the backend (again, on a retry)
+static int conn_queue_request(http_conn_t *conn) {
+    const char *etag = NULL;
+    int etag_len = 0;
+    if (conn->cache_revalidate) {
+        const http_header_t *h = http_message_header(&conn->cache_fill->msg, HTTP_HDR_ETAG);
+        etag = conn->cache_fill->data + h->value.off;
+        etag_len = h->value.len;
     }
-    
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
-    
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(listen_port);
-    
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-        printf("❌ Bind failed: %d\n", WSAGetLastError());
-        closesocket(server_fd);
-        WSACleanup();
-        return;
+
+    http_out_reset(&conn->out);
+    if (fix_request_headers(&conn->req, conn->in, conn->content_length, conn->client_ip, conn_client_tls(conn),
+                            conn_backend(conn), etag, etag_len, &conn->out) != 0) {
+        LOG_WARN("❌ Failed to fix request headers from %s\n", conn->client_ip);
+        return -1;
     }
-    
-    if (listen(server_fd, 100) == SOCKET_ERROR) {
-        printf("❌ Listen failed: %d\n", WSAGetLastError());
-        closesocket(server_fd);
-        WSACleanup();
-        return;
+    return 0;
+}
+
+// Choose the backend for this request among those whose circuit breaker
+// lets traffic through. Returns -1 when every backend is ejected.
+static int conn_pick_backend(http_conn_t *conn) {
+    uint64_t now = time_now_ms();
+    if (conn_upstream(conn)->hash_key == LB_KEY_URI) {
+        conn->backend = upstream_lb_pick(conn->view->lb, conn->in + conn->req.target.off, conn->req.target.len, now);
+    } else {
+        conn->backend = upstream_lb_pick(conn->view->lb, conn->client_ip, strlen(conn->client_ip), now);
     }
-    
-    printf("🚀 Threaded proxy with proper headers listening on port %d\n", listen_port);
-    printf("📡 Forwarding to %s:%d with header fixes\n", backend_host, backend_port);
-    printf("🔧 Features: X-Forwarded-For, proper Host header, hop-by-hop filtering\n");
-    
-    while (1) {
-        SOCKET client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &addrlen);
-        if (client_fd == INVALID_SOCKET) {
-            continue;
+    return conn->backend < 0 ? -1 : 0;
+}
+
+// True if the client's If-None-Match lists the entry's ETag
+static int cache_etag_matches(const http_conn_t *conn, const cache_entry_t *entry) {
+    const http_header_t *inm = http_message_header(&conn->req, HTTP_HDR_IF_NONE_MATCH);
+    const http_header_t *etag = http_message_header(&entry->msg, HTTP_HDR_ETAG);
+    if (!inm || !etag) return 0;
+    if (http_span_equals(conn->in, inm->value, "*")) return 1;
+
+    char tag[256];
+    if (etag->value.len + 2 >= sizeof(tag)) return 0;
+    memcpy(tag + 2, entry->data + etag->value.off, etag->value.len);
+    tag[etag->value.len + 2] = '\0';
+    if (http_value_has_token(conn->in, inm->value, tag + 2)) return 1;
+
+    // Compressed copies went out with the tag weakened; If-None-Match
+    // compares weakly anyway
+    memcpy(tag, "W/", 2);
+    return http_value_has_token(conn->in, inm->value, tag);
+}
+
+// Coding to compress a response body with for this client, if any. length
+// is the body size when known, else -1.
+static compress_coding_t conn_response_coding(const http_conn_t *conn, const http_message_t *msg,
+                                              const char *buf, int64_t length) {
+    const http_server_config_t *config = conn_config(conn);
+    const http_header_t *accept = http_message_header(&conn->req, HTTP_HDR_ACCEPT_ENCODING);
+    if (!config->compress_codings || !accept || conn->head_request) return COMPRESS_NONE;
+    if (length >= 0 && length < config->compress_min_size) return COMPRESS_NONE;
+    if (!compress_response_eligible(msg, buf, config->compress_types)) return COMPRESS_NONE;
+    return compress_negotiate(conn->in, accept->value, config->compress_codings);
+}
+
+// Compressed copy of a cached body, made by the first request that wants
+// it and shared by every later hit. NULL to send the body as stored.
+static const cache_variant_t *conn_cache_variant(http_conn_t *conn, cache_entry_t *entry, compress_coding_t coding) {
+    const cache_variant_t *found = atomic_get(&entry->variants[coding]);
+    if (found) return found;
+
+    worker_metrics_t *metrics = conn->worker->metrics;
+    const char *body = entry->data + entry->msg.header_len;
+    size_t len = entry->data_len - entry->msg.header_len;
+    char *payload = NULL;
+    if (entry->msg.chunked) {
+        // Stored with the backend's framing
+        int payload_len;
+        http_chunked_t chunks;
+        http_chunked_init(&chunks);
+        counter_add(&metrics->heap_allocs, 1);
+        payload = len <= INT_MAX ? malloc(len ? len : 1) : NULL;
+        if (!payload) return NULL;
+        memcpy(payload, body, len);
+        if (http_chunked_decode(&chunks, payload, (int)len, &payload_len) < 0) {
+            free(payload);
+            return NULL;
         }
-        
-        // Create thread to handle client
-        uintptr_t thread_handle = _beginthreadex(NULL, 0, handle_client_thread, 
-                                               (void*)(uintptr_t)client_fd, 0, NULL);
-        if (thread_handle) {
-            CloseHandle((HANDLE)thread_handle);
-        } else {
-            // Fallback to synchronous handling
-            handle_client_thread((void*)(uintptr_t)client_fd);
+        body = payload;
+        len = payload_len;
+    }
+
+    // Past what either coding grows incompressible input to
+    size_t cap = len + len / 16 + 1024;
+    counter_add(&metrics->heap_allocs, 1);
+    cache_variant_t *variant = malloc(sizeof(*variant) + cap);
+    long n = variant ? compress_buffer(coding, conn_config(conn)->compress_cache_level, body, len, variant->data, cap)
+                     : -1;
+    free(payload);
+    if (n < 0) {
+        free(variant);
+        return NULL;
+    }
+    counter_add(&metrics->compress_bytes_in, len);
+    counter_add(&metrics->compress_bytes_out, n);
+    cache_variant_t *shrunk = realloc(variant, sizeof(*variant) + n);
+    if (shrunk) variant = shrunk;
+    variant->len = (size_t)n;
+    return cache_add_variant(g_cache, entry, coding, variant);
+}
+
+// 304 for a conditional request the cached entry satisfies
+static int queue_not_modified(const http_conn_t *conn, const cache_entry_t *entry, int age, http_out_t *out) {
+    int r = http_out_literal(out, "HTTP/1.1 304 Not Modified\r\n");
+    for (int i = 0; i < entry->msg.header_count; i++) {
+        const http_header_t *h = &entry->msg.headers[i];
+        if (h->id == HTTP_HDR_ETAG || h->id == HTTP_HDR_CACHE_CONTROL || h->id == HTTP_HDR_VARY) {
+            r |= out_add_header(out, entry->data, h);
         }
     }
-    
-    closesocket(server_fd);
-    WSACleanup();
-}
\ No newline at end of file
+    r |= http_out_literal(out, "Via: 1.1 reverse-proxy\r\n"
+                              "X-Cache: HIT\r\n");
+    r |= http_out_printf(out, "Age: %d\r\n", age);
+    if (conn->keep_alive) r |= http_out_literal(out, "Connection: keep-alive\r\n\r\n");
+    else r |= http_out_literal(out, "Connection: close\r\n\r\n");
+    return r;
+}
+
+// Answer from a cache entry; the reference is kept until the response
+// has been sent, since the body goes out straight from the entry
+static void conn_serve_cached(http_conn_t *conn, cache_entry_t *entry, const char *status, uint64_t now) {
+    const http_message_t *msg = &entry->msg;
+    uint64_t stored_at = atomic_get(&entry->stored_at);
+    int age = now > stored_at ? (int)((now - stored_at) / 1000) : 0;
+    size_t body_len = conn->head_request ? 0 : entry->data_len - msg->header_len;
+    int r;
+
+    conn->cache_entry = entry;
+    conn->cache_status = status;
+    conn->status = msg->status;
+    conn->write_start_us = time_now_us();
+    http_out_reset(&conn->out);
+    if (cache_etag_matches(conn, entry)) {
+        r = queue_not_modified(conn, entry, age, &conn->out);
+        conn->status = 304;
+        body_len = 0;
+    } else {
+        const http_header_t *host = http_message_header(&conn->req, HTTP_HDR_HOST);
+        compress_coding_t coding = conn_response_coding(conn, msg, entry->data, (int64_t)body_len);
+        const cache_variant_t *variant = coding != COMPRESS_NONE ? conn_cache_variant(conn, entry, coding) : NULL;
+        r = fix_response_headers(msg, entry->data, conn->keep_alive, entry->backend_host, entry->backend_port,
+                                 host ? conn->in + host->value.off : NULL, host ? (int)host->value.len : 0,
+                                 conn_client_tls(conn), status, age, RECODE_NONE, variant ? coding : COMPRESS_NONE,
+                                 variant ? (int64_t)variant->len : -1, &conn->out);
+        if (variant) {
+            counter_add(&conn->worker->metrics->compressed_responses, 1);
+            body_len = variant->len;
+            r |= http_out_add(&conn->out, variant->data, body_len);
+        } else {
+            r |= http_out_add(&conn->out, entry->data + msg->header_len, body_len);
+        }
+    }
+    if (r != 0) {
+        conn_close(conn);
+        return;
+    }
+
+    LOG_DEBUG("💾 Cache %s for %s (age %ds)\n", status, conn->client_ip, age);
+    conn->resp_start = conn->resp_end = 0;
+    conn->body_done = 1;
+    conn->bytes_sent = (int64_t)body_len;
+    conn_clear_timeout(conn);
+    conn->state = CONN_WRITE_RESPONSE;
+}
+
+// Park the request until the fetch it is waiting on completes
+static void conn_cache_wait(http_conn_t *conn) {
+    http_worker_t *worker = conn->worker;
+    conn->state = CONN_CACHE_WAIT;
+    conn_set_timeout(conn, TIMEOUT_CACHE_WAIT, CACHE_WAIT_TIMEOUT_MS);
+    conn->wait_prev = NULL;
+    conn->wait_next = worker->cache_waiters;
+    if (worker->cache_waiters) worker->cache_waiters->wait_prev = conn;
+    worker->cache_waiters = conn;
+}
+
+// Answer from the cache or queue behind a fetch of the same key. Returns
+// 1 if the request was taken care of, 0 to forward it (as the cache fill
+// if it now owns one).
+static int conn_cache_lookup(http_conn_t *conn) {
+    const http_request_t *req = &conn->req;
+    int get = http_span_equals(conn->in, req->method, "GET");
+    if (!get && !conn->head_request) return 0;
+
+    // Key: Host value followed by the target
+    char key[CACHE_KEY_MAX];
+    const http_header_t *host = http_message_header(req, HTTP_HDR_HOST);
+    uint32_t host_len = host ? host->value.len : 0;
+    uint32_t key_len = host_len + req->target.len;
+    if (key_len > sizeof(key)) return 0;
+    if (host) memcpy(key, conn->in + host->value.off, host_len);
+    memcpy(key + host_len, conn->in + req->target.off, req->target.len);
+
+    // Conditional requests may be answered from a fresh entry, but a 304
+    // from the backend can't populate one
+    int conditional = http_message_header(req, HTTP_HDR_IF_NONE_MATCH) ||
+                      http_message_header(req, HTTP_HDR_IF_MODIFIED_SINCE);
+    uint64_t now = time_now_ms();
+    cache_entry_t *entry;
+
+    switch (cache_lookup(g_cache, key, key_len, req, conn->in, get && !conditional,
+                         conn->worker->id, now, &entry)) {
+    case CACHE_HIT:
+        conn_serve_cached(conn, entry, "HIT", now);
+        return 1;
+    case CACHE_WAIT:
+        conn_cache_wait(conn);
+        return 1;
+    case CACHE_FILL:
+        conn->cache_fill = entry;
+        conn->cache_status = entry->state == CACHE_ENTRY_READY ? "EXPIRED" : "MISS";
+        return 0;
+    case CACHE_REVALIDATE:
+        conn->cache_fill = entry;
+        conn->cache_revalidate = 1;
+        conn->cache_status = "EXPIRED";
+        return 0;
+    case CACHE_PASS:
+        conn->cache_status = "PASS";
+        return 0;
+    case CACHE_BYPASS:
+    default:
+        conn->cache_status = "BYPASS";
+        return 0;
+    }
+}
+
+// Serve the request from the cache or send it to a backend
+static void conn_dispatch(http_conn_t *conn, int use_cache) {
+    conn->state = CONN_FORWARD;
+    conn_clear_timeout(conn);
+    if (use_cache && conn_cache_lookup(conn)) return;
+
+    conn->upstream_start_us = time_now_us();
+    conn->upstream_retried = 0;
+    conn->upstream_tries = 0;
+
+    // Answer at once instead of waiting on a backend known to be down
+    if (conn_pick_backend(conn) != 0) {
+        LOG_WARN("❌ No healthy backend in upstream '%s'\n", conn_upstream(conn)->name);
+        upstream_fail(conn);
+        return;
+    }
+
+    // Fix request headers
+    if (conn_queue_request(conn) != 0) {
+        conn_close(conn);
+        return;
+    }
+
+    if (upstream_attach(conn) != 0) {
+        upstream_connect_failed(conn);
+    }
+}
+
+static void conn_start_forward(http_conn_t *conn) {
+    int total = conn->header_len + conn->content_length;
+    worker_metrics_t *metrics = conn->worker->metrics;
+    counter_add(&metrics->requests, 1);
+    metrics_stage(metrics, STAGE_CLIENT_READ, conn->read_start_us, time_now_us());
+    LOG_DEBUG("📥 Received %d bytes from %s\n", total, conn->client_ip);
+
+    conn->head_request = http_span_equals(conn->in, conn->req.method, "HEAD");
+    conn_dispatch(conn, g_cache != NULL);
+}
+
+static void conn_capture(http_conn_t *conn, const char *data, int n);
+static void conn_capture_commit(http_conn_t *conn);
+
+// Account for n freshly received body bytes at resp_start. Bytes past the
+// end of the message are dropped and the backend connection is not reused.
+// A cache fill captures the bytes as the backend framed them.
+static int response_body_consume(http_conn_t *conn, int n) {
+    char *data = conn->resp + conn->resp_start;
+    int keep = n;
+
+    switch (conn->body_framing) {
+    case BODY_NONE:
+        keep = 0;
+        break;
+    case BODY_LENGTH:
+        if (keep > conn->body_remaining) keep = (int)conn->body_remaining;
+        conn->body_remaining -= keep;
+        if (conn->capture) conn_capture(conn, data, keep);
+        break;
+    case BODY_CHUNKED:
+        if (conn->recode != RECODE_NONE) {
+            // Framing is stripped in place, so capture comes first
+            int payload;
+            if (conn->capture) conn_capture(conn, data, n);
+            keep = http_chunked_decode(&conn->chunked, data, n, &payload);
+            if (keep < 0) return -1;
+            if (conn->capture) conn->capture_len -= n - keep;
+            if (keep < n) conn->upstream_keep_alive = 0;
+            keep = n = payload;
+            conn->resp_end = conn->resp_start + payload;
+            break;
+        }
+        keep = http_chunked_scan(&conn->chunked, data, n);
+        if (keep < 0) return -1;
+        if (conn->capture) conn_capture(conn, data, keep);
+        break;
+    case BODY_UNTIL_CLOSE:
+        break;
+    }
+
+    if (keep < n) {
+        conn->resp_end = conn->resp_start + keep;
+        conn->upstream_keep_alive = 0;
+    }
+
+    if (conn->body_framing == BODY_NONE ||
+        (conn->body_framing == BODY_LENGTH && conn->body_remaining == 0) ||
+        (conn->body_framing == BODY_CHUNKED && http_chunked_done(&conn->chunked))) {
+        conn->body_done = 1;
+        metrics_stage(conn->worker->metrics, STAGE_UPSTREAM_BODY, conn->upstream_headers_us, time_now_us());
+        if (conn->capture) conn_capture_commit(conn);
+        // Backend is free as soon as its message ends, even if the client
+        // is still draining the window
+        upstream_detach(conn, conn->upstream_keep_alive);
+    }
+    return 0;
+}
+
+// Start storing the response this request fills the cache with, or mark
+// the key uncacheable for a while so requests stop queueing behind it
+static void conn_capture_begin(http_conn_t *conn) {
+    const http_message_t *msg = &conn->resp_msg;
+    size_t max = cache_max_entry(g_cache);
+    uint64_t ttl = cache_response_ttl(msg, conn->resp);
+
+    if (ttl == 0 || msg->header_len > max ||
+        (conn->body_framing != BODY_LENGTH && conn->body_framing != BODY_CHUNKED) ||
+        (conn->body_framing == BODY_LENGTH && (uint64_t)conn->body_remaining > max - msg->header_len)) {
+        conn_cache_abort(conn, CACHE_PASS_TTL_MS);
+        return;
+    }
+
+    // Handed to the cache on commit, so it can't come from the slab
+    size_t cap = msg->header_len + (conn->body_framing == BODY_LENGTH ? (size_t)conn->body_remaining
+                                                                      : (size_t)g_io_buffer_size);
+    counter_add(&conn->worker->metrics->heap_allocs, 1);
+    conn->capture = malloc(cap ? cap : 1);
+    if (!conn->capture) {
+        conn_cache_abort(conn, 0);
+        return;
+    }
+    memcpy(conn->capture, conn->resp, msg->header_len);
+    conn->capture_len = msg->header_len;
+    conn->capture_cap = cap;
+    conn->capture_ttl = ttl;
+    conn->capture_vary = cache_vary_hash(msg, conn->resp, &conn->req, conn->in);
+}
+
+// Copy relayed body bytes into the capture
+static void conn_capture(http_conn_t *conn, const char *data, int n) {
+    if (conn->capture_len + n > conn->capture_cap) {
+        size_t max = cache_max_entry(g_cache);
+        size_t cap = conn->capture_cap * 2;
+        if (cap < conn->capture_len + n) cap = conn->capture_len + n;
+        if (cap > max) cap = max;
+        char *capture = conn->capture_len + n <= cap ? worker_realloc(conn->worker, conn->capture, cap) : NULL;
+        if (!capture) {
+            conn_cache_abort(conn, CACHE_PASS_TTL_MS);
+            return;
+        }
+        conn->capture = capture;
+        conn->capture_cap = cap;
+    }
+    memcpy(conn->capture + conn->capture_len, data, n);
+    conn->capture_len += n;
+}
+
+// The body has ended: store the capture
+static void conn_capture_commit(http_conn_t *conn) {
+    const upstream_backend_t *backend = conn_backend(conn);
+    cache_wake(cache_commit(g_cache, conn->cache_fill, conn->capture, conn->capture_len, backend->host, backend->port,
+                            conn->capture_ttl, conn->capture_vary, time_now_ms()));
+    conn->capture = NULL;
+    conn->cache_fill = NULL;
+}
+
+// Compress the body for this client if the response and settings allow.
+// The encoder output goes out chunked, or close-delimited to HTTP/1.0.
+static void conn_begin_compress(http_conn_t *conn) {
+    const http_message_t *msg = &conn->resp_msg;
+    http_worker_t *worker = conn->worker;
+    if (conn->body_framing == BODY_NONE || (msg->has_transfer_encoding && !msg->chunked)) return;
+
+    int64_t length = conn->body_framing == BODY_LENGTH ? conn->body_remaining : -1;
+    compress_coding_t coding = conn_response_coding(conn, msg, conn->resp, length);
+    if (coding == COMPRESS_NONE) return;
+    conn->encoder = compress_stream_get(&worker->encoders, coding, conn_config(conn)->compress_level);
+    conn->zbuf = slab_alloc(&worker->buffer_slab);
+    if (!conn->encoder || !conn->zbuf) {
+        conn_release_encoder(conn); // Sent as is
+        return;
+    }
+
+    conn->coding = coding;
+    if (conn->req.minor_version >= 1) {
+        conn->recode = RECODE_CHUNK;
+    } else {
+        conn->recode = RECODE_UNCHUNK;
+        conn->keep_alive = 0;
+    }
+    counter_add(&worker->metrics->compressed_responses, 1);
+}
+
+// Run the encoder over what is left of the window and queue its output.
+// zbuf is referenced by out until sent, so this only runs again once out
+// has drained; if zbuf filled up, the window isn't used up yet and
+// conn_compress_pending() says so. The op is FINISH once the backend body
+// has ended, and FLUSH while flushing before a wait on the backend.
+static int conn_queue_compressed(http_conn_t *conn) {
+    worker_metrics_t *metrics = conn->worker->metrics;
+    compress_op_t op = conn->body_done ? COMPRESS_FINISH : conn->compress_flush ? COMPRESS_FLUSH : COMPRESS_PROCESS;
+    size_t in_len = conn->resp_end - conn->resp_start;
+    int n = compress_stream_run(conn->encoder, op, conn->resp + conn->resp_start, &in_len,
+                                conn->zbuf, g_io_buffer_size);
+    if (n < 0) return -1;
+    conn->resp_start += (int)in_len;
+    if (in_len > 0) conn->compress_unflushed = 1;
+    int complete = !compress_stream_pending(conn->encoder);
+    if (op != COMPRESS_PROCESS && complete) {
+        conn->compress_unflushed = 0;
+        conn->compress_flush = 0;
+    }
+    counter_add(&metrics->compress_bytes_in, in_len);
+    counter_add(&metrics->compress_bytes_out, n);
+    conn->bytes_sent += n;
+
+    if (conn->recode == RECODE_CHUNK) {
+        if (http_chunked_encode(&conn->out, conn->zbuf, n) != 0) return -1;
+        if (op == COMPRESS_FINISH && complete && http_chunked_finish(&conn->out) != 0) return -1;
+    } else if (n > 0 && http_out_add(&conn->out, conn->zbuf, n) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int conn_compress_pending(const http_conn_t *conn) {
+    return conn->encoder && (conn->resp_start < conn->resp_end || compress_stream_pending(conn->encoder));
+}
+
+// Queue the unsent part of the response window behind whatever is pending
+static int conn_queue_window(http_conn_t *conn) {
+    if (conn->encoder) return conn_queue_compressed(conn);
+    int n = conn->resp_end - conn->resp_start;
+    if (conn->recode == RECODE_CHUNK) {
+        if (http_chunked_encode(&conn->out, conn->resp + conn->resp_start, n) != 0) return -1;
+    } else if (http_out_add(&conn->out, conn->resp + conn->resp_start, n) != 0) {
+        return -1;
+    }
+    conn->resp_start = conn->resp_end;
+    conn->bytes_sent += n;
+    return 0;
+}
+
+#ifdef PLATFORM_HAS_SPLICE
+// Relay the rest of the body with splice when it is passed through as is
+// and large enough to pay for the pipe: no recoding, nothing to capture,
+// and over TLS only once the kernel does the encryption
+static void conn_begin_splice(http_conn_t *conn) {
+    http_worker_t *worker = conn->worker;
+    if (!conn_config(conn)->splice || conn->stream || conn->body_done || conn->recode != RECODE_NONE || conn->capture ||
+        conn->upstream.fd == SOCK_INVALID || (conn->tls && !tls_kernel_send(conn->tls))) return;
+    if (conn->body_framing == BODY_LENGTH) {
+        if (conn->body_remaining < SPLICE_MIN_BODY) return;
+    } else if (conn->body_framing != BODY_UNTIL_CLOSE) {
+        return;
+    }
+
+    if (worker->pipe_count > 0) {
+        conn->pipe = worker->pipes[--worker->pipe_count];
+    } else if (splice_pipe_open(&conn->pipe) != 0) {
+        return; // Out of descriptors: copy instead
+    }
+    conn->pipe_open = 1;
+    conn->pipe_bytes = 0;
+    conn->splicing = 1;
+}
+
+// conn_relay_response() for a spliced body: the header block and any body
+// bytes read with it go out from `out` first, then each round splices
+// backend -> pipe and pipe -> client. Only the pipe's worth of data is
+// ever in flight, so a slow client still throttles the backend.
+static int conn_relay_splice(http_conn_t *conn) {
+    worker_metrics_t *metrics = conn->worker->metrics;
+    int progressed = 0;
+    while (1) {
+        if (http_out_pending(&conn->out)) {
+            size_t pending = conn->out.remaining;
+            int r = conn_client_send(conn);
+            counter_add(&metrics->client_bytes_out, pending - conn->out.remaining);
+            if (r == 0) conn_wait_client(conn, conn->out.remaining < pending);
+            if (r <= 0) return r;
+            progressed = 1;
+        }
+
+        if (conn->pipe_bytes > 0) {
+            int n = sock_splice(conn->pipe.rd, (int)conn->client.fd, conn->pipe_bytes);
+            if (n < 0 && sock_would_block()) {
+                conn_wait_client(conn, progressed);
+                return 0;
+            }
+            if (n <= 0) return -1;
+            progressed = 1;
+            conn->pipe_bytes -= n;
+            conn->bytes_sent += n;
+            counter_add(&metrics->client_bytes_out, n);
+            counter_add(&metrics->client_bytes_spliced, n);
+            continue;
+        }
+
+        if (conn->body_done) return 1;
+        if (conn->upstream.fd == SOCK_INVALID) return -1;
+
+        size_t want = SPLICE_PIPE_SIZE;
+        if (conn->body_framing == BODY_LENGTH && (int64_t)want > conn->body_remaining) {
+            want = (size_t)conn->body_remaining;
+        }
+        int n = sock_splice((int)conn->upstream.fd, conn->pipe.wr, want);
+        if (n < 0 && sock_would_block()) {
+            conn_set_timeout(conn, TIMEOUT_RESPONSE, conn_config(conn)->response_timeout_ms);
+            return 0;
+        }
+        if (n <= 0) {
+            if (conn->body_framing != BODY_UNTIL_CLOSE) return -1; // Truncated by backend
+            conn->body_done = 1;
+            metrics_stage(metrics, STAGE_UPSTREAM_BODY, conn->upstream_headers_us, time_now_us());
+            upstream_detach(conn, 0);
+            continue;
+        }
+
+        conn->pipe_bytes += n;
+        counter_add(&metrics->upstream_bytes_in, n);
+        if (conn->body_framing == BODY_LENGTH) {
+            conn->body_remaining -= n;
+            if (conn->body_remaining == 0) {
+                conn->body_done = 1;
+                metrics_stage(metrics, STAGE_UPSTREAM_BODY, conn->upstream_headers_us, time_now_us());
+                upstream_detach(conn, conn->upstream_keep_alive);
+            }
+        }
+    }
+}
+#endif
+
+// Backend header block is complete: rewrite it and decide body framing
+static int conn_begin_response(http_conn_t *conn) {
+    const http_message_t *msg = &conn->resp_msg;
+    int status = msg->status;
+
+    uint64_t now_us = time_now_us();
+    conn->upstream_keep_alive = !msg->conn_close && (msg->minor_version >= 1 || msg->conn_keep_alive);
+    conn->upstream_us = (int64_t)(now_us - conn->upstream_start_us);
+    conn->upstream_headers_us = now_us;
+    conn->write_start_us = now_us;
+    metrics_stage(conn->worker->metrics, STAGE_UPSTREAM_TTFB, conn->ttfb_start_us, now_us);
+    conn->status = status;
+    upstream_report(conn_upstream(conn), conn->backend, 1);
+
+    if (conn->cache_revalidate && status == 304) {
+        // Stale entry confirmed: extend it and answer from it
+        cache_entry_t *entry = conn->cache_fill;
+        uint64_t now = time_now_ms();
+        conn->cache_fill = NULL;
+        conn->cache_revalidate = 0;
+        upstream_detach(conn, conn->upstream_keep_alive && msg->header_len == (uint32_t)conn->resp_end);
+        cache_wake(cache_refresh(g_cache, entry, cache_response_ttl(&entry->msg, entry->data), now));
+        conn_serve_cached(conn, entry, "REVALIDATED", now);
+        return 0;
+    }
+
+    conn->body_done = 0;
+    conn->recode = RECODE_NONE;
+    int client_http11 = conn->req.minor_version >= 1;
+    if (conn->head_request || status / 100 == 1 || status == 204 || status == 304) {
+        conn->body_framing = BODY_NONE;
+    } else if (msg->chunked) {
+        conn->body_framing = BODY_CHUNKED;
+        http_chunked_init(&conn->chunked);
+        if (!client_http11) {
+            // HTTP/1.0 has no chunked coding: strip it and end with the close
+            conn->recode = RECODE_UNCHUNK;
+            conn->keep_alive = 0;
+        }
+    } else if (msg->content_length >= 0 && !msg->has_transfer_encoding) {
+        conn->body_framing = BODY_LENGTH;
+        conn->body_remaining = msg->content_length;
+    } else {
+        conn->body_framing = BODY_UNTIL_CLOSE;
+        conn->upstream_keep_alive = 0;
+        // Chunk it so an HTTP/1.1 client keeps its connection; anyone else
+        // can only find the end of this body by the close
+        if (client_http11 && !msg->has_transfer_encoding) conn->recode = RECODE_CHUNK;
+        else conn->keep_alive = 0;
+    }
+
+    conn_begin_compress(conn);
+    if (conn->cache_fill) conn_capture_begin(conn);
+
+    // Fix response headers
+    http_out_reset(&conn->out);
+    const http_header_t *host = http_message_header(&conn->req, HTTP_HDR_HOST);
+    const upstream_backend_t *backend = conn_backend(conn);
+    if (fix_response_headers(msg, conn->resp, conn->keep_alive, backend->host, backend->port,
+                             host ? conn->in + host->value.off : NULL, host ? (int)host->value.len : 0,
+                             conn_client_tls(conn), conn->cache_status, -1, conn->recode, conn->coding, -1, &conn->out) != 0) return -1;
+
+    // Body bytes that arrived with the headers go out in the same write
+    conn->resp_start = msg->header_len;
+    conn->bytes_sent = 0;
+    conn->state = CONN_WRITE_RESPONSE;
+    if (response_body_consume(conn, conn->resp_end - conn->resp_start) != 0) return -1;
+    if (conn_queue_window(conn) != 0) return -1;
+#ifdef PLATFORM_HAS_SPLICE
+    conn_begin_splice(conn);
+#endif
+    return 0;
+}
+
+// Decide whether the client connection survives this request
+static int request_keep_alive(const http_conn_t *conn) {
+    const http_request_t *req = &conn->req;
+    if (conn->stream) return 0;     // A stream ends with its response
+    if (conn->requests_served + 1 >= conn_config(conn)->max_keep_alive_requests) return 0;
+    if (conn->worker->draining) return 0;
+
+    if (req->conn_close) return 0;
+    if (req->minor_version == 0) return req->conn_keep_alive;
+    return 1;
+}
+
+// Frame the body bytes that arrived since the last scan. Bytes past the
+// end of the body belong to the next request and stay where they are.
+// Returns 0, or the canned response to reject the request with.
+static const char *conn_scan_upload(http_conn_t *conn) {
+    int start = conn->header_len + conn->content_length;
+    int n = conn->in_len - start;
+
+    if (conn->req_framing == BODY_LENGTH) {
+        if (n > conn->req_body_left) n = (int)conn->req_body_left;
+        conn->req_body_left -= n;
+        conn->req_body_done = conn->req_body_left == 0;
+    } else {
+        n = http_chunked_scan(&conn->req_chunks, conn->in + start, n);
+        if (n < 0) {
+            LOG_WARN("❌ Malformed chunked upload from %s\n", conn->client_ip);
+            return BAD_REQUEST_RESPONSE;
+        }
+        conn->req_body_done = http_chunked_done(&conn->req_chunks);
+    }
+    conn->content_length += n;
+    conn->req_body_bytes += n;
+
+    // Content-Length was checked up front; chunked bodies are counted as
+    // they arrive, framing included
+    uint64_t max_body_size = conn_config(conn)->max_body_size;
+    if (max_body_size && conn->req_body_bytes > max_body_size) {
+        LOG_WARN("❌ Upload from %s exceeds the body size limit\n", conn->client_ip);
+        return TOO_LARGE_RESPONSE;
+    }
+    return NULL;
+}
+
+static void conn_reject(http_conn_t *conn, const char *response) {
+    conn_respond_static(conn, response, (int)strlen(response));
+}
+
+// Decide how the request body is framed and check it may be sent.
+// Returns NULL or the canned response to reject the request with.
+static const char *conn_begin_upload(http_conn_t *conn) {
+    const http_request_t *req = &conn->req;
+
+    conn->content_length = 0;
+    conn->req_body_bytes = 0;
+    conn->req_body_streamed = 0;
+    conn->req_body_done = 1;
+    conn->continue_left = 0;
+    conn->req_framing = BODY_NONE;
+    if (req->has_transfer_encoding) {
+        // Without chunked last there is no way to find the body's end
+        if (!req->chunked) return BAD_REQUEST_RESPONSE;
+        // Both headers get a request smuggled past any backend that trusts
+        // Content-Length over the chunked framing (RFC 9112 6.3)
+        if (http_message_header(req, HTTP_HDR_CONTENT_LENGTH)) return BAD_REQUEST_RESPONSE;
+        conn->req_framing = BODY_CHUNKED;
+        conn->req_body_done = 0;
+        http_chunked_init_strict(&conn->req_chunks);
+    } else if (req->content_length > 0) {
+        uint64_t max_body_size = conn_config(conn)->max_body_size;
+        if (max_body_size && (uint64_t)req->content_length > max_body_size) return TOO_LARGE_RESPONSE;
+        conn->req_framing = BODY_LENGTH;
+        conn->req_body_left = req->content_length;
+        conn->req_body_done = 0;
+    }
+
+    // The proxy wants every body it accepts, so it answers the expectation
+    // itself instead of waiting for the backend (the header is not forwarded)
+    const http_header_t *expect = http_message_header(req, HTTP_HDR_EXPECT);
+    if (expect && req->minor_version >= 1) {
+        if (!http_span_iequals(conn->in, expect->value, "100-continue")) return EXPECTATION_FAILED_RESPONSE;
+        if (!conn->req_body_done && conn->in_len == conn->header_len) {
+            // Whatever the socket doesn't take now goes out as the body is
+            // read, or ahead of the response
+            conn->continue_left = sizeof(CONTINUE_RESPONSE) - 1;
+            conn_send_continue(conn);
+        }
+    }
+
+    return conn->req_framing == BODY_NONE ? NULL : conn_scan_upload(conn);
+}
+
+// Rate limits, one token per request from the client address's bucket and
+// then the global one. Returns NULL or the canned response to refuse with.
+static const char *conn_admit(http_conn_t *conn) {
+    const http_server_config_t *config = conn_config(conn);
+    worker_metrics_t *metrics = conn->worker->metrics;
+    uint64_t now = time_now_ms();
+    if (config->rate_limit_client_rps > 0 &&
+        !rate_limiter_take(g_client_limits, conn->client_ip, strlen(conn->client_ip), config->rate_limit_client_rps,
+                           config->rate_limit_client_burst, now)) {
+        LOG_DEBUG("🚦 Rate limited %s\n", conn->client_ip);
+        counter_add(&metrics->limited_client, 1);
+        return TOO_MANY_REQUESTS_RESPONSE;
+    }
+    if (config->rate_limit_global_rps > 0 &&
+        !rate_bucket_take(&g_global_bucket, config->rate_limit_global_rps, config->rate_limit_global_burst, now)) {
+        LOG_DEBUG("🚦 Over the global rate, refused %s\n", conn->client_ip);
+        counter_add(&metrics->limited_global, 1);
+        return SERVICE_UNAVAILABLE_RESPONSE;
+    }
+    return NULL;
+}
+
+// Look at what is buffered so far. Returns 1 once the request head is in
+// (the body streams behind it), 0 when more bytes are needed, -1 if the
+// request was rejected.
+static int conn_parse_request(http_conn_t *conn) {
+    // Resumes where the previous read left off
+    int r = http_parse(&conn->req, conn->in, conn->in_len);
+    if (r == HTTP_PARSE_AGAIN) return 0;
+    conn->request_start_us = time_now_us();
+    conn->upstream_us = -1;
+    if (r == HTTP_PARSE_ERROR) {
+        LOG_WARN("❌ Malformed HTTP request from %s\n", conn->client_ip);
+        conn_respond_static(conn, BAD_REQUEST_RESPONSE, sizeof(BAD_REQUEST_RESPONSE) - 1);
+        return -1;
+    }
+
+    conn->header_len = conn->req.header_len;
+    conn_pin_view(conn);
+    conn->keep_alive = request_keep_alive(conn);
+    const char *reject = conn_admit(conn);
+    if (!reject) reject = conn_begin_upload(conn);
+    if (reject) {
+        conn_reject(conn, reject);
+        return -1;
+    }
+    return 1;
+}
+
+// TLS handshake ahead of the first request, bounded by the header
+// timeout armed at accept. Returns 1 once done, 0 to wait, -1 after closing.
+static int conn_tls_handshake(http_conn_t *conn) {
+    worker_metrics_t *metrics = conn->worker->metrics;
+    int r = tls_handshake(conn->tls);
+    if (r == 0) return 0;
+    if (r < 0) {
+        LOG_DEBUG("❌ TLS handshake with %s failed\n", conn->client_ip);
+        counter_add(&metrics->tls_handshake_failures, 1);
+        conn_close(conn);
+        return -1;
+    }
+    conn->tls_ready = 1;
+    counter_add(tls_resumed(conn->tls) ? &metrics->tls_resumed : &metrics->tls_handshakes, 1);
+    if (tls_kernel_send(conn->tls)) counter_add(&metrics->tls_kernel, 1);
+    return 1;
+}
+
+// Prior-knowledge HTTP/2 opens a plain connection with its preface.
+// Returns 1 if this one did, 0 if it still may, -1 for HTTP/1.x.
+static int conn_h2_preface(const http_conn_t *conn) {
+    if (conn->requests_served > 0 || conn->stream || conn->tls || !worker_config(conn->worker)->http2) return -1;
+    return h2_preface_match(conn->in, conn->in_len);
+}
+
+static int conn_h2_begin(http_conn_t *conn);
+
+// Returns 1 when the request is complete, 0 to wait, -1 after closing
+static int conn_read_request(http_conn_t *conn) {
+    if (conn->tls && !conn->tls_ready) {
+        int r = conn_tls_handshake(conn);
+        if (r <= 0) return r;
+        if (tls_alpn_h2(conn->tls)) return conn_h2_begin(conn);
+    }
+    while (1) {
+        // Pipelined requests may already be sitting in the buffer
+        if (conn->in_len > 0) {
+            int h2 = conn_h2_preface(conn);
+            if (h2 > 0) return conn_h2_begin(conn);
+            if (h2 < 0) {
+                int r = conn_parse_request(conn);
+                if (r != 0) return r > 0 ? 1 : 0;
+            }
+        }
+
+        if (!conn->in) {
+            conn->in = slab_alloc(&conn->worker->buffer_slab);
+            if (!conn->in) {
+                conn_close(conn);
+                return -1;
+            }
+            conn->in_cap = g_io_buffer_size;
+        }
+
+        if (conn->in_len == conn->in_cap) {
+            if (conn->in_cap >= worker_config(conn->worker)->max_request_header_size) {
+                conn_respond_static(conn, TOO_LARGE_RESPONSE, sizeof(TOO_LARGE_RESPONSE) - 1);
+                return 0;
+            }
+            int cap = conn->in_cap * 2;
+            char *in = worker_realloc(conn->worker, conn->in, cap);
+            if (!in) {
+                conn_close(conn);
+                return -1;
+            }
+            conn->in = in;
+            conn->in_cap = cap;
+        }
+
+        int n = conn_client_recv(conn, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n <= 0) {
+            if (n < 0 && sock_would_block()) return 0;
+            if (conn->in_len > 0) LOG_WARN("❌ Incomplete HTTP request from %s\n", conn->client_ip);
+            conn_close(conn);
+            return -1;
+        }
+
+        conn->in_len += n;
+        counter_add(&conn->worker->metrics->client_bytes_in, n);
+        if (!conn->read_start_us) conn->read_start_us = time_now_us();
+
+        // The idle wait is over; the whole head must now arrive in time
+        if (conn->timeout == TIMEOUT_KEEP_ALIVE) {
+            conn_set_timeout(conn, TIMEOUT_HEADER, worker_config(conn->worker)->request_timeout_ms);
+        }
+    }
+}
+
+// Response fully delivered: wait for the next request on this connection,
+// keeping any pipelined bytes that arrived behind the current one. Buffers
+// the idle connection doesn't need go back to the worker's slab.
+static void conn_reset_for_next_request(http_conn_t *conn) {
+    int consumed = conn->header_len + conn->content_length;
+    int leftover = conn->in_len - consumed;
+    conn_cache_done(conn);
+    conn_release_resp(conn);
+    conn_release_encoder(conn);
+#ifdef PLATFORM_HAS_SPLICE
+    conn_release_pipe(conn);
+#endif
+    conn_unpin_view(conn);
+    if (leftover == 0) {
+        worker_buffer_put(conn->worker, conn->in, conn->in_cap);
+        conn->in = NULL;
+        conn->in_cap = 0;
+    } else if (conn->in_cap != g_io_buffer_size && leftover <= g_io_buffer_size) {
+        // Shrink a buffer grown for a large request back to slab size
+        char *in = slab_alloc(&conn->worker->buffer_slab);
+        if (in) {
+            memcpy(in, conn->in + consumed, leftover);
+            free(conn->in);
+            conn->in = in;
+            conn->in_cap = g_io_buffer_size;
+            consumed = 0;
+        }
+    }
+    if (leftover > 0 && consumed > 0) memmove(conn->in, conn->in + consumed, leftover);
+    conn->in_len = leftover;
+    conn->read_start_us = leftover > 0 ? time_now_us() : 0;
+
+    http_message_init(&conn->req, HTTP_MESSAGE_REQUEST);
+    conn->header_len = 0;
+    conn->content_length = 0;
+    conn->requests_served++;
+    if (leftover > 0) conn_set_timeout(conn, TIMEOUT_HEADER, worker_config(conn->worker)->request_timeout_ms);
+    else conn_set_timeout(conn, TIMEOUT_KEEP_ALIVE, worker_config(conn->worker)->keep_alive_timeout_ms);
+    conn->state = CONN_READ_HEADERS;
+}
+
+// Read until the backend header block is complete.
+// Returns 1 when complete, 0 to wait, -1 on failure.
+static int upstream_read_headers(http_conn_t *conn) {
+    while (1) {
+        if (conn->resp_end > 0) {
+            int r = http_parse(&conn->resp_msg, conn->resp, conn->resp_end);
+            if (r == HTTP_PARSE_ERROR) return -1;
+            if (r == HTTP_PARSE_DONE) {
+                int status = conn->resp_msg.status;
+                if (status / 100 != 1 || status == 101) return 1;
+
+                // Drop interim 1xx responses; the final one follows
+                int consumed = conn->resp_msg.header_len;
+                memmove(conn->resp, conn->resp + consumed, conn->resp_end - consumed);
+                conn->resp_end -= consumed;
+                http_message_init(&conn->resp_msg, HTTP_MESSAGE_RESPONSE);
+                continue;
+            }
+        }
+
+        if (conn->resp_end == conn->resp_cap) {
+            if (conn->resp_cap >= conn_config(conn)->max_response_header_size) return -1;
+            int cap = conn->resp_cap * 2;
+            char *resp = worker_realloc(conn->worker, conn->resp, cap);
+            if (!resp) return -1;
+            conn->resp = resp;
+            conn->resp_cap = cap;
+        }
+
+        int n = recv(conn->upstream.fd, conn->resp + conn->resp_end,
+                     conn->resp_cap - conn->resp_end, 0);
+        if (n < 0 && sock_would_block()) return 0;
+        if (n <= 0) return -1;
+        conn->resp_end += n;
+        counter_add(&conn->worker->metrics->upstream_bytes_in, n);
+    }
+}
+
+// Send the queued request, then stream the rest of the body one window at
+// a time: the window is only refilled from the client once the backend has
+// taken it, so a slow backend throttles the client and an upload of any
+// size uses one buffer. Returns 1 once everything is sent, 0 to wait, -1
+// if the backend failed and -2 if the client did (the connection was
+// answered or closed).
+static int upstream_send_request(http_conn_t *conn) {
+    // The client holds the body back until it sees the 100 Continue
+    if (conn->continue_left > 0 && conn_send_continue(conn) < 0) {
+        conn_close(conn);
+        return -2;
+    }
+    while (1) {
+        size_t pending = conn->out.remaining;
+        int r = http_out_send(&conn->out, conn->upstream.fd);
+        counter_add(&conn->worker->metrics->upstream_bytes_out, pending - conn->out.remaining);
+        if (r == 0) conn_set_timeout(conn, TIMEOUT_RESPONSE, conn_config(conn)->response_timeout_ms);
+        if (r <= 0) return r;
+        if (conn->req_body_done) return 1;
+
+        // Everything buffered was body and has been sent. Append while
+        // there is room, so a body that fits stays replayable for a retry,
+        // then start the window over behind the head.
+        if (conn->in_cap - conn->in_len < MIN_UPLOAD_WINDOW) {
+            if (conn->in_cap - conn->header_len < MIN_UPLOAD_WINDOW) {
+                char *in = worker_realloc(conn->worker, conn->in, conn->in_cap * 2);
+                if (!in) {
+                    conn_close(conn);
+                    return -2;
+                }
+                conn->in = in;
+                conn->in_cap *= 2;
+            } else {
+                conn->in_len = conn->header_len;
+                conn->content_length = 0;
+                conn->req_body_streamed = 1;
+            }
+        }
+
+        int n = conn_client_recv(conn, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n < 0 && sock_would_block()) {
+            conn_set_timeout(conn, TIMEOUT_BODY, conn_config(conn)->body_timeout_ms);
+            return 0;
+        }
+        if (n <= 0) {
+            LOG_WARN("❌ Incomplete request body from %s\n", conn->client_ip);
+            conn_close(conn);
+            return -2;
+        }
+        int start = conn->header_len + conn->content_length;
+        conn->in_len += n;
+        counter_add(&conn->worker->metrics->client_bytes_in, n);
+
+        const char *reject = conn_scan_upload(conn);
+        if (reject) {
+            // Part of the body is already with the backend: drop that exchange
+            upstream_detach(conn, 0);
+            conn_cache_abort(conn, 0);
+            conn_reject(conn, reject);
+            return -2;
+        }
+        int body_end = conn->header_len + conn->content_length;
+        if (http_out_add(&conn->out, conn->in + start, body_end - start) != 0) return -1;
+    }
+}
+
+static void conn_forward(http_conn_t *conn) {
+    if (conn->upstream_state == UPSTREAM_CONNECTING) return; // Wait for writability
+
+    if (conn->upstream_state == UPSTREAM_SENDING) {
+        int r = upstream_send_request(conn);
+        if (r == 0 || r == -2) return;
+        if (r < 0) {
+            if (conn->upstream_reused) upstream_fail(conn);
+            else upstream_fail_backend(conn);
+            return;
+        }
+        conn->upstream_state = UPSTREAM_READ_HEADERS;
+        conn->ttfb_start_us = time_now_us();
+        conn_set_timeout(conn, TIMEOUT_RESPONSE, conn_config(conn)->response_timeout_ms);
+    }
+
+    int r = upstream_read_headers(conn);
+    if (r == 0) return;
+    if (r < 0) {
+        // A pooled socket the backend already closed: retry once on a fresh one
+        if (conn->upstream_reused && !conn->upstream_retried && conn->resp_end == 0 &&
+            !conn->req_body_streamed) {
+            conn->upstream_retried = 1;
+            upstream_detach(conn, 0);
+            if (conn_queue_request(conn) == 0 && upstream_attach(conn) == 0) {
+                conn_forward(conn);
+            } else {
+                upstream_connect_failed(conn);
+            }
+            return;
+        }
+        upstream_fail_backend(conn);
+        return;
+    }
+    if (conn_begin_response(conn) != 0) {
+        upstream_fail_backend(conn);
+    }
+}
+
+// Stream the rewritten headers and then the body window to the client,
+// refilling the window from the backend only when it has drained.
+// Returns 1 when the response is fully sent, 0 to wait, -1 on error.
+static int conn_relay_response(http_conn_t *conn) {
+#ifdef PLATFORM_HAS_SPLICE
+    if (conn->splicing) return conn_relay_splice(conn);
+#endif
+    while (1) {
+        if (http_out_pending(&conn->out)) {
+            size_t pending = conn->out.remaining;
+            int r = conn_client_send(conn);
+            counter_add(&conn->worker->metrics->client_bytes_out, pending - conn->out.remaining);
+            if (r == 0) conn_wait_client(conn, conn->out.remaining < pending);
+            if (r <= 0) return r;
+        }
+
+        if (conn_compress_pending(conn)) {
+            if (conn_queue_compressed(conn) != 0) return -1;
+            continue;
+        }
+        if (conn->body_done) return 1;
+        if (conn->upstream.fd == SOCK_INVALID) return -1;
+
+        // Window drained: refill from backend
+        int want = conn->resp_cap;
+        if (conn->body_framing == BODY_LENGTH && want > conn->body_remaining) {
+            want = (int)conn->body_remaining;
+        }
+        conn->resp_start = conn->resp_end = 0;
+
+        int n = recv(conn->upstream.fd, conn->resp, want, 0);
+        if (n < 0 && sock_would_block()) {
+            // Backend went quiet: what the encoder holds goes out meanwhile
+            if (conn->compress_unflushed) {
+                conn->compress_flush = 1;
+                if (conn_queue_compressed(conn) != 0) return -1;
+                continue;
+            }
+            conn_set_timeout(conn, TIMEOUT_RESPONSE, conn_config(conn)->response_timeout_ms);
+            return 0;
+        }
+        if (n <= 0) {
+            if (conn->body_framing != BODY_UNTIL_CLOSE) return -1; // Truncated by backend
+            conn->body_done = 1;
+            if (conn->encoder) {
+                if (conn_queue_compressed(conn) != 0) return -1;
+            } else if (conn->recode == RECODE_CHUNK && http_chunked_finish(&conn->out) != 0) {
+                return -1;
+            }
+            metrics_stage(conn->worker->metrics, STAGE_UPSTREAM_BODY, conn->upstream_headers_us, time_now_us());
+            upstream_detach(conn, 0);
+            continue;
+        }
+
+        conn->resp_end = n;
+        counter_add(&conn->worker->metrics->upstream_bytes_in, n);
+        if (response_body_consume(conn, n) != 0) return -1;
+        if (conn_queue_window(conn) != 0) return -1;
+    }
+}
+
+static metrics_cache_result_t cache_result(const char *status) {
+    switch (status[0]) {
+    case 'H': return CACHE_RESULT_HIT;
+    case 'M': return CACHE_RESULT_MISS;
+    case 'E': return CACHE_RESULT_EXPIRED;
+    case 'R': return CACHE_RESULT_REVALIDATED;
+    case 'P': return CACHE_RESULT_PASS;
+    default: return CACHE_RESULT_BYPASS;
+    }
+}
+
+// Response fully delivered: account for it in this worker's metrics
+static void conn_count_response(http_conn_t *conn) {
+    worker_metrics_t *metrics = conn->worker->metrics;
+    uint64_t now = time_now_us();
+    int status_class = conn->status / 100;
+
+    metrics_stage(metrics, STAGE_CLIENT_WRITE, conn->write_start_us, now);
+    metrics_stage(metrics, STAGE_TOTAL, conn->request_start_us, now);
+    counter_add(&metrics->responses[status_class >= 1 && status_class <= 5 ? status_class : 0], 1);
+    if (conn->cache_status) counter_add(&metrics->cache[cache_result(conn->cache_status)], 1);
+}
+
+static void copy_span(char *dst, size_t cap, const char *buf, http_span_t span) {
+    size_t len = span.len < cap - 1 ? span.len : cap - 1;
+    memcpy(dst, buf + span.off, len);
+    dst[len] = '\0';
+}
+
+// Hand the finished request to the access log writer
+static void conn_log_access(http_conn_t *conn) {
+    if (!g_access_log) return;
+    access_log_entry_t *e = access_log_reserve(g_access_log, conn->worker->id);
+    if (!e) return;
+
+    e->time = (int64_t)time(NULL);
+    memcpy(e->client_ip, conn->client_ip, sizeof(conn->client_ip));
+    copy_span(e->method, sizeof(e->method), conn->in, conn->req.method);
+    copy_span(e->path, sizeof(e->path), conn->in, conn->req.target);
+    e->status = conn->status;
+    e->bytes = conn->bytes_sent;
+    e->upstream_us = conn->upstream_us;
+    e->total_us = (int64_t)(time_now_us() - conn->request_start_us);
+    e->upstream_host = conn->upstream_us >= 0 ? conn_backend(conn)->host : NULL;
+    e->upstream_port = conn->upstream_us >= 0 ? conn_backend(conn)->port : 0;
+    e->cache = conn->cache_status;
+    access_log_commit(g_access_log, conn->worker->id);
+}
+
+static void on_conn_timeout(timer_entry_t *timer);
+
+// Give up on the session from wherever the failure shows: streams stop
+// writing at once and the session closes on the next timer tick, outside
+// their call stacks
+static void h2_session_fail(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    if (s->failed) return;
+    s->failed = 1;
+    if (!s->closing) conn_set_timeout(session, TIMEOUT_KEEP_ALIVE, 0);
+}
+
+// Move wbuf to the socket. Returns 1 once it is empty, 0 to wait for
+// writability, -1 on a socket error.
+static int h2_flush(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    if (s->failed) return -1;
+    int progressed = 0;
+    while (1) {
+        if (!http_out_pending(&session->out)) {
+            if (s->wbuf_queued == s->wbuf_len) {
+                s->wbuf_len = s->wbuf_queued = 0;
+                if (session->timeout == TIMEOUT_SEND && s->stream_count > 0) conn_clear_timeout(session);
+                return 1;
+            }
+            http_out_reset(&session->out);
+            http_out_add(&session->out, (const char *)s->wbuf + s->wbuf_queued, s->wbuf_len - s->wbuf_queued);
+            s->wbuf_queued = s->wbuf_len;
+        }
+        size_t pending = session->out.remaining;
+        int r = conn_client_send(session);
+        if (r < 0) {
+            h2_session_fail(session);
+            return -1;
+        }
+        if (session->out.remaining < pending) progressed = 1;
+        // With streams open the session has no deadline of its own but
+        // this one; without, keep-alive covers it
+        if (r == 0) {
+            if (s->stream_count > 0 && !s->closing) conn_wait_client(session, progressed);
+            return 0;
+        }
+    }
+}
+
+// Frames queued outside the session's own turn go out right away
+static void h2_kick(http_conn_t *session) {
+    if (!session->h2->driving) h2_flush(session);
+}
+
+// Room for len bytes at the end of wbuf, flushing first if needed
+static uint8_t *h2_reserve(http_conn_t *session, int len) {
+    h2_session_t *s = session->h2;
+    if (s->wbuf_cap - s->wbuf_len < len) h2_flush(session);
+    if (s->wbuf_cap - s->wbuf_len < len) return NULL;
+    uint8_t *p = s->wbuf + s->wbuf_len;
+    s->wbuf_len += len;
+    return p;
+}
+
+// Queue a frame. One that doesn't fit even in the reserve means the
+// client keeps sending without reading: the session is given up.
+static void h2_queue_frame(http_conn_t *session, uint8_t type, uint8_t flags, uint32_t stream_id,
+                           const void *payload, int len) {
+    uint8_t *p = h2_reserve(session, H2_FRAME_HEADER_SIZE + len);
+    if (!p) {
+        h2_session_fail(session);
+        return;
+    }
+    h2_frame_write(p, (uint32_t)len, type, flags, stream_id);
+    if (len > 0) memcpy(p + H2_FRAME_HEADER_SIZE, payload, len);
+}
+
+static void h2_queue_rst(http_conn_t *session, uint32_t stream_id, h2_error_t code) {
+    uint8_t payload[4];
+    h2_put32(payload, code);
+    h2_queue_frame(session, H2_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+    counter_add(&session->worker->metrics->h2_streams_reset, 1);
+}
+
+static void h2_queue_window_update(http_conn_t *session, uint32_t stream_id, uint32_t increment) {
+    uint8_t payload[4];
+    h2_put32(payload, increment);
+    h2_queue_frame(session, H2_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+// No streams past those already opened
+static void h2_queue_goaway(http_conn_t *session, h2_error_t code) {
+    h2_session_t *s = session->h2;
+    uint8_t payload[8];
+    h2_put32(payload, s->last_stream);
+    h2_put32(payload + 4, code);
+    h2_queue_frame(session, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    s->goaway_sent = 1;
+}
+
+// HEADERS, continued in CONTINUATION frames past the frame size. wbuf
+// must have room for all of them.
+static void h2_write_block(h2_session_t *s, uint32_t stream_id, const uint8_t *block, int len, int end_stream) {
+    uint8_t type = H2_HEADERS;
+    uint8_t flags = end_stream ? H2_FLAG_END_STREAM : 0;
+    do {
+        int n = len < H2_DEFAULT_FRAME_SIZE ? len : H2_DEFAULT_FRAME_SIZE;
+        len -= n;
+        uint8_t *p = s->wbuf + s->wbuf_len;
+        h2_frame_write(p, (uint32_t)n, type, flags | (len == 0 ? H2_FLAG_END_HEADERS : 0), stream_id);
+        memcpy(p + H2_FRAME_HEADER_SIZE, block, n);
+        s->wbuf_len += H2_FRAME_HEADER_SIZE + n;
+        block += n;
+        type = H2_CONTINUATION;
+        flags = 0;
+    } while (len > 0);
+}
+
+// The proxy takes every body it accepts, so 100-continue is answered at once
+static void h2_queue_continue(http_conn_t *session, uint32_t stream_id) {
+    h2_session_t *s = session->h2;
+    uint8_t block[HPACK_FIELD_BOUND(7, 3)];
+    size_t len = 0;
+    hpack_encode(&s->encoder, ":status", 7, "100", 3, HPACK_INDEX, block, sizeof(block), &len);
+    h2_queue_frame(session, H2_HEADERS, H2_FLAG_END_HEADERS, stream_id, block, (int)len);
+}
+
+static int h2_error(http_conn_t *session, h2_error_t code) {
+    session->h2->error = code;
+    return -1;
+}
+
+static http_conn_t *h2_find(const h2_session_t *s, uint32_t stream_id) {
+    for (http_conn_t *conn = s->streams; conn; conn = conn->next) {
+        if (conn->stream->id == stream_id) return conn;
+    }
+    return NULL;
+}
+
+// n bytes of DATA were taken by a backend, or will never be (st NULL):
+// reopen the windows once half of one is used
+static void h2_consumed(http_conn_t *session, h2_stream_t *st, int n) {
+    h2_session_t *s = session->h2;
+    int queued = 0;
+    s->recv_consumed += n;
+    if (s->recv_consumed >= H2_CONN_WINDOW / 2) {
+        h2_queue_window_update(session, 0, (uint32_t)s->recv_consumed);
+        s->recv_window += s->recv_consumed;
+        s->recv_consumed = 0;
+        queued = 1;
+    }
+    if (st && !st->remote_closed) {
+        st->recv_consumed += n;
+        if (st->recv_consumed >= H2_STREAM_WINDOW / 2) {
+            h2_queue_window_update(session, st->id, (uint32_t)st->recv_consumed);
+            st->recv_window += st->recv_consumed;
+            st->recv_consumed = 0;
+            queued = 1;
+        }
+    }
+    if (queued) h2_kick(session);
+}
+
+// Wait for a turn from the session
+static void h2_stream_wait(http_conn_t *conn) {
+    h2_stream_t *st = conn->stream;
+    h2_session_t *s = st->session->h2;
+    if (st->queued) return;
+    st->queued = 1;
+    st->ready_next = NULL;
+    if (s->ready_tail[st->urgency]) s->ready_tail[st->urgency]->stream->ready_next = conn;
+    else s->ready[st->urgency] = conn;
+    s->ready_tail[st->urgency] = conn;
+}
+
+static void h2_stream_unwait(http_conn_t *conn) {
+    h2_stream_t *st = conn->stream;
+    h2_session_t *s = st->session->h2;
+    if (!st->queued) return;
+    http_conn_t *prev = NULL;
+    for (http_conn_t *c = s->ready[st->urgency]; c != conn; c = c->stream->ready_next) prev = c;
+    if (prev) prev->stream->ready_next = st->ready_next;
+    else s->ready[st->urgency] = st->ready_next;
+    if (s->ready_tail[st->urgency] == conn) s->ready_tail[st->urgency] = prev;
+    st->queued = 0;
+}
+
+// conn_client_recv() of a stream: the DATA buffered so far, chunk framed
+// when the head says so
+static int h2_stream_recv(http_conn_t *conn, char *buf, int len) {
+    h2_stream_t *st = conn->stream;
+    if (st->body_len == 0) {
+        if (st->reset || st->session->h2->failed) {
+            sock_set_would_block(0);
+            return -1;
+        }
+        if (!st->remote_closed || (st->body_chunked && !st->body_final && len < 5)) {
+            sock_set_would_block(1);
+            return -1;
+        }
+        if (!st->body_chunked || st->body_final) return 0;
+        st->body_final = 1;
+        memcpy(buf, "0\r\n\r\n", 5);
+        return 5;
+    }
+
+    int take = st->body_len;
+    int n;
+    if (st->body_chunked) {
+        if (take > len - H2_CHUNK_OVERHEAD) take = len - H2_CHUNK_OVERHEAD;
+        if (take <= 0) {
+            sock_set_would_block(1);
+            return -1;
+        }
+        n = sprintf(buf, "%x\r\n", (unsigned)take);
+        memcpy(buf + n, st->body + st->body_start, take);
+        memcpy(buf + n + take, "\r\n", 2);
+        n += take + 2;
+    } else {
+        if (take > len) take = len;
+        memcpy(buf, st->body + st->body_start, take);
+        n = take;
+    }
+    st->body_start += take;
+    st->body_len -= take;
+    if (st->body_len == 0) st->body_start = 0;
+    h2_consumed(st->session, st, take);
+    return n;
+}
+
+static int h2_stream_buffer(http_conn_t *conn, const uint8_t *data, int len) {
+    h2_stream_t *st = conn->stream;
+    if (st->body_start + st->body_len + len > st->body_cap) {
+        if (st->body_len > 0) memmove(st->body, st->body + st->body_start, st->body_len);
+        st->body_start = 0;
+    }
+    if (st->body_len + len > st->body_cap) {
+        // Flow control keeps it within the stream window
+        int cap = st->body_cap ? st->body_cap : H2_BODY_BUFFER_MIN;
+        while (cap < st->body_len + len) cap *= 2;
+        char *body = worker_realloc(conn->worker, st->body, cap);
+        if (!body) return -1;
+        st->body = body;
+        st->body_cap = cap;
+    }
+    memcpy(st->body + st->body_start + st->body_len, data, len);
+    st->body_len += len;
+    return 0;
+}
+
+// Queue the parsed response head as HEADERS once wbuf has room for the
+// whole block, which must go out in one piece. Returns 1 when queued, 0 to
+// wait, -1 on failure.
+static int h2_stream_headers(http_conn_t *conn) {
+    h2_stream_t *st = conn->stream;
+    http_conn_t *session = st->session;
+    h2_session_t *s = session->h2;
+    const http_message_t *msg = &st->msg;
+
+    int bound = (int)H2_RESPONSE_BLOCK_BOUND(msg);
+    int need = bound + (bound / H2_DEFAULT_FRAME_SIZE + 1) * H2_FRAME_HEADER_SIZE;
+    if (s->wbuf_cap - H2_CONTROL_RESERVE - s->wbuf_len < need) {
+        h2_flush(session);
+        if (s->wbuf_len == 0 && s->wbuf_cap - H2_CONTROL_RESERVE < need) {
+            uint8_t *wbuf = worker_realloc(session->worker, s->wbuf, need + H2_CONTROL_RESERVE);
+            if (!wbuf) return -1;
+            s->wbuf = wbuf;
+            s->wbuf_cap = need + H2_CONTROL_RESERVE;
+        }
+        if (s->wbuf_cap - H2_CONTROL_RESERVE - s->wbuf_len < need) return 0;
+    }
+    if (s->hbuf_cap < bound) {
+        uint8_t *hbuf = worker_realloc(session->worker, s->hbuf, bound);
+        if (!hbuf) return -1;
+        s->hbuf = hbuf;
+        s->hbuf_cap = bound;
+    }
+    long len = h2_response_block(&s->encoder, msg, st->head, s->hbuf, bound);
+    if (len < 0) return -1;
+
+    int end = 0;
+    if (conn->head_request || msg->status == 204 || msg->status == 304) {
+        end = 1;
+    } else if (msg->chunked) {
+        st->out_state = H2_OUT_CHUNKED;
+        http_chunked_init(&st->out_chunks);
+    } else if (msg->content_length >= 0 && !msg->has_transfer_encoding) {
+        st->out_state = H2_OUT_LENGTH;
+        st->out_remaining = msg->content_length;
+        end = st->out_remaining == 0;
+    } else {
+        st->out_state = H2_OUT_UNTIL_CLOSE;
+    }
+    if (end) st->out_state = H2_OUT_DONE;
+    h2_write_block(s, st->id, s->hbuf, (int)len, end);
+    s->framed += len;
+
+    worker_buffer_put(conn->worker, st->head, st->head_cap);
+    st->head = NULL;
+    st->head_cap = 0;
+    return 1;
+}
+
+// Take response head bytes until the head parses
+static int h2_stream_head(http_conn_t *conn, const char *data, int len) {
+    h2_stream_t *st = conn->stream;
+    if (st->head_parsed) {
+        int r = h2_stream_headers(conn);
+        return r <= 0 ? r : 1;
+    }
+
+    if (st->head_len == st->head_cap) {
+        // Room for what fix_response_headers() adds to the backend's head
+        int max = worker_config(conn->worker)->max_response_header_size + HTTP_OUT_ARENA_SIZE;
+        if (st->head_cap >= max) return -1;
+        if (!st->head) {
+            st->head = slab_alloc(&conn->worker->buffer_slab);
+            if (!st->head) return -1;
+            st->head_cap = g_io_buffer_size;
+        } else {
+            int cap = st->head_cap * 2 < max ? st->head_cap * 2 : max;
+            char *head = worker_realloc(conn->worker, st->head, cap);
+            if (!head) return -1;
+            st->head = head;
+            st->head_cap = cap;
+        }
+    }
+    int take = len < st->head_cap - st->head_len ? len : st->head_cap - st->head_len;
+    int old = st->head_len;
+    memcpy(st->head + st->head_len, data, take);
+    st->head_len += take;
+
+    int r = http_parse(&st->msg, st->head, st->head_len);
+    if (r == HTTP_PARSE_ERROR) return -1;
+    if (r == HTTP_PARSE_AGAIN) return take;
+
+    take = (int)st->msg.header_len - old;
+    st->head_len = (int)st->msg.header_len;
+    if (st->msg.status / 100 == 1) {
+        // Interim responses stay between proxy and backend
+        st->head_len = 0;
+        http_message_init(&st->msg, HTTP_MESSAGE_RESPONSE);
+        return take;
+    }
+    st->head_parsed = 1;
+    r = h2_stream_headers(conn);
+    if (r < 0) return -1;
+    return r ? take : take - 1;
+}
+
+// Body bytes as DATA, as far as the flow-control windows, wbuf and the
+// stream's turn allow
+static int h2_stream_data(http_conn_t *conn, const char *data, int len) {
+    h2_stream_t *st = conn->stream;
+    http_conn_t *session = st->session;
+    h2_session_t *s = session->h2;
+
+    int64_t allow = st->send_window < s->send_window ? st->send_window : s->send_window;
+    if (allow > H2_DEFAULT_FRAME_SIZE) allow = H2_DEFAULT_FRAME_SIZE;
+    if (allow > st->quantum) allow = st->quantum;
+    if (allow <= 0) return 0;
+    int room = s->wbuf_cap - H2_CONTROL_RESERVE - s->wbuf_len - H2_FRAME_HEADER_SIZE;
+    if (room < allow) {
+        h2_flush(session);
+        room = s->wbuf_cap - H2_CONTROL_RESERVE - s->wbuf_len - H2_FRAME_HEADER_SIZE;
+    }
+    if (allow > room) allow = room;
+    if (allow <= 0) return 0;
+
+    int take = len < allow ? len : (int)allow;
+    if (st->out_state == H2_OUT_LENGTH && take > st->out_remaining) take = (int)st->out_remaining;
+    uint8_t *frame = s->wbuf + s->wbuf_len;
+    char *payload = (char *)frame + H2_FRAME_HEADER_SIZE;
+    memcpy(payload, data, take);
+
+    int consumed = take;
+    int payload_len = take;
+    int end = 0;
+    if (st->out_state == H2_OUT_CHUNKED) {
+        consumed = http_chunked_decode(&st->out_chunks, payload, take, &payload_len);
+        if (consumed < 0) return -1;
+        end = http_chunked_done(&st->out_chunks);
+    } else if (st->out_state == H2_OUT_LENGTH) {
+        st->out_remaining -= take;
+        end = st->out_remaining == 0;
+    }
+
+    if (payload_len > 0 || end) {
+        h2_frame_write(frame, (uint32_t)payload_len, H2_DATA, end ? H2_FLAG_END_STREAM : 0, st->id);
+        s->wbuf_len += H2_FRAME_HEADER_SIZE + payload_len;
+        s->framed += H2_FRAME_HEADER_SIZE + payload_len;
+        st->send_window -= payload_len;
+        s->send_window -= payload_len;
+        if (st->quantum != INT_MAX) st->quantum -= payload_len;
+    }
+    if (end) st->out_state = H2_OUT_DONE;
+    return consumed;
+}
+
+// Turn bytes of the exchange's HTTP/1.1 response into frames. Returns how
+// many were taken, or -1 to abandon the stream.
+static int h2_stream_output(http_conn_t *conn, const char *data, int len) {
+    h2_stream_t *st = conn->stream;
+    if (st->reset || st->session->h2->failed) return -1;
+    int done = 0;
+    while (done < len) {
+        int n;
+        if (st->out_state == H2_OUT_HEAD) n = h2_stream_head(conn, data + done, len - done);
+        else if (st->out_state == H2_OUT_DONE) n = len - done;  // Nothing belongs past the body
+        else n = h2_stream_data(conn, data + done, len - done);
+        if (n < 0) return -1;
+        if (n == 0) {
+            h2_stream_wait(conn);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// The http_sendv_fn a stream's response goes out through
+static int sendv_h2_stream(void *arg, sock_iov_t *iov, int count) {
+    http_conn_t *conn = arg;
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        int len = (int)SOCK_IOV_LEN(iov[i]);
+        int n = h2_stream_output(conn, SOCK_IOV_BASE(iov[i]), len);
+        if (n < 0) {
+            sock_set_would_block(0);
+            return -1;
+        }
+        total += n;
+        if (n < len) break;
+    }
+    h2_kick(conn->stream->session);
+    if (total == 0) {
+        sock_set_would_block(1);
+        return -1;
+    }
+    return total;
+}
+
+static int h2_stream_can_send(const h2_stream_t *st) {
+    if (st->out_state == H2_OUT_HEAD || st->out_state == H2_OUT_DONE) return 1;
+    return st->send_window > 0 && st->session->h2->send_window > 0;
+}
+
+// Give waiting streams a turn of up to H2_QUANTUM bytes each, most urgent
+// first and round-robin within an urgency. Returns 1 as soon as one
+// urgency level framed anything, so the caller flushes and the most
+// urgent streams go first again.
+static int h2_session_wake(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    for (int u = 0; u < H2_URGENCY_LEVELS; u++) {
+        uint64_t framed = s->framed;
+        int waiting = 0;
+        for (http_conn_t *c = s->ready[u]; c; c = c->stream->ready_next) waiting++;
+
+        // Streams that queue again during the pass wait for the next one
+        while (waiting-- > 0 && s->ready[u]) {
+            http_conn_t *conn = s->ready[u];
+            h2_stream_t *st = conn->stream;
+            s->ready[u] = st->ready_next;
+            if (!s->ready[u]) s->ready_tail[u] = NULL;
+            st->queued = 0;
+            if (!h2_stream_can_send(st)) {
+                h2_stream_wait(conn);
+                continue;
+            }
+            st->quantum = H2_QUANTUM;
+            conn_drive(conn);
+            if (conn->state != CONN_CLOSED) st->quantum = INT_MAX;
+        }
+        if (s->framed != framed) return 1;
+    }
+    return 0;
+}
+
+// Flush, then let waiting streams refill wbuf, until the socket pushes
+// back or nobody has anything to send. Returns -1 on a socket error.
+static int h2_session_write(http_conn_t *session) {
+    while (1) {
+        int r = h2_flush(session);
+        if (r <= 0) return r;
+        if (!h2_session_wake(session)) return 1;
+    }
+}
+
+// A stream's exchange is over or abandoned: end the stream on the wire if
+// its response didn't, and give back its share of the connection window
+static void h2_stream_close(http_conn_t *conn) {
+    h2_stream_t *st = conn->stream;
+    http_conn_t *session = st->session;
+    h2_session_t *s = session->h2;
+
+    if (!s->closing) {
+        if (!st->reset && st->out_state != H2_OUT_DONE) {
+            if (st->out_state == H2_OUT_UNTIL_CLOSE && conn->body_done && !http_out_pending(&conn->out)) {
+                h2_queue_frame(session, H2_DATA, H2_FLAG_END_STREAM, st->id, NULL, 0);
+            } else {
+                h2_queue_rst(session, st->id, H2_INTERNAL_ERROR);
+                st->reset = 1;
+            }
+        }
+        // Answered before the upload finished: the rest isn't wanted
+        if (!st->reset && !st->remote_closed) h2_queue_rst(session, st->id, H2_NO_ERROR);
+        if (st->body_len > 0) h2_consumed(session, NULL, st->body_len);
+        h2_kick(session);
+    }
+
+    h2_stream_unwait(conn);
+    if (conn->prev) conn->prev->next = conn->next;
+    else s->streams = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    s->stream_count--;
+    counter_add(&conn->worker->metrics->h2_streams_active, -1);
+    if (s->stream_count == 0 && !s->closing) {
+        int goaway = s->goaway_sent || s->goaway_received;
+        conn_set_timeout(session, TIMEOUT_KEEP_ALIVE, goaway ? 0 : worker_config(session->worker)->keep_alive_timeout_ms);
+    }
+}
+
+static void h2_stream_free(http_worker_t *worker, h2_stream_t *st) {
+    free(st->body);
+    if (st->head) worker_buffer_put(worker, st->head, st->head_cap);
+    slab_free(&worker->stream_slab, st);
+}
+
+// A stream error: reset it, and drop its exchange if it has one
+static void h2_stream_abort(http_conn_t *session, uint32_t stream_id, h2_error_t code) {
+    http_conn_t *conn = h2_find(session->h2, stream_id);
+    h2_queue_rst(session, stream_id, code);
+    if (!conn) return;
+    conn->stream->reset = 1;
+    conn_close(conn);
+}
+
+// A request head decoded into s->request becomes a connection of its own
+// that runs the HTTP/1.1 exchange path
+static int h2_stream_open(http_conn_t *session, uint32_t stream_id, int end_stream) {
+    h2_session_t *s = session->h2;
+    http_worker_t *worker = session->worker;
+    const http_server_config_t *config = worker_config(worker);
+    h2_request_t *req = &s->request;
+
+    char *in = slab_alloc(&worker->buffer_slab);
+    if (!in) return h2_error(session, H2_INTERNAL_ERROR);
+    h2_request_begin(req, in, g_io_buffer_size, config->max_request_header_size, &worker->metrics->heap_allocs);
+    if (hpack_decode(&s->decoder, s->block, s->block_len, s->scratch, s->scratch_cap, h2_request_field, req) != 0) {
+        worker_buffer_put(worker, req->buf, (int)req->cap);
+        return h2_error(session, H2_COMPRESSION_ERROR);
+    }
+    h2_request_status_t status = h2_request_finish(req, !end_stream);
+
+    http_conn_t *conn = NULL;
+    h2_stream_t *st = NULL;
+    if (status != H2_REQUEST_MALFORMED && !s->goaway_sent && !s->goaway_received &&
+        s->stream_count < config->http2_max_streams) {
+        conn = slab_alloc(&worker->conn_slab);
+        st = slab_alloc(&worker->stream_slab);
+    }
+    if (!conn || !st) {
+        slab_free(&worker->conn_slab, conn);
+        slab_free(&worker->stream_slab, st);
+        worker_buffer_put(worker, req->buf, (int)req->cap);
+        h2_queue_rst(session, stream_id, status == H2_REQUEST_MALFORMED ? H2_PROTOCOL_ERROR : H2_REFUSED_STREAM);
+        return 0;
+    }
+
+    memset(conn, 0, sizeof(*conn));
+    conn->worker = worker;
+    conn->state = CONN_READ_HEADERS;
+    conn->timer.fn = on_conn_timeout;
+    conn->timer.data = conn;
+    http_message_init(&conn->req, HTTP_MESSAGE_REQUEST);
+    conn->client.fd = SOCK_INVALID;
+    conn->upstream.fd = SOCK_INVALID;
+    conn->upstream.slot = -1;
+    memcpy(conn->client_ip, session->client_ip, sizeof(conn->client_ip));
+    conn->in = req->buf;
+    conn->in_len = (int)req->len;
+    conn->in_cap = (int)req->cap;
+    conn->read_start_us = time_now_us();
+    conn->stream = st;
+
+    memset(st, 0, sizeof(*st));
+    st->session = session;
+    st->id = stream_id;
+    st->urgency = req->urgency;
+    st->send_window = s->peer_initial_window;
+    st->recv_window = H2_STREAM_WINDOW;
+    st->quantum = INT_MAX;
+    st->body_chunked = !end_stream && !req->has_length;
+    st->remote_closed = end_stream;
+    http_message_init(&st->msg, HTTP_MESSAGE_RESPONSE);
+
+    conn->next = s->streams;
+    if (s->streams) s->streams->prev = conn;
+    s->streams = conn;
+    if (s->stream_count++ == 0) conn_clear_timeout(session);
+    counter_add(&worker->metrics->h2_streams, 1);
+    counter_add(&worker->metrics->h2_streams_active, 1);
+
+    if (status == H2_REQUEST_TOO_LARGE) {
+        conn->request_start_us = time_now_us();
+        conn->upstream_us = -1;
+        conn_respond_static(conn, TOO_LARGE_RESPONSE, sizeof(TOO_LARGE_RESPONSE) - 1);
+    }
+    conn_drive(conn);
+    if (req->expect_continue && conn->state == CONN_FORWARD) h2_queue_continue(session, stream_id);
+    return 0;
+}
+
+static void h2_ignore_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    (void)arg;
+    (void)name;
+    (void)name_len;
+    (void)value;
+    (void)value_len;
+}
+
+// A complete header block: a new stream, or trailers
+static int h2_on_header_block(http_conn_t *session, uint32_t stream_id) {
+    h2_session_t *s = session->h2;
+    int end_stream = s->block_end_stream;
+    s->block_stream = 0;
+
+    // Huffman strings decode to at most 8/5 of their size
+    if (s->scratch_cap < 2 * s->block_len) {
+        char *scratch = worker_realloc(session->worker, s->scratch, 2 * s->block_len);
+        if (!scratch) return h2_error(session, H2_INTERNAL_ERROR);
+        s->scratch = scratch;
+        s->scratch_cap = 2 * s->block_len;
+    }
+
+    http_conn_t *conn = h2_find(s, stream_id);
+    if (!conn && stream_id > s->last_stream) {
+        s->last_stream = stream_id;
+        return h2_stream_open(session, stream_id, end_stream);
+    }
+
+    // Trailers are dropped: the body is already framed for the backend.
+    // The block is decoded anyway to keep the table in step, even for a
+    // stream that is gone.
+    if (hpack_decode(&s->decoder, s->block, s->block_len, s->scratch, s->scratch_cap, h2_ignore_field, NULL) != 0) {
+        return h2_error(session, H2_COMPRESSION_ERROR);
+    }
+    if (!conn) return 0;
+    if (!end_stream || conn->stream->remote_closed) {
+        h2_stream_abort(session, stream_id, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    conn->stream->remote_closed = 1;
+    conn_drive(conn);
+    return 0;
+}
+
+static int h2_on_block_fragment(http_conn_t *session, uint32_t stream_id, const uint8_t *p, int len,
+                                int end_headers) {
+    h2_session_t *s = session->h2;
+    if (s->block_len + len > s->block_cap) {
+        // Decoded even when the head turns out too large, so bounded
+        // separately from max_request_header_size
+        int max = 2 * worker_config(session->worker)->max_request_header_size;
+        if (s->block_len + len > max) return h2_error(session, H2_ENHANCE_YOUR_CALM);
+        int cap = s->block_cap ? s->block_cap : H2_DEFAULT_FRAME_SIZE;
+        while (cap < s->block_len + len) cap *= 2;
+        uint8_t *block = worker_realloc(session->worker, s->block, cap);
+        if (!block) return h2_error(session, H2_INTERNAL_ERROR);
+        s->block = block;
+        s->block_cap = cap;
+    }
+    memcpy(s->block + s->block_len, p, len);
+    s->block_len += len;
+    if (!end_headers) {
+        s->block_stream = stream_id;
+        return 0;
+    }
+    return h2_on_header_block(session, stream_id);
+}
+
+static int h2_on_headers(http_conn_t *session, const h2_frame_t *f, const uint8_t *p) {
+    h2_session_t *s = session->h2;
+    int len = (int)f->length;
+    int pad = 0;
+    if (f->stream_id == 0 || (f->stream_id & 1) == 0) return h2_error(session, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_PADDED) {
+        if (len < 1) return h2_error(session, H2_PROTOCOL_ERROR);
+        pad = p[0];
+        p++;
+        len--;
+    }
+    if (f->flags & H2_FLAG_PRIORITY) {
+        // Dependencies and weights are obsolete; urgency comes from the Priority field
+        if (len < 5) return h2_error(session, H2_PROTOCOL_ERROR);
+        p += 5;
+        len -= 5;
+    }
+    if (pad > len) return h2_error(session, H2_PROTOCOL_ERROR);
+    s->block_len = 0;
+    s->block_end_stream = f->flags & H2_FLAG_END_STREAM;
+    return h2_on_block_fragment(session, f->stream_id, p, len - pad, f->flags & H2_FLAG_END_HEADERS);
+}
+
+static int h2_on_data(http_conn_t *session, const h2_frame_t *f, const uint8_t *p) {
+    h2_session_t *s = session->h2;
+    int len = (int)f->length;
+    if (f->stream_id == 0) return h2_error(session, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_PADDED) {
+        if (len < 1 || p[0] >= len) return h2_error(session, H2_PROTOCOL_ERROR);
+        len -= 1 + p[0];
+        p++;
+    }
+
+    // The whole frame counts against flow control, padding included
+    if ((int32_t)f->length > s->recv_window) return h2_error(session, H2_FLOW_CONTROL_ERROR);
+    s->recv_window -= (int32_t)f->length;
+
+    http_conn_t *conn = h2_find(s, f->stream_id);
+    if (!conn) {
+        if (f->stream_id > s->last_stream) return h2_error(session, H2_PROTOCOL_ERROR);
+        h2_consumed(session, NULL, (int)f->length);     // Reset or finished already
+        return 0;
+    }
+    h2_stream_t *st = conn->stream;
+    if (st->remote_closed || (int32_t)f->length > st->recv_window) {
+        h2_consumed(session, NULL, (int)f->length);
+        h2_stream_abort(session, f->stream_id, st->remote_closed ? H2_STREAM_CLOSED : H2_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+    st->recv_window -= (int32_t)f->length;
+    if ((int)f->length > len) h2_consumed(session, st, (int)f->length - len);
+    if (len > 0 && h2_stream_buffer(conn, p, len) != 0) {
+        h2_consumed(session, NULL, len);
+        h2_stream_abort(session, f->stream_id, H2_INTERNAL_ERROR);
+        return 0;
+    }
+    if (f->flags & H2_FLAG_END_STREAM) st->remote_closed = 1;
+    conn_drive(conn);
+    return 0;
+}
+
+static int h2_on_settings(http_conn_t *session, const h2_frame_t *f, const uint8_t *p) {
+    h2_session_t *s = session->h2;
+    if (f->stream_id != 0) return h2_error(session, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_ACK) return f->length == 0 ? 0 : h2_error(session, H2_FRAME_SIZE_ERROR);
+    if (f->length % 6 != 0) return h2_error(session, H2_FRAME_SIZE_ERROR);
+
+    for (uint32_t i = 0; i < f->length; i += 6) {
+        uint32_t value = h2_get32(p + i + 2);
+        switch (p[i] << 8 | p[i + 1]) {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            hpack_encoder_set_max(&s->encoder, value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1) return h2_error(session, H2_PROTOCOL_ERROR);
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            // Moves every open stream's window by the difference
+            if (value > H2_MAX_WINDOW) return h2_error(session, H2_FLOW_CONTROL_ERROR);
+            for (http_conn_t *c = s->streams; c; c = c->next) {
+                c->stream->send_window += (int64_t)value - s->peer_initial_window;
+                if (c->stream->send_window > H2_MAX_WINDOW) return h2_error(session, H2_FLOW_CONTROL_ERROR);
+            }
+            s->peer_initial_window = value;
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            // Allowed, but frames stay at the default: larger ones only
+            // hold up the other streams
+            if (value < H2_DEFAULT_FRAME_SIZE || value > H2_MAX_FRAME_SIZE) {
+                return h2_error(session, H2_PROTOCOL_ERROR);
+            }
+            break;
+        }
+    }
+    s->settings_seen = 1;
+    h2_queue_frame(session, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    return 0;
+}
+
+static int h2_on_window_update(http_conn_t *session, const h2_frame_t *f, const uint8_t *p) {
+    h2_session_t *s = session->h2;
+    if (f->length != 4) return h2_error(session, H2_FRAME_SIZE_ERROR);
+    uint32_t increment = h2_get32(p) & 0x7fffffff;
+    if (f->stream_id == 0) {
+        if (increment == 0) return h2_error(session, H2_PROTOCOL_ERROR);
+        s->send_window += increment;
+        return s->send_window > H2_MAX_WINDOW ? h2_error(session, H2_FLOW_CONTROL_ERROR) : 0;
+    }
+
+    http_conn_t *conn = h2_find(s, f->stream_id);
+    if (!conn) return f->stream_id > s->last_stream ? h2_error(session, H2_PROTOCOL_ERROR) : 0;
+    conn->stream->send_window += increment;
+    if (increment == 0 || conn->stream->send_window > H2_MAX_WINDOW) {
+        h2_stream_abort(session, f->stream_id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+    }
+    return 0;   // Streams it unblocks run when the session writes
+}
+
+// Returns -1 on a connection error, its code in s->error
+static int h2_on_frame(http_conn_t *session, const h2_frame_t *f, const uint8_t *p) {
+    h2_session_t *s = session->h2;
+    if (s->block_stream && (f->type != H2_CONTINUATION || f->stream_id != s->block_stream)) {
+        return h2_error(session, H2_PROTOCOL_ERROR);
+    }
+    if (!s->settings_seen && f->type != H2_SETTINGS) return h2_error(session, H2_PROTOCOL_ERROR);
+
+    switch (f->type) {
+    case H2_DATA:
+        return h2_on_data(session, f, p);
+    case H2_HEADERS:
+        return h2_on_headers(session, f, p);
+    case H2_CONTINUATION:
+        if (!s->block_stream) return h2_error(session, H2_PROTOCOL_ERROR);
+        return h2_on_block_fragment(session, f->stream_id, p, (int)f->length, f->flags & H2_FLAG_END_HEADERS);
+    case H2_PRIORITY:
+        if (f->stream_id == 0) return h2_error(session, H2_PROTOCOL_ERROR);
+        if (f->length != 5) h2_stream_abort(session, f->stream_id, H2_FRAME_SIZE_ERROR);
+        return 0;
+    case H2_RST_STREAM: {
+        if (f->stream_id == 0 || f->stream_id > s->last_stream) return h2_error(session, H2_PROTOCOL_ERROR);
+        if (f->length != 4) return h2_error(session, H2_FRAME_SIZE_ERROR);
+        http_conn_t *conn = h2_find(s, f->stream_id);
+        if (conn) {
+            conn->stream->reset = 1;
+            counter_add(&session->worker->metrics->h2_streams_reset, 1);
+            conn_close(conn);
+        }
+        return 0;
+    }
+    case H2_SETTINGS:
+        return h2_on_settings(session, f, p);
+    case H2_PUSH_PROMISE:
+        return h2_error(session, H2_PROTOCOL_ERROR);    // Clients can't push
+    case H2_PING:
+        if (f->stream_id != 0) return h2_error(session, H2_PROTOCOL_ERROR);
+        if (f->length != 8) return h2_error(session, H2_FRAME_SIZE_ERROR);
+        if (!(f->flags & H2_FLAG_ACK)) h2_queue_frame(session, H2_PING, H2_FLAG_ACK, 0, p, 8);
+        return 0;
+    case H2_GOAWAY:
+        if (f->stream_id != 0) return h2_error(session, H2_PROTOCOL_ERROR);
+        if (f->length < 8) return h2_error(session, H2_FRAME_SIZE_ERROR);
+        s->goaway_received = 1;     // Open streams still finish
+        return 0;
+    case H2_WINDOW_UPDATE:
+        return h2_on_window_update(session, f, p);
+    default:
+        return 0;   // Unknown frame types are ignored
+    }
+}
+
+// Handle the complete frames in `in`
+static int h2_session_frames(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    int pos = 0;
+    int r = 0;
+    if (!s->preface_done) {
+        int match = h2_preface_match(session->in, session->in_len);
+        if (match < 0) return h2_error(session, H2_PROTOCOL_ERROR);
+        if (match == 0) return 0;
+        pos = H2_PREFACE_LEN;
+        s->preface_done = 1;
+    }
+    while (session->in_len - pos >= H2_FRAME_HEADER_SIZE) {
+        const uint8_t *p = (const uint8_t *)session->in + pos;
+        h2_frame_t f;
+        h2_frame_read(&f, p);
+        if (f.length > H2_DEFAULT_FRAME_SIZE) {
+            r = h2_error(session, H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (session->in_len - pos < H2_FRAME_HEADER_SIZE + (int)f.length) break;
+        pos += H2_FRAME_HEADER_SIZE + (int)f.length;
+        r = h2_on_frame(session, &f, p + H2_FRAME_HEADER_SIZE);
+        if (r != 0) break;
+    }
+    memmove(session->in, session->in + pos, session->in_len - pos);
+    session->in_len -= pos;
+    return r;
+}
+
+// Read and handle frames until the socket runs dry. Returns -1 once the
+// session is over.
+static int h2_session_read(http_conn_t *session) {
+    while (1) {
+        if (h2_session_frames(session) != 0) return -1;
+        int n = conn_client_recv(session, session->in + session->in_len, session->in_cap - session->in_len);
+        if (n < 0 && sock_would_block()) return 0;
+        if (n <= 0) return -1;
+        session->in_len += n;
+    }
+}
+
+static void h2_session_drive(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    s->driving = 1;
+    int r = h2_session_read(session);
+    if (r == 0) r = h2_session_write(session);
+    s->driving = 0;
+    if (r < 0 || s->failed) {
+        conn_close(session);
+        return;
+    }
+    if ((s->goaway_sent || s->goaway_received) && s->stream_count == 0 && !http_out_pending(&session->out)) {
+        conn_close(session);
+    }
+}
+
+// Switch a client connection to HTTP/2, after the preface (prior
+// knowledge) or a TLS handshake that chose h2. Returns 0, or -1 after
+// closing.
+static int conn_h2_begin(http_conn_t *conn) {
+    http_worker_t *worker = conn->worker;
+    const http_server_config_t *config = worker_config(worker);
+    h2_session_t *s = worker_realloc(worker, NULL, sizeof(*s));
+    uint8_t *wbuf = worker_realloc(worker, NULL, H2_WRITE_BUFFER_SIZE);
+    if (s) memset(s, 0, sizeof(*s));
+    if (!conn->in && s) {
+        conn->in = slab_alloc(&worker->buffer_slab);
+        conn->in_cap = conn->in ? g_io_buffer_size : 0;
+    }
+    // Room for the largest frame the client may send
+    int in_cap = H2_FRAME_HEADER_SIZE + H2_DEFAULT_FRAME_SIZE;
+    if (s && conn->in && conn->in_cap < in_cap) {
+        char *in = worker_realloc(worker, conn->in, in_cap);
+        if (in) {
+            conn->in = in;
+            conn->in_cap = in_cap;
+        }
+    }
+    if (!s || !wbuf || !conn->in || conn->in_cap < in_cap) {
+        free(s);
+        free(wbuf);
+        conn_close(conn);
+        return -1;
+    }
+
+    hpack_decoder_init(&s->decoder);
+    hpack_encoder_init(&s->encoder);
+    s->wbuf = wbuf;
+    s->wbuf_cap = H2_WRITE_BUFFER_SIZE;
+    s->peer_initial_window = H2_DEFAULT_WINDOW;
+    s->send_window = H2_DEFAULT_WINDOW;
+    s->recv_window = H2_CONN_WINDOW;
+    conn->h2 = s;
+    conn->state = CONN_H2;
+    counter_add(&worker->metrics->h2_sessions, 1);
+
+    // Our settings, and the connection window opened past its default
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    h2_put32(settings + 2, (uint32_t)config->http2_max_streams);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    h2_put32(settings + 8, (uint32_t)config->max_request_header_size);
+    h2_queue_frame(conn, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    h2_queue_window_update(conn, 0, H2_CONN_WINDOW - H2_DEFAULT_WINDOW);
+    conn_set_timeout(conn, TIMEOUT_KEEP_ALIVE, config->keep_alive_timeout_ms);
+    LOG_DEBUG("⚡ HTTP/2 with %s\n", conn->client_ip);
+    return 0;
+}
+
+// Before the socket goes: GOAWAY, best effort, then every open stream
+static void h2_session_close(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    if (!s->failed) {
+        s->closing = 1;
+        if (!s->goaway_sent) h2_queue_goaway(session, s->error);
+        h2_flush(session);
+    }
+    s->closing = 1;
+    while (s->streams) conn_close(s->streams);
+}
+
+static void h2_session_free(h2_session_t *s) {
+    hpack_decoder_free(&s->decoder);
+    hpack_encoder_free(&s->encoder);
+    free(s->block);
+    free(s->scratch);
+    free(s->wbuf);
+    free(s->hbuf);
+    free(s);
+}
+
+// Draining: no new streams; the session closes once its open ones finish
+static void h2_session_drain(http_conn_t *session) {
+    h2_session_t *s = session->h2;
+    if (!s->goaway_sent) h2_queue_goaway(session, H2_NO_ERROR);
+    if (s->stream_count == 0) conn_close(session);
+    else h2_flush(session);
+}
+
+// Advance the connection as far as possible without blocking
+static void conn_drive(http_conn_t *conn) {
+    while (1) {
+        conn_state_t state = conn->state;
+
+        switch (state) {
+        case CONN_READ_HEADERS:
+            if (conn_read_request(conn) == 1) {
+                conn_start_forward(conn);
+            }
+            break;
+
+        case CONN_CACHE_WAIT:
+            return; // Resumed by the worker's notify socket
+
+        case CONN_H2:
+            h2_session_drive(conn);
+            return;
+
+        case CONN_FORWARD:
+            conn_forward(conn);
+            break;
+
+        case CONN_WRITE_RESPONSE: {
+            int r = conn_relay_response(conn);
+            if (r == 0) return;
+            if (r > 0) conn_count_response(conn);
+            conn_log_access(conn);
+            if (r > 0) LOG_DEBUG("📤 Sent %lld body bytes to %s\n", (long long)conn->bytes_sent, conn->client_ip);
+            if (r > 0 && conn->keep_alive) {
+                conn_reset_for_next_request(conn);
+                // Draining: pipelined requests are still answered, idle
+                // connections go
+                if (!conn->worker->draining || conn->in_len > 0) break;
+            }
+            conn_close(conn);
+            return;
+        }
+
+        case CONN_CLOSED:
+            return;
+        }
+
+        // Stop once a state makes no progress; readiness events resume it
+        if (conn->state == state) return;
+    }
+}
+
+static void on_client_event(io_watch_t *watch, uint32_t events) {
+    (void)events;
+    conn_drive(watch->data);
+}
+
+static void on_upstream_event(io_watch_t *watch, uint32_t events) {
+    http_conn_t *conn = watch->data;
+
+    if (conn->state == CONN_FORWARD && conn->upstream_state == UPSTREAM_CONNECTING) {
+        if (!(events & (EV_WRITE | EV_ERROR))) return;
+        if (proxy_handler_connect_result(watch->fd) != 0) {
+            upstream_connect_failed(conn);
+            conn_drive(conn);
+            return;
+        }
+        conn->upstream_state = UPSTREAM_SENDING;
+        conn_clear_timeout(conn);
+        metrics_stage(conn->worker->metrics, STAGE_UPSTREAM_CONNECT, conn->connect_start_us, time_now_us());
+    }
+    conn_drive(conn);
+}
+
+// A cache fill finished somewhere: let every waiting request look again.
+// Those whose key is still being fetched simply queue up anew.
+static void on_notify(io_watch_t *watch, uint32_t events) {
+    http_worker_t *worker = watch->data;
+    char buf[64];
+    (void)events;
+
+    while (recv(watch->fd, buf, sizeof(buf), 0) > 0) {
+    }
+    atomic_set(&worker->notify_pending, 0);
+
+    http_conn_t *conn = worker->cache_waiters;
+    while (conn) {
+        http_conn_t *next = conn->wait_next;
+        conn_wait_remove(conn);
+        conn_dispatch(conn, 1);
+        conn_drive(conn);
+        conn = next;
+    }
+}
+
+// Turn a new connection away before it costs anything, when the proxy is
+// at max_connections or this worker is falling behind. A plain HTTP client
+// gets a 503 it can act on; a TLS one only sees the close.
+static int worker_shed(http_worker_t *worker, sock_t fd) {
+    const http_server_config_t *config = worker_config(worker);
+    uint64_t *counter;
+    if (config->max_connections > 0 && atomic_get(&g_open_conns) >= config->max_connections) {
+        counter = &worker->metrics->shed_max_connections;
+    } else if (config->shed_lag_ms > 0 && worker->lag_us >= (uint64_t)config->shed_lag_ms * 1000) {
+        counter = &worker->metrics->shed_lag;
+    } else {
+        return 0;
+    }
+
+    if (!worker->view->snap->tls && sock_set_nonblocking(fd) == 0) {
+        sock_iov_t iov;
+        SOCK_IOV_BASE(iov) = (char *)SERVICE_UNAVAILABLE_RESPONSE;
+        SOCK_IOV_LEN(iov) = sizeof(SERVICE_UNAVAILABLE_RESPONSE) - 1;
+        int n = sock_sendv(fd, &iov, 1);
+        if (n > 0) counter_add(&worker->metrics->client_bytes_out, n);
+    }
+    sock_close(fd);
+    counter_add(counter, 1);
+    return 1;
+}
+
+static void on_accept(io_watch_t *watch, uint32_t events) {
+    http_worker_t *worker = watch->data;
+    (void)events;
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t addrlen = sizeof(client_addr);
+        sock_t client_fd = accept(watch->fd, (struct sockaddr*)&client_addr, &addrlen);
+        if (client_fd == SOCK_INVALID) {
+            // Drained the backlog (or a transient error like ECONNABORTED)
+            return;
+        }
+
+        if (worker_shed(worker, client_fd)) continue;
+
+        // The request buffer is only taken once bytes arrive
+        http_conn_t *conn = slab_alloc(&worker->conn_slab);
+        if (!conn || sock_set_nonblocking(client_fd) != 0) {
+            slab_free(&worker->conn_slab, conn);
+            sock_close(client_fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(*conn));
+
+        int opt = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+
+        conn->worker = worker;
+        conn->state = CONN_READ_HEADERS;
+        conn->timer.fn = on_conn_timeout;
+        conn->timer.data = conn;
+        http_message_init(&conn->req, HTTP_MESSAGE_REQUEST);
+        conn->client.fd = client_fd;
+        conn->client.handler = on_client_event;
+        conn->client.data = conn;
+        conn->upstream.fd = SOCK_INVALID;
+        conn->upstream.slot = -1;
+        get_client_ip(&client_addr, conn->client_ip, sizeof(conn->client_ip));
+
+        tls_context_t *tls = worker->view->snap->tls;
+        if (tls && !(conn->tls = tls_conn_create(tls, client_fd))) {
+            sock_close(client_fd);
+            conn_free(conn);
+            continue;
+        }
+
+        if (event_loop_add(worker->loop, &conn->client, EV_READ | EV_WRITE) != 0) {
+            tls_conn_free(conn->tls);
+            sock_close(client_fd);
+            conn_free(conn);
+            continue;
+        }
+        conn_set_timeout(conn, TIMEOUT_HEADER, worker_config(worker)->request_timeout_ms);
+        worker->active_conns++;
+        atomic_add(&g_open_conns, 1);
+        counter_add(&worker->metrics->connections_accepted, 1);
+        counter_add(&worker->metrics->connections_active, 1);
+        conn->next = worker->conns;
+        if (worker->conns) worker->conns->prev = conn;
+        worker->conns = conn;
+        LOG_DEBUG("🔗 New client from %s\n", conn->client_ip);
+
+        // Requests often arrive with the handshake; don't wait for another edge
+        conn_drive(conn);
+    }
+}
+
+static sock_t create_listener(int listen_port, int reuse_port) {
+    sock_t server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd == SOCK_INVALID) {
+        printf("❌ Socket failed: %d\n", sock_last_error());
+        return SOCK_INVALID;
+    }
+
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    if (reuse_port) {
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt));
+    }
+#else
+    (void)reuse_port;
+#endif
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(listen_port);
+
+    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
+        printf("❌ Bind failed: %d\n", sock_last_error());
+        sock_close(server_fd);
+        return SOCK_INVALID;
+    }
+
+    if (listen(server_fd, LISTEN_BACKLOG) != 0 || sock_set_nonblocking(server_fd) != 0) {
+        printf("❌ Listen failed: %d\n", sock_last_error());
+        sock_close(server_fd);
+        return SOCK_INVALID;
+    }
+    return server_fd;
+}
+
+// A connection's deadline passed: clients that sat idle or trickled a
+// request are closed, a stalled backend is given up on
+static void on_conn_timeout(timer_entry_t *timer) {
+    http_conn_t *conn = timer->data;
+
+    switch (conn->timeout) {
+    case TIMEOUT_CACHE_WAIT:
+        // The fetch we queued behind is taking too long: go ourselves
+        LOG_WARN("⏱️ Cache wait timed out for %s\n", conn->client_ip);
+        conn_wait_remove(conn);
+        conn->cache_status = "BYPASS";
+        conn_dispatch(conn, 0);
+        conn_drive(conn);
+        break;
+
+    case TIMEOUT_CONNECT:
+        // Backend never completed the connect
+        LOG_WARN("⏱️ Connect to %s:%d timed out\n", conn_backend(conn)->host, conn_backend(conn)->port);
+        upstream_connect_failed(conn);
+        conn_drive(conn);
+        break;
+
+    case TIMEOUT_RESPONSE:
+        LOG_WARN("⏱️ Backend %s:%d stalled on a request from %s\n",
+                 conn_backend(conn)->host, conn_backend(conn)->port, conn->client_ip);
+        counter_add(&conn->worker->metrics->upstream_failures, 1);
+        upstream_report(conn_upstream(conn), conn->backend, 0);
+        if (conn->state != CONN_FORWARD) {
+            conn_close(conn);   // Part of the response is already out
+            break;
+        }
+        upstream_detach(conn, 0);
+        conn_cache_abort(conn, 0);
+        conn_respond_static(conn, GATEWAY_TIMEOUT_RESPONSE, sizeof(GATEWAY_TIMEOUT_RESPONSE) - 1);
+        conn_drive(conn);
+        break;
+
+    default:
+        // Idle, a request or upload that stopped arriving, or a client
+        // that stopped reading
+        conn_close(conn);
+        break;
+    }
+}
+
+// Listeners belong to the new process now. Idle keep-alive connections
+// close; the rest get Connection: close on their current response, and
+// HTTP/2 sessions a GOAWAY that lets their open streams finish.
+static void worker_begin_drain(http_worker_t *worker) {
+    worker->draining = 1;
+    event_loop_remove(worker->loop, &worker->listener);
+    http_conn_t *conn = worker->conns;
+    while (conn) {
+        http_conn_t *next = conn->next;
+        if (conn->state == CONN_READ_HEADERS && conn->in_len == 0 && conn->requests_served > 0) conn_close(conn);
+        else if (conn->state == CONN_H2) h2_session_drain(conn);
+        conn = next;
+    }
+}
+
+static void worker_close_all(http_worker_t *worker) {
+    if (worker->active_conns > 0) {
+        printf("⏱️ Drain deadline passed on worker %d, closing %d connections\n", worker->id, worker->active_conns);
+    }
+    while (worker->conns) conn_close(worker->conns);
+}
+
+static void worker_run(void *arg) {
+    http_worker_t *worker = arg;
+    uint64_t next_reap = time_now_ms() + LOOP_TICK_MS;
+    uint64_t next_probe = 0;
+
+    while (1) {
+        uint64_t now = time_now_ms();
+        int timeout = timer_wheel_timeout(&worker->timers, now, LOOP_TICK_MS);
+
+        // Load shedding: the loop asks to wake for a probe every
+        // LAG_PROBE_MS, and how late it actually gets there is how long
+        // ready events wait behind the work in front of them
+        if (worker_config(worker)->shed_lag_ms > 0) {
+            if (!next_probe) next_probe = now + LAG_PROBE_MS;
+            if (next_probe <= now) timeout = 0;
+            else if (timeout > (int)(next_probe - now)) timeout = (int)(next_probe - now);
+        } else {
+            next_probe = 0;
+            worker->lag_us = 0;
+        }
+
+        if (event_loop_run_once(worker->loop, timeout) < 0) {
+            printf("❌ Event loop failed on worker %d: %d\n", worker->id, sock_last_error());
+            return;
+        }
+
+        if (atomic_get(&g_snapshot_gen) != worker->view->snap->gen) worker_adopt_snapshot(worker);
+
+        now = time_now_ms();
+        if (next_probe && now >= next_probe) {
+            worker->lag_us = (3 * worker->lag_us + (now - next_probe) * 1000) / 4;
+            next_probe = now + LAG_PROBE_MS;
+        }
+        timer_wheel_advance(&worker->timers, now);
+        if (now >= next_reap) {
+            proxy_pool_reap(worker->pool, now);
+            next_reap = now + LOOP_TICK_MS;
+        }
+
+        if (!worker->draining && atomic_get(&g_draining)) worker_begin_drain(worker);
+        if (worker->draining && (worker->active_conns == 0 || now >= g_drain_deadline)) worker_close_all(worker);
+
+        // Connections closed during dispatch may still have had events queued
+        while (worker->closed) {
+            http_conn_t *conn = worker->closed;
+            worker->closed = conn->next_closed;
+            conn_free(conn);
+        }
+        if (worker->draining && worker->active_conns == 0) return;
+    }
+}
+
+void http_server_config_defaults(http_server_config_t *config) {
+    config->listen_port = 8080;
+    config->upstream = NULL;
+    config->io_engine = EVENT_ENGINE_DEFAULT;
+    config->pool_max_idle = POOL_DEFAULT_MAX_IDLE;
+    config->pool_idle_timeout_ms = POOL_DEFAULT_IDLE_TIMEOUT_MS;
+    config->request_timeout_ms = 10000;
+    config->body_timeout_ms = 10000;
+    config->keep_alive_timeout_ms = 15000;
+    config->send_timeout_ms = 30000;
+    config->connect_timeout_ms = 3000;
+    config->response_timeout_ms = 60000;
+    config->max_keep_alive_requests = 1000;
+    config->io_buffer_size = HTTP_DEFAULT_IO_BUFFER_SIZE;
+    config->max_request_header_size = 64 * 1024;
+    config->max_response_header_size = 64 * 1024;
+    config->max_body_size = HTTP_DEFAULT_MAX_BODY_SIZE;
+    config->splice = 1;
+    config->compress_codings = COMPRESS_BIT(COMPRESS_BROTLI) | COMPRESS_BIT(COMPRESS_GZIP);
+    config->compress_level = 5;
+    config->compress_cache_level = 9;
+    config->compress_min_size = 1024;
+    snprintf(config->compress_types, sizeof(config->compress_types), "%s", HTTP_DEFAULT_COMPRESS_TYPES);
+    config->cache_size = 0;
+    config->cache_max_entry = CACHE_DEFAULT_MAX_ENTRY;
+    config->access_log = "-";
+    config->access_log_format = ACCESS_LOG_TEXT;
+    config->admin_port = 0;
+    config->upgrade_socket = NULL;
+    config->drain_timeout_ms = 30000;
+    config->tls_cert_count = 0;
+    config->tls_session_timeout = HTTP_DEFAULT_TLS_SESSION_TIMEOUT;
+    config->tls_ktls = 1;
+    config->http2 = 1;
+    config->http2_max_streams = HTTP_DEFAULT_H2_MAX_STREAMS;
+    config->rate_limit_client_rps = 0;
+    config->rate_limit_client_burst = HTTP_DEFAULT_RATE_BURST;
+    config->rate_limit_global_rps = 0;
+    config->rate_limit_global_burst = HTTP_DEFAULT_RATE_BURST;
+    config->max_connections = 0;
+    config->shed_lag_ms = 0;
+    config->reload = NULL;
+    config->reload_arg = NULL;
+    config->strings = NULL;
+}
+
+struct config_string {
+    config_string_t *next;
+    char s[];
+};
+
+const char *http_server_config_keep(http_server_config_t *config, const char *s) {
+    if (!s) return NULL;
+    size_t len = strlen(s) + 1;
+    config_string_t *str = malloc(sizeof(*str) + len);
+    if (!str) return NULL;
+    memcpy(str->s, s, len);
+    str->next = config->strings;
+    config->strings = str;
+    return str->s;
+}
+
+void http_server_config_free_strings(http_server_config_t *config) {
+    while (config->strings) {
+        config_string_t *next = config->strings->next;
+        free(config->strings);
+        config->strings = next;
+    }
+}
+
+static server_snapshot_t *snapshot_create(const http_server_config_t *config, int owns_config) {
+    server_snapshot_t *snap = calloc(1, sizeof(*snap));
+    if (!snap) return NULL;
+    snap->config = *config;
+    snap->upstream = config->upstream;
+    snap->owns_config = owns_config;
+    snap->refs = 1;
+    return snap;
+}
+
+static void snapshot_destroy(server_snapshot_t *snap) {
+    if (snap->owns_config) {
+        upstream_group_destroy((upstream_group_t *)snap->upstream);
+        http_server_config_free_strings(&snap->config);
+    }
+    tls_context_release(snap->tls);  // Connections still on it keep it alive
+    free(snap);
+}
+
+static void on_hangup(int sig) {
+    (void)sig;
+    g_reload_requested = 1;
+}
+
+// Free retired snapshots no worker holds any more. The grace period
+// covers access log entries still pointing at their backend names.
+static void server_reap_snapshots(void) {
+    uint64_t now = time_now_ms();
+    server_snapshot_t **link = &g_retired;
+    while (*link) {
+        server_snapshot_t *snap = *link;
+        if (atomic_get(&snap->refs) == 0 && now - snap->retired_at >= SNAPSHOT_GRACE_MS) {
+            *link = snap->next_retired;
+            snapshot_destroy(snap);
+        } else {
+            link = &snap->next_retired;
+        }
+    }
+}
+
+// Load a new configuration and publish it. Workers switch on their next
+// loop turn; requests already running finish on the snapshot they began on.
+static void server_reload(void) {
+    http_server_config_t next;
+    http_server_config_defaults(&next);
+    if (g_reload(&next, g_reload_arg) != 0) {
+        http_server_config_free_strings(&next);
+        printf("❌ Reload failed, keeping current configuration\n");
+        return;
+    }
+
+    // Only this thread replaces g_snapshot, so reading it needs no lock
+    server_snapshot_t *cur = g_snapshot;
+    const http_server_config_t *c = &cur->config;
+    if (next.listen_port != c->listen_port || next.admin_port != c->admin_port ||
+        next.io_engine != c->io_engine || next.io_buffer_size != c->io_buffer_size ||
+        next.cache_size != c->cache_size || next.cache_max_entry != c->cache_max_entry ||
+        (next.access_log == NULL) != (c->access_log == NULL) ||
+        (next.access_log && strcmp(next.access_log, c->access_log) != 0) ||
+        next.access_log_format != c->access_log_format ||
+        (next.upgrade_socket == NULL) != (c->upgrade_socket == NULL) ||
+        (next.upgrade_socket && strcmp(next.upgrade_socket, c->upgrade_socket) != 0) ||
+        (next.tls_cert_count > 0) != (c->tls_cert_count > 0)) {
+        printf("⚠️ Ports, I/O engine, buffer size, cache, access log, upgrade socket and TLS on/off changes "
+               "need a restart\n");
+    }
+    next.listen_port = c->listen_port;
+    next.admin_port = c->admin_port;
+    next.io_engine = c->io_engine;
+    next.io_buffer_size = c->io_buffer_size;
+    next.cache_size = c->cache_size;
+    next.cache_max_entry = c->cache_max_entry;
+    // Copied: the current snapshot's strings go when it is retired
+    next.access_log = http_server_config_keep(&next, c->access_log);
+    next.access_log_format = c->access_log_format;
+    next.upgrade_socket = http_server_config_keep(&next, c->upgrade_socket);
+    if ((next.tls_cert_count > 0) != (c->tls_cert_count > 0)) {
+        for (int i = 0; i < c->tls_cert_count; i++) {
+            next.tls_certs[i].cert_file = http_server_config_keep(&next, c->tls_certs[i].cert_file);
+            next.tls_certs[i].key_file = http_server_config_keep(&next, c->tls_certs[i].key_file);
+        }
+        next.tls_cert_count = c->tls_cert_count;
+    }
+
+    // Certificates are read again; tickets issued so far stay valid
+    tls_context_t *tls = NULL;
+    if (next.tls_cert_count > 0) {
+        char err[256];
+        tls = tls_context_create(next.tls_certs, next.tls_cert_count, next.tls_session_timeout, next.tls_ktls,
+                                 next.http2, cur->tls, err, sizeof(err));
+        if (!tls) printf("❌ TLS: %s\n", err);
+    }
+    server_snapshot_t *snap = (tls || next.tls_cert_count == 0) ? snapshot_create(&next, 1) : NULL;
+    if (!snap) {
+        tls_context_release(tls);
+        upstream_group_destroy((upstream_group_t *)next.upstream);
+        http_server_config_free_strings(&next);
+        printf("❌ Reload failed, keeping current configuration\n");
+        return;
+    }
+    snap->tls = tls;
+    snap->gen = cur->gen + 1;
+    snap->checker = health_checker_start(snap->upstream);
+
+    mutex_lock(&g_snapshot_lock);
+    g_snapshot = snap;
+    mutex_unlock(&g_snapshot_lock);
+    atomic_set(&g_snapshot_gen, snap->gen);
+
+    health_checker_stop(cur->checker);
+    cur->checker = NULL;
+    cur->retired_at = time_now_ms();
+    cur->next_retired = g_retired;
+    g_retired = cur;
+    snapshot_release(cur);
+
+    printf("🔄 Configuration reloaded: upstream '%s' (%s), %d backends\n", snap->upstream->name,
+           upstream_algorithm_name(snap->upstream->algorithm), snap->upstream->backend_count);
+}
+
+// A new process has confirmed it is accepting on our listeners
+static void server_begin_drain(void *arg) {
+    (void)arg;
+    mutex_lock(&g_snapshot_lock);
+    int drain_ms = g_snapshot->config.drain_timeout_ms;
+    mutex_unlock(&g_snapshot_lock);
+
+    g_drain_deadline = time_now_ms() + drain_ms;
+    atomic_set(&g_draining, 1);
+    metrics_server_stop(atomic_swap(&g_admin, NULL)); // Frees the port for the new process
+    printf("♻️ Listeners handed to the new process, draining for up to %d ms\n", drain_ms);
+}
+
+// The old process lets go of the admin port only once it starts draining
+static metrics_server_t *start_admin(int port, const worker_metrics_t *metrics, int count, int upgrading) {
+    for (int tries = upgrading ? ADMIN_BIND_TRIES : 1; tries > 0; tries--) {
+        metrics_server_t *admin = metrics_server_start(port, metrics, count);
+        if (admin) return admin;
+        if (tries > 1) sleep_ms(100);
+    }
+    return NULL;
+}
+
+static void reload_run(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep_ms(RELOAD_POLL_MS);
+        if (g_reload_requested) {
+            g_reload_requested = 0;
+            server_reload();
+        }
+        server_reap_snapshots();
+    }
+}
+
+// Socket pair other workers write to when a cache fill we wait on is done
+static int worker_notify_init(http_worker_t *worker) {
+    sock_t pair[2];
+    if (sock_pair(pair) != 0) return -1;
+    if (sock_set_nonblocking(pair[0]) != 0 || sock_set_nonblocking(pair[1]) != 0) {
+        sock_close(pair[0]);
+        sock_close(pair[1]);
+        return -1;
+    }
+    worker->notify.fd = pair[0];
+    worker->notify.handler = on_notify;
+    worker->notify.data = worker;
+    worker->notify_tx = pair[1];
+    return event_loop_add(worker->loop, &worker->notify, EV_READ);
+}
+
+void start_http_server(const http_server_config_t *config) {
+    int listen_port = config->listen_port;
+    const upstream_group_t *upstream = config->upstream;
+    if (!upstream || upstream->backend_count == 0) {
+        printf("❌ No upstream backends configured\n");
+        return;
+    }
+
+    server_snapshot_t *snap = snapshot_create(config, 0);
+    if (!snap) return;
+#ifndef PLATFORM_HAS_SPLICE
+    snap->config.splice = 0;
+#endif
+    if (config->tls_cert_count > 0) {
+        char err[256];
+        snap->tls = tls_context_create(config->tls_certs, config->tls_cert_count, config->tls_session_timeout,
+                                       config->tls_ktls, config->http2, NULL, err, sizeof(err));
+        if (!snap->tls) {
+            printf("❌ TLS: %s\n", err);
+            return;
+        }
+    }
+    mutex_init(&g_snapshot_lock);
+    g_snapshot = snap;
+    g_io_buffer_size = config->io_buffer_size;
+
+    if (platform_net_init() != 0) {
+        printf("❌ Network init failed: %d\n", sock_last_error());
+        return;
+    }
+
+#ifdef SO_REUSEPORT
+    int reuse_port = 1;
+#else
+    int reuse_port = 0;
+#endif
+
+    g_client_limits = rate_limiter_create(RATE_LIMIT_DEFAULT_SLOTS);
+    if (!g_client_limits) {
+        printf("❌ Failed to create the rate limit table\n");
+        return;
+    }
+
+    if (config->cache_size > 0) {
+        g_cache = cache_create(config->cache_size, config->cache_max_entry);
+        if (!g_cache) {
+            printf("❌ Failed to create response cache\n");
+            return;
+        }
+    }
+
+    // Listeners come from the process being upgraded, when there is one;
+    // every one it hands over gets a worker
+    sock_t listen_fds[UPGRADE_MAX_LISTENERS];
+    int listen_count = 0;
+    sock_t upgrade_ctl = SOCK_INVALID;
+    if (config->upgrade_socket) {
+        listen_count = upgrade_takeover(config->upgrade_socket, listen_port, listen_fds,
+                                        UPGRADE_MAX_LISTENERS, &upgrade_ctl);
+        if (listen_count > 0) {
+            printf("♻️ Took over %d listening sockets from the running proxy\n", listen_count);
+        }
+    }
+    int inherited = listen_count > 0;
+
+    int worker_count = platform_cpu_count();
+    if (worker_count < listen_count) worker_count = listen_count;
+    http_worker_t *workers = calloc(worker_count, sizeof(*workers));
+    worker_metrics_t *metrics = calloc(worker_count, sizeof(*metrics));
+    if (!workers || !metrics) return;
+    g_workers = workers;
+    g_worker_count = worker_count;
+
+    if (config->access_log) {
+        g_access_log = access_log_open(config->access_log, config->access_log_format, worker_count);
+        if (!g_access_log) {
+            printf("❌ Failed to open access log '%s'\n", config->access_log);
+            return;
+        }
+    }
+
+    // Without SO_REUSEPORT every worker polls the one shared listener
+    sock_t shared_fd = SOCK_INVALID;
+    if (!inherited && !reuse_port) {
+        shared_fd = create_listener(listen_port, 0);
+        if (shared_fd == SOCK_INVALID) {
+            free(workers);
+            platform_net_cleanup();
+            return;
+        }
+        listen_fds[listen_count++] = shared_fd;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        http_worker_t *worker = &workers[i];
+        worker->id = i;
+        worker->metrics = &metrics[i];
+        timer_wheel_init(&worker->timers, TIMER_TICK_MS, time_now_ms());
+        slab_init(&worker->conn_slab, sizeof(http_conn_t), SLAB_MAX_FREE, &metrics[i].heap_allocs);
+        slab_init(&worker->stream_slab, sizeof(h2_stream_t), SLAB_MAX_FREE, &metrics[i].heap_allocs);
+        slab_init(&worker->buffer_slab, g_io_buffer_size, SLAB_MAX_FREE, &metrics[i].heap_allocs);
+        worker->loop = event_loop_create_engine(config->io_engine);
+        if (!worker->loop) {
+            printf("❌ I/O engine '%s' is not available here\n", event_engine_name(config->io_engine));
+            return;
+        }
+        if (inherited) {
+            worker->listener.fd = listen_fds[i % listen_count];
+        } else if (reuse_port) {
+            worker->listener.fd = create_listener(listen_port, 1);
+            if (worker->listener.fd != SOCK_INVALID && listen_count < UPGRADE_MAX_LISTENERS) {
+                listen_fds[listen_count++] = worker->listener.fd;
+            }
+        } else {
+            worker->listener.fd = shared_fd;
+        }
+        worker->listener.handler = on_accept;
+        worker->listener.data = worker;
+        worker->pool = proxy_pool_create(config->pool_max_idle, config->pool_idle_timeout_ms);
+        worker->view = worker_view_create(worker, snap);
+        if (worker->view) atomic_add(&snap->refs, 1);
+
+        if (!worker->loop || !worker->pool || !worker->view || worker->listener.fd == SOCK_INVALID ||
+            event_loop_add(worker->loop, &worker->listener, EV_READ) != 0 ||
+            (g_cache && worker_notify_init(worker) != 0)) {
+            printf("❌ Failed to start worker %d\n", i);
+            return;
+        }
+    }
+
+    printf("🚀 Event-driven proxy (%s, %d workers) listening on port %d\n",
+           event_loop_backend(workers[0].loop), worker_count, listen_port);
+    if (snap->tls) {
+        char resume[48] = "no session resumption";
+        if (config->tls_session_timeout > 0) {
+            snprintf(resume, sizeof(resume), "sessions resumed for %d s", config->tls_session_timeout);
+        }
+        printf("🔒 HTTPS with %d certificate%s (SNI), %s, kTLS %s\n", config->tls_cert_count,
+               config->tls_cert_count > 1 ? "s" : "", resume, config->tls_ktls ? "where the kernel has it" : "off");
+    }
+    if (config->http2) {
+        printf("⚡ HTTP/2 %s, up to %d streams per connection\n",
+               snap->tls ? "negotiated by ALPN" : "with prior knowledge", config->http2_max_streams);
+    }
+    printf("📡 Forwarding to upstream '%s' (%s) with header fixes:\n",
+           upstream->name, upstream_algorithm_name(upstream->algorithm));
+    for (int i = 0; i < upstream->backend_count; i++) {
+        const upstream_backend_t *b = &upstream->backends[i];
+        printf("   %s:%d weight %d\n", b->host, b->port, b->weight);
+    }
+    printf("🔗 Upstream pool: %d idle per backend per worker, %d ms idle timeout\n",
+           config->pool_max_idle, config->pool_idle_timeout_ms);
+    printf("⏱️ Timeouts: request %d ms, body %d ms, keep-alive %d ms, connect %d ms, response %d ms, send %d ms\n",
+           config->request_timeout_ms, config->body_timeout_ms, config->keep_alive_timeout_ms,
+           config->connect_timeout_ms, config->response_timeout_ms, config->send_timeout_ms);
+    if (config->max_body_size) {
+        printf("📦 Request bodies streamed, up to %llu KB\n", (unsigned long long)(config->max_body_size >> 10));
+    } else {
+        printf("📦 Request bodies streamed, no size limit\n");
+    }
+    if (snap->config.splice) {
+        printf("🧵 Response bodies over %d KB relayed with splice\n", SPLICE_MIN_BODY >> 10);
+    }
+    unsigned codings = config->compress_codings & compress_available();
+    if (codings) {
+        printf("🗜️ Compressing %s responses over %d bytes:%s%s%s\n", config->compress_types, config->compress_min_size,
+               codings & COMPRESS_BIT(COMPRESS_BROTLI) ? " br" : "", codings & COMPRESS_BIT(COMPRESS_GZIP) ? " gzip" : "",
+               codings & COMPRESS_BIT(COMPRESS_DEFLATE) ? " deflate" : "");
+    }
+    if (g_cache) {
+        printf("💾 Response cache: %zu MB, entries up to %zu KB\n",
+               config->cache_size >> 20, cache_max_entry(g_cache) >> 10);
+    }
+    if (config->rate_limit_client_rps > 0) {
+        printf("🚦 Rate limit: %d requests/s per client address, bursts of %d, then 429\n",
+               config->rate_limit_client_rps, config->rate_limit_client_burst);
+    }
+    if (config->rate_limit_global_rps > 0) {
+        printf("🚦 Rate limit: %d requests/s overall, bursts of %d, then 503\n",
+               config->rate_limit_global_rps, config->rate_limit_global_burst);
+    }
+    if (config->max_connections > 0 || config->shed_lag_ms > 0) {
+        char cap[32] = "no connection cap";
+        char lag[48] = "";
+        if (config->max_connections > 0) snprintf(cap, sizeof(cap), "at most %d connections", config->max_connections);
+        if (config->shed_lag_ms > 0) snprintf(lag, sizeof(lag), ", shedding at %d ms loop lag", config->shed_lag_ms);
+        printf("🛡️ Admission: %s%s\n", cap, lag);
+    }
+    if (g_access_log) {
+        printf("📝 Access log: %s (%s)\n", strcmp(config->access_log, "-") == 0 ? "stdout" : config->access_log,
+               config->access_log_format == ACCESS_LOG_JSON ? "json" : "text");
+    }
+    printf("🔧 Features: X-Forwarded-For, proper Host header, hop-by-hop filtering\n");
+
+    // Worker 0 runs on the calling thread, which returns once it has
+    // drained after an upgrade
+    for (int i = 1; i < worker_count; i++) {
+        if (thread_start(&workers[i].thread, worker_run, &workers[i]) != 0) {
+            printf("❌ Failed to start worker thread %d\n", i);
+        } else {
+            workers[i].started = 1;
+        }
+    }
+    if (upgrade_ctl != SOCK_INVALID) upgrade_confirm(upgrade_ctl);
+    if (config->admin_port > 0) {
+        g_admin = start_admin(config->admin_port, metrics, worker_count, inherited);
+        if (g_admin) printf("📊 Metrics on http://127.0.0.1:%d/metrics\n", config->admin_port);
+        else printf("❌ Failed to start metrics endpoint on port %d\n", config->admin_port);
+    }
+    if (config->upgrade_socket) {
+        g_upgrade = upgrade_serve(config->upgrade_socket, listen_port, listen_fds, listen_count,
+                                  server_begin_drain, NULL);
+        if (g_upgrade) printf("♻️ A new process started with --upgrade-socket %s takes over\n", config->upgrade_socket);
+        else printf("❌ Failed to serve upgrades on %s\n", config->upgrade_socket);
+    }
+    snap->checker = health_checker_start(upstream);
+    if (snap->checker) {
+        const health_config_t *hc = &upstream->health_config;
+        printf("🩺 Health checks every %d ms (%s)\n", hc->interval_ms, hc->path[0] ? hc->path : "TCP connect");
+    }
+    if (config->reload) {
+        thread_t reload_thread;
+        g_reload = config->reload;
+        g_reload_arg = config->reload_arg;
+        if (platform_on_hangup(on_hangup) == 0 && thread_start(&reload_thread, reload_run, NULL) == 0) {
+            printf("🔄 SIGHUP reloads the configuration\n");
+        }
+    }
+
+    worker_run(&workers[0]);
+    for (int i = 1; i < worker_count; i++) {
+        if (workers[i].started) thread_join(workers[i].thread);
+    }
+
+    upgrade_serve_stop(g_upgrade);
+    health_checker_stop(g_snapshot->checker);
+    metrics_server_stop(atomic_swap(&g_admin, NULL));
+
+    for (int i = 0; i < worker_count; i++) {
+        proxy_pool_destroy(workers[i].pool);
+        compress_pool_clear(&workers[i].encoders);
+        worker_view_free(workers[i].view);
+        event_loop_destroy(workers[i].loop);
+    }
+    for (int i = 0; i < listen_count; i++) sock_close(listen_fds[i]);
+    cache_destroy(g_cache);
+    rate_limiter_destroy(g_client_limits);
+    access_log_close(g_access_log);
+    platform_net_cleanup();
+}
@@ -1,6 +1,133 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
-void start_http_server(int listen_port, const char *backend_host, int backend_port);
+#include "../core/event_loop.h"
+#include "../proxy/upstream.h"
+#include "access_log.h"
+#include "tls.h"
+
+#define HTTP_DEFAULT_MAX_BODY_SIZE (1024 * 1024)
+#define HTTP_DEFAULT_IO_BUFFER_SIZE 16384
+#define HTTP_MIN_IO_BUFFER_SIZE 4096
+#define HTTP_MAX_IO_BUFFER_SIZE (1024 * 1024)
+#define HTTP_DEFAULT_TLS_SESSION_TIMEOUT 3600
+#define HTTP_DEFAULT_H2_MAX_STREAMS 100
+#define HTTP_DEFAULT_RATE_BURST 20
+#define HTTP_DEFAULT_COMPRESS_TYPES "text/*,application/json,application/javascript,application/xml," \
+                                    "application/xhtml+xml,image/svg+xml"
+
+typedef struct http_server_config http_server_config_t;
+typedef struct config_string config_string_t;
+
+// Fills config with a freshly loaded configuration, including a newly
+// created upstream group that the server takes over. Returns 0 on success.
+typedef int (*http_config_reload_fn)(http_server_config_t *config, void *arg);
+
+// listen_port, admin_port, io_engine, io_buffer_size, cache, access log and
+// upgrade_socket settings, and whether TLS is on, are fixed at startup;
+// everything else (certificates included) is picked up on reload.
+struct http_server_config {
+    int listen_port;
+
+    // HTTPS on listen_port when certificates are given (HAVE_OPENSSL
+    // builds). tls_certs[0] serves clients whose SNI matches no other.
+    // Sessions resume for tls_session_timeout seconds, 0 disables that;
+    // tls_ktls moves record encryption into the kernel where it can
+    // (Linux), so large bodies are still spliced.
+    tls_keypair_t tls_certs[TLS_MAX_CERTS];
+    int tls_cert_count;
+    int tls_session_timeout;
+    int tls_ktls;
+
+    // HTTP/2 for clients that ask for it: over ALPN on HTTPS, or by
+    // opening with the connection preface (prior knowledge) on plain HTTP.
+    // A connection runs up to http2_max_streams requests at once.
+    int http2;
+    int http2_max_streams;
+
+    // Admission control, all 0 to disable. Requests past their client
+    // address's token bucket get 429, past the global one 503, both with
+    // Retry-After (rates per second, bursts in requests). Connections past
+    // max_connections, or accepted while the worker's loop runs
+    // shed_lag_ms behind, get a 503 and are closed at once.
+    int rate_limit_client_rps;
+    int rate_limit_client_burst;
+    int rate_limit_global_rps;
+    int rate_limit_global_burst;
+    int max_connections;
+    int shed_lag_ms;
+
+    const upstream_group_t *upstream;
+    event_engine_t io_engine;   // Kernel interface of every worker loop
+
+    // Upstream keep-alive pool, per worker
+    int pool_max_idle;          // Idle sockets kept per backend
+    int pool_idle_timeout_ms;
+
+    // Client and backend deadlines
+    int request_timeout_ms;     // Request head, from its first byte
+    int body_timeout_ms;        // Longest gap while a request body uploads
+    int keep_alive_timeout_ms;  // Idle time between requests
+    int connect_timeout_ms;     // Backend connect
+    int response_timeout_ms;    // Longest the backend may go quiet, 504 before headers
+    int send_timeout_ms;        // Longest the client may go without taking response bytes
+    int max_keep_alive_requests;
+
+    // Request and relay buffers come from per-worker slabs of
+    // io_buffer_size blocks and grow up to the header limits
+    int io_buffer_size;
+    int max_request_header_size;
+    int max_response_header_size;
+
+    // Request bodies stream to the backend; larger ones get 413
+    uint64_t max_body_size;     // Bytes, 0 for no limit
+
+    // Large response bodies bypass user space (Linux splice); ignored
+    // where the platform has no splice
+    int splice;
+
+    // Responses compressed for clients that accept it: codings offered
+    // (COMPRESS_BIT each, 0 disables), level for streamed bodies and for
+    // the copies kept with cache entries, smallest Content-Length worth
+    // it, and the content types to touch ("text/*" for a whole type)
+    unsigned compress_codings;
+    int compress_level;
+    int compress_cache_level;
+    int compress_min_size;
+    char compress_types[256];
+
+    // Shared response cache
+    size_t cache_size;          // Bytes, 0 disables caching
+    size_t cache_max_entry;     // Largest response stored, headers included
+
+    const char *access_log;     // File, "-" for stdout, NULL to disable
+    access_log_format_t access_log_format;
+
+    int admin_port;             // Prometheus /metrics on 127.0.0.1, 0 disables
+
+    // Zero-downtime upgrade (POSIX): a process started with the same path
+    // takes over the listening sockets, and this one then drains for up to
+    // drain_timeout_ms and returns from start_http_server(). NULL disables.
+    const char *upgrade_socket;
+    int drain_timeout_ms;
+
+    // SIGHUP calls reload and switches to the result without dropping
+    // connections (POSIX only). NULL leaves SIGHUP alone.
+    http_config_reload_fn reload;
+    void *reload_arg;
+
+    config_string_t *strings;   // Copies made by http_server_config_keep()
+};
+
+void http_server_config_defaults(http_server_config_t *config);
+
+// Copy s into strings the config owns, for values that must outlive what
+// they were read from. NULL stays NULL, as does s when out of memory.
+const char *http_server_config_keep(http_server_config_t *config, const char *s);
+void http_server_config_free_strings(http_server_config_t *config);
+
+// Runs until the server has handed its listeners to a new process and
+// drained
+void start_http_server(const http_server_config_t *config);
 
 #endif
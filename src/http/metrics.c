@@ -0,0 +1,304 @@
+#include "metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADMIN_IO_TIMEOUT_MS 2000
+#define ADMIN_REQUEST_SIZE 4096
+
+struct metrics_server {
+    sock_t fd;
+    thread_t thread;
+    int stop;
+    const worker_metrics_t *workers;
+    int count;
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+    "client_read", "upstream_connect", "upstream_ttfb", "upstream_body", "client_write", "total"
+};
+
+static const char *cache_result_names[CACHE_RESULT_COUNT] = {
+    "hit", "miss", "expired", "revalidated", "pass", "bypass"
+};
+
+// Prometheus bucket bounds in microseconds
+static const uint64_t latency_bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} text_t;
+
+static void text_printf(text_t *t, const char *fmt, ...) {
+    va_list ap;
+    while (1) {
+        va_start(ap, fmt);
+        int n = vsnprintf(t->data + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < t->cap - t->len) {
+            t->len += n;
+            return;
+        }
+        size_t cap = t->cap * 2 + n;
+        char *data = realloc(t->data, cap);
+        if (!data) return;
+        t->data = data;
+        t->cap = cap;
+    }
+}
+
+static void counter(text_t *t, const char *name, const char *help, uint64_t value) {
+    text_printf(t, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+// Sum every worker's block. Each field is read with a relaxed load while
+// its worker keeps writing, so the snapshot is per-field consistent only.
+static void aggregate(const metrics_server_t *s, worker_metrics_t *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int w = 0; w < s->count; w++) {
+        const worker_metrics_t *m = &s->workers[w];
+        sum->connections_accepted += counter_get(&m->connections_accepted);
+        sum->connections_active += counter_get(&m->connections_active);
+        sum->requests += counter_get(&m->requests);
+        for (int i = 0; i < 6; i++) sum->responses[i] += counter_get(&m->responses[i]);
+        sum->pool_hits += counter_get(&m->pool_hits);
+        sum->pool_misses += counter_get(&m->pool_misses);
+        sum->upstream_failures += counter_get(&m->upstream_failures);
+        for (int i = 0; i < CACHE_RESULT_COUNT; i++) sum->cache[i] += counter_get(&m->cache[i]);
+        sum->client_bytes_in += counter_get(&m->client_bytes_in);
+        sum->client_bytes_out += counter_get(&m->client_bytes_out);
+        sum->upstream_bytes_in += counter_get(&m->upstream_bytes_in);
+        sum->upstream_bytes_out += counter_get(&m->upstream_bytes_out);
+        sum->client_bytes_spliced += counter_get(&m->client_bytes_spliced);
+        sum->compressed_responses += counter_get(&m->compressed_responses);
+        sum->compress_bytes_in += counter_get(&m->compress_bytes_in);
+        sum->compress_bytes_out += counter_get(&m->compress_bytes_out);
+        sum->tls_handshakes += counter_get(&m->tls_handshakes);
+        sum->tls_resumed += counter_get(&m->tls_resumed);
+        sum->tls_handshake_failures += counter_get(&m->tls_handshake_failures);
+        sum->tls_kernel += counter_get(&m->tls_kernel);
+        sum->h2_sessions += counter_get(&m->h2_sessions);
+        sum->h2_streams += counter_get(&m->h2_streams);
+        sum->h2_streams_active += counter_get(&m->h2_streams_active);
+        sum->h2_streams_reset += counter_get(&m->h2_streams_reset);
+        sum->limited_client += counter_get(&m->limited_client);
+        sum->limited_global += counter_get(&m->limited_global);
+        sum->shed_max_connections += counter_get(&m->shed_max_connections);
+        sum->shed_lag += counter_get(&m->shed_lag);
+        sum->heap_allocs += counter_get(&m->heap_allocs);
+        for (int i = 0; i < STAGE_COUNT; i++) histogram_merge(&sum->stages[i], &m->stages[i]);
+    }
+}
+
+static void render(const metrics_server_t *s, text_t *t) {
+    worker_metrics_t *m = malloc(sizeof(*m));
+    if (!m) return;
+    aggregate(s, m);
+
+    counter(t, "proxy_connections_accepted_total", "Client connections accepted.", m->connections_accepted);
+    text_printf(t, "# HELP proxy_connections_active Client connections open now.\n"
+                   "# TYPE proxy_connections_active gauge\nproxy_connections_active %lld\n",
+                (long long)m->connections_active);
+    counter(t, "proxy_requests_total", "Requests received.", m->requests);
+
+    text_printf(t, "# HELP proxy_responses_total Responses sent, by status class.\n"
+                   "# TYPE proxy_responses_total counter\n");
+    static const char *classes[6] = { "other", "1xx", "2xx", "3xx", "4xx", "5xx" };
+    for (int i = 0; i < 6; i++) {
+        text_printf(t, "proxy_responses_total{code=\"%s\"} %llu\n", classes[i], (unsigned long long)m->responses[i]);
+    }
+
+    counter(t, "proxy_upstream_pool_hits_total", "Backend requests sent on a pooled connection.", m->pool_hits);
+    counter(t, "proxy_upstream_pool_misses_total", "Backend requests that opened a new connection.", m->pool_misses);
+    counter(t, "proxy_upstream_failures_total", "Failed backend exchanges.", m->upstream_failures);
+
+    text_printf(t, "# HELP proxy_cache_requests_total Cacheable-method requests, by cache result.\n"
+                   "# TYPE proxy_cache_requests_total counter\n");
+    for (int i = 0; i < CACHE_RESULT_COUNT; i++) {
+        text_printf(t, "proxy_cache_requests_total{result=\"%s\"} %llu\n", cache_result_names[i],
+                    (unsigned long long)m->cache[i]);
+    }
+
+    text_printf(t, "# HELP proxy_bytes_total Bytes moved, by peer and direction.\n"
+                   "# TYPE proxy_bytes_total counter\n"
+                   "proxy_bytes_total{peer=\"client\",direction=\"in\"} %llu\n"
+                   "proxy_bytes_total{peer=\"client\",direction=\"out\"} %llu\n"
+                   "proxy_bytes_total{peer=\"upstream\",direction=\"in\"} %llu\n"
+                   "proxy_bytes_total{peer=\"upstream\",direction=\"out\"} %llu\n",
+                (unsigned long long)m->client_bytes_in, (unsigned long long)m->client_bytes_out,
+                (unsigned long long)m->upstream_bytes_in, (unsigned long long)m->upstream_bytes_out);
+
+    counter(t, "proxy_spliced_bytes_total",
+            "Response body bytes relayed backend to client with splice, never copied to user space.",
+            m->client_bytes_spliced);
+
+    counter(t, "proxy_compressed_responses_total", "Responses sent with a content coding.", m->compressed_responses);
+    text_printf(t, "# HELP proxy_compression_bytes_total Body bytes into and out of encoders.\n"
+                   "# TYPE proxy_compression_bytes_total counter\n"
+                   "proxy_compression_bytes_total{direction=\"in\"} %llu\n"
+                   "proxy_compression_bytes_total{direction=\"out\"} %llu\n",
+                (unsigned long long)m->compress_bytes_in, (unsigned long long)m->compress_bytes_out);
+
+    text_printf(t, "# HELP proxy_tls_handshakes_total Client TLS handshakes, by outcome.\n"
+                   "# TYPE proxy_tls_handshakes_total counter\n"
+                   "proxy_tls_handshakes_total{result=\"full\"} %llu\n"
+                   "proxy_tls_handshakes_total{result=\"resumed\"} %llu\n"
+                   "proxy_tls_handshakes_total{result=\"failed\"} %llu\n",
+                (unsigned long long)m->tls_handshakes, (unsigned long long)m->tls_resumed,
+                (unsigned long long)m->tls_handshake_failures);
+    counter(t, "proxy_tls_kernel_connections_total",
+            "TLS connections handed to kernel TLS after the handshake.", m->tls_kernel);
+
+    counter(t, "proxy_http2_connections_total", "Client connections that spoke HTTP/2.", m->h2_sessions);
+    counter(t, "proxy_http2_streams_total", "Requests received as HTTP/2 streams.", m->h2_streams);
+    text_printf(t, "# HELP proxy_http2_streams_active HTTP/2 streams open now.\n"
+                   "# TYPE proxy_http2_streams_active gauge\nproxy_http2_streams_active %lld\n",
+                (long long)m->h2_streams_active);
+    counter(t, "proxy_http2_streams_reset_total", "HTTP/2 streams ended by RST_STREAM, from either side.",
+            m->h2_streams_reset);
+
+    text_printf(t, "# HELP proxy_requests_limited_total Requests refused by a rate limit, by bucket.\n"
+                   "# TYPE proxy_requests_limited_total counter\n"
+                   "proxy_requests_limited_total{bucket=\"client\"} %llu\n"
+                   "proxy_requests_limited_total{bucket=\"global\"} %llu\n",
+                (unsigned long long)m->limited_client, (unsigned long long)m->limited_global);
+    text_printf(t, "# HELP proxy_connections_shed_total Connections answered 503 and closed on accept, by reason.\n"
+                   "# TYPE proxy_connections_shed_total counter\n"
+                   "proxy_connections_shed_total{reason=\"max_connections\"} %llu\n"
+                   "proxy_connections_shed_total{reason=\"lag\"} %llu\n",
+                (unsigned long long)m->shed_max_connections, (unsigned long long)m->shed_lag);
+
+    counter(t, "proxy_heap_allocations_total",
+            "Heap allocations on the request path; flat once the worker slabs are warm.", m->heap_allocs);
+
+    text_printf(t, "# HELP proxy_stage_duration_seconds Time spent per request stage.\n"
+                   "# TYPE proxy_stage_duration_seconds histogram\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const histogram_t *h = &m->stages[i];
+        for (size_t b = 0; b < sizeof(latency_bounds) / sizeof(latency_bounds[0]); b++) {
+            text_printf(t, "proxy_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stage_names[i],
+                        latency_bounds[b] / 1e6, (unsigned long long)histogram_count_le(h, latency_bounds[b]));
+        }
+        text_printf(t, "proxy_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                       "proxy_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n"
+                       "proxy_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                    stage_names[i], (unsigned long long)h->count, stage_names[i], h->sum / 1e6,
+                    stage_names[i], (unsigned long long)h->count);
+    }
+
+    // Exact-bucket quantiles straight from the HDR histograms
+    text_printf(t, "# HELP proxy_stage_duration_quantile_seconds Stage latency quantiles.\n"
+                   "# TYPE proxy_stage_duration_quantile_seconds gauge\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            text_printf(t, "proxy_stage_duration_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+                        stage_names[i], quantiles[q], histogram_quantile(&m->stages[i], quantiles[q]) / 1e6);
+        }
+    }
+    free(m);
+}
+
+static int admin_wait(sock_t sock, int for_write) {
+    return sock_wait(sock, for_write, ADMIN_IO_TIMEOUT_MS) ? 0 : -1;
+}
+
+static void send_all(sock_t sock, const char *data, size_t len) {
+    while (len > 0) {
+        int n = send(sock, data, (int)len, 0);
+        if (n < 0 && sock_would_block() && admin_wait(sock, 1) == 0) continue;
+        if (n <= 0) return;
+        data += n;
+        len -= n;
+    }
+}
+
+static void admin_serve(metrics_server_t *s, sock_t sock) {
+    char request[ADMIN_REQUEST_SIZE];
+    int got = 0;
+    while (got < (int)sizeof(request) - 1) {
+        if (admin_wait(sock, 0) != 0) return;
+        int n = recv(sock, request + got, sizeof(request) - 1 - got, 0);
+        if (n <= 0) return;
+        got += n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET /metrics?", 13) != 0) {
+        static const char not_found[] =
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(sock, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    text_t body = { malloc(16384), 0, 16384 };
+    if (!body.data) return;
+    render(s, &body);
+
+    char head[160];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\nConnection: close\r\n\r\n", body.len);
+    send_all(sock, head, head_len);
+    send_all(sock, body.data, body.len);
+    free(body.data);
+}
+
+static void metrics_server_run(void *arg) {
+    metrics_server_t *s = arg;
+    while (!atomic_get(&s->stop)) {
+        // Check for stop five times a second
+        if (!sock_wait(s->fd, 0, 200)) continue;
+
+        sock_t client = accept(s->fd, NULL, NULL);
+        if (client == SOCK_INVALID) continue;
+        if (sock_set_nonblocking(client) == 0) admin_serve(s, client);
+        sock_close(client);
+    }
+}
+
+metrics_server_t *metrics_server_start(int port, const worker_metrics_t *workers, int count) {
+    metrics_server_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->workers = workers;
+    s->count = count;
+
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->fd == SOCK_INVALID) {
+        free(s);
+        return NULL;
+    }
+    int opt = 1;
+    setsockopt(s->fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+
+    // Operators only: never exposed beyond this host
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(s->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s->fd, 16) != 0 ||
+        sock_set_nonblocking(s->fd) != 0 || thread_start(&s->thread, metrics_server_run, s) != 0) {
+        sock_close(s->fd);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void metrics_server_stop(metrics_server_t *server) {
+    if (!server) return;
+    atomic_set(&server->stop, 1);
+    thread_join(server->thread);
+    sock_close(server->fd);
+    free(server);
+}
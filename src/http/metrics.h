@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "../core/histogram.h"
+
+// Per-worker counters and stage latency histograms. Each worker only ever
+// writes its own block (counter_add, no locks or shared cache lines); the
+// admin thread sums all blocks when scraped and renders them in
+// Prometheus text format on GET /metrics.
+
+typedef enum {
+    STAGE_CLIENT_READ,      // First request byte to complete request
+    STAGE_UPSTREAM_CONNECT, // New backend connection established
+    STAGE_UPSTREAM_TTFB,    // Request sent to backend headers received
+    STAGE_UPSTREAM_BODY,    // Backend headers to end of backend body
+    STAGE_CLIENT_WRITE,     // Response headers queued to last byte sent
+    STAGE_TOTAL,            // Complete request to last byte sent
+    STAGE_COUNT
+} metrics_stage_t;
+
+typedef enum {
+    CACHE_RESULT_HIT,
+    CACHE_RESULT_MISS,
+    CACHE_RESULT_EXPIRED,
+    CACHE_RESULT_REVALIDATED,
+    CACHE_RESULT_PASS,
+    CACHE_RESULT_BYPASS,
+    CACHE_RESULT_COUNT
+} metrics_cache_result_t;
+
+typedef struct {
+    uint64_t connections_accepted;
+    int64_t connections_active;
+    uint64_t requests;
+    uint64_t responses[6];          // By status class, [0] for anything else
+    uint64_t pool_hits;             // Backend sockets reused from the pool
+    uint64_t pool_misses;           // New backend connections
+    uint64_t upstream_failures;     // Connect errors, resets, bad responses
+    uint64_t cache[CACHE_RESULT_COUNT];
+    uint64_t client_bytes_in;
+    uint64_t client_bytes_out;
+    uint64_t upstream_bytes_in;
+    uint64_t upstream_bytes_out;
+    uint64_t client_bytes_spliced;  // Part of client_bytes_out relayed in the kernel
+    uint64_t compressed_responses;
+    uint64_t compress_bytes_in;     // Body bytes fed to encoders, cached copies included
+    uint64_t compress_bytes_out;
+    uint64_t tls_handshakes;        // Full handshakes completed
+    uint64_t tls_resumed;           // Handshakes that resumed a session
+    uint64_t tls_handshake_failures;
+    uint64_t tls_kernel;            // Connections whose records the kernel encrypts
+    uint64_t h2_sessions;           // Client connections that switched to HTTP/2
+    uint64_t h2_streams;            // Requests received as HTTP/2 streams
+    int64_t h2_streams_active;
+    uint64_t h2_streams_reset;      // Streams ended by RST_STREAM, either side
+    uint64_t limited_client;        // Requests over their client's rate (429)
+    uint64_t limited_global;        // Requests over the global rate (503)
+    uint64_t shed_max_connections;  // Connections turned away at the cap
+    uint64_t shed_lag;              // ... or while the worker lagged
+    uint64_t heap_allocs;           // Request-path mallocs: slab misses, buffer growth, cache copies
+    histogram_t stages[STAGE_COUNT];
+} worker_metrics_t;
+
+static inline void metrics_stage(worker_metrics_t *m, metrics_stage_t stage, uint64_t start_us, uint64_t now_us) {
+    histogram_record(&m->stages[stage], now_us > start_us ? now_us - start_us : 0);
+}
+
+typedef struct metrics_server metrics_server_t;
+
+// Serve /metrics for workers[0..count) on 127.0.0.1:port from a
+// background thread
+metrics_server_t *metrics_server_start(int port, const worker_metrics_t *workers, int count);
+void metrics_server_stop(metrics_server_t *server);
+
+#endif
@@ -0,0 +1,331 @@
+#include "tls.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#define TLS_RECORD_SIZE 16384       // Largest plaintext per record
+#define TLS_TICKET_KEYS_SIZE 80     // Name, HMAC and AES keys as SSL_CTX_get_tlsext_ticket_keys() returns them
+#define TLS_SESSION_ID_CONTEXT "reverse-proxy"
+
+struct tls_context {
+    SSL_CTX *ctx[TLS_MAX_CERTS];    // [0] is the default
+    int count;
+    int refs;
+};
+
+struct tls_conn {
+    SSL *ssl;
+    tls_context_t *context;
+    int established;
+    int kernel_send;
+};
+
+int tls_available(void) {
+    return 1;
+}
+
+static void set_error(char *err, size_t err_len, const char *what, const char *file) {
+    char reason[160];
+    ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+    ERR_clear_error();
+    snprintf(err, err_len, "%s %s: %s", what, file, reason);
+}
+
+// SNI: move the handshake to the first certificate that covers the name.
+// The default one is tried first, so a match there keeps it.
+static int on_servername(SSL *ssl, int *alert, void *arg) {
+    const tls_context_t *t = arg;
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    (void)alert;
+    if (!name) return SSL_TLSEXT_ERR_NOACK;
+
+    for (int i = 0; i < t->count; i++) {
+        X509 *cert = SSL_CTX_get0_certificate(t->ctx[i]);
+        if (cert && X509_check_host(cert, name, 0, 0, NULL) == 1) {
+            if (i > 0) SSL_set_SSL_CTX(ssl, t->ctx[i]);
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+    return SSL_TLSEXT_ERR_NOACK;
+}
+
+// Offered over ALPN in order of preference; the HTTP/1.1-only list is the
+// tail of the full one
+static const char ALPN_PROTOCOLS[] = "\x02h2\x08http/1.1";
+#define ALPN_HTTP11 (ALPN_PROTOCOLS + 3)
+
+// Clients offering none of arg's protocols still get HTTP/1.1, as without
+// ALPN
+static int on_alpn(SSL *ssl, const unsigned char **out, unsigned char *out_len, const unsigned char *in,
+                   unsigned in_len, void *arg) {
+    const char *server = arg;
+    (void)ssl;
+    if (SSL_select_next_proto((unsigned char **)out, out_len, (const unsigned char *)server, (unsigned)strlen(server),
+                              in, in_len) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static SSL_CTX *context_load(const tls_keypair_t *pair, int session_timeout, int ktls, int h2, char *err,
+                             size_t err_len) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        set_error(err, err_len, "creating context for", pair->cert_file);
+        return NULL;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, pair->cert_file) != 1) {
+        set_error(err, err_len, "loading certificate", pair->cert_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, pair->key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        set_error(err, err_len, "loading key", pair->key_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF;
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls) options |= SSL_OP_ENABLE_KTLS;
+#else
+    (void)ktls;
+#endif
+    if (session_timeout > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_timeout(ctx, session_timeout);
+        SSL_CTX_set_session_id_context(ctx, (const unsigned char *)TLS_SESSION_ID_CONTEXT,
+                                       sizeof(TLS_SESSION_ID_CONTEXT) - 1);
+        SSL_CTX_set_num_tickets(ctx, 1);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_num_tickets(ctx, 0);
+        options |= SSL_OP_NO_TICKET;
+    }
+    SSL_CTX_set_options(ctx, options);
+
+    // Writes come from buffers that stay put but are re-gathered on a
+    // retry; idle keep-alive connections give their record buffers back
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_read_ahead(ctx, 1);
+
+    // Set on every context: SNI may switch the handshake before ALPN runs
+    SSL_CTX_set_alpn_select_cb(ctx, on_alpn, (void *)(h2 ? ALPN_PROTOCOLS : ALPN_HTTP11));
+    return ctx;
+}
+
+tls_context_t *tls_context_create(const tls_keypair_t *certs, int count, int session_timeout, int ktls, int h2,
+                                  const tls_context_t *prev, char *err, size_t err_len) {
+    if (count < 1 || count > TLS_MAX_CERTS) {
+        snprintf(err, err_len, "between 1 and %d certificates are supported", TLS_MAX_CERTS);
+        return NULL;
+    }
+    tls_context_t *t = calloc(1, sizeof(*t));
+    if (!t) {
+        snprintf(err, err_len, "out of memory");
+        return NULL;
+    }
+    t->refs = 1;
+    for (int i = 0; i < count; i++) {
+        t->ctx[i] = context_load(&certs[i], session_timeout, ktls, h2, err, err_len);
+        if (!t->ctx[i]) {
+            tls_context_release(t);
+            return NULL;
+        }
+        t->count++;
+    }
+
+    // Resumption state lives in the default context, whichever
+    // certificate SNI picks
+    SSL_CTX_set_tlsext_servername_callback(t->ctx[0], on_servername);
+    SSL_CTX_set_tlsext_servername_arg(t->ctx[0], t);
+    if (prev && session_timeout > 0) {
+        unsigned char keys[TLS_TICKET_KEYS_SIZE];
+        if (SSL_CTX_get_tlsext_ticket_keys(prev->ctx[0], keys, sizeof(keys)) == 1) {
+            SSL_CTX_set_tlsext_ticket_keys(t->ctx[0], keys, sizeof(keys));
+        }
+        OPENSSL_cleanse(keys, sizeof(keys));
+    }
+    return t;
+}
+
+void tls_context_release(tls_context_t *t) {
+    if (!t || atomic_add(&t->refs, -1) > 0) return;
+    for (int i = 0; i < t->count; i++) SSL_CTX_free(t->ctx[i]);
+    free(t);
+}
+
+tls_conn_t *tls_conn_create(tls_context_t *t, sock_t fd) {
+    tls_conn_t *tls = calloc(1, sizeof(*tls));
+    if (!tls) return NULL;
+    tls->ssl = SSL_new(t->ctx[0]);
+    if (!tls->ssl || SSL_set_fd(tls->ssl, (int)fd) != 1) {
+        SSL_free(tls->ssl);
+        free(tls);
+        ERR_clear_error();
+        return NULL;
+    }
+    SSL_set_accept_state(tls->ssl);
+    atomic_add(&t->refs, 1);
+    tls->context = t;
+    return tls;
+}
+
+void tls_conn_free(tls_conn_t *tls) {
+    if (!tls) return;
+    if (tls->established) SSL_shutdown(tls->ssl);
+    SSL_free(tls->ssl);
+    ERR_clear_error();
+    tls_context_release(tls->context);
+    free(tls);
+}
+
+// Map an SSL call's failure onto the socket error convention
+static int fail(tls_conn_t *tls, int r) {
+    int e = SSL_get_error(tls->ssl, r);
+    ERR_clear_error();
+    if (e == SSL_ERROR_ZERO_RETURN) return 0;
+    sock_set_would_block(e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE);
+    return -1;
+}
+
+int tls_handshake(tls_conn_t *tls) {
+    if (tls->established) return 1;
+    int r = SSL_do_handshake(tls->ssl);
+    if (r != 1) {
+        r = fail(tls, r);
+        return r < 0 && sock_would_block() ? 0 : -1;
+    }
+    tls->established = 1;
+#ifdef BIO_get_ktls_send
+    tls->kernel_send = BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+#endif
+    return 1;
+}
+
+int tls_resumed(const tls_conn_t *tls) {
+    return SSL_session_reused(tls->ssl);
+}
+
+int tls_kernel_send(const tls_conn_t *tls) {
+    return tls->kernel_send;
+}
+
+int tls_alpn_h2(const tls_conn_t *tls) {
+    const unsigned char *proto;
+    unsigned len;
+    SSL_get0_alpn_selected(tls->ssl, &proto, &len);
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+int tls_recv(tls_conn_t *tls, char *buf, int len) {
+    size_t n;
+    int r = SSL_read_ex(tls->ssl, buf, (size_t)len, &n);
+    return r == 1 ? (int)n : fail(tls, r);
+}
+
+int tls_sendv(tls_conn_t *tls, sock_iov_t *iov, int count) {
+    if (tls->kernel_send) return sock_sendv(SSL_get_fd(tls->ssl), iov, count);
+
+    // A buffer of a full record or more goes as is; smaller ones are
+    // gathered so header lines don't each become a record. A retry after
+    // a wait gathers the same leading bytes again.
+    const char *data = SOCK_IOV_BASE(iov[0]);
+    size_t len = SOCK_IOV_LEN(iov[0]);
+    char gathered[TLS_RECORD_SIZE];
+    if (len < TLS_RECORD_SIZE && count > 1) {
+        len = 0;
+        for (int i = 0; i < count && len < TLS_RECORD_SIZE; i++) {
+            size_t take = SOCK_IOV_LEN(iov[i]);
+            if (take > TLS_RECORD_SIZE - len) take = TLS_RECORD_SIZE - len;
+            memcpy(gathered + len, SOCK_IOV_BASE(iov[i]), take);
+            len += take;
+        }
+        data = gathered;
+    }
+
+    size_t n;
+    int r = SSL_write_ex(tls->ssl, data, len, &n);
+    if (r == 1) return (int)n;
+    r = fail(tls, r);
+    if (r == 0) sock_set_would_block(0);   // close_notify instead of a write is a broken connection
+    return -1;
+}
+
+#else
+
+int tls_available(void) {
+    return 0;
+}
+
+tls_context_t *tls_context_create(const tls_keypair_t *certs, int count, int session_timeout, int ktls, int h2,
+                                  const tls_context_t *prev, char *err, size_t err_len) {
+    (void)certs;
+    (void)count;
+    (void)session_timeout;
+    (void)ktls;
+    (void)h2;
+    (void)prev;
+    snprintf(err, err_len, "TLS is not built in (HAVE_OPENSSL)");
+    return NULL;
+}
+
+void tls_context_release(tls_context_t *ctx) {
+    (void)ctx;
+}
+
+tls_conn_t *tls_conn_create(tls_context_t *ctx, sock_t fd) {
+    (void)ctx;
+    (void)fd;
+    return NULL;
+}
+
+void tls_conn_free(tls_conn_t *tls) {
+    (void)tls;
+}
+
+int tls_handshake(tls_conn_t *tls) {
+    (void)tls;
+    return -1;
+}
+
+int tls_resumed(const tls_conn_t *tls) {
+    (void)tls;
+    return 0;
+}
+
+int tls_kernel_send(const tls_conn_t *tls) {
+    (void)tls;
+    return 0;
+}
+
+int tls_alpn_h2(const tls_conn_t *tls) {
+    (void)tls;
+    return 0;
+}
+
+int tls_recv(tls_conn_t *tls, char *buf, int len) {
+    (void)tls;
+    (void)buf;
+    (void)len;
+    sock_set_would_block(0);
+    return -1;
+}
+
+int tls_sendv(tls_conn_t *tls, sock_iov_t *iov, int count) {
+    (void)tls;
+    (void)iov;
+    (void)count;
+    sock_set_would_block(0);
+    return -1;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include "../core/platform.h"
+
+// TLS termination for client connections, on OpenSSL (built with
+// HAVE_OPENSSL; without it no context can be created and the listener
+// stays plain HTTP).
+//
+// Each certificate gets its own SSL_CTX; the first is the default and SNI
+// switches a handshake to any other whose names (subjectAltName, or the
+// CN) match the requested host. Sessions resume from tickets and from the
+// default context's session cache. With kTLS the kernel takes over record
+// encryption once the handshake is done: plain writes, gather-writes and
+// splice then go straight to the socket and only reads stay with OpenSSL.
+//
+// Calls on a connection follow the socket calls they replace: they return
+// -1 with the error left for sock_would_block() when they have to wait,
+// and the wait may be on either readiness, so callers watch both.
+
+#define TLS_MAX_CERTS 8
+
+typedef struct {
+    const char *cert_file;  // PEM chain, leaf first
+    const char *key_file;   // PEM private key
+} tls_keypair_t;
+
+typedef struct tls_context tls_context_t;
+typedef struct tls_conn tls_conn_t;
+
+// True when this build can terminate TLS
+int tls_available(void);
+
+// Load count keypairs. session_timeout is in seconds, 0 disables
+// resumption. h2 offers HTTP/2 over ALPN next to HTTP/1.1. Ticket keys
+// are taken over from prev when given, so a reload doesn't invalidate the
+// tickets clients hold. NULL with the reason in err on failure.
+tls_context_t *tls_context_create(const tls_keypair_t *certs, int count, int session_timeout, int ktls, int h2,
+                                  const tls_context_t *prev, char *err, size_t err_len);
+
+// Contexts are shared by the connections created from them and go once
+// the last of those is freed. Thread-safe.
+void tls_context_release(tls_context_t *ctx);
+
+tls_conn_t *tls_conn_create(tls_context_t *ctx, sock_t fd);
+
+// Sends close_notify, best effort, once the handshake has completed.
+// Leaves fd open.
+void tls_conn_free(tls_conn_t *tls);
+
+// Returns 1 once the handshake has completed, 0 to wait, -1 on failure
+int tls_handshake(tls_conn_t *tls);
+int tls_resumed(const tls_conn_t *tls);
+
+// The client chose HTTP/2 over ALPN
+int tls_alpn_h2(const tls_conn_t *tls);
+
+// Record encryption is in the kernel: write to the socket directly
+int tls_kernel_send(const tls_conn_t *tls);
+
+// As recv(): bytes read, 0 at end of stream, -1 on error or to wait
+int tls_recv(tls_conn_t *tls, char *buf, int len);
+
+// As sock_sendv(). Small buffers are gathered into one record.
+int tls_sendv(tls_conn_t *tls, sock_iov_t *iov, int count);
+
+#endif
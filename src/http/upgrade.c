@@ -0,0 +1,157 @@
+#include "upgrade.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PLATFORM_HAS_FD_PASSING
+#include <poll.h>
+
+#define UPGRADE_MAGIC 0x50585955u           // Tags the offer message
+#define UPGRADE_CONFIRM_TIMEOUT_MS 30000    // For the new process to start its workers
+#define UPGRADE_POLL_MS 200                 // Serving thread checks for stop this often
+
+// Sent by the running process along with its listeners
+typedef struct {
+    uint32_t magic;
+    uint32_t port;
+} upgrade_offer_t;
+
+struct upgrade_server {
+    sock_t fd;
+    thread_t thread;
+    int stop;
+    int handed_off;
+    char path[108];             // sun_path size
+    int port;
+    sock_t fds[UPGRADE_MAX_LISTENERS];
+    int count;
+    upgrade_fn on_handoff;
+    void *arg;
+};
+
+// poll rather than select: the old process may hold far more than
+// FD_SETSIZE descriptors by the time it is upgraded
+static int wait_readable(sock_t sock, int timeout_ms) {
+    struct pollfd p = { sock, POLLIN, 0 };
+    return poll(&p, 1, timeout_ms) > 0;
+}
+
+int upgrade_takeover(const char *path, int port, sock_t *fds, int max, sock_t *ctl) {
+    sock_t sock = unix_connect(path);
+    if (sock == SOCK_INVALID) return 0;
+
+    upgrade_offer_t offer;
+    int count = 0;
+    int n = -1;
+    if (wait_readable(sock, UPGRADE_CONFIRM_TIMEOUT_MS)) {
+        n = sock_recv_fds(sock, &offer, sizeof(offer), fds, max, &count);
+    }
+    if (n != (int)sizeof(offer) || offer.magic != UPGRADE_MAGIC || (int)offer.port != port || count == 0) {
+        if (n == (int)sizeof(offer) && offer.magic == UPGRADE_MAGIC && (int)offer.port != port) {
+            printf("❌ Proxy at %s listens on port %u, not %d: not taking over\n", path, offer.port, port);
+        }
+        for (int i = 0; i < count; i++) sock_close(fds[i]);
+        sock_close(sock);
+        return 0;
+    }
+    *ctl = sock;
+    return count;
+}
+
+void upgrade_confirm(sock_t ctl) {
+    send(ctl, "R", 1, 0);
+    sock_close(ctl);
+}
+
+static void upgrade_serve_run(void *arg) {
+    upgrade_server_t *s = arg;
+    while (!atomic_get(&s->stop)) {
+        if (!wait_readable(s->fd, UPGRADE_POLL_MS)) continue;
+        sock_t client = accept(s->fd, NULL, NULL);
+        if (client == SOCK_INVALID) continue;
+
+        upgrade_offer_t offer = { UPGRADE_MAGIC, (uint32_t)s->port };
+        char reply = 0;
+        int confirmed = sock_send_fds(client, &offer, sizeof(offer), s->fds, s->count) == 0 &&
+                        wait_readable(client, UPGRADE_CONFIRM_TIMEOUT_MS) &&
+                        recv(client, &reply, 1, 0) == 1 && reply == 'R';
+        sock_close(client);
+        if (confirmed) {
+            atomic_set(&s->handed_off, 1);
+            s->on_handoff(s->arg);
+            return;
+        }
+        // The new process gave up before accepting: keep serving
+        printf("❌ Upgrade attempt on %s was not confirmed\n", s->path);
+    }
+}
+
+upgrade_server_t *upgrade_serve(const char *path, int port, const sock_t *fds, int count,
+                                upgrade_fn on_handoff, void *arg) {
+    upgrade_server_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    if (count < 1 || count > UPGRADE_MAX_LISTENERS || strlen(path) >= sizeof(s->path)) {
+        free(s);
+        return NULL;
+    }
+    strcpy(s->path, path);
+    s->port = port;
+    memcpy(s->fds, fds, count * sizeof(*fds));
+    s->count = count;
+    s->on_handoff = on_handoff;
+    s->arg = arg;
+
+    s->fd = unix_listen(path);
+    if (s->fd == SOCK_INVALID) {
+        free(s);
+        return NULL;
+    }
+    if (thread_start(&s->thread, upgrade_serve_run, s) != 0) {
+        sock_close(s->fd);
+        unlink(path);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void upgrade_serve_stop(upgrade_server_t *s) {
+    if (!s) return;
+    atomic_set(&s->stop, 1);
+    thread_join(s->thread);
+    sock_close(s->fd);
+    if (!atomic_get(&s->handed_off)) unlink(s->path);
+    free(s);
+}
+
+#else
+
+int upgrade_takeover(const char *path, int port, sock_t *fds, int max, sock_t *ctl) {
+    (void)path;
+    (void)port;
+    (void)fds;
+    (void)max;
+    (void)ctl;
+    return 0;
+}
+
+void upgrade_confirm(sock_t ctl) {
+    (void)ctl;
+}
+
+upgrade_server_t *upgrade_serve(const char *path, int port, const sock_t *fds, int count,
+                                upgrade_fn on_handoff, void *arg) {
+    (void)path;
+    (void)port;
+    (void)fds;
+    (void)count;
+    (void)on_handoff;
+    (void)arg;
+    return NULL;
+}
+
+void upgrade_serve_stop(upgrade_server_t *server) {
+    (void)server;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include "../core/platform.h"
+
+// Zero-downtime binary upgrade. A running proxy offers its listening
+// sockets on a Unix socket; a new process started with the same path takes
+// them over (SCM_RIGHTS), starts its workers on them and confirms, and only
+// then does the old process stop accepting and drain. The sockets never
+// close, so connections keep queueing on them throughout and none are
+// refused. POSIX only: elsewhere there is never anything to take over and
+// upgrade_serve() fails.
+
+#ifdef PLATFORM_HAS_FD_PASSING
+#define UPGRADE_MAX_LISTENERS SOCK_MAX_PASSED_FDS
+#else
+#define UPGRADE_MAX_LISTENERS 1
+#endif
+
+typedef struct upgrade_server upgrade_server_t;
+typedef void (*upgrade_fn)(void *arg);
+
+// New process: take the listeners of the proxy serving path on port.
+// Returns how many landed in fds, with *ctl set to confirm on; 0 if no
+// proxy is serving path or its port differs.
+int upgrade_takeover(const char *path, int port, sock_t *fds, int max, sock_t *ctl);
+
+// The new process is accepting: tell the old one to drain. Closes ctl.
+void upgrade_confirm(sock_t ctl);
+
+// Running process: hand fds to the next process that asks on path.
+// on_handoff runs on the serving thread once that process confirms, and
+// serving ends there.
+upgrade_server_t *upgrade_serve(const char *path, int port, const sock_t *fds, int count,
+                                upgrade_fn on_handoff, void *arg);
+
+// Removes path unless a successor has taken it over
+void upgrade_serve_stop(upgrade_server_t *server);
+
+#endif
@@ -1,18 +1,284 @@
+#include "core/rate_limit.h"
+#include "http/compress.h"
+#include "http/config_file.h"
+#include "http/http_scan.h"
 #include "http/http_server.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_CONFIG_PATH "config/config.json"
+
+// Kept for reloads, which parse the command line again
+typedef struct {
+    int argc;
+    char **argv;
+} cli_args_t;
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--config FILE] [--backend HOST:PORT[,weight=N]]... [--lb ALGORITHM] [--hash-key ip|uri]\n"
+           "          [--request-timeout MS] [--body-timeout MS] [--keep-alive-timeout MS]\n"
+           "          [--connect-timeout MS] [--response-timeout MS] [--send-timeout MS]\n"
+           "          [--pool-size N] [--pool-idle-timeout MS] [--max-body-size MB] [--no-splice]\n"
+           "          [--io-engine epoll|io_uring|poll]\n"
+           "          [--health-interval MS] [--health-path PATH] [--health-timeout MS]\n"
+           "          [--health-fails N] [--health-rises N] [--health-cooldown MS]\n"
+           "          [--cache-size MB] [--cache-max-entry KB]\n"
+           "          [--compress br,gzip,deflate|off] [--compress-level N] [--compress-min-size BYTES]\n"
+           "          [--compress-types LIST]\n"
+           "          [--access-log PATH|off] [--log-format text|json] [--admin-port N]\n"
+           "          [--upgrade-socket PATH] [--drain-timeout MS]\n"
+           "          [--tls-cert FILE --tls-key FILE]... [--tls-session-timeout S] [--no-ktls]\n"
+           "          [--no-http2] [--http2-max-streams N]\n"
+           "          [--client-rate RPS] [--client-burst N] [--global-rate RPS] [--global-burst N]\n"
+           "          [--max-connections N] [--shed-lag MS]\n"
+           "  Settings come from --config (default " DEFAULT_CONFIG_PATH " if present); options\n"
+           "  given here override the file, and --backend replaces its backend list.\n"
+           "  SIGHUP re-reads both and applies the result without dropping connections.\n"
+           "  ALGORITHM: round-robin (default), least-conn, p2c, hash\n"
+           "  Active health checks are off unless --health-interval is set; without\n"
+           "  --health-path they only test that the backend accepts a connection.\n"
+           "  Request bodies over --max-body-size (default 1, 0 for no limit) get 413.\n"
+           "  --io-engine picks the kernel interface (default epoll on Linux, poll elsewhere).\n"
+           "  --no-splice copies large response bodies through user space (Linux).\n"
+           "  The response cache is off unless --cache-size is set.\n"
+           "  Text-like responses are compressed for clients that accept it (br and gzip\n"
+           "  by default, where built in); cached ones once per coding, at level 9.\n"
+           "  The access log goes to stdout unless --access-log names a file.\n"
+           "  --admin-port serves Prometheus metrics at http://127.0.0.1:N/metrics.\n"
+           "  With --tls-cert the port speaks HTTPS; further pairs are picked by SNI and\n"
+           "  replace the file's list. --no-ktls keeps record encryption in user space.\n"
+           "  HTTP/2 is offered over ALPN with TLS and spoken to clients that open with\n"
+           "  its preface on plain HTTP, unless --no-http2 is given.\n"
+           "  --client-rate limits requests per client address (429 past it), --global-rate\n"
+           "  all requests together (503); bursts default to 20. --max-connections caps open\n"
+           "  client connections and --shed-lag turns new ones away while a worker's event\n"
+           "  loop runs that far behind; both answer 503 and close. All are off by default.\n"
+           "  With --upgrade-socket, starting a new proxy on the same path hands it the\n"
+           "  listening sockets; the old one finishes its requests and exits.\n", prog);
+}
+
+// Command line options, applied over whatever the config file set
+static int parse_args(http_server_config_t *config, upstream_group_t *upstream, int argc, char **argv) {
+    int cli_backends = 0;
+    int cli_certs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            i++;    // Already loaded
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (cli_backends++ == 0) {
+                // Replace the file's list; the group is not finalized yet
+                upstream->backend_count = 0;
+                upstream->total_weight = 0;
+            }
+            if (upstream_group_add(upstream, argv[++i]) != 0) {
+                printf("❌ Invalid backend '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--lb") == 0 && i + 1 < argc) {
+            if (upstream_parse_algorithm(argv[++i], &upstream->algorithm) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--hash-key") == 0 && i + 1 < argc) {
+            if (upstream_parse_hash_key(argv[++i], &upstream->hash_key) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--health-interval") == 0 && i + 1 < argc) {
+            upstream->health_config.interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--health-path") == 0 && i + 1 < argc) {
+            snprintf(upstream->health_config.path, sizeof(upstream->health_config.path), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--health-timeout") == 0 && i + 1 < argc) {
+            upstream->health_config.timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--health-fails") == 0 && i + 1 < argc) {
+            upstream->health_config.fall = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--health-rises") == 0 && i + 1 < argc) {
+            upstream->health_config.rise = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--health-cooldown") == 0 && i + 1 < argc) {
+            upstream->health_config.cooldown_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--request-timeout") == 0 && i + 1 < argc) {
+            config->request_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--body-timeout") == 0 && i + 1 < argc) {
+            config->body_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--response-timeout") == 0 && i + 1 < argc) {
+            config->response_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--send-timeout") == 0 && i + 1 < argc) {
+            config->send_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--keep-alive-timeout") == 0 && i + 1 < argc) {
+            config->keep_alive_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--connect-timeout") == 0 && i + 1 < argc) {
+            config->connect_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc) {
+            config->pool_max_idle = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool-idle-timeout") == 0 && i + 1 < argc) {
+            config->pool_idle_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-body-size") == 0 && i + 1 < argc) {
+            config->max_body_size = (uint64_t)strtoull(argv[++i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "--io-engine") == 0 && i + 1 < argc) {
+            if (event_engine_parse(argv[++i], &config->io_engine) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--no-splice") == 0) {
+            config->splice = 0;
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            config->cache_size = (size_t)strtoul(argv[++i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "--cache-max-entry") == 0 && i + 1 < argc) {
+            config->cache_max_entry = (size_t)strtoul(argv[++i], NULL, 10) << 10;
+        } else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+            if (compress_parse_codings(argv[++i], &config->compress_codings) != 0) {
+                printf("❌ Unknown coding in '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--compress-level") == 0 && i + 1 < argc) {
+            config->compress_level = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compress-min-size") == 0 && i + 1 < argc) {
+            config->compress_min_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compress-types") == 0 && i + 1 < argc) {
+            snprintf(config->compress_types, sizeof(config->compress_types), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--access-log") == 0 && i + 1 < argc) {
+            i++;
+            config->access_log = strcmp(argv[i], "off") == 0 ? NULL : argv[i];
+        } else if (strcmp(argv[i], "--upgrade-socket") == 0 && i + 1 < argc) {
+            config->upgrade_socket = argv[++i];
+        } else if (strcmp(argv[i], "--drain-timeout") == 0 && i + 1 < argc) {
+            config->drain_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tls-cert") == 0 && i + 1 < argc) {
+            if (cli_certs == TLS_MAX_CERTS) {
+                printf("❌ At most %d certificates\n", TLS_MAX_CERTS);
+                return -1;
+            }
+            config->tls_certs[cli_certs].cert_file = argv[++i];
+            config->tls_certs[cli_certs].key_file = NULL;
+            config->tls_cert_count = ++cli_certs;
+        } else if (strcmp(argv[i], "--tls-key") == 0 && i + 1 < argc) {
+            if (cli_certs == 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            config->tls_certs[cli_certs - 1].key_file = argv[++i];
+        } else if (strcmp(argv[i], "--tls-session-timeout") == 0 && i + 1 < argc) {
+            config->tls_session_timeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-ktls") == 0) {
+            config->tls_ktls = 0;
+        } else if (strcmp(argv[i], "--no-http2") == 0) {
+            config->http2 = 0;
+        } else if (strcmp(argv[i], "--http2-max-streams") == 0 && i + 1 < argc) {
+            config->http2_max_streams = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--client-rate") == 0 && i + 1 < argc) {
+            config->rate_limit_client_rps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--client-burst") == 0 && i + 1 < argc) {
+            config->rate_limit_client_burst = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--global-rate") == 0 && i + 1 < argc) {
+            config->rate_limit_global_rps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--global-burst") == 0 && i + 1 < argc) {
+            config->rate_limit_global_burst = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc) {
+            config->max_connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shed-lag") == 0 && i + 1 < argc) {
+            config->shed_lag_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--admin-port") == 0 && i + 1 < argc) {
+            config->admin_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-format") == 0 && i + 1 < argc) {
+            if (access_log_parse_format(argv[++i], &config->access_log_format) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    for (int i = 0; i < cli_certs; i++) {
+        if (!config->tls_certs[i].key_file) {
+            printf("❌ --tls-cert %s has no --tls-key\n", config->tls_certs[i].cert_file);
+            return -1;
+        }
+    }
+    const health_config_t *hc = &upstream->health_config;
+    if (config->pool_max_idle < 0 || config->pool_idle_timeout_ms <= 0 || hc->interval_ms < 0 ||
+        hc->timeout_ms <= 0 || hc->fall < 1 || hc->rise < 1 || hc->cooldown_ms < 0 ||
+        config->request_timeout_ms <= 0 || config->body_timeout_ms <= 0 || config->keep_alive_timeout_ms <= 0 ||
+        config->connect_timeout_ms <= 0 || config->response_timeout_ms <= 0 || config->send_timeout_ms <= 0 ||
+        config->drain_timeout_ms < 0 ||
+        config->cache_max_entry == 0 || config->admin_port < 0 || config->admin_port > 65535 ||
+        config->compress_level < COMPRESS_MIN_LEVEL || config->compress_level > COMPRESS_MAX_LEVEL ||
+        config->compress_min_size < 0 || config->tls_session_timeout < 0 ||
+        config->http2_max_streams < 1 || config->rate_limit_client_rps < 0 || config->rate_limit_client_burst < 1 ||
+        config->rate_limit_client_burst > RATE_LIMIT_MAX_BURST || config->rate_limit_global_rps < 0 ||
+        config->rate_limit_global_burst < 1 || config->rate_limit_global_burst > RATE_LIMIT_MAX_BURST ||
+        config->max_connections < 0 ||
+        config->shed_lag_ms < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+// Config file first, then the command line. Runs at startup and again on
+// every SIGHUP, so it reports problems instead of exiting.
+static int load_config(http_server_config_t *config, void *arg) {
+    const cli_args_t *cli = arg;
+    http_server_config_defaults(config);
 
-int main() {
     // 🔹 Proxy listen ở cổng 8080
-    int listen_port = 8080;
+    config->listen_port = 8080;
+
+    upstream_group_t *upstream = upstream_group_create("default", LB_ROUND_ROBIN);
+    if (!upstream) return -1;
+
+    const char *path = NULL;
+    for (int i = 1; i + 1 < cli->argc; i++) {
+        if (strcmp(cli->argv[i], "--config") == 0) path = cli->argv[i + 1];
+    }
+    if (!path) {
+        FILE *f = fopen(DEFAULT_CONFIG_PATH, "r");
+        if (f) {
+            fclose(f);
+            path = DEFAULT_CONFIG_PATH;
+        }
+    }
+    if (path) {
+        char err[512];
+        if (config_file_load(path, config, upstream, err, sizeof(err)) != 0) {
+            printf("❌ Invalid configuration: %s\n", err);
+            upstream_group_destroy(upstream);
+            return -1;
+        }
+    }
+    if (parse_args(config, upstream, cli->argc, cli->argv) != 0) {
+        upstream_group_destroy(upstream);
+        return -1;
+    }
 
     // 🔹 Backend server chạy ở localhost:5000 (Live Server của bạn)
-    const char *backend_host = "127.0.0.1";
-    int backend_port = 5501;
+    if (upstream->backend_count == 0) upstream_group_add(upstream, "127.0.0.1:5501");
+    if (upstream_group_finalize(upstream) != 0) {
+        printf("❌ Failed to build upstream group\n");
+        upstream_group_destroy(upstream);
+        return -1;
+    }
+    config->upstream = upstream;
+    config->reload = load_config;
+    config->reload_arg = arg;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    cli_args_t cli = { argc, argv };
+    http_server_config_t config;
+    if (load_config(&config, &cli) != 0) return 1;
+    const upstream_group_t *upstream = config.upstream;
 
     printf("Starting reverse proxy...\n");
-    printf("Frontend: http://127.0.0.1:%d/\n", listen_port);
-    printf("Backend : http://%s:%d/\n", backend_host, backend_port);
+    printf("Frontend: %s://127.0.0.1:%d/\n", config.tls_cert_count > 0 ? "https" : "http", config.listen_port);
+    for (int i = 0; i < upstream->backend_count; i++) {
+        printf("Backend : http://%s:%d/\n", upstream->backends[i].host, upstream->backends[i].port);
+    }
 
-    start_http_server(listen_port, backend_host, backend_port);
+    http_scan_select(HTTP_SCAN_AUTO);   // Once, before any thread parses
+    start_http_server(&config);
+    upstream_group_destroy((upstream_group_t *)upstream);
     return 0;
 }
@@ -0,0 +1,172 @@
+#include "health.h"
+#include "upstream.h"
+#include "proxy_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROBE_RESPONSE_SIZE 64
+#define TRIAL_TIMEOUT_MS 30000  // A trial that never reports back is retried after this
+
+struct health_checker {
+    const upstream_group_t *group;
+    thread_t thread;
+    int stop;
+};
+
+void health_config_defaults(health_config_t *config) {
+    config->interval_ms = 0;
+    config->timeout_ms = 1000;
+    config->path[0] = '\0';
+    config->fall = 3;
+    config->rise = 2;
+    config->cooldown_ms = 10000;
+}
+
+int health_available(const backend_health_t *h, uint64_t now) {
+    int state = atomic_get(&h->state);
+    if (state == HEALTH_UP) return 1;
+    // A half-open trial that never reported back expires like a cooldown
+    return now >= atomic_get(&h->retry_at);
+}
+
+int health_acquire(backend_health_t *h, uint64_t now) {
+    int state = atomic_get(&h->state);
+    if (state == HEALTH_UP) return 1;
+    if (now < atomic_get(&h->retry_at)) return 0;
+
+    // Exactly one worker gets the trial; the rest keep skipping the backend
+    atomic_set(&h->retry_at, now + TRIAL_TIMEOUT_MS);
+    return atomic_cas(&h->state, &state, HEALTH_HALF_OPEN);
+}
+
+static void health_eject(backend_health_t *h, const health_config_t *config, int from,
+                         const char *host, int port, const char *why) {
+    atomic_set(&h->retry_at, time_now_ms() + config->cooldown_ms);
+    if (atomic_cas(&h->state, &from, HEALTH_DOWN)) {
+        printf("🩺 Backend %s:%d %s, ejected for %d ms\n", host, port, why, config->cooldown_ms);
+    }
+}
+
+void health_report(backend_health_t *h, const health_config_t *config,
+                   const char *host, int port, int ok, int active) {
+    int state = atomic_get(&h->state);
+
+    if (ok) {
+        atomic_set(&h->failures, 0);
+        if (state == HEALTH_UP) return;
+
+        // A passing trial request closes the breaker at once; probes need
+        // `rise` passes in a row. Requests that were already in flight when
+        // the backend was ejected don't count.
+        if (active) {
+            if (atomic_add(&h->successes, 1) < config->rise) return;
+        } else if (state != HEALTH_HALF_OPEN) {
+            return;
+        }
+        atomic_set(&h->successes, 0);
+        if (atomic_cas(&h->state, &state, HEALTH_UP)) {
+            printf("🩺 Backend %s:%d is healthy again\n", host, port);
+        }
+        return;
+    }
+
+    atomic_set(&h->successes, 0);
+    switch (state) {
+    case HEALTH_UP:
+        if (atomic_add(&h->failures, 1) >= config->fall) {
+            health_eject(h, config, state, host, port, active ? "failed health checks" : "failing requests");
+        }
+        break;
+    case HEALTH_HALF_OPEN:
+        health_eject(h, config, state, host, port, "failed its trial request");
+        break;
+    case HEALTH_DOWN:
+        // Failing probes keep it out rather than letting a trial through
+        if (active) atomic_set(&h->retry_at, time_now_ms() + config->cooldown_ms);
+        break;
+    }
+}
+
+// Wait for the socket to become readable or writable within timeout_ms
+static int probe_wait(sock_t sock, int for_write, int timeout_ms) {
+    return sock_wait(sock, for_write, timeout_ms) ? 0 : -1;
+}
+
+// TCP connect, then optionally GET path and expect a 2xx/3xx status line
+// The address probed is the one workers connect to
+static int probe_backend(const upstream_backend_t *b, const health_config_t *config) {
+    sock_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == SOCK_INVALID) return 0;
+
+    int ok = 0;
+    if (sock_set_nonblocking(sock) != 0) goto done;
+    if (connect(sock, (const struct sockaddr *)&b->addr, sizeof(b->addr)) != 0) {
+        if (!sock_would_block() || probe_wait(sock, 1, config->timeout_ms) != 0) goto done;
+        if (proxy_handler_connect_result(sock) != 0) goto done;
+    }
+
+    if (config->path[0] == '\0') {
+        ok = 1;
+        goto done;
+    }
+
+    char request[512];
+    int len = snprintf(request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: reverse-proxy-health\r\nConnection: close\r\n\r\n",
+                       config->path, b->host, b->port);
+    if (len >= (int)sizeof(request) || send(sock, request, len, 0) != len) goto done;
+
+    char response[PROBE_RESPONSE_SIZE];
+    int got = 0;
+    while (got < 12) {
+        if (probe_wait(sock, 0, config->timeout_ms) != 0) goto done;
+        int n = recv(sock, response + got, sizeof(response) - got, 0);
+        if (n <= 0) goto done;
+        got += n;
+    }
+    ok = memcmp(response, "HTTP/1.", 7) == 0 && (response[9] == '2' || response[9] == '3');
+
+done:
+    sock_close(sock);
+    return ok;
+}
+
+static void health_checker_run(void *arg) {
+    health_checker_t *checker = arg;
+    const upstream_group_t *group = checker->group;
+    const health_config_t *config = &group->health_config;
+
+    while (!atomic_get(&checker->stop)) {
+        for (int i = 0; i < group->backend_count && !atomic_get(&checker->stop); i++) {
+            const upstream_backend_t *b = &group->backends[i];
+            int ok = probe_backend(b, config);
+            health_report(&group->health[i], config, b->host, b->port, ok, 1);
+        }
+
+        // Sleep in short steps so stopping doesn't wait a whole interval
+        for (int waited = 0; waited < config->interval_ms && !atomic_get(&checker->stop); waited += 100) {
+            sleep_ms(100);
+        }
+    }
+}
+
+health_checker_t *health_checker_start(const upstream_group_t *group) {
+    if (group->health_config.interval_ms <= 0) return NULL;
+
+    health_checker_t *checker = calloc(1, sizeof(*checker));
+    if (!checker) return NULL;
+    checker->group = group;
+    if (thread_start(&checker->thread, health_checker_run, checker) != 0) {
+        free(checker);
+        return NULL;
+    }
+    return checker;
+}
+
+void health_checker_stop(health_checker_t *checker) {
+    if (!checker) return;
+    atomic_set(&checker->stop, 1);
+    thread_join(checker->thread);
+    free(checker);
+}
@@ -0,0 +1,58 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include "../core/platform.h"
+
+// Per-backend circuit breaker fed by passive failures (connect errors,
+// resets, timeouts seen by workers) and, optionally, by active probes from
+// a checker thread. An ejected backend is skipped by the balancer, so
+// requests fail or move on without waiting on a dead peer. After the
+// cooldown one trial request is let through (half-open); its outcome closes
+// or re-opens the breaker. Active probes can restore a backend earlier.
+
+typedef enum {
+    HEALTH_UP,          // Closed breaker: traffic flows
+    HEALTH_DOWN,        // Open: skipped until retry_at
+    HEALTH_HALF_OPEN    // One trial request in flight
+} health_state_t;
+
+typedef struct {
+    int interval_ms;    // Active probe period, 0 disables probing
+    int timeout_ms;     // Per probe
+    char path[256];     // HTTP GET path; empty probes with a TCP connect
+    int fall;           // Consecutive failures that eject a backend
+    int rise;           // Consecutive probe successes that restore it
+    int cooldown_ms;    // Ejection time before a half-open trial
+} health_config_t;
+
+// Shared by all workers; only touched through atomics
+typedef struct {
+    int state;
+    int failures;
+    int successes;
+    uint64_t retry_at;
+} backend_health_t;
+
+void health_config_defaults(health_config_t *config);
+
+// True if the balancer may pick this backend at now
+int health_available(const backend_health_t *h, uint64_t now);
+
+// Claim the backend for a request. Fails only when another worker won the
+// race for the single half-open trial.
+int health_acquire(backend_health_t *h, uint64_t now);
+
+// Outcome of a request (active = 0) or probe (active = 1); host and port
+// only label state change logs
+void health_report(backend_health_t *h, const health_config_t *config,
+                   const char *host, int port, int ok, int active);
+
+typedef struct health_checker health_checker_t;
+struct upstream_group;
+
+// Probe every backend of the group every health_config.interval_ms on a
+// background thread. Returns NULL when probing is disabled.
+health_checker_t *health_checker_start(const struct upstream_group *group);
+void health_checker_stop(health_checker_t *checker);
+
+#endif
@@ -1,301 +1,286 @@
 #include "proxy_handler.h"
+#include "../core/timer_wheel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <process.h>
 
-#pragma comment(lib, "ws2_32.lib")
+#define POOL_WHEEL_TICK_MS 1000
+#define POOL_INITIAL_BACKENDS 16
 
-#define MAX_POOL_SIZE 20
-#define KEEP_ALIVE_TIMEOUT 30000 // 30 seconds
+typedef struct pool_backend pool_backend_t;
 
-// Connection pool structure
-typedef struct {
-    SOCKET sock;
+// One idle socket, linked into its backend's idle list
+typedef struct pool_conn {
+    sock_t sock;
+    pool_backend_t *backend;
+    timer_entry_t idle_timer;
+    struct pool_conn *prev;
+    struct pool_conn *next;
+} pool_conn_t;
+
+struct pool_backend {
+    uint64_t key;
     char host[256];
     int port;
-    DWORD last_used;
-    int in_use;
-} pool_connection_t;
-
-static pool_connection_t connection_pool[MAX_POOL_SIZE];
-static CRITICAL_SECTION pool_mutex;
-static int pool_initialized = 0;
-
-void proxy_handler_init() {
-    if (!pool_initialized) {
-        InitializeCriticalSection(&pool_mutex);
-        memset(connection_pool, 0, sizeof(connection_pool));
-        for (int i = 0; i < MAX_POOL_SIZE; i++) {
-            connection_pool[i].sock = INVALID_SOCKET;
-        }
-        pool_initialized = 1;
-        printf("🔗 Connection pool initialized with %d slots\n", MAX_POOL_SIZE);
+    upstream_pool_t *pool;
+    pool_conn_t *idle;  // Most recently used first
+    int idle_count;
+};
+
+struct upstream_pool {
+    pool_backend_t **backends;  // Open addressing on key
+    int backend_cap;
+    int backend_count;
+    pool_conn_t *free_conns;    // Recycled list nodes
+    timer_wheel_t wheel;
+    int max_idle;
+    int idle_timeout_ms;
+};
+
+// FNV-1a over host and port; 0 is reserved
+static uint64_t backend_key(const char *host, int port) {
+    uint64_t h = 1469598103934665603ull;
+    for (const char *p = host; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ull;
     }
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ (unsigned char)(port >> (i * 8))) * 1099511628211ull;
+    }
+    return h ? h : 1;
 }
 
-void proxy_handler_cleanup() {
-    if (pool_initialized) {
-        EnterCriticalSection(&pool_mutex);
-        for (int i = 0; i < MAX_POOL_SIZE; i++) {
-            if (connection_pool[i].sock != INVALID_SOCKET) {
-                closesocket(connection_pool[i].sock);
-                connection_pool[i].sock = INVALID_SOCKET;
-            }
-        }
-        LeaveCriticalSection(&pool_mutex);
-        DeleteCriticalSection(&pool_mutex);
-        pool_initialized = 0;
+upstream_pool_t *proxy_pool_create(int max_idle_per_backend, int idle_timeout_ms) {
+    upstream_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->backends = calloc(POOL_INITIAL_BACKENDS, sizeof(*pool->backends));
+    if (!pool->backends) {
+        free(pool);
+        return NULL;
     }
+    pool->backend_cap = POOL_INITIAL_BACKENDS;
+    pool->max_idle = max_idle_per_backend;
+    pool->idle_timeout_ms = idle_timeout_ms;
+    timer_wheel_init(&pool->wheel, POOL_WHEEL_TICK_MS, time_now_ms());
+    return pool;
+}
+
+void proxy_pool_configure(upstream_pool_t *pool, int max_idle_per_backend, int idle_timeout_ms) {
+    pool->max_idle = max_idle_per_backend;
+    pool->idle_timeout_ms = idle_timeout_ms;
 }
 
-// Get connection from pool or create new one
-SOCKET get_pooled_connection(const char *host, int port) {
-    if (!pool_initialized) return INVALID_SOCKET;
-    
-    EnterCriticalSection(&pool_mutex);
-    
-    DWORD now = GetTickCount();
-    
-    // First, clean up expired connections
-    for (int i = 0; i < MAX_POOL_SIZE; i++) {
-        if (connection_pool[i].sock != INVALID_SOCKET && 
-            !connection_pool[i].in_use &&
-            (now - connection_pool[i].last_used) > KEEP_ALIVE_TIMEOUT) {
-            closesocket(connection_pool[i].sock);
-            connection_pool[i].sock = INVALID_SOCKET;
+void proxy_pool_destroy(upstream_pool_t *pool) {
+    if (!pool) return;
+    for (int i = 0; i < pool->backend_cap; i++) {
+        pool_backend_t *b = pool->backends[i];
+        if (!b) continue;
+        while (b->idle) {
+            pool_conn_t *c = b->idle;
+            b->idle = c->next;
+            sock_close(c->sock);
+            free(c);
         }
+        free(b);
     }
-    
-    // Look for existing connection to same host:port
-    for (int i = 0; i < MAX_POOL_SIZE; i++) {
-        if (connection_pool[i].sock != INVALID_SOCKET &&
-            !connection_pool[i].in_use &&
-            strcmp(connection_pool[i].host, host) == 0 &&
-            connection_pool[i].port == port) {
-            
-            // Test if connection is still alive with a quick check
-            fd_set write_fds;
-            struct timeval timeout = {0, 0};
-            FD_ZERO(&write_fds);
-            FD_SET(connection_pool[i].sock, &write_fds);
-            
-            if (select(0, NULL, &write_fds, NULL, &timeout) >= 0) {
-                connection_pool[i].in_use = 1;
-                connection_pool[i].last_used = now;
-                SOCKET sock = connection_pool[i].sock;
-                LeaveCriticalSection(&pool_mutex);
-                return sock;
-            } else {
-                // Connection is dead, close it
-                closesocket(connection_pool[i].sock);
-                connection_pool[i].sock = INVALID_SOCKET;
-            }
+    while (pool->free_conns) {
+        pool_conn_t *c = pool->free_conns;
+        pool->free_conns = c->next;
+        free(c);
+    }
+    free(pool->backends);
+    free(pool);
+}
+
+static pool_backend_t **backend_slot(upstream_pool_t *pool, uint64_t key, const char *host, int port) {
+    int mask = pool->backend_cap - 1;
+    for (int i = (int)(key & mask);; i = (i + 1) & mask) {
+        pool_backend_t *b = pool->backends[i];
+        if (!b) return &pool->backends[i];
+        // The string compare only runs on a hash match
+        if (b->key == key && b->port == port && strcmp(b->host, host) == 0) {
+            return &pool->backends[i];
         }
     }
-    
-    LeaveCriticalSection(&pool_mutex);
-    return INVALID_SOCKET;
+}
+
+static int backends_grow(upstream_pool_t *pool) {
+    int cap = pool->backend_cap * 2;
+    pool_backend_t **old = pool->backends;
+    int old_cap = pool->backend_cap;
+
+    pool->backends = calloc(cap, sizeof(*pool->backends));
+    if (!pool->backends) {
+        pool->backends = old;
+        return -1;
+    }
+    pool->backend_cap = cap;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i]) *backend_slot(pool, old[i]->key, old[i]->host, old[i]->port) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static pool_backend_t *backend_get(upstream_pool_t *pool, const char *host, int port, int create) {
+    uint64_t key = backend_key(host, port);
+    pool_backend_t **slot = backend_slot(pool, key, host, port);
+    if (*slot || !create) return *slot;
+    if (strlen(host) >= sizeof((*slot)->host)) return NULL;
+
+    // Keep the table at most half full
+    if ((pool->backend_count + 1) * 2 > pool->backend_cap) {
+        if (backends_grow(pool) != 0) return NULL;
+        slot = backend_slot(pool, key, host, port);
+    }
+
+    pool_backend_t *b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    b->key = key;
+    strcpy(b->host, host);
+    b->port = port;
+    b->pool = pool;
+    *slot = b;
+    pool->backend_count++;
+    return b;
+}
+
+static void idle_unlink(pool_conn_t *c) {
+    pool_backend_t *b = c->backend;
+    if (c->prev) c->prev->next = c->next;
+    else b->idle = c->next;
+    if (c->next) c->next->prev = c->prev;
+    b->idle_count--;
+}
+
+static void idle_recycle(upstream_pool_t *pool, pool_conn_t *c) {
+    c->next = pool->free_conns;
+    pool->free_conns = c;
+}
+
+static void on_idle_timeout(timer_entry_t *timer) {
+    pool_conn_t *c = timer->data;
+    upstream_pool_t *pool = c->backend->pool;
+    idle_unlink(c);
+    sock_close(c->sock);
+    idle_recycle(pool, c);
+}
+
+void proxy_pool_reap(upstream_pool_t *pool, uint64_t now) {
+    timer_wheel_advance(&pool->wheel, now);
+}
+
+// An idle HTTP/1.1 connection should have nothing to read. EOF means the
+// backend closed it; stray bytes mean the stream is out of sync.
+static int pooled_socket_alive(sock_t sock) {
+    char ch;
+    int n = recv(sock, &ch, 1, MSG_PEEK);
+    if (n >= 0) return 0;
+    return sock_would_block();
+}
+
+// Most recently used live socket for host:port, or SOCK_INVALID
+static sock_t get_pooled_connection(upstream_pool_t *pool, const char *host, int port) {
+    pool_backend_t *b = backend_get(pool, host, port, 0);
+    if (!b) return SOCK_INVALID;
+
+    while (b->idle) {
+        pool_conn_t *c = b->idle;
+        sock_t sock = c->sock;
+        idle_unlink(c);
+        timer_wheel_remove(&pool->wheel, &c->idle_timer);
+        idle_recycle(pool, c);
+
+        if (pooled_socket_alive(sock)) return sock;
+        sock_close(sock);
+    }
+    return SOCK_INVALID;
 }
 
 // Return connection to pool
-void return_pooled_connection(SOCKET sock, const char *host, int port, int keep_alive) {
-    if (!pool_initialized || sock == INVALID_SOCKET) return;
-    
-    EnterCriticalSection(&pool_mutex);
-    
-    // Find the connection in pool
-    for (int i = 0; i < MAX_POOL_SIZE; i++) {
-        if (connection_pool[i].sock == sock) {
-            connection_pool[i].in_use = 0;
-            connection_pool[i].last_used = GetTickCount();
-            
-            if (!keep_alive) {
-                closesocket(connection_pool[i].sock);
-                connection_pool[i].sock = INVALID_SOCKET;
-            }
-            LeaveCriticalSection(&pool_mutex);
-            return;
-        }
+static void return_pooled_connection(upstream_pool_t *pool, sock_t sock, const char *host, int port, int keep_alive) {
+    if (sock == SOCK_INVALID) return;
+
+    pool_backend_t *b = keep_alive ? backend_get(pool, host, port, 1) : NULL;
+    if (!b || b->idle_count >= pool->max_idle) {
+        sock_close(sock);
+        return;
     }
-    
-    // If not in pool and we want to keep it, add it
-    if (keep_alive) {
-        for (int i = 0; i < MAX_POOL_SIZE; i++) {
-            if (connection_pool[i].sock == INVALID_SOCKET) {
-                connection_pool[i].sock = sock;
-                strcpy(connection_pool[i].host, host);
-                connection_pool[i].port = port;
-                connection_pool[i].last_used = GetTickCount();
-                connection_pool[i].in_use = 0;
-                LeaveCriticalSection(&pool_mutex);
-                return;
-            }
-        }
+
+    pool_conn_t *c = pool->free_conns;
+    if (c) pool->free_conns = c->next;
+    else c = malloc(sizeof(*c));
+    if (!c) {
+        sock_close(sock);
+        return;
     }
-    
-    // Pool is full or we don't want to keep it
-    closesocket(sock);
-    LeaveCriticalSection(&pool_mutex);
+
+    c->sock = sock;
+    c->backend = b;
+    c->idle_timer.fn = on_idle_timeout;
+    c->idle_timer.data = c;
+    c->idle_timer.pprev = NULL;
+    c->prev = NULL;
+    c->next = b->idle;
+    if (b->idle) b->idle->prev = c;
+    b->idle = c;
+    b->idle_count++;
+    timer_wheel_add(&pool->wheel, &c->idle_timer, time_now_ms() + pool->idle_timeout_ms);
 }
 
-// Fast version with connection pooling
-unsigned char *proxy_handler_forward_fast(const char *host, int port, const char *request, int request_len, int *out_len) {
-    SOCKET sock;
-    struct addrinfo hints, *res;
-    char buffer[8192];
-    unsigned char *response = NULL;
-    int use_keep_alive = 0;
-    
-    *out_len = 0;
-    
+// Connect to backend without blocking the calling event loop
+sock_t proxy_handler_connect(upstream_pool_t *pool, const char *host, int port, const struct sockaddr_in *addr,
+                             int *connected, int *reused) {
+    sock_t sock;
+
+    *connected = 0;
+    *reused = 0;
+
     // Try to get from connection pool first
-    sock = get_pooled_connection(host, port);
-    
-    if (sock == INVALID_SOCKET) {
-        // Create new connection
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        
-        char port_str[16];
-        sprintf(port_str, "%d", port);
-        
-        if (getaddrinfo(host, port_str, &hints, &res) != 0) {
-            return NULL;
-        }
-        
-        sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-        if (sock == INVALID_SOCKET) {
-            freeaddrinfo(res);
-            return NULL;
-        }
-        
-        // Set socket options for performance
-        int opt = 1;
-        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt)); // Disable Nagle
-        
-        int bufsize = 32768; // 32KB buffer
-        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&bufsize, sizeof(bufsize));
-        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&bufsize, sizeof(bufsize));
-        
-        // Quick connect timeout
-        int timeout = 3000; // 3 seconds
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
-        
-        if (connect(sock, res->ai_addr, (int)res->ai_addrlen) == SOCKET_ERROR) {
-            closesocket(sock);
-            freeaddrinfo(res);
-            return NULL;
-        }
-        
-        freeaddrinfo(res);
-        use_keep_alive = 1; // New connection, can be reused
+    sock = get_pooled_connection(pool, host, port);
+    if (sock != SOCK_INVALID) {
+        *connected = 1;
+        *reused = 1;
+        return sock;
     }
-    
-    // Modify request to add Connection: keep-alive if not present
-    char *modified_request = NULL;
-    int modified_len = request_len;
-    
-    if (!strstr(request, "Connection:")) {
-        // Add Connection: keep-alive
-        char *header_end = strstr(request, "\r\n\r\n");
-        if (header_end) {
-            int headers_len = header_end - request;
-            int body_len = request_len - headers_len - 4;
-            
-            modified_len = request_len + 24; // "Connection: keep-alive\r\n"
-            modified_request = malloc(modified_len + 1);
-            
-            memcpy(modified_request, request, headers_len);
-            memcpy(modified_request + headers_len, "\r\nConnection: keep-alive\r\n\r\n", 28);
-            if (body_len > 0) {
-                memcpy(modified_request + headers_len + 28, header_end + 4, body_len);
-            }
-            modified_len = headers_len + 28 + body_len;
-        } else {
-            modified_request = (char*)request;
-            use_keep_alive = 0;
-        }
-    } else {
-        modified_request = (char*)request;
-        // Check if it already has keep-alive
-        use_keep_alive = (strstr(request, "Connection: keep-alive") != NULL);
+
+    // Create new connection to the address resolved with the upstream group
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == SOCK_INVALID) {
+        return SOCK_INVALID;
     }
-    
-    // Send request
-    int sent = 0;
-    while (sent < modified_len) {
-        int bytes_sent = send(sock, modified_request + sent, modified_len - sent, 0);
-        if (bytes_sent == SOCKET_ERROR) {
-            if (modified_request != request) free(modified_request);
-            return_pooled_connection(sock, host, port, 0);
-            return NULL;
-        }
-        sent += bytes_sent;
+
+    // Set socket options for performance
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt)); // Disable Nagle
+
+    int bufsize = 32768; // 32KB buffer
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&bufsize, sizeof(bufsize));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&bufsize, sizeof(bufsize));
+
+    if (sock_set_nonblocking(sock) != 0) {
+        sock_close(sock);
+        return SOCK_INVALID;
     }
-    
-    if (modified_request != request) free(modified_request);
-    
-    // Read response with better buffering
-    response = malloc(8192);
-    int capacity = 8192;
-    
-    while (1) {
-        int n = recv(sock, buffer, sizeof(buffer), 0);
-        if (n <= 0) break;
-        
-        // Expand buffer if needed
-        if (*out_len + n > capacity) {
-            capacity *= 2;
-            unsigned char *new_response = realloc(response, capacity);
-            if (!new_response) {
-                free(response);
-                return_pooled_connection(sock, host, port, 0);
-                return NULL;
-            }
-            response = new_response;
-        }
-        
-        memcpy(response + *out_len, buffer, n);
-        *out_len += n;
-        
-        // Quick check for complete response (optimize for small responses)
-        if (*out_len >= 4 && strstr((char*)response, "\r\n\r\n")) {
-            char *header_end = strstr((char*)response, "\r\n\r\n");
-            char *content_length_str = strstr((char*)response, "Content-Length:");
-            
-            if (content_length_str && content_length_str < header_end) {
-                int content_length = 0;
-                sscanf(content_length_str, "Content-Length: %d", &content_length);
-                
-                int headers_len = header_end - (char*)response + 4;
-                int body_received = *out_len - headers_len;
-                
-                if (body_received >= content_length) {
-                    break; // Complete response
-                }
-            } else if (strstr((char*)response, "Transfer-Encoding: chunked")) {
-                if (strstr((char*)response, "\r\n0\r\n\r\n")) {
-                    break; // End of chunked response
-                }
-            }
-        }
+
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) == 0) {
+        *connected = 1; // Loopback connects often complete immediately
+    } else if (!sock_would_block()) {
+        sock_close(sock);
+        return SOCK_INVALID;
     }
-    
-    // Check if backend wants to keep connection alive
-    int backend_keep_alive = use_keep_alive && 
-                           strstr((char*)response, "Connection: keep-alive") != NULL;
-    
-    return_pooled_connection(sock, host, port, backend_keep_alive);
-    
-    return response;
+
+    return sock;
 }
 
-// Legacy function for compatibility
-unsigned char *proxy_handler_forward(const char *host, int port, const char *request, int request_len, int *out_len) {
-    return proxy_handler_forward_fast(host, port, request, request_len, out_len);
-}
\ No newline at end of file
+int proxy_handler_connect_result(sock_t sock) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&err, &len) != 0) {
+        return sock_last_error();
+    }
+    return err;
+}
+
+void proxy_handler_release(upstream_pool_t *pool, sock_t sock, const char *host, int port, int keep_alive) {
+    return_pooled_connection(pool, sock, host, port, keep_alive);
+}
@@ -1,18 +1,38 @@
 #ifndef PROXY_HANDLER_H
 #define PROXY_HANDLER_H
 
-#include <winsock2.h>
+#include "../core/platform.h"
 
-// Initialize connection pool
-void proxy_handler_init(void);
+#define POOL_DEFAULT_MAX_IDLE 32            // Idle sockets per backend, per worker
+#define POOL_DEFAULT_IDLE_TIMEOUT_MS 30000
 
-// Cleanup connection pool
-void proxy_handler_cleanup(void);
+// Idle backend connections, one pool per worker. Only the owning worker's
+// event loop touches it, so acquire and release take no locks. Backends
+// are found by a hash of host:port; each keeps its idle sockets most
+// recently used first, and a timer wheel closes the ones left idle too long.
+typedef struct upstream_pool upstream_pool_t;
 
-// Fast forwarding with connection pooling
-unsigned char *proxy_handler_forward_fast(const char *host, int port, const char *request, int request_len, int *out_len);
+upstream_pool_t *proxy_pool_create(int max_idle_per_backend, int idle_timeout_ms);
+void proxy_pool_destroy(upstream_pool_t *pool);
 
-// Legacy function for compatibility
-unsigned char *proxy_handler_forward(const char *host, int port, const char *request, int request_len, int *out_len);
+// New limits for sockets released from now on; sockets already idle keep
+// their expiry
+void proxy_pool_configure(upstream_pool_t *pool, int max_idle_per_backend, int idle_timeout_ms);
 
-#endif
\ No newline at end of file
+// Close idle sockets whose timeout has passed; call from the worker's tick
+void proxy_pool_reap(upstream_pool_t *pool, uint64_t now);
+
+// Get a non-blocking connection to the backend at addr, pooled if possible
+// (host:port names the pool). *connected is 1 when the socket is usable
+// right away (pooled or connected immediately); otherwise wait for
+// writability and call proxy_handler_connect_result().
+sock_t proxy_handler_connect(upstream_pool_t *pool, const char *host, int port, const struct sockaddr_in *addr,
+                             int *connected, int *reused);
+
+// 0 once a pending non-blocking connect has succeeded, the socket error otherwise
+int proxy_handler_connect_result(sock_t sock);
+
+// Hand a backend connection back; it is pooled only if keep_alive is set
+void proxy_handler_release(upstream_pool_t *pool, sock_t sock, const char *host, int port, int keep_alive);
+
+#endif
@@ -0,0 +1,349 @@
+#include "upstream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGLEV_EMPTY 0xffff
+#define MAGLEV_MAX_PROBE 64     // Table entries tried past an ejected backend
+
+struct upstream_lb {
+    const upstream_group_t *group;
+    int *current;       // Smooth round-robin credit per backend (also least-conn ties)
+    int *active;        // Requests in flight per backend, this worker only
+    int *cumulative;    // Running weight sums for weighted random picks
+    uint8_t *excluded;  // Lost a half-open race during the current pick
+    uint64_t now;       // Time of the current pick
+    uint32_t rng;
+};
+
+static uint64_t fnv1a(const char *data, size_t len, uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+upstream_group_t *upstream_group_create(const char *name, lb_algorithm_t algorithm) {
+    upstream_group_t *group = calloc(1, sizeof(*group));
+    if (!group) return NULL;
+    snprintf(group->name, sizeof(group->name), "%s", name);
+    group->algorithm = algorithm;
+    group->hash_key = LB_KEY_CLIENT_IP;
+    health_config_defaults(&group->health_config);
+    return group;
+}
+
+void upstream_group_destroy(upstream_group_t *group) {
+    if (!group) return;
+    free(group->maglev);
+    free(group->health);
+    free(group);
+}
+
+int upstream_group_add(upstream_group_t *group, const char *spec) {
+    if (group->backend_count == UPSTREAM_MAX_BACKENDS) return -1;
+
+    int weight = 1;
+    const char *end = strchr(spec, ',');
+    if (end) {
+        if (strncmp(end, ",weight=", 8) != 0) return -1;
+        weight = atoi(end + 8);
+        if (weight < 1 || weight > UPSTREAM_MAX_WEIGHT) return -1;
+    } else {
+        end = spec + strlen(spec);
+    }
+
+    const char *colon = NULL;
+    for (const char *p = spec; p < end; p++) {
+        if (*p == ':') colon = p;
+    }
+    if (!colon || colon == spec) return -1;
+
+    size_t host_len = (size_t)(colon - spec);
+    int port = atoi(colon + 1);
+    if (host_len >= sizeof(group->backends[0].host) || port <= 0 || port > 65535) return -1;
+
+    upstream_backend_t *b = &group->backends[group->backend_count++];
+    memcpy(b->host, spec, host_len);
+    b->host[host_len] = '\0';
+    b->port = port;
+    b->weight = weight;
+    group->total_weight += weight;
+    return 0;
+}
+
+// Maglev: every backend walks its own permutation of the table and claims
+// the next free entry in turn (weight turns per round), so each gets a
+// share proportional to its weight and a backend change only moves the
+// keys that have to move.
+static int maglev_build(upstream_group_t *group) {
+    int n = group->backend_count;
+    uint64_t m = UPSTREAM_MAGLEV_SIZE;
+
+    uint16_t *table = malloc(m * sizeof(*table));
+    uint64_t *offset = malloc(n * sizeof(*offset));
+    uint64_t *skip = malloc(n * sizeof(*skip));
+    uint64_t *next = calloc(n, sizeof(*next));
+    if (!table || !offset || !skip || !next) {
+        free(table);
+        free(offset);
+        free(skip);
+        free(next);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        char id[300];
+        int len = snprintf(id, sizeof(id), "%s:%d", group->backends[i].host, group->backends[i].port);
+        offset[i] = fnv1a(id, len, 1469598103934665603ull) % m;
+        skip[i] = fnv1a(id, len, 0x9e3779b97f4a7c15ull) % (m - 1) + 1;
+    }
+    memset(table, 0xff, m * sizeof(*table));
+
+    uint64_t filled = 0;
+    while (filled < m) {
+        for (int i = 0; i < n && filled < m; i++) {
+            for (int w = 0; w < group->backends[i].weight && filled < m; w++) {
+                uint64_t c = (offset[i] + next[i] * skip[i]) % m;
+                while (table[c] != MAGLEV_EMPTY) {
+                    next[i]++;
+                    c = (offset[i] + next[i] * skip[i]) % m;
+                }
+                table[c] = (uint16_t)i;
+                next[i]++;
+                filled++;
+            }
+        }
+    }
+
+    free(offset);
+    free(skip);
+    free(next);
+    free(group->maglev);
+    group->maglev = table;
+    return 0;
+}
+
+static int backend_resolve(upstream_backend_t *b) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", b->port);
+    if (getaddrinfo(b->host, port_str, &hints, &res) != 0) {
+        printf("❌ Cannot resolve backend %s:%d\n", b->host, b->port);
+        return -1;
+    }
+    memcpy(&b->addr, res->ai_addr, sizeof(b->addr));
+    freeaddrinfo(res);
+    return 0;
+}
+
+int upstream_group_finalize(upstream_group_t *group) {
+    if (group->backend_count == 0) return -1;
+    for (int i = 0; i < group->backend_count; i++) {
+        if (backend_resolve(&group->backends[i]) != 0) return -1;
+    }
+    free(group->health);
+    group->health = calloc(group->backend_count, sizeof(*group->health));
+    if (!group->health) return -1;
+    if (group->algorithm == LB_HASH) return maglev_build(group);
+    return 0;
+}
+
+static const char *algorithm_names[] = { "round-robin", "least-conn", "p2c", "hash" };
+
+int upstream_parse_algorithm(const char *name, lb_algorithm_t *algorithm) {
+    for (int i = 0; i < (int)(sizeof(algorithm_names) / sizeof(algorithm_names[0])); i++) {
+        if (strcmp(name, algorithm_names[i]) == 0) {
+            *algorithm = (lb_algorithm_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int upstream_parse_hash_key(const char *name, lb_hash_key_t *key) {
+    if (strcmp(name, "ip") == 0) *key = LB_KEY_CLIENT_IP;
+    else if (strcmp(name, "uri") == 0) *key = LB_KEY_URI;
+    else return -1;
+    return 0;
+}
+
+const char *upstream_algorithm_name(lb_algorithm_t algorithm) {
+    return algorithm_names[algorithm];
+}
+
+upstream_lb_t *upstream_lb_create(const upstream_group_t *group, uint32_t seed) {
+    int n = group->backend_count;
+    upstream_lb_t *lb = calloc(1, sizeof(*lb));
+    if (!lb) return NULL;
+    lb->group = group;
+    lb->current = calloc(n, sizeof(int));
+    lb->active = calloc(n, sizeof(int));
+    lb->cumulative = malloc(n * sizeof(int));
+    lb->excluded = malloc(n);
+    if (!lb->current || !lb->active || !lb->cumulative || !lb->excluded) {
+        upstream_lb_destroy(lb);
+        return NULL;
+    }
+
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += group->backends[i].weight;
+        lb->cumulative[i] = sum;
+    }
+    lb->rng = seed ? seed : 0x9e3779b9u;
+    return lb;
+}
+
+void upstream_lb_destroy(upstream_lb_t *lb) {
+    if (!lb) return;
+    free(lb->current);
+    free(lb->active);
+    free(lb->cumulative);
+    free(lb->excluded);
+    free(lb);
+}
+
+static uint32_t lb_random(upstream_lb_t *lb) {
+    // xorshift32
+    uint32_t x = lb->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    lb->rng = x;
+    return x;
+}
+
+// Backend chosen with probability proportional to its weight
+static int pick_weighted_random(upstream_lb_t *lb) {
+    const upstream_group_t *group = lb->group;
+    int r = (int)(lb_random(lb) % (uint32_t)group->total_weight);
+    int lo = 0, hi = group->backend_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lb->cumulative[mid] > r) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+static int usable(const upstream_lb_t *lb, int i) {
+    return !lb->excluded[i] && health_available(&lb->group->health[i], lb->now);
+}
+
+// True if a carries less load per unit of weight than b
+static int less_loaded(const upstream_lb_t *lb, int a, int b) {
+    const upstream_backend_t *backends = lb->group->backends;
+    return (int64_t)lb->active[a] * backends[b].weight < (int64_t)lb->active[b] * backends[a].weight;
+}
+
+// nginx-style smooth weighted round-robin: no bursts to heavy backends
+static int pick_round_robin(upstream_lb_t *lb) {
+    const upstream_group_t *group = lb->group;
+    int best = -1;
+    int total = 0;
+    for (int i = 0; i < group->backend_count; i++) {
+        if (!usable(lb, i)) continue;
+        lb->current[i] += group->backends[i].weight;
+        total += group->backends[i].weight;
+        if (best < 0 || lb->current[i] > lb->current[best]) best = i;
+    }
+    if (best >= 0) lb->current[best] -= total;
+    return best;
+}
+
+static int pick_least_conn(upstream_lb_t *lb) {
+    const upstream_group_t *group = lb->group;
+    int best = -1;
+    for (int i = 0; i < group->backend_count; i++) {
+        if (usable(lb, i) && (best < 0 || less_loaded(lb, i, best))) best = i;
+    }
+    if (best < 0) return -1;
+
+    // Ties are shared out by weighted round-robin among the least loaded
+    int chosen = -1;
+    int total = 0;
+    for (int i = 0; i < group->backend_count; i++) {
+        if (!usable(lb, i) || less_loaded(lb, best, i)) continue;
+        lb->current[i] += group->backends[i].weight;
+        total += group->backends[i].weight;
+        if (chosen < 0 || lb->current[i] > lb->current[chosen]) chosen = i;
+    }
+    lb->current[chosen] -= total;
+    return chosen;
+}
+
+static int pick_p2c(upstream_lb_t *lb) {
+    int n = lb->group->backend_count;
+    int a = pick_weighted_random(lb);
+    int b = pick_weighted_random(lb);
+    if (a == b) {
+        b = (a + 1 + (int)(lb_random(lb) % (uint32_t)(n - 1))) % n;
+    }
+    if (!usable(lb, a)) a = b;
+    else if (usable(lb, b) && less_loaded(lb, b, a)) a = b;
+
+    // Both choices ejected: fall back to a full scan
+    return usable(lb, a) ? a : pick_least_conn(lb);
+}
+
+// Walk the Maglev table past ejected backends, so only their keys move
+static int pick_hash(upstream_lb_t *lb, const char *key, size_t key_len) {
+    const upstream_group_t *group = lb->group;
+    uint64_t slot = fnv1a(key, key_len, 1469598103934665603ull) % UPSTREAM_MAGLEV_SIZE;
+    for (int k = 0; k < MAGLEV_MAX_PROBE; k++) {
+        int b = group->maglev[(slot + k) % UPSTREAM_MAGLEV_SIZE];
+        if (usable(lb, b)) return b;
+    }
+    return pick_round_robin(lb);
+}
+
+static int pick_once(upstream_lb_t *lb, const char *key, size_t key_len) {
+    switch (lb->group->algorithm) {
+    case LB_LEAST_CONN:
+        return pick_least_conn(lb);
+    case LB_P2C:
+        return pick_p2c(lb);
+    case LB_HASH:
+        return pick_hash(lb, key, key_len);
+    case LB_ROUND_ROBIN:
+    default:
+        return pick_round_robin(lb);
+    }
+}
+
+int upstream_lb_pick(upstream_lb_t *lb, const char *key, size_t key_len, uint64_t now) {
+    const upstream_group_t *group = lb->group;
+    if (group->backend_count == 1) {
+        return health_acquire(&group->health[0], now) ? 0 : -1;
+    }
+
+    lb->now = now;
+    memset(lb->excluded, 0, group->backend_count);
+    for (int attempt = 0; attempt < group->backend_count; attempt++) {
+        int b = pick_once(lb, key, key_len);
+        if (b < 0) return -1;
+        if (health_acquire(&group->health[b], now)) return b;
+        // Another worker took the half-open trial; choose again without it
+        lb->excluded[b] = 1;
+    }
+    return -1;
+}
+
+void upstream_report(const upstream_group_t *group, int backend, int ok) {
+    const upstream_backend_t *b = &group->backends[backend];
+    health_report(&group->health[backend], &group->health_config, b->host, b->port, ok, 0);
+}
+
+void upstream_lb_acquire(upstream_lb_t *lb, int backend) {
+    lb->active[backend]++;
+}
+
+void upstream_lb_release(upstream_lb_t *lb, int backend) {
+    if (lb->active[backend] > 0) lb->active[backend]--;
+}
@@ -0,0 +1,85 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include "health.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Upstream groups: a named set of weighted backends and the algorithm that
+// spreads requests over them. A group is built once (at startup, or by a
+// configuration reload, which replaces it) and then only read, apart from
+// the health array, which workers and the checker update atomically. Everything that changes per request (round-robin
+// position, active connection counts) lives in a per-worker upstream_lb_t.
+
+#define UPSTREAM_MAX_BACKENDS 256
+#define UPSTREAM_MAX_WEIGHT 100
+#define UPSTREAM_MAGLEV_SIZE 65537 // Prime, well above 100x the backend limit
+
+typedef enum {
+    LB_ROUND_ROBIN,   // Smooth weighted round-robin
+    LB_LEAST_CONN,    // Fewest active connections per unit of weight
+    LB_P2C,           // Power of two random choices on active connections
+    LB_HASH           // Maglev consistent hashing on the request key
+} lb_algorithm_t;
+
+typedef enum {
+    LB_KEY_CLIENT_IP,
+    LB_KEY_URI
+} lb_hash_key_t;
+
+typedef struct {
+    char host[256];
+    int port;
+    int weight;
+    struct sockaddr_in addr;    // host:port, resolved by upstream_group_finalize
+} upstream_backend_t;
+
+typedef struct upstream_group {
+    char name[64];
+    lb_algorithm_t algorithm;
+    lb_hash_key_t hash_key;
+    upstream_backend_t backends[UPSTREAM_MAX_BACKENDS];
+    int backend_count;
+    int total_weight;
+    uint16_t *maglev;   // Lookup table for LB_HASH, built by upstream_group_finalize
+    health_config_t health_config;
+    backend_health_t *health;   // Per backend, built by upstream_group_finalize
+} upstream_group_t;
+
+typedef struct upstream_lb upstream_lb_t;
+
+upstream_group_t *upstream_group_create(const char *name, lb_algorithm_t algorithm);
+void upstream_group_destroy(upstream_group_t *group);
+
+// "host:port" with an optional ",weight=N" suffix. Returns -1 if malformed
+// or the group is full.
+int upstream_group_add(upstream_group_t *group, const char *spec);
+
+// Call once every backend is added; resolves the backends' addresses and
+// builds the hashing table. Names are looked up here, outside any event
+// loop, so connecting never waits on DNS; a changed address is picked up
+// by the next reload.
+int upstream_group_finalize(upstream_group_t *group);
+
+// Names used on the command line: round-robin, least-conn, p2c, hash
+int upstream_parse_algorithm(const char *name, lb_algorithm_t *algorithm);
+int upstream_parse_hash_key(const char *name, lb_hash_key_t *key);
+const char *upstream_algorithm_name(lb_algorithm_t algorithm);
+
+// Per-worker balancer state
+upstream_lb_t *upstream_lb_create(const upstream_group_t *group, uint32_t seed);
+void upstream_lb_destroy(upstream_lb_t *lb);
+
+// Backend index for the next request among those whose breaker lets
+// traffic through, or -1 if every backend is ejected. key is only used by
+// LB_HASH.
+int upstream_lb_pick(upstream_lb_t *lb, const char *key, size_t key_len, uint64_t now);
+
+// Feed a request outcome to the backend's circuit breaker
+void upstream_report(const upstream_group_t *group, int backend, int ok);
+
+// Track requests in flight on a backend (least-conn, p2c)
+void upstream_lb_acquire(upstream_lb_t *lb, int backend);
+void upstream_lb_release(upstream_lb_t *lb, int backend);
+
+#endif